@@ -0,0 +1,86 @@
+/* See LICENSE file for copyright and license details. */
+
+#include "SDL.h"
+#include "data_structures.h"
+#include "config.h"
+#include "cache.h"
+
+/*
+ * Entries form a list in order of use, most recent first. The list stays short, since each entry
+ * holds a texture about the size of the window, so lookups simply walk it.
+ */
+static CACHE_ENTRY * newest = NULL;
+static CACHE_ENTRY * oldest = NULL;
+static size_t cached_bytes = 0;
+static int cached_window_w = 0;
+static int cached_window_h = 0;
+
+static void cache_unlink( CACHE_ENTRY * entry ) {
+        if( entry->prev != NULL ) entry->prev->next = entry->next; else newest = entry->next;
+        if( entry->next != NULL ) entry->next->prev = entry->prev; else oldest = entry->prev;
+        entry->next = NULL;
+        entry->prev = NULL;
+}
+
+static void cache_push( CACHE_ENTRY * entry ) {
+        entry->prev = NULL;
+        entry->next = newest;
+        if( newest != NULL ) newest->prev = entry; else oldest = entry;
+        newest = entry;
+}
+
+static void cache_evict( CACHE_ENTRY * entry ) {
+        if( SGK_DEBUG ) printf( "DEBUG: Evicting texture for image %d from cache.\n", entry->id );
+        cache_unlink( entry );
+        cached_bytes -= entry->bytes;
+        SDL_DestroyTexture( entry->texture );
+        free( entry );
+}
+
+SDL_Texture * cache_get( int id ) {
+        for( CACHE_ENTRY * entry = newest; entry != NULL; entry = entry->next ) {
+                if( entry->id == id ) {
+                        cache_unlink( entry );
+                        cache_push( entry );
+                        return entry->texture;
+                }
+        }
+        return NULL;
+}
+
+void cache_put( int id, SDL_Texture * texture, size_t bytes ) {
+        CACHE_ENTRY * entry = malloc( sizeof( CACHE_ENTRY ) );
+        if( entry == NULL ) {
+                fprintf( stderr, "ERROR: Unable to malloc for texture cache entry.\n" );
+                return;
+        }
+        entry->id = id;
+        entry->texture = texture;
+        entry->bytes = bytes;
+        cache_push( entry );
+        cached_bytes += bytes;
+
+        while( cached_bytes > (size_t) TEXTURE_CACHE_MB * 1024 * 1024 && oldest != newest ) cache_evict( oldest );
+}
+
+void cache_drop( int id ) {
+        for( CACHE_ENTRY * entry = newest; entry != NULL; entry = entry->next ) {
+                if( entry->id == id ) {
+                        cache_evict( entry );
+                        return;
+                }
+        }
+}
+
+void cache_resize( int window_w, int window_h ) {
+        if( window_w == cached_window_w && window_h == cached_window_h ) return;
+
+        /* Textures are scaled for the window, so a new size makes them all stale. */
+        cache_terminate();
+        cached_window_w = window_w;
+        cached_window_h = window_h;
+}
+
+void cache_terminate( void ) {
+        while( oldest != NULL ) cache_evict( oldest );
+}
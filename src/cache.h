@@ -0,0 +1,35 @@
+/* See LICENSE file for copyright and license details. */
+
+#ifndef CACHE_H
+#define CACHE_H
+
+/*
+ * Returns the cached display texture for FILE_LIST id 'id' and marks it most recently used,
+ * or returns NULL if it is not cached. The cache keeps ownership of the texture.
+ */
+SDL_Texture * cache_get( int id );
+
+/*
+ * Hands 'texture', holding 'bytes' bytes of pixels, to the cache as the display texture for 'id'.
+ * Least recently used textures are destroyed until the cache fits in TEXTURE_CACHE_MB again,
+ * though 'texture' itself is always kept.
+ */
+void cache_put( int id, SDL_Texture * texture, size_t bytes );
+
+/*
+ * Destroys the cached texture for 'id', if there is one, such as when its file has changed.
+ */
+void cache_drop( int id );
+
+/*
+ * Destroys every cached texture if 'window_w'x'window_h' differs from the window size they were
+ * scaled for. Call before cache_get() whenever the window may have changed.
+ */
+void cache_resize( int window_w, int window_h );
+
+/*
+ * Destroys every cached texture. Must be called before the SDL renderer is destroyed.
+ */
+void cache_terminate( void );
+
+#endif
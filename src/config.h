@@ -28,6 +28,14 @@
 
 #define KEY_SELECTIONBOX_RESET SDLK_KP_0        // Reset size and location of selection box to defaults
 #define KEY_TOGGLE_OUTLINE_COLOR SDLK_KP_5      // Toggle the selection box color between light and dark.
+#define KEY_HUD SDLK_i                          // Toggle the overlay of decode, upload and frame times, hit rates and memory.
+
+#define KEY_SORT SDLK_s                         // Cycle the view order: scan, name, date, file size, pixel count.
+#define KEY_FILTER SDLK_f                       // Cycle the view filter: all, unprocessed, too small, wrong aspect.
+#define KEY_JUMP SDLK_g                         // Type a position, a percentage or a filename prefix, then Enter.
+#define KEY_FIRST SDLK_HOME                     // Jump to the first image in the view.
+#define KEY_LAST SDLK_END                       // Jump to the last image in the view.
+#define KEY_SKIP SDLK_n                         // Jump to the next image in the view with no crop in the destination.
 
 #define KEY_QUIT SDLK_q                         // Exit this application
 #define KEY_HELP SDLK_h                         // Pops up a dialog box with key commands after the GUI has launched. 
@@ -52,6 +60,163 @@
  */
 #define SELECT_POS_MULT 0.05
 
+/*
+ * Number of images decoded in the background on each side of the displayed image.
+ * Example: A value of 2 keeps the next two and the previous two images decoded and ready to display.
+ */
+#define PREFETCH_DEPTH 2
+
+/*
+ * Memory budget, in megabytes, for display textures of recently viewed images. Returning to a cached
+ * image costs only a render copy. Each texture is at most the size of the window, 4 bytes per pixel.
+ */
+#define TEXTURE_CACHE_MB 256
+
+/*
+ * Set to 1 to place each new selection box over the busiest part of the image, judged by its edges,
+ * instead of centering it. The placement is worked out while the image decodes in the background.
+ */
+#define SALIENT_SELECTION 1
+
+/*
+ * The selection box only moves off center when the busiest placement holds this many times more
+ * edge energy than the centered one. Keeps flat or evenly detailed images centered.
+ */
+#define SALIENT_MARGIN 1.1
+
+/*
+ * Set to 1 to crop JPEG images losslessly, by copying their compressed blocks instead of decoding and
+ * re-encoding them. The selection box then snaps to the JPEG block grid, usually 8 or 16 pixels.
+ */
+#define LOSSLESS_JPEG_CROP 1
+
+/*
+ * Sources of at least this many megapixels are cropped a row at a time instead of being loaded whole,
+ * when they are JPEG or PNG. Memory then stays near one source row, at the cost of re-encoding. JPEG
+ * crops on the block grid still go through the lossless crop first, since its blocks take a fraction of
+ * the memory of decoded pixels.
+ */
+#define STREAM_CROP_MPX 64
+
+/*
+ * Extra sizes every saved crop is also written at, as a comma separated list such as
+ * "3840x2400,2560x1600,1920x1200.webp,1280x800". Each size goes to a directory of that name inside the
+ * destination, optionally in the format of its extension. The crop is decoded once and each size shrunk
+ * from the next larger one; sizes larger than the crop are skipped. Empty to write the crop alone.
+ * wp_batch takes the same list with -l.
+ */
+#define EXPORT_LADDER ""
+
+/*
+ * Largest number of differing perceptual hash bits, out of 64, at which wp_dedupe still counts two images
+ * as the same picture. Rescaled and recompressed copies rarely differ by more than a few bits.
+ */
+#define DEDUPE_RADIUS 6
+
+/*
+ * Number of entries on each side of the displayed image whose headers are checked in the background,
+ * so that stepping past broken or non-image files never waits on the disk.
+ */
+#define VALIDATE_DEPTH 32
+
+/*
+ * Number of background threads checking headers ahead of and behind the displayed image.
+ */
+#define VALIDATE_THREADS 2
+
+/*
+ * Number of background threads cropping and saving images.
+ */
+#define SAVE_THREADS 2
+
+/*
+ * Number of queued saves that keep their decoded image. Saves queued beyond this read the file again
+ * instead, so memory stays bounded while KEY_SAVE never waits.
+ */
+#define SAVE_QUEUE_DEPTH 16
+
+/*
+ * Name of the metadata index kept in each source directory. It caches image dimensions, formats and
+ * selection boxes so that unchanged files need not be probed again on the next run.
+ */
+#define INDEX_FILENAME ".wallproc_index"
+
+/*
+ * Set to 1 to open on the image that was on screen when the last session ended, as recorded in the index.
+ * Startup then waits for the scan to reach that image, which takes well under a second for tens of
+ * thousands of files.
+ */
+#define RESUME_SESSION 1
+
+/*
+ * Size of each pixel of the performance overlay's 5x7 font, in screen pixels.
+ */
+#define HUD_SCALE 2
+
+/*
+ * Set to 1 to print the percentiles of each stage's latency (scan, probe, decode, upload, frame, save)
+ * on exit.
+ */
+#define STATS_SUMMARY 1
+
+/*
+ * Images with fewer megapixels than this are shown by the "too small" view filter.
+ */
+#define VIEW_SMALL_MPX 2.0
+
+/*
+ * Images whose aspect ratio differs from the requested one by more than this fraction are shown by the
+ * "wrong aspect" view filter. Example: 0.01 accepts 1% either way.
+ */
+#define VIEW_ASPECT_TOLERANCE 0.01
+
+/*
+ * Views of more entries than this gather their sort keys and sort on one thread per CPU.
+ */
+#define VIEW_PARALLEL_MIN 16384
+
+/*
+ * Most files the file table can hold, and the size of its pool for their paths. Both are only reserved
+ * address space; memory is used as entries are added.
+ */
+#define FILE_TABLE_MAX 4194304
+#define FILE_TABLE_POOL_MB 512
+
+/*
+ * Number of threads reading the source directory tree at startup. The first image is shown as soon as
+ * it is found, and the rest of the tree keeps arriving in the background.
+ */
+#define SCAN_THREADS 4
+
+/*
+ * Set to 1 to include images in subdirectories of the source directory, at any depth.
+ */
+#define SCAN_RECURSIVE 1
+
+/*
+ * Set to 1 to follow symbolic links to files and directories. Each directory is read only once, however
+ * many links lead to it, so link loops are harmless.
+ */
+#define SCAN_FOLLOW_SYMLINKS 0
+
+/*
+ * Which files the scan passes on for probing.
+ * 0: Every regular file. 1: Files named with an extension from SCAN_EXTENSIONS, in any case.
+ * 2: Files starting with the signature of a JPEG, PNG, GIF, WebP or BMP image. Costs a read per file.
+ */
+#define SCAN_FILTER 0
+
+/*
+ * Extensions accepted when SCAN_FILTER is 1, each starting with a dot.
+ */
+#define SCAN_EXTENSIONS ".jpg.jpeg.jpe.png.gif.webp.bmp.tif.tiff"
+
+/*
+ * Set to 1 to keep watching the source directory tree after the scan, with inotify. Files written, moved
+ * or deleted while wallproc runs join or leave the list, and rewritten files are probed and decoded again.
+ */
+#define WATCH_SOURCE 1
+
 /*
  * =====================================================================================================================
  * dev options
@@ -66,3 +231,20 @@
 
 /* Set to 1 to enable debugging info on console. */
 #define SGK_DEBUG 0
+
+/*
+ * Environment variable naming the file to write a Chrome trace to, viewable in chrome://tracing or
+ * ui.perfetto.dev. Tracing is off when it is unset. The trace is written on exit and whenever the
+ * process receives TRACE_SIGNAL, e.g. 'kill -USR1 <pid>' during a slow session.
+ */
+#define TRACE_ENV "WALLPROC_TRACE"
+#define TRACE_SIGNAL SIGUSR1
+
+/*
+ * Spans kept per thread. Once a thread's ring is full its oldest spans are overwritten. Must be a power
+ * of two. Each span takes about 48 bytes, allocated only while tracing.
+ */
+#define TRACE_RING_SIZE 16384
+
+/* Most threads traced. Spans from any further threads are dropped. */
+#define TRACE_THREADS 64
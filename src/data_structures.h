@@ -5,45 +5,298 @@
 #ifndef DATA_STRUCTURES_H
 #define DATA_STRUCTURES_H
 
+typedef enum IMAGEFORMAT {
+        format_unknown,         /* Not probed yet */
+        format_none,            /* Probed, and not a readable image */
+        format_jpeg,
+        format_png,
+        format_gif,
+        format_webp,
+        format_bmp,
+        format_other            /* Recognized only by ImageMagick */
+} IMAGE_FORMAT;
+
+typedef struct IMAGE {
+        unsigned char * bytes;  /* Read-only mapping of the whole image file */
+        size_t length;          /* Length of the mapping in bytes */
+        SDL_Surface * surface;  /* Decoded pixels in IMAGE_PIXELFORMAT, possibly reduced to window size */
+        int w;                  /* Full resolution width in pixels */
+        int h;                  /* Full resolution height in pixels */
+        int has_alpha;          /* Set to 1 when the source image carries an alpha channel */
+        float * energy_cols;    /* Edge energy per column of a small copy of the image, or NULL */
+        float * energy_rows;    /* Edge energy per row of the same copy, or NULL */
+        int energy_w;           /* Number of columns in 'energy_cols' */
+        int energy_h;           /* Number of rows in 'energy_rows' */
+        SDL_atomic_t refs;      /* Number of holders. The image is freed when the last one lets go */
+} IMAGE;
+
 typedef struct FILELIST {
         struct FILELIST * next; /* Pointer to next struct */
         struct FILELIST * prev; /* Pointer to previous struct */
-        char * path;            /* Full filename/path (ex: /path/to/file.png) */
-        char * file;            /* Just the filename */
+        char * path;            /* Full filename/path (ex: /path/to/file.png), in the file table's string pool */
+        char * file;            /* Just the filename, pointing into 'path' */
+        char * name;            /* Path below the source directory (ex: dir/file.png), pointing into 'path' */
         int img_h;              /* Image vertical dimensions in pixels */
         int img_w;              /* Image horizontal dimensions in pixels */
         int sel_h;              /* Selection box vertical dimensions in pixels */
         int sel_w;              /* Selection box horizontal dimensions in pixels */
         int sel_x;              /* Selection box horizontal offset in pixels */
         int sel_y;              /* Selection box vertical offset in pixels */
-        int sel_r;              /* Selection box red color value from 0-255 */
-        int sel_g;              /* Selection box green color value from 0-255 */
-        int sel_b;              /* Selection box blue color value from 0-255 */
-        int sel_a;              /* Selection box alpha value from 0-255 */
         double aspect;          /* Desired aspect ratio */
-        int valid_sdl;          /* Set to 1 when image has been verified by SDL */
-        int valid_imagick;      /* Set to 1 when image has been verified by ImageMagick */
-        int id;                 /* Image ID number. Unique and assigned sequentially */
+        IMAGE_FORMAT format;    /* Image format as identified by its header */
+        int mcu_w;              /* JPEG minimum coded unit width in pixels, 0 for other formats */
+        int mcu_h;              /* JPEG minimum coded unit height in pixels, 0 for other formats */
+        Uint8 valid_sdl;        /* Set to 1 when image has been verified by SDL */
+        Uint8 valid_imagick;    /* Set to 1 when image has been verified by ImageMagick */
+        Uint8 sel_placed;       /* Set to 1 once the selection box was placed from the image content or by hand */
+        Uint8 deleted;          /* Set to 1 when removed from the list. The entry stays in the table as a tombstone */
+        int view_pos;           /* Position in the active view, or -1 if the view leaves this entry out */
+        int id;                 /* Image ID number, and index in the file table. Unique and assigned sequentially */
+        struct IMAGE * image;   /* Decoded image while this entry is displayed, otherwise NULL */
 } FILE_LIST;
 
+typedef struct EXPORTSIZE {
+        int w;                  /* Largest width in pixels */
+        int h;                  /* Largest height in pixels */
+        char * ext;             /* Extension naming the output format, such as ".webp", or NULL to keep the source's */
+} EXPORT_SIZE;
+
 typedef struct CMDLINEARGS {
         char * src;
         char * dst;
         double aspect;
+        struct EXPORTSIZE * ladder;     /* Extra sizes every crop is also written at, largest first */
+        int ladder_count;               /* Number of entries in 'ladder' */
 } CMD_LINE_ARGS;
 
+typedef enum DAMAGE {
+        damage_none = 0,
+        damage_overlay = 1,     /* Selection box or window contents need compositing again */
+        damage_image = 2        /* Window size changed, so the image layer must be fetched again */
+} DAMAGE;
+
 typedef struct SDLPOINTERS {
         SDL_Window * window;
         SDL_Renderer * renderer;
-        SDL_Texture * texture;
+        SDL_Texture * texture;  /* Image layer on screen, owned by the texture cache */
+        int damage;             /* DAMAGE flags awaiting repaint() */
+        SDL_Color sel_color;    /* Selection box outline color, shared by every image */
+        int hud;                /* Set to 1 while the performance overlay is shown */
 } SDL_POINTERS;
 
 typedef struct INITPOINTERS {
         struct FILELIST * file_list;
+        struct INDEX * index;
         struct CMDLINEARGS * cmd_line_args;
         struct SDLPOINTERS * sdl_pointers;
 } INIT_POINTERS;
 
+typedef struct SPSCQUEUE {
+        SDL_atomic_t head;      /* Index of next slot to pop. Written only by the consumer thread */
+        SDL_atomic_t tail;      /* Index of next slot to push. Written only by the producer thread */
+        int size;               /* Number of slots, always a power of two */
+        void ** slots;          /* Ring of 'size' item pointers */
+} SPSC_QUEUE;
+
+typedef struct PREFETCHJOB {
+        int id;                 /* FILE_LIST id of the image being decoded */
+        char * path;            /* Private copy of the image path, owned by the job */
+        struct IMAGE * image;   /* Decoded image, or NULL if decoding failed or was cancelled */
+        int max_w;              /* Window size the image is decoded for */
+        int max_h;
+        SDL_atomic_t cancelled; /* Set to 1 by the UI thread when the decoded image is no longer wanted */
+        int done;               /* Set to 1 by the UI thread once the job has come back from the decoder */
+} PREFETCH_JOB;
+
+typedef struct CACHEENTRY {
+        struct CACHEENTRY * next;       /* Next less recently used entry */
+        struct CACHEENTRY * prev;       /* Next more recently used entry */
+        int id;                         /* FILE_LIST id of the displayed image */
+        SDL_Texture * texture;          /* Display texture, scaled for the current window */
+        size_t bytes;                   /* Size of the texture's pixels */
+} CACHE_ENTRY;
+
+typedef struct SAVEJOB {
+        struct SAVEJOB * next;  /* Next job for the same writer thread */
+        int remove;             /* Set to 1 to delete 'dest_path' instead of writing it */
+        char * src_path;        /* Image to crop, read only if 'image' is NULL */
+        char * dst;             /* Destination directory holding 'dest_path'. Shared, never freed by the job */
+        char * dest_path;       /* File to write or delete */
+        struct IMAGE * image;   /* Reference to the decoded source image, or NULL */
+        int id;                 /* FILE_LIST id of the image, for tracing */
+        struct EXPORTSIZE * ladder;     /* Sizes to write besides 'dest_path'. Shared, never freed by the job */
+        int ladder_count;
+        int sel_x;              /* Selection box at the time of KEY_SAVE */
+        int sel_y;
+        int sel_w;
+        int sel_h;
+} SAVE_JOB;
+
+typedef struct VALIDATERESULT {
+        struct VALIDATERESULT * next;
+        int id;                 /* File table id of the probed entry */
+        IMAGE_FORMAT format;    /* Probe results, copied to the entry by the UI thread */
+        int img_w;
+        int img_h;
+        int mcu_w;
+        int mcu_h;
+} VALIDATE_RESULT;
+
+typedef struct INDEXRECORD {
+        Uint64 ino;             /* Inode number of the file when it was last probed */
+        Sint64 size;            /* Size of the file in bytes when it was last probed */
+        Sint64 mtime;           /* Modification time of the file in nanoseconds when it was last probed */
+        Uint32 name;            /* Offset of the path, relative to the indexed directory, in the string pool */
+        Sint32 img_w;           /* Cached FILE_LIST fields */
+        Sint32 img_h;
+        Sint32 sel_x;
+        Sint32 sel_y;
+        Sint32 sel_w;
+        Sint32 sel_h;
+        Uint8 format;           /* IMAGE_FORMAT */
+        Uint8 flags;            /* INDEX_* flags */
+        Uint8 mcu_w;
+        Uint8 mcu_h;
+} INDEX_RECORD;
+
+typedef struct INDEXHEADER {
+        char magic[4];          /* INDEX_MAGIC */
+        Uint32 version;         /* INDEX_VERSION */
+        Uint32 count;           /* Number of INDEX_RECORDs following the header */
+        Uint32 pool_size;       /* Bytes of string pool following the records */
+        double aspect;          /* Aspect ratio the cached selection boxes were made for */
+} INDEX_HEADER;
+
+typedef struct INDEX {
+        char * dir;             /* Directory described by the index */
+        double aspect;          /* Aspect ratio the cached selection boxes were made for */
+        INDEX_RECORD * records; /* Every record, loaded or added this session */
+        int count;              /* Number of records in use */
+        int capacity;           /* Number of records allocated */
+        char * pool;            /* String pool holding relative paths, NUL terminated */
+        size_t pool_size;       /* Bytes of the string pool in use */
+        size_t pool_capacity;   /* Bytes of the string pool allocated */
+        int * buckets;          /* Open addressing hash table of record numbers plus one, zero when empty */
+        int bucket_count;       /* Number of buckets, always a power of two */
+        int cursor;             /* Record of the file on screen when the last session ended, or -1 */
+        int reused;             /* Files matched to an unchanged record this session */
+} INDEX;
+
+typedef struct SCANDIR {
+        struct SCANDIR * next;  /* Next directory waiting to be read */
+        char * path;            /* Directory path, relative to PWD */
+} SCAN_DIR;
+
+typedef enum WATCHKIND {
+        watch_written,          /* A file was written or moved into a watched directory */
+        watch_removed,          /* A file was deleted or moved out */
+        watch_removed_dir       /* A directory was deleted or moved out, with everything below it */
+} WATCH_KIND;
+
+typedef struct WATCHCHANGE {
+        struct WATCHCHANGE * next;      /* Next change, in the order they happened */
+        WATCH_KIND kind;
+        char * path;            /* Full path of the file or directory, held in the same allocation */
+        char * dir;             /* Directory holding it, held in the same allocation */
+        char * name;            /* Just the name, pointing into 'path' */
+} WATCH_CHANGE;
+
+typedef enum VIEWSORT {
+        sort_scan,              /* Order in which the directory scan found the files */
+        sort_name,              /* Path, with runs of digits compared as numbers */
+        sort_mtime,             /* Modification time, oldest first */
+        sort_size,              /* File size, smallest first */
+        sort_pixels,            /* Pixel count, smallest first */
+        sort_count              /* Number of sort orders, not an order itself */
+} VIEW_SORT;
+
+typedef enum VIEWFILTER {
+        filter_all,             /* Every image */
+        filter_unprocessed,     /* Images with no cropped copy in the destination yet */
+        filter_small,           /* Images below VIEW_SMALL_MPX */
+        filter_aspect,          /* Images whose aspect ratio is off target by more than VIEW_ASPECT_TOLERANCE */
+        filter_count            /* Number of filters, not a filter itself */
+} VIEW_FILTER;
+
+typedef struct VIEWKEY {
+        struct FILELIST * entry;
+        Sint64 key;             /* Sort key; unused when sorting by name */
+} VIEW_KEY;
+
+typedef struct VIEWWORK {
+        VIEW_KEY * keys;        /* One thread's slice of the keys to fill in, filter and sort */
+        int count;              /* Entries in the slice */
+        int kept;               /* Entries left at the front of the slice after filtering */
+} VIEW_WORK;
+
+typedef struct MINSIZEWORK {
+        FILE_LIST ** entries;   /* Every entry in the file list, in list order */
+        int count;              /* Number of entries */
+        SDL_atomic_t next;      /* Index of the next entry to be claimed by a worker */
+} MINSIZE_WORK;
+
+typedef struct DEDUPEWORK {
+        FILE_LIST ** entries;   /* Every file under the source, claimed by workers in order */
+        Uint64 * hashes;        /* Perceptual hash of each entry */
+        Uint8 * hashed;         /* Set to 1 once the matching entry of 'hashes' holds a hash */
+        int count;              /* Number of entries */
+        SDL_atomic_t next;      /* Index of the next entry to be claimed by a worker */
+} DEDUPE_WORK;
+
+typedef struct BATCHWORK {
+        FILE_LIST ** entries;   /* One entry per manifest line, carrying the file and its requested crop */
+        int count;              /* Number of entries */
+        struct CMDLINEARGS * cmd_line_args; /* Destination directory shared by every entry */
+        SDL_atomic_t next;      /* Index of the next entry to be claimed by a worker */
+        SDL_atomic_t done;      /* Number of entries finished, successfully or not */
+        SDL_atomic_t failed;    /* Number of entries that could not be cropped */
+        SDL_sem * finished;     /* Posted by each worker as it runs out of entries */
+} BATCH_WORK;
+
+typedef enum STATSSTAGE {
+        stat_scan,              /* Reading one source directory */
+        stat_probe,             /* Reading one image header */
+        stat_decode,            /* Decoding one image to window size */
+        stat_upload,            /* Uploading one decoded image to a texture */
+        stat_frame,             /* One repaint, from damage to present */
+        stat_save,              /* One background crop and save */
+        stat_count              /* Number of stages, not a stage itself */
+} STATS_STAGE;
+
+typedef enum STATSCOUNTER {
+        counter_prefetch_hit,   /* Displayed image was already decoded in the background */
+        counter_prefetch_miss,  /* Displayed image had to be decoded on the UI thread */
+        counter_cache_hit,      /* Displayed image's texture was still in the texture cache */
+        counter_cache_miss,
+        counter_count           /* Number of counters, not a counter itself */
+} STATS_COUNTER;
+
+typedef struct TRACEEVENT {
+        SDL_atomic_t seq;       /* Ring position + 1 once the span is complete, 0 while it is written */
+        const char * name;      /* Span name, a string constant */
+        Uint64 start;           /* Performance counter at the start of the span */
+        Uint64 ticks;           /* Duration, in performance counter ticks */
+        int id;                 /* FILE_LIST id the span worked on, or -1 */
+        Sint64 bytes;           /* Bytes read or written, or -1 */
+} TRACE_EVENT;
+
+typedef struct TRACERING {
+        SDL_atomic_t head;      /* Number of spans ever recorded. Written only by the owning thread */
+        const char * name;      /* Thread name shown in the trace, or NULL */
+        TRACE_EVENT * events;   /* TRACE_RING_SIZE spans, written round-robin */
+        SDL_atomic_t owned;     /* Set while a running thread records into the ring; cleared when it exits */
+} TRACE_RING;
+
+typedef struct BENCHRESULT {
+        const char * name;      /* Benchmark name, as written to the JSON report */
+        Uint64 * samples;       /* Duration of each timed operation, in performance counter ticks */
+        int count;              /* Number of samples */
+        int capacity;
+        double seconds;         /* Wall time of the whole benchmark */
+        double items;           /* Items processed, for throughput */
+        long peak_rss_kb;       /* Peak resident set size once the benchmark finished, in kilobytes */
+} BENCH_RESULT;
+
 typedef enum DIRECTION {
         none,
         up,
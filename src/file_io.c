@@ -1,133 +1,65 @@
 /* See LICENSE file for copyright and license details. */
 
 #include <stdio.h>
-#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "wand/magick_wand.h"
 #include "config.h"
 #include "data_structures.h"
+#include "file_list.h"
+#include "image.h"
+#include "jpeg_crop.h"
+#include "ladder.h"
+#include "probe.h"
+#include "stream_crop.h"
+#include "trace.h"
 #include "file_io.h"
 
-void clear_filelist_struct( FILE_LIST * ent ) {
-        ent->next = NULL;
-        ent->prev = NULL;
-        ent->path = NULL;
-        ent->file = NULL;
-        ent->img_h = 0;
-        ent->img_w = 0;
-        ent->sel_h = 0;
-        ent->sel_w = 0;
-        ent->sel_x = 0;
-        ent->sel_y = 0;
-        ent->sel_r = 255;
-        ent->sel_g = 255;
-        ent->sel_b = 255;
-        ent->sel_a = 255;
-        ent->aspect = 0.0;
-        ent->valid_sdl = 0;
-        ent->valid_imagick = 0;
-        ent->id = 0;
-}
-
-FILE_LIST * build_file_list( char * source, double aspect ) {
-        DIR * dir = NULL;
-        struct dirent * ent = NULL;
-        int count = 0;
-
-        if( SGK_DEBUG ) printf( "DEBUG: Building file list -- Using directory: %s\n", source );
-
-        /* 
-         * Pointers to the first and last FILE_LIST structs.
-         * In order to form a loop, we will need to join them.
-         */
-        FILE_LIST * first = NULL;
-        FILE_LIST * last = NULL;
-
-
-        if(( dir = opendir(source)) != NULL ) {
-                while(( ent = readdir(dir)) != NULL ) {
-                        if( ent->d_type == DT_REG ) { /* tests if ent is a regular file, not symlink/etc */
-                                FILE_LIST * temp = malloc( sizeof( FILE_LIST ) );
-                                if( temp == NULL ) {
-                                        /* 
-                                         * Print the error, but take no other action.
-                                         * Since temp == NULL, this entry is not added to the list. 
-                                         */
-                                        fprintf( stderr, "ERROR: Unable to malloc for FILE_LIST entry.\n" );
-                                } else {
-                                        clear_filelist_struct( temp );
-                                        int len = strlen(ent->d_name)   /* filename */
-                                                + strlen(source)        /* path to file, relative to PWD */
-                                                + 1                     /* +1 for '/' between path and filename */
-                                                + 1;                    /* +1 for terminating null character */
-                                        temp->path = malloc( len );
-                                        temp->file = malloc( strlen(ent->d_name) + 1 );
-                                        if( temp->path == NULL || temp->file == NULL) {
-                                                /*
-                                                 * Print the error, but also free temp and set temp = NULL.
-                                                 * This ensures we don't add a bogus entry to the list.
-                                                 */
-                                                fprintf( stderr, "ERROR: Unable to malloc for path in FILE_LIST.\n" );
-                                                free(temp);
-                                                temp = NULL;
-                                        } else {
-                                                /* Copy the string, including the relative path from PWD. */
-                                                snprintf( temp->path, len, "%s/%s", source, ent->d_name );
-                                                /* Copy string containing only the filename. */
-                                                snprintf( temp->file, strlen(ent->d_name)+1, ent->d_name );
-                                                /* Add the desired aspect ratio field. */
-                                                temp->aspect = aspect;
-                                                /* Add the image count field */
-                                                temp->id = count;
-                                        }
-                                        if( temp != NULL ) { /* We have a valid entry to add. */
-                                                if( first == NULL ) {
-                                                        /* Start the list. */
-                                                        first = temp;
-                                                        last = temp;
-                                                } else {
-                                                        /* Extend the list, continuing from last. */
-                                                        last->next = temp;
-                                                        temp->prev = last;
-                                                        last = temp;
-                                                }
-                                                count += 1;
-                                        }
-                                }
-                        }
-                }
-        }
-
-        /* Close the loop */
-        if( first != NULL && last != NULL ) {
-                first->prev = last;
-                last->next = first;
-        }
-        
-        return first;
-}
-
 void del_file_from_list( FILE_LIST * file_list ) {
-        if( SGK_DEBUG ) printf( "DEBUG: Removing file from list: %s\n", file_list->path );
-        /* Make the next element in the file_list loop point to the previous element and vice versa. */
-        file_list->prev->next = file_list->next;
-        file_list->next->prev = file_list->prev;
-        /* Since we have isolated this file_list element, we can now delete it. */
-        free(file_list->path);
-        free(file_list->file);
-        free(file_list);
+        unlink_file_from_list( file_list );
+        image_free(file_list->image);
+        file_list->image = NULL;
 }
 
-void del_img( FILE_LIST * file_list, CMD_LINE_ARGS * cmd_line_args ) {
-        /* Build the destination path. */
-        int len = strlen( cmd_line_args->dst ) + strlen( file_list->file ) + 1 + 1; /* +2 for '/' separator and '\0' */
+char * build_dest_path( char * dst, char * file ) {
+        int len = strlen( dst ) + strlen( file ) + 1 + 1; /* +2 for '/' separator and '\0' */
         char * path = malloc( len );
         if( path == NULL ) {
                 fprintf( stderr, "ERROR: Unable to malloc for file path string.\n" );
-                return;
         } else {
-                snprintf( path, len, "%s/%s", cmd_line_args->dst, file_list->file );
+                snprintf( path, len, "%s/%s", dst, file );
+        }
+        return path;
+}
+
+int make_parent_dirs( char * path ) {
+        int len = strlen( path ) + 1;
+        char * dir = malloc( len );
+        if( dir == NULL ) {
+                fprintf( stderr, "ERROR: Unable to malloc for directory path.\n" );
+                return 1;
+        }
+        memcpy( dir, path, len );
+
+        /* Create each directory along the way, outermost first. Those already there are fine. */
+        int ret_val = 0;
+        for( char * slash = strchr( dir + 1, '/' ); slash != NULL && ret_val == 0; slash = strchr( slash + 1, '/' )) {
+                *slash = '\0';
+                if( mkdir( dir, 0755 ) != 0 && errno != EEXIST ) {
+                        fprintf( stderr, "WARN: Unable to create directory %s\n", dir );
+                        ret_val = 1;
+                }
+                *slash = '/';
         }
 
+        free( dir );
+        return ret_val;
+}
+
+int del_img_path( char * path ) {
         /* Delete the file */
         int temp = remove( path );
         if( temp != 0 ) fprintf( stderr, "WARN: Unable to delete image: %s\n", path );
@@ -142,68 +74,155 @@ void del_img( FILE_LIST * file_list, CMD_LINE_ARGS * cmd_line_args ) {
                 }
         }
 
+        return temp != 0;
+}
+
+void del_img( FILE_LIST * file_list, CMD_LINE_ARGS * cmd_line_args ) {
+        /* Build the destination path. */
+        char * path = build_dest_path( cmd_line_args->dst, file_list->name );
+        if( path == NULL ) return;
+
+        del_img_path( path );
+        ladder_delete( cmd_line_args->dst, path, cmd_line_args->ladder, cmd_line_args->ladder_count );
+
         /* Clean up */
         free( path );
 }
 
-void crop_save( FILE_LIST * file_list, CMD_LINE_ARGS * cmd_line_args ) {
-        if( SGK_DEBUG ) printf( "DEBUG: Cropping and saving image.\n" );
+/*
+ * Tries to crop a JPEG to a JPEG without re-encoding it, mapping the source if it isn't already loaded.
+ * Returns 1 if the lossless path doesn't apply, so the caller should take the ImageMagick path.
+ */
+static int crop_save_lossless( IMAGE * image, char * src_path, char * dest_path, int sel_x, int sel_y, int sel_w, int sel_h ) {
+        if( ! LOSSLESS_JPEG_CROP || ! jpeg_crop_extension( dest_path ) ) return 1;
+        if( image != NULL ) {
+                return jpeg_crop_lossless( image->bytes, image->length, dest_path, sel_x, sel_y, sel_w, sel_h );
+        }
 
-        /* Open the file */
-        MagickBooleanType magick_status;
-        MagickWand * magick_wand = NewMagickWand();
-        magick_status = MagickReadImage( magick_wand, file_list->path );
-        if( magick_status == MagickFalse ) {
-                fprintf( stderr, "ERROR:  -- Failed to open file: %s\n", file_list->path );
-                return;
+        int fd = open( src_path, O_RDONLY );
+        if( fd == -1 ) return 1;
+        struct stat st;
+        if( fstat( fd, &st ) != 0 || st.st_size == 0 ) {
+                close( fd );
+                return 1;
         }
+        void * bytes = mmap( NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+        close( fd );
+        if( bytes == MAP_FAILED ) return 1;
+        int ret_val = jpeg_crop_lossless( bytes, st.st_size, dest_path, sel_x, sel_y, sel_w, sel_h );
+        munmap( bytes, st.st_size );
+        return ret_val;
+}
 
-        /* Build the destination path */
-        int len = strlen( cmd_line_args->dst ) + strlen( file_list->file ) + 1 + 1; /* +2 for '/' separator and '\0' */
-        char * dest_path = malloc( len );
-        if( dest_path == NULL ) {
-                fprintf( stderr, "ERROR: Unable to malloc for destination string.\n" );
-                return;
+/*
+ * Crops sources of STREAM_CROP_MPX or more a row at a time, probing the header when the image isn't loaded.
+ * Returns 1 if the source is smaller or can't be streamed, so the caller should take another path.
+ */
+static int crop_save_streamed( IMAGE * image, char * src_path, char * dest_path, int sel_x, int sel_y, int sel_w, int sel_h ) {
+        int w = 0;
+        int h = 0;
+        if( image != NULL ) {
+                w = image->w;
+                h = image->h;
         } else {
-                snprintf( dest_path, len, "%s/%s", cmd_line_args->dst, file_list->file );
+                int mcu_w, mcu_h;
+                if( probe_image( src_path, &w, &h, &mcu_w, &mcu_h ) == format_none ) return 1;
         }
+        if( (double) w * h < STREAM_CROP_MPX * 1000000.0 ) return 1;
+        return stream_crop( src_path, dest_path, sel_x, sel_y, sel_w, sel_h );
+}
+
+int crop_save_image( IMAGE * image, char * src_path, char * dst, char * dest_path, int sel_x, int sel_y, int sel_w,
+                int sel_h, EXPORT_SIZE * ladder, int ladder_count, int id ) {
+        if( SGK_DEBUG ) printf( "DEBUG: Cropping and saving image %s to %s.\n", src_path, dest_path );
+
+        /* Images from subdirectories of the source are saved in the same subdirectories of 'dst'. */
+        if( make_parent_dirs( dest_path )) return 1;
+
+        /*
+         * JPEG to JPEG crops on the block grid copy coefficients instead of re-encoding. This comes first at
+         * any size: the coefficients take a fraction of the memory of decoded pixels, and the crop stays exact.
+         */
+        Uint64 span = trace_begin();
+        if( crop_save_lossless( image, src_path, dest_path, sel_x, sel_y, sel_w, sel_h ) == 0 ) {
+                if( SGK_DEBUG ) printf( "DEBUG:  -- Cropped losslessly.\n" );
+                trace_end( "crop_lossless", span, id, image != NULL ? (Sint64) image->length : -1 );
+                return ladder_export( NULL, dst, dest_path, ladder, ladder_count, id );
+        }
+
+        /* Other very large crops never go through ImageMagick, which would hold every pixel at once. */
+        if( crop_save_streamed( image, src_path, dest_path, sel_x, sel_y, sel_w, sel_h ) == 0 ) {
+                if( SGK_DEBUG ) printf( "DEBUG:  -- Cropped by streaming rows.\n" );
+                if( span != 0 ) {
+                        struct stat st;
+                        trace_end( "crop_stream", span, id, stat( dest_path, &st ) == 0 ? st.st_size : -1 );
+                }
+                return ladder_export( NULL, dst, dest_path, ladder, ladder_count, id );
+        }
+
+        /* 
+         * When the image is already decoded, only the selection is handed to ImageMagick.
+         * Otherwise fall back to opening the file.
+         */
+        MagickBooleanType magick_status;
+        MagickWand * magick_wand = NULL;
+        if( image != NULL ) {
+                magick_wand = image_crop_wand( image, sel_x, sel_y, sel_w, sel_h );
+                if( magick_wand == NULL ) {
+                        fprintf( stderr, "ERROR:  -- Failed to crop decoded image: %s\n", src_path );
+                        return 1;
+                }
+        } else {
+                magick_wand = NewMagickWand();
+                magick_status = MagickReadImage( magick_wand, src_path );
+                if( magick_status == MagickFalse ) {
+                        fprintf( stderr, "ERROR:  -- Failed to open file: %s\n", src_path );
+                        DestroyMagickWand( magick_wand );
+                        return 1;
+                }
+        }
+
+        int ret_val = 0;
 
-        /* Crop the image */
-        magick_status = MagickCropImage( magick_wand, file_list->sel_w, file_list->sel_h, 
-                                         file_list->sel_x, file_list->sel_y );
-        if( magick_status == MagickFalse ) fprintf( stderr, "WARN: Problem cropping image.\n" );
-        magick_status = MagickSetImagePage( magick_wand, file_list->sel_w, file_list->sel_h, 0, 0 );
+        /* Crop the image, unless it was built from the selection to begin with. */
+        if( image == NULL ) {
+                magick_status = MagickCropImage( magick_wand, sel_w, sel_h, sel_x, sel_y );
+                if( magick_status == MagickFalse ) fprintf( stderr, "WARN: Problem cropping image.\n" );
+        }
+        magick_status = MagickSetImagePage( magick_wand, sel_w, sel_h, 0, 0 );
         if( magick_status == MagickFalse ) fprintf( stderr, "WARN: Problem setting image page geometry.\n" );
+        trace_end( "crop", span, id, image != NULL ? (Sint64) image->length : -1 );
+        span = trace_begin();
         magick_status = MagickWriteImage( magick_wand, dest_path );
-        if( magick_status == MagickFalse ) fprintf( stderr, "WARN: Problem saving cropped image.\n" );
+        if( magick_status == MagickFalse ) {
+                fprintf( stderr, "WARN: Problem saving cropped image.\n" );
+                ret_val = 1;
+        }
+        if( span != 0 ) {
+                struct stat st;
+                trace_end( "encode", span, id, ( ret_val == 0 && stat( dest_path, &st ) == 0 ) ? st.st_size : -1 );
+        }
+
+        /* The wand still holds the crop, so the exported sizes are shrunk from it. */
+        if( ret_val == 0 ) ret_val = ladder_export( magick_wand, dst, dest_path, ladder, ladder_count, id );
 
         /* Clean up */
-        free( dest_path );
         DestroyMagickWand( magick_wand );
+
+        return ret_val;
 }
 
-char * sanitize_path( char * path ) {
-        /* Remove trailing slash */
-        int last_char = strlen(path) - 1;
-        if( path[last_char] == '/' ) {
-                path[last_char] = '\0';
-        }
+int crop_save( FILE_LIST * file_list, CMD_LINE_ARGS * cmd_line_args ) {
+        /* Build the destination path */
+        char * dest_path = build_dest_path( cmd_line_args->dst, file_list->name );
+        if( dest_path == NULL ) return 1;
 
-        /* Verify directory exists and can be accessed under our current environment. */
-        DIR * dir = NULL;
-        if(( dir = opendir(path)) == NULL ) {
-                return NULL;
-        }
+        int ret_val = crop_save_image( file_list->image, file_list->path, cmd_line_args->dst, dest_path,
+                        file_list->sel_x, file_list->sel_y, file_list->sel_w, file_list->sel_h,
+                        cmd_line_args->ladder, cmd_line_args->ladder_count, file_list->id );
 
-        /* Copy string to new location, to be considered 'fully sanitized', whatever that really means. */
-        int string_length = strlen(path) + 1; // +1 leaves space for null-terminator.
-        char * sanitized_string = malloc( string_length );
-        if( sanitized_string == NULL ) {
-                fprintf( stderr, "ERROR: Failed to malloc for string in function sanitize_path().\n" );
-        } else {
-                snprintf( sanitized_string, string_length, "%s", path );
-        }
+        /* Clean up */
+        free( dest_path );
 
-        
-        return sanitized_string;
+        return ret_val;
 }
@@ -4,38 +4,51 @@
 #define FILE_IO_H
 
 /*
- * Sets a FILE_LIST struct to default values.
+ * Removes 'file_list' from the linked list with unlink_file_from_list(), and frees its decoded image.
  */
-void clear_filelist_struct( FILE_LIST * ent );
+void del_file_from_list( FILE_LIST * file_list );
 
-/* 
- * Non-recursively builds a linked list of all files in 'source' directory.
- * Returns NULL if no items found; otherwise returns pointer to the linked list.
- * This function mallocs memory.
+/*
+ * Joins directory 'dst' and 'file', a FILE_LIST 'name', into a path. Subdirectories of the source
+ * are kept, so two images of the same filename never share a destination.
+ * Returns NULL on error. This function mallocs memory.
  */
-FILE_LIST * build_file_list( char * source, double aspect );
+char * build_dest_path( char * dst, char * file );
 
 /*
- * Removes 'file_list' from the linked list and stiches the previous and next entries together.
+ * Creates every directory leading up to the file at 'path' that doesn't exist yet.
+ * Returns 1 on error, otherwise 0.
  */
-void del_file_from_list( FILE_LIST * file_list );
+int make_parent_dirs( char * path );
+
+/*
+ * Deletes the file at 'path'.
+ * Returns 1 on error, otherwise 0.
+ */
+int del_img_path( char * path );
 
 /* 
- * In 'cmd_line_args->dst' folder, deletes image specified in 'file_list'.
+ * In 'cmd_line_args->dst' folder, deletes image specified in 'file_list', along with its exported sizes.
  */
 void del_img( FILE_LIST * file_list, CMD_LINE_ARGS * cmd_line_args );
 
 /*
- * Crops image from 'file_list' according to selection box info in 'file_list'.
- * After cropping, saves image to 'cmd_line_args->dst' folder.
+ * Crops the 'sel_w'x'sel_h' region at 'sel_x','sel_y' and saves it to 'dest_path' under directory 'dst',
+ * creating subdirectories as needed, then at each of the 'ladder_count' sizes in 'ladder' from the crop's
+ * pixels. The pixels come from 'image' when it is not NULL,
+ * otherwise 'src_path' is read. Trace spans carry 'id', the FILE_LIST id of the image. Safe to call from
+ * any thread.
+ * Returns 1 on error, otherwise 0.
  */
-void crop_save( FILE_LIST * file_list, CMD_LINE_ARGS * cmd_line_args );
+int crop_save_image( IMAGE * image, char * src_path, char * dst, char * dest_path, int sel_x, int sel_y, int sel_w,
+                int sel_h, EXPORT_SIZE * ladder, int ladder_count, int id );
 
 /*
- * Removes trailing slash and verifies 'path' exists.
- * If so, copies path and returns pointer. Otherwise, returns NULL.
- * This function mallocs memory.
+ * Crops image from 'file_list' according to selection box info in 'file_list'.
+ * After cropping, saves image to 'cmd_line_args->dst' folder, then at every size in 'cmd_line_args->ladder'.
+ * Safe to call from any thread.
+ * Returns 1 on error, otherwise 0.
  */
-char * sanitize_path( char * path );
+int crop_save( FILE_LIST * file_list, CMD_LINE_ARGS * cmd_line_args );
 
-#endif 
+#endif
@@ -0,0 +1,81 @@
+/* See LICENSE file for copyright and license details. */
+
+#include <stdio.h>
+#include <dirent.h>
+#include "data_structures.h"
+#include "config.h"
+#include "file_list.h"
+
+void clear_filelist_struct( FILE_LIST * ent ) {
+        ent->next = NULL;
+        ent->prev = NULL;
+        ent->path = NULL;
+        ent->file = NULL;
+        ent->name = NULL;
+        ent->img_h = 0;
+        ent->img_w = 0;
+        ent->sel_h = 0;
+        ent->sel_w = 0;
+        ent->sel_x = 0;
+        ent->sel_y = 0;
+        ent->aspect = 0.0;
+        ent->format = format_unknown;
+        ent->mcu_w = 0;
+        ent->mcu_h = 0;
+        ent->valid_sdl = 0;
+        ent->valid_imagick = 0;
+        ent->sel_placed = 0;
+        ent->deleted = 0;
+        ent->view_pos = -1;
+        ent->id = 0;
+        ent->image = NULL;
+}
+
+FILE_LIST * splice_file_list( FILE_LIST * file_list, FILE_LIST * batch ) {
+        if( file_list == NULL ) return batch;
+        if( batch == NULL ) return file_list;
+
+        /* Going right from 'file_list', the batch comes last, just before wrapping around to 'file_list'. */
+        FILE_LIST * batch_last = batch->prev;
+        file_list->prev->next = batch;
+        batch->prev = file_list->prev;
+        batch_last->next = file_list;
+        file_list->prev = batch_last;
+
+        return file_list;
+}
+
+void unlink_file_from_list( FILE_LIST * file_list ) {
+        if( SGK_DEBUG ) printf( "DEBUG: Removing file from list: %s\n", file_list->path );
+        /* Make the next element in the file_list loop point to the previous element and vice versa. */
+        file_list->prev->next = file_list->next;
+        file_list->next->prev = file_list->prev;
+        /* Since we have isolated this file_list element, leave it in the file table as a tombstone. */
+        file_list->deleted = 1;
+}
+
+char * sanitize_path( char * path ) {
+        /* Remove trailing slash */
+        int last_char = strlen(path) - 1;
+        if( path[last_char] == '/' ) {
+                path[last_char] = '\0';
+        }
+
+        /* Verify directory exists and can be accessed under our current environment. */
+        DIR * dir = NULL;
+        if(( dir = opendir(path)) == NULL ) {
+                return NULL;
+        }
+
+        /* Copy string to new location, to be considered 'fully sanitized', whatever that really means. */
+        int string_length = strlen(path) + 1; // +1 leaves space for null-terminator.
+        char * sanitized_string = malloc( string_length );
+        if( sanitized_string == NULL ) {
+                fprintf( stderr, "ERROR: Failed to malloc for string in function sanitize_path().\n" );
+        } else {
+                snprintf( sanitized_string, string_length, "%s", path );
+        }
+
+        
+        return sanitized_string;
+}
@@ -0,0 +1,31 @@
+/* See LICENSE file for copyright and license details. */
+
+#ifndef FILE_LIST_H
+#define FILE_LIST_H
+
+/*
+ * Sets a FILE_LIST struct to default values.
+ */
+void clear_filelist_struct( FILE_LIST * ent );
+
+/*
+ * Joins the loop 'batch' into the loop 'file_list', so that stepping right from 'file_list' reaches the
+ * new entries last. Either may be NULL. Returns the joined loop, positioned at 'file_list' if it exists.
+ */
+FILE_LIST * splice_file_list( FILE_LIST * file_list, FILE_LIST * batch );
+
+/*
+ * Removes 'file_list' from the linked list and stiches the previous and next entries together.
+ * Flags it 'deleted'; the entry itself stays in the file table. Any decoded image is left alone, so
+ * callers holding one use del_file_from_list() instead.
+ */
+void unlink_file_from_list( FILE_LIST * file_list );
+
+/*
+ * Removes trailing slash and verifies 'path' exists.
+ * If so, copies path and returns pointer. Otherwise, returns NULL.
+ * This function mallocs memory.
+ */
+char * sanitize_path( char * path );
+
+#endif
@@ -0,0 +1,140 @@
+/* See LICENSE file for copyright and license details. */
+
+#include <ctype.h>
+#include "data_structures.h"
+#include "config.h"
+#include "save.h"
+#include "stats.h"
+#include "hud.h"
+
+/*
+ * A 5x7 pixel font covering what the overlay prints, so no font library is needed. Each glyph is
+ * seven rows, top first, with the leftmost pixel in bit 4. Lowercase prints as uppercase and any
+ * other character as a space.
+ */
+#define HUD_GLYPH_W 5
+#define HUD_GLYPH_H 7
+#define HUD_LINE_CHARS 40
+#define HUD_LINES 5
+
+static const char glyph_chars[] = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ.:%/-";
+static const Uint8 glyphs[][HUD_GLYPH_H] = {
+        { 0x0E, 0x11, 0x13, 0x15, 0x19, 0x11, 0x0E }, /* 0 */
+        { 0x04, 0x0C, 0x04, 0x04, 0x04, 0x04, 0x0E }, /* 1 */
+        { 0x0E, 0x11, 0x01, 0x02, 0x04, 0x08, 0x1F }, /* 2 */
+        { 0x1F, 0x02, 0x04, 0x02, 0x01, 0x11, 0x0E }, /* 3 */
+        { 0x02, 0x06, 0x0A, 0x12, 0x1F, 0x02, 0x02 }, /* 4 */
+        { 0x1F, 0x10, 0x1E, 0x01, 0x01, 0x11, 0x0E }, /* 5 */
+        { 0x06, 0x08, 0x10, 0x1E, 0x11, 0x11, 0x0E }, /* 6 */
+        { 0x1F, 0x01, 0x02, 0x04, 0x08, 0x08, 0x08 }, /* 7 */
+        { 0x0E, 0x11, 0x11, 0x0E, 0x11, 0x11, 0x0E }, /* 8 */
+        { 0x0E, 0x11, 0x11, 0x0F, 0x01, 0x02, 0x0C }, /* 9 */
+        { 0x0E, 0x11, 0x11, 0x11, 0x1F, 0x11, 0x11 }, /* A */
+        { 0x1E, 0x11, 0x11, 0x1E, 0x11, 0x11, 0x1E }, /* B */
+        { 0x0E, 0x11, 0x10, 0x10, 0x10, 0x11, 0x0E }, /* C */
+        { 0x1C, 0x12, 0x11, 0x11, 0x11, 0x12, 0x1C }, /* D */
+        { 0x1F, 0x10, 0x10, 0x1E, 0x10, 0x10, 0x1F }, /* E */
+        { 0x1F, 0x10, 0x10, 0x1E, 0x10, 0x10, 0x10 }, /* F */
+        { 0x0E, 0x11, 0x10, 0x17, 0x11, 0x11, 0x0F }, /* G */
+        { 0x11, 0x11, 0x11, 0x1F, 0x11, 0x11, 0x11 }, /* H */
+        { 0x0E, 0x04, 0x04, 0x04, 0x04, 0x04, 0x0E }, /* I */
+        { 0x07, 0x02, 0x02, 0x02, 0x02, 0x12, 0x0C }, /* J */
+        { 0x11, 0x12, 0x14, 0x18, 0x14, 0x12, 0x11 }, /* K */
+        { 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x1F }, /* L */
+        { 0x11, 0x1B, 0x15, 0x15, 0x11, 0x11, 0x11 }, /* M */
+        { 0x11, 0x11, 0x19, 0x15, 0x13, 0x11, 0x11 }, /* N */
+        { 0x0E, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0E }, /* O */
+        { 0x1E, 0x11, 0x11, 0x1E, 0x10, 0x10, 0x10 }, /* P */
+        { 0x0E, 0x11, 0x11, 0x11, 0x15, 0x12, 0x0D }, /* Q */
+        { 0x1E, 0x11, 0x11, 0x1E, 0x14, 0x12, 0x11 }, /* R */
+        { 0x0F, 0x10, 0x10, 0x0E, 0x01, 0x01, 0x1E }, /* S */
+        { 0x1F, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04 }, /* T */
+        { 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0E }, /* U */
+        { 0x11, 0x11, 0x11, 0x11, 0x11, 0x0A, 0x04 }, /* V */
+        { 0x11, 0x11, 0x11, 0x15, 0x15, 0x15, 0x0A }, /* W */
+        { 0x11, 0x11, 0x0A, 0x04, 0x0A, 0x11, 0x11 }, /* X */
+        { 0x11, 0x11, 0x11, 0x0A, 0x04, 0x04, 0x04 }, /* Y */
+        { 0x1F, 0x01, 0x02, 0x04, 0x08, 0x10, 0x1F }, /* Z */
+        { 0x00, 0x00, 0x00, 0x00, 0x00, 0x0C, 0x0C }, /* . */
+        { 0x00, 0x0C, 0x0C, 0x00, 0x0C, 0x0C, 0x00 }, /* : */
+        { 0x18, 0x19, 0x02, 0x04, 0x08, 0x13, 0x03 }, /* % */
+        { 0x00, 0x01, 0x02, 0x04, 0x08, 0x10, 0x00 }, /* / */
+        { 0x00, 0x00, 0x00, 0x1F, 0x00, 0x00, 0x00 }, /* - */
+};
+
+/* Draws 'text' with its top left corner at 'x','y', as one batch of rectangles. */
+static void hud_text( SDL_Renderer * renderer, const char * text, int x, int y ) {
+        SDL_Rect rects[HUD_LINE_CHARS * HUD_GLYPH_W * HUD_GLYPH_H];
+        int count = 0;
+        for( int c = 0; text[c] != '\0' && c < HUD_LINE_CHARS; c++ ) {
+                const char * found = strchr( glyph_chars, toupper( (unsigned char) text[c] ));
+                if( text[c] == ' ' || found == NULL ) continue;
+                const Uint8 * glyph = glyphs[found - glyph_chars];
+                for( int row = 0; row < HUD_GLYPH_H; row++ ) {
+                        for( int col = 0; col < HUD_GLYPH_W; col++ ) {
+                                if( ! ( glyph[row] & ( 0x10 >> col ))) continue;
+                                rects[count].x = x + ( c * ( HUD_GLYPH_W + 1 ) + col ) * HUD_SCALE;
+                                rects[count].y = y + row * HUD_SCALE;
+                                rects[count].w = HUD_SCALE;
+                                rects[count].h = HUD_SCALE;
+                                count += 1;
+                        }
+                }
+        }
+        if( count > 0 ) SDL_RenderFillRects( renderer, rects, count );
+}
+
+/* Formats 'ms' into 'buffer', or a dash if there is no sample yet. */
+static void hud_ms( char * buffer, size_t size, double ms ) {
+        if( ms < 0 ) {
+                snprintf( buffer, size, "-" );
+        } else {
+                snprintf( buffer, size, "%.1f MS", ms );
+        }
+}
+
+static void hud_percent( char * buffer, size_t size, double percent ) {
+        if( percent < 0 ) {
+                snprintf( buffer, size, "-" );
+        } else {
+                snprintf( buffer, size, "%.0f%%", percent );
+        }
+}
+
+void hud_draw( SDL_POINTERS * sdl_pointers ) {
+        if( ! sdl_pointers->hud ) return;
+
+        char decode[16], upload[16], frame[16], probe[16], prefetch[16], cache[16], save[16];
+        hud_ms( decode, sizeof( decode ), stats_last_ms( stat_decode ));
+        hud_ms( upload, sizeof( upload ), stats_last_ms( stat_upload ));
+        hud_ms( frame, sizeof( frame ), stats_last_ms( stat_frame ));
+        hud_ms( probe, sizeof( probe ), stats_last_ms( stat_probe ));
+        hud_ms( save, sizeof( save ), stats_last_ms( stat_save ));
+        hud_percent( prefetch, sizeof( prefetch ), stats_hit_rate( counter_prefetch_hit, counter_prefetch_miss ));
+        hud_percent( cache, sizeof( cache ), stats_hit_rate( counter_cache_hit, counter_cache_miss ));
+        int pending = 0;
+        int done = 0;
+        int failed = 0;
+        save_status( &pending, &done, &failed );
+
+        char lines[HUD_LINES][HUD_LINE_CHARS + 1];
+        snprintf( lines[0], sizeof( lines[0] ), "DECODE %-10s UPLOAD %s", decode, upload );
+        snprintf( lines[1], sizeof( lines[1] ), "FRAME  %-10s PROBE  %s", frame, probe );
+        snprintf( lines[2], sizeof( lines[2] ), "PREFETCH HITS %-5s CACHE HITS %s", prefetch, cache );
+        snprintf( lines[3], sizeof( lines[3] ), "SAVES QUEUED %-6d LAST %s", pending, save );
+        snprintf( lines[4], sizeof( lines[4] ), "RSS %.0f MB", stats_rss_kb() / 1024.0 );
+
+        /* A translucent backing keeps the text readable over any image. */
+        int line_h = ( HUD_GLYPH_H + 3 ) * HUD_SCALE;
+        SDL_Rect backing = { 0, 0, ( HUD_LINE_CHARS * ( HUD_GLYPH_W + 1 ) + 2 ) * HUD_SCALE,
+                        HUD_LINES * line_h + 2 * HUD_SCALE };
+        SDL_SetRenderDrawBlendMode( sdl_pointers->renderer, SDL_BLENDMODE_BLEND );
+        SDL_SetRenderDrawColor( sdl_pointers->renderer, 0, 0, 0, 160 );
+        SDL_RenderFillRect( sdl_pointers->renderer, &backing );
+        SDL_SetRenderDrawBlendMode( sdl_pointers->renderer, SDL_BLENDMODE_NONE );
+
+        SDL_SetRenderDrawColor( sdl_pointers->renderer, 255, 255, 255, 255 );
+        for( int i = 0; i < HUD_LINES; i++ ) {
+                hud_text( sdl_pointers->renderer, lines[i], 2 * HUD_SCALE, 2 * HUD_SCALE + i * line_h );
+        }
+}
@@ -0,0 +1,13 @@
+/* See LICENSE file for copyright and license details. */
+
+#ifndef HUD_H
+#define HUD_H
+
+/*
+ * Draws the performance overlay in the top left corner of the renderer in 'sdl_pointers': the latest
+ * decode, upload, frame and probe times, prefetch and texture cache hit rates, queued saves and memory.
+ * Does nothing unless 'sdl_pointers->hud' is set. Called by redraw() before presenting.
+ */
+void hud_draw( SDL_POINTERS * sdl_pointers );
+
+#endif
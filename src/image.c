@@ -0,0 +1,282 @@
+/* See LICENSE file for copyright and license details. */
+
+#include <stdio.h>
+#include <setjmp.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <jpeglib.h>
+#include "SDL_image.h"
+#include "wand/magick_wand.h"
+#include "data_structures.h"
+#include "config.h"
+#include "scale.h"
+#include "saliency.h"
+#include "image.h"
+
+/* libjpeg reports fatal errors by calling error_exit(), which must not return. Jump back instead. */
+struct image_jpeg_error {
+        struct jpeg_error_mgr pub;
+        jmp_buf escape;
+};
+
+static void image_jpeg_error_exit( j_common_ptr cinfo ) {
+        struct image_jpeg_error * err = (struct image_jpeg_error *) cinfo->err;
+        longjmp( err->escape, 1 );
+}
+
+/* Shrinks 'w'x'h' to fit inside 'max_w'x'max_h', keeping its aspect ratio. Never enlarges. */
+static void image_fit( int w, int h, int max_w, int max_h, int * fit_w, int * fit_h ) {
+        *fit_w = w;
+        *fit_h = h;
+        if( max_w <= 0 || max_h <= 0 || ( w <= max_w && h <= max_h )) return;
+
+        double scale = (double) max_w / w;
+        if( (double) max_h / h < scale ) scale = (double) max_h / h;
+        *fit_w = (int) ( w * scale + 0.5 );
+        *fit_h = (int) ( h * scale + 0.5 );
+        if( *fit_w < 1 ) *fit_w = 1;
+        if( *fit_h < 1 ) *fit_h = 1;
+}
+
+/*
+ * Decodes the JPEG in 'image' with libjpeg's scaled IDCT, at the smallest of 1/8, 1/4, 1/2 or full
+ * scale that still covers 'max_w'x'max_h', and records the full resolution in 'image'.
+ * Returns NULL if libjpeg cannot decode the image to RGB, so the caller can try SDL_image instead.
+ */
+static SDL_Surface * image_decode_jpeg( IMAGE * image, int max_w, int max_h ) {
+        struct jpeg_decompress_struct cinfo;
+        struct image_jpeg_error err;
+        /* Volatile, since they change between setjmp() and a possible longjmp(). */
+        SDL_Surface * volatile surface = NULL;
+        unsigned char * volatile row = NULL;
+
+        cinfo.err = jpeg_std_error( &err.pub );
+        err.pub.error_exit = image_jpeg_error_exit;
+        jpeg_create_decompress( &cinfo );
+        if( setjmp( err.escape ) ) {
+                jpeg_destroy_decompress( &cinfo );
+                SDL_FreeSurface( surface );
+                free( row );
+                return NULL;
+        }
+
+        jpeg_mem_src( &cinfo, image->bytes, image->length );
+        jpeg_read_header( &cinfo, TRUE );
+        image->w = cinfo.image_width;
+        image->h = cinfo.image_height;
+
+        int fit_w = 0;
+        int fit_h = 0;
+        image_fit( image->w, image->h, max_w, max_h, &fit_w, &fit_h );
+        cinfo.scale_num = 1;
+        cinfo.scale_denom = 1;
+        for( int denom = 8; denom > 1; denom /= 2 ) {
+                if( ( image->w + denom - 1 ) / denom >= fit_w && ( image->h + denom - 1 ) / denom >= fit_h ) {
+                        cinfo.scale_denom = denom;
+                        break;
+                }
+        }
+        cinfo.out_color_space = JCS_RGB;
+        jpeg_start_decompress( &cinfo );
+
+        int masks_bpp = 0;
+        Uint32 r_mask, g_mask, b_mask, a_mask;
+        SDL_PixelFormatEnumToMasks( IMAGE_PIXELFORMAT, &masks_bpp, &r_mask, &g_mask, &b_mask, &a_mask );
+        surface = SDL_CreateRGBSurface( 0, cinfo.output_width, cinfo.output_height, 32, 
+                        r_mask, g_mask, b_mask, a_mask );
+        row = malloc( (size_t) cinfo.output_width * 3 );
+        if( surface == NULL || row == NULL ) {
+                fprintf( stderr, "ERROR: Unable to allocate memory for decoding JPEG.\n" );
+                longjmp( err.escape, 1 );
+        }
+
+        /* IMAGE_PIXELFORMAT is R,G,B,A in memory, so each RGB row only needs an opaque alpha added. */
+        while( cinfo.output_scanline < cinfo.output_height ) {
+                unsigned char * dst = (unsigned char *) surface->pixels + (size_t) cinfo.output_scanline * surface->pitch;
+                JSAMPROW rows[1] = { row };
+                jpeg_read_scanlines( &cinfo, rows, 1 );
+                for( JDIMENSION col = 0; col < cinfo.output_width; col++ ) {
+                        *dst++ = row[col * 3];
+                        *dst++ = row[col * 3 + 1];
+                        *dst++ = row[col * 3 + 2];
+                        *dst++ = SDL_ALPHA_OPAQUE;
+                }
+        }
+
+        jpeg_finish_decompress( &cinfo );
+        jpeg_destroy_decompress( &cinfo );
+        free( row );
+
+        return surface;
+}
+
+IMAGE * image_load( char * path, int max_w, int max_h ) {
+        /* Map the file once. Every later consumer of the raw bytes reads this mapping. */
+        int fd = open( path, O_RDONLY );
+        if( fd < 0 ) return NULL;
+        struct stat st;
+        if( fstat( fd, &st ) != 0 || st.st_size <= 0 || st.st_size > INT_MAX ) {
+                close( fd );
+                return NULL;
+        }
+        void * bytes = mmap( NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+        close( fd );
+        if( bytes == MAP_FAILED ) return NULL;
+
+        IMAGE * image = malloc( sizeof( IMAGE ) );
+        if( image == NULL ) {
+                fprintf( stderr, "ERROR: Unable to malloc for IMAGE struct.\n" );
+                munmap( bytes, st.st_size );
+                return NULL;
+        }
+        image->bytes = bytes;
+        image->length = st.st_size;
+        image->surface = NULL;
+        image->has_alpha = 0;
+        image->w = 0;
+        image->h = 0;
+        image->energy_cols = NULL;
+        image->energy_rows = NULL;
+        image->energy_w = 0;
+        image->energy_h = 0;
+        SDL_AtomicSet( &image->refs, 1 );
+
+        /* Decode straight from the mapping. JPEGs can skip most of the work when the window is small. */
+        if( image->length >= 3 && image->bytes[0] == 0xFF && image->bytes[1] == 0xD8 && image->bytes[2] == 0xFF ) {
+                image->surface = image_decode_jpeg( image, max_w, max_h );
+        }
+        if( image->surface == NULL ) {
+                SDL_Surface * decoded = IMG_Load_RW( SDL_RWFromConstMem( image->bytes, image->length ), 1 );
+                if( decoded == NULL ) {
+                        image_free( image );
+                        return NULL;
+                }
+                image->w = decoded->w;
+                image->h = decoded->h;
+                image->has_alpha = ( decoded->format->Amask != 0 );
+                image->surface = SDL_ConvertSurfaceFormat( decoded, IMAGE_PIXELFORMAT, 0 );
+                SDL_FreeSurface( decoded );
+                if( image->surface == NULL ) {
+                        fprintf( stderr, "ERROR: Unable to convert decoded image: %s\n", SDL_GetError() );
+                        image_free( image );
+                        return NULL;
+                }
+        }
+
+        /* Finish the reduction to window size. Only the preview is kept; crops decode the file again. */
+        int fit_w = 0;
+        int fit_h = 0;
+        image_fit( image->w, image->h, max_w, max_h, &fit_w, &fit_h );
+        if( fit_w < image->surface->w || fit_h < image->surface->h ) {
+                SDL_Surface * scaled = scale_surface( image->surface, fit_w, fit_h );
+                if( scaled != NULL ) {
+                        SDL_FreeSurface( image->surface );
+                        image->surface = scaled;
+                }
+        }
+
+        /* Still on the decoding thread, so working out where the selection box belongs costs the UI nothing. */
+        if( SALIENT_SELECTION ) saliency_profile( image );
+
+        return image;
+}
+
+int image_fits( IMAGE * image, int max_w, int max_h ) {
+        if( image->surface->w == image->w && image->surface->h == image->h ) return 1;
+
+        int fit_w = 0;
+        int fit_h = 0;
+        image_fit( image->w, image->h, max_w, max_h, &fit_w, &fit_h );
+        return fit_w <= image->surface->w && fit_h <= image->surface->h;
+}
+
+MagickWand * image_crop_wand( IMAGE * image, int x, int y, int w, int h ) {
+        if( x < 0 || y < 0 || w <= 0 || h <= 0 || x + w > image->w || y + h > image->h ) {
+                fprintf( stderr, "ERROR: Crop region lies outside of the image.\n" );
+                return NULL;
+        }
+
+        /*
+         * Pinging the mapped bytes reads only the header, which is enough to learn the source quality and
+         * whether the decoded pixels hold everything the file does. They are 8 bits per channel with no
+         * color profile or metadata, so deeper or profiled sources are cropped from the file itself.
+         */
+        MagickWand * ping_wand = NewMagickWand();
+        size_t quality = 0;
+        int faithful = 0;
+        if( MagickPingImageBlob( ping_wand, image->bytes, image->length ) == MagickTrue ) {
+                size_t profile_count = 0;
+                char ** profiles = MagickGetImageProfiles( ping_wand, "*", &profile_count );
+                if( profiles != NULL ) MagickRelinquishMemory( profiles );
+                faithful = ( profile_count == 0 && MagickGetImageDepth( ping_wand ) <= 8 );
+                quality = MagickGetImageCompressionQuality( ping_wand );
+        }
+        DestroyMagickWand( ping_wand );
+
+        /* A reduced preview is no use for the crop either. Decode the full image from the mapping instead. */
+        if( ! faithful || image->surface->w != image->w || image->surface->h != image->h ) {
+                MagickWand * magick_wand = NewMagickWand();
+                if( MagickReadImageBlob( magick_wand, image->bytes, image->length ) == MagickFalse 
+                                || MagickCropImage( magick_wand, w, h, x, y ) == MagickFalse ) {
+                        fprintf( stderr, "ERROR: Unable to decode full resolution image for cropping.\n" );
+                        DestroyMagickWand( magick_wand );
+                        return NULL;
+                }
+                return magick_wand;
+        }
+
+        /* Copy only the rows and columns inside the crop, dropping alpha when the source had none. */
+        int channels = image->has_alpha ? 4 : 3;
+        unsigned char * pixels = malloc( (size_t) w * h * channels );
+        if( pixels == NULL ) {
+                fprintf( stderr, "ERROR: Unable to malloc for cropped pixels.\n" );
+                return NULL;
+        }
+        unsigned char * dst = pixels;
+        for( int row = 0; row < h; row++ ) {
+                unsigned char * src = (unsigned char *) image->surface->pixels
+                                    + (size_t) ( y + row ) * image->surface->pitch + (size_t) x * 4;
+                if( channels == 4 ) {
+                        memcpy( dst, src, (size_t) w * 4 );
+                        dst += (size_t) w * 4;
+                } else {
+                        for( int col = 0; col < w; col++ ) {
+                                *dst++ = src[0];
+                                *dst++ = src[1];
+                                *dst++ = src[2];
+                                src += 4;
+                        }
+                }
+        }
+
+        MagickWand * magick_wand = NewMagickWand();
+        MagickBooleanType magick_status = MagickConstituteImage( magick_wand, w, h, 
+                        channels == 4 ? "RGBA" : "RGB", CharPixel, pixels );
+        free( pixels );
+        if( magick_status == MagickFalse ) {
+                fprintf( stderr, "ERROR: Unable to build ImageMagick image from decoded pixels.\n" );
+                DestroyMagickWand( magick_wand );
+                return NULL;
+        }
+        if( quality > 0 ) MagickSetImageCompressionQuality( magick_wand, quality );
+
+        return magick_wand;
+}
+
+IMAGE * image_ref( IMAGE * image ) {
+        if( image != NULL ) SDL_AtomicIncRef( &image->refs );
+        return image;
+}
+
+void image_free( IMAGE * image ) {
+        if( image == NULL ) return;
+        if( !SDL_AtomicDecRef( &image->refs ) ) return;
+        SDL_FreeSurface( image->surface );
+        free( image->energy_cols );
+        free( image->energy_rows );
+        munmap( image->bytes, image->length );
+        free( image );
+}
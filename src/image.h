@@ -0,0 +1,47 @@
+/* See LICENSE file for copyright and license details. */
+
+#ifndef IMAGE_H
+#define IMAGE_H
+
+/*
+ * Pixel layout of IMAGE->surface. Four bytes per pixel in R,G,B,A memory order on either endianness.
+ */
+#if SDL_BYTEORDER == SDL_BIG_ENDIAN
+#define IMAGE_PIXELFORMAT SDL_PIXELFORMAT_RGBA8888
+#else
+#define IMAGE_PIXELFORMAT SDL_PIXELFORMAT_ABGR8888
+#endif
+
+/*
+ * Maps the file at 'path' into memory and decodes it no larger than needed to fill a 'max_w'x'max_h'
+ * window. JPEGs use libjpeg's reduced-scale IDCT; the rest is shrunk with an area filter.
+ * A 'max_w' or 'max_h' of 0 keeps full resolution.
+ * Returns NULL if the file cannot be read or is not an image SDL_image understands.
+ * The caller holds the only reference. Safe to call from any thread. This function mallocs memory.
+ */
+IMAGE * image_load( char * path, int max_w, int max_h );
+
+/*
+ * Returns 1 if the decoded pixels in 'image' are large enough to fill a 'max_w'x'max_h' window, otherwise 0.
+ */
+int image_fits( IMAGE * image, int max_w, int max_h );
+
+/*
+ * Builds an ImageMagick image of the 'w'x'h' region at offset 'x','y' of 'image'. Full resolution pixels
+ * are used directly; a reduced preview, or a source with color profiles, metadata or more than 8 bits per
+ * channel, means decoding the mapped file again so nothing is lost. Compression quality is carried over
+ * from the source file. Returns NULL on failure; otherwise the caller must DestroyMagickWand() the result.
+ */
+MagickWand * image_crop_wand( IMAGE * image, int x, int y, int w, int h );
+
+/*
+ * Adds a holder to 'image' so it can be shared with another thread, and returns it. Accepts NULL.
+ */
+IMAGE * image_ref( IMAGE * image );
+
+/*
+ * Drops one holder of 'image'. The last one frees the decoded pixels and unmaps the file. Accepts NULL.
+ */
+void image_free( IMAGE * image );
+
+#endif
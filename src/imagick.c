@@ -5,6 +5,7 @@
 #include "config.h"
 #include "file_io.h"
 #include "selection_box.h"
+#include "probe.h"
 #include "imagick.h"
 
 int imagick_init( void ) {
@@ -20,18 +21,13 @@ void imagick_test( FILE_LIST * file_list ) {
                 if( SGK_DEBUG ) printf( " -- already tested\n" );
                 return;
         }
-        MagickBooleanType magick_status;
-        MagickWand * magick_wand = NewMagickWand();
-        magick_status = MagickReadImage( magick_wand, file_list->path );
-        if( magick_status == MagickFalse ) {
+        /* Only the header is needed; it falls back to MagickPingImage() for formats it doesn't parse. */
+        if( probe_entry( file_list ) ) {
                 if( SGK_DEBUG ) printf( " -- failure\n" );
                 del_file_from_list( file_list );
         } else {
                 if( SGK_DEBUG ) printf( " -- success\n" );
-                file_list->img_h = MagickGetImageHeight( magick_wand );
-                file_list->img_w = MagickGetImageWidth( magick_wand );
                 reset_sel_box( file_list );
                 file_list->valid_imagick = 1;
-                magick_wand = DestroyMagickWand( magick_wand );
         }
 }
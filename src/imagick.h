@@ -9,7 +9,7 @@
 int imagick_init( void );
 
 /* 
- * Attempts to load the file referenced in 'file_list' with ImageMagick.
+ * Identifies the file referenced in 'file_list' from its header, without decoding it.
  * On failure, removes file_list from the FILE_LIST struct loop.
  * On success, sets file_list->valid_imagick = 1 and relevant selection box values (example: file_list->sel_x).
  */
@@ -0,0 +1,408 @@
+/* See LICENSE file for copyright and license details. */
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "data_structures.h"
+#include "config.h"
+#include "file_list.h"
+#include "index.h"
+#include "probe.h"
+#include "table.h"
+
+#define INDEX_MAGIC "WPIX"
+#define INDEX_VERSION 3
+
+/* Flags stored on disk. */
+#define INDEX_VALID_SDL         0x01
+#define INDEX_VALID_IMAGICK     0x02
+#define INDEX_HAS_SELECTION     0x04
+#define INDEX_SEL_PLACED        0x08    /* The selection was placed from the image content or by hand */
+#define INDEX_CURSOR            0x10    /* The file was on screen when the session ended */
+/* Flags only meaningful in memory, for the current session. */
+#define INDEX_SEEN              0x40    /* The file was present when the list was built */
+#define INDEX_FRESH             0x80    /* The record was refreshed from an entry when it was saved */
+#define INDEX_SESSION_FLAGS     ( INDEX_SEEN | INDEX_FRESH )
+
+static Uint32 index_hash( const char * name ) {
+        /* FNV-1a */
+        Uint32 hash = 2166136261u;
+        while( *name ) {
+                hash ^= (unsigned char) *name++;
+                hash *= 16777619u;
+        }
+        return hash;
+}
+
+/* Returns the number of the record for 'name', or -1 if there is none. */
+static int index_find( INDEX * index, const char * name ) {
+        Uint32 mask = index->bucket_count - 1;
+        for( Uint32 b = index_hash( name ) & mask; index->buckets[b] != 0; b = ( b + 1 ) & mask ) {
+                int r = index->buckets[b] - 1;
+                if( strcmp( index->pool + index->records[r].name, name ) == 0 ) return r;
+        }
+        return -1;
+}
+
+static int index_rehash( INDEX * index, int bucket_count ) {
+        int * buckets = calloc( bucket_count, sizeof( int ) );
+        if( buckets == NULL ) {
+                fprintf( stderr, "ERROR: Unable to malloc for index hash table.\n" );
+                return 1;
+        }
+        free( index->buckets );
+        index->buckets = buckets;
+        index->bucket_count = bucket_count;
+
+        Uint32 mask = bucket_count - 1;
+        for( int r = 0; r < index->count; r++ ) {
+                Uint32 b = index_hash( index->pool + index->records[r].name ) & mask;
+                while( buckets[b] != 0 ) b = ( b + 1 ) & mask;
+                buckets[b] = r + 1;
+        }
+        return 0;
+}
+
+/* Appends an empty record for 'name' and returns its number, or -1 on failure. */
+static int index_add( INDEX * index, const char * name ) {
+        size_t len = strlen( name ) + 1;
+
+        if( index->count == index->capacity ) {
+                int capacity = index->capacity ? index->capacity * 2 : 1024;
+                INDEX_RECORD * records = realloc( index->records, capacity * sizeof( INDEX_RECORD ) );
+                if( records == NULL ) {
+                        fprintf( stderr, "ERROR: Unable to malloc for index records.\n" );
+                        return -1;
+                }
+                index->records = records;
+                index->capacity = capacity;
+        }
+        if( index->pool_size + len > index->pool_capacity ) {
+                size_t capacity = index->pool_capacity ? index->pool_capacity * 2 : 65536;
+                while( index->pool_size + len > capacity ) capacity *= 2;
+                char * pool = realloc( index->pool, capacity );
+                if( pool == NULL ) {
+                        fprintf( stderr, "ERROR: Unable to malloc for index string pool.\n" );
+                        return -1;
+                }
+                index->pool = pool;
+                index->pool_capacity = capacity;
+        }
+        /* Keep the hash table at most half full. */
+        if( ( index->count + 1 ) * 2 > index->bucket_count ) {
+                if( index_rehash( index, index->bucket_count * 2 ) ) return -1;
+        }
+
+        int r = index->count++;
+        INDEX_RECORD * record = &index->records[r];
+        memset( record, 0, sizeof( INDEX_RECORD ) );
+        record->name = index->pool_size;
+        record->format = format_unknown;
+        memcpy( index->pool + index->pool_size, name, len );
+        index->pool_size += len;
+
+        Uint32 mask = index->bucket_count - 1;
+        Uint32 b = index_hash( name ) & mask;
+        while( index->buckets[b] != 0 ) b = ( b + 1 ) & mask;
+        index->buckets[b] = r + 1;
+
+        return r;
+}
+
+/* Path of 'file_list' relative to the indexed directory. */
+static const char * index_relative( INDEX * index, FILE_LIST * file_list ) {
+        size_t len = strlen( index->dir );
+        if( strncmp( file_list->path, index->dir, len ) == 0 && file_list->path[len] == '/' ) {
+                return file_list->path + len + 1;
+        }
+        return file_list->path;
+}
+
+/* Builds the path of the index file, with an optional 'suffix'. This function mallocs memory. */
+static char * index_path( INDEX * index, const char * suffix ) {
+        int len = strlen( index->dir ) + 1 + strlen( INDEX_FILENAME ) + strlen( suffix ) + 1;
+        char * path = malloc( len );
+        if( path == NULL ) {
+                fprintf( stderr, "ERROR: Unable to malloc for index path.\n" );
+        } else {
+                snprintf( path, len, "%s/%s%s", index->dir, INDEX_FILENAME, suffix );
+        }
+        return path;
+}
+
+INDEX * index_load( char * dir, double aspect ) {
+        INDEX * index = calloc( 1, sizeof( INDEX ) );
+        int len = strlen( dir ) + 1;
+        if( index == NULL || ( index->dir = malloc( len ) ) == NULL || index_rehash( index, 1024 ) ) {
+                fprintf( stderr, "ERROR: Unable to malloc for index.\n" );
+                index_free( index );
+                return NULL;
+        }
+        snprintf( index->dir, len, "%s", dir );
+        index->aspect = aspect;
+        index->cursor = -1;
+
+        char * path = index_path( index, "" );
+        if( path == NULL ) return index;
+        int fd = open( path, O_RDONLY );
+        free( path );
+        if( fd < 0 ) {
+                if( SGK_DEBUG ) printf( "DEBUG: No metadata index in %s\n", dir );
+                return index;
+        }
+        struct stat st;
+        void * map = MAP_FAILED;
+        if( fstat( fd, &st ) == 0 && st.st_size >= (off_t) sizeof( INDEX_HEADER ) ) {
+                map = mmap( NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+        }
+        close( fd );
+        if( map == MAP_FAILED ) return index;
+
+        /* Anything that doesn't add up exactly is treated as no index at all. */
+        INDEX_HEADER * header = map;
+        INDEX_RECORD * records = (INDEX_RECORD *) ( header + 1 );
+        char * pool = (char *) ( records + header->count );
+        if( memcmp( header->magic, INDEX_MAGIC, 4 ) != 0 || header->version != INDEX_VERSION
+                        || (off_t) ( sizeof( INDEX_HEADER ) + (size_t) header->count * sizeof( INDEX_RECORD )
+                                + header->pool_size ) != st.st_size
+                        || header->pool_size == 0 || pool[header->pool_size - 1] != '\0' ) {
+                fprintf( stderr, "WARN: Ignoring unreadable metadata index in %s\n", dir );
+                munmap( map, st.st_size );
+                return index;
+        }
+
+        /* Tools that don't care about selection boxes keep whatever aspect ratio the index was made for. */
+        if( aspect <= 0.0 ) index->aspect = header->aspect;
+
+        for( Uint32 i = 0; i < header->count; i++ ) {
+                if( records[i].name >= header->pool_size ) continue;
+                int r = index_add( index, pool + records[i].name );
+                if( r < 0 ) break;
+                Uint32 name = index->records[r].name;
+                index->records[r] = records[i];
+                index->records[r].name = name;
+                index->records[r].flags &= ~( INDEX_SESSION_FLAGS | INDEX_CURSOR );
+                if( records[i].flags & INDEX_CURSOR ) index->cursor = r;
+                /* Selection boxes made for another aspect ratio are useless. */
+                if( header->aspect != index->aspect ) index->records[r].flags &= ~INDEX_HAS_SELECTION;
+        }
+        if( SGK_DEBUG ) printf( "DEBUG: Loaded %d records from metadata index in %s\n", index->count, dir );
+
+        munmap( map, st.st_size );
+        return index;
+}
+
+int index_match( INDEX * index, FILE_LIST * file_list, Uint64 ino, Sint64 size, Sint64 mtime ) {
+        const char * name = index_relative( index, file_list );
+        const char * base = strrchr( name, '/' );
+        base = ( base == NULL ) ? name : base + 1;
+        /* The index itself, or its temporary file. */
+        if( strncmp( base, INDEX_FILENAME, strlen( INDEX_FILENAME ) ) == 0 ) return 1;
+
+        int r = index_find( index, name );
+        INDEX_RECORD * record = r < 0 ? NULL : &index->records[r];
+        if( record != NULL && record->format != format_unknown && record->ino == ino
+                        && record->size == size && record->mtime == mtime ) {
+                /* Unchanged since it was last probed. */
+                record->flags |= INDEX_SEEN;
+                index->reused += 1;
+                if( record->format == format_none ) return 1;
+                file_list->format = record->format;
+                file_list->img_w = record->img_w;
+                file_list->img_h = record->img_h;
+                file_list->mcu_w = record->mcu_w;
+                file_list->mcu_h = record->mcu_h;
+                file_list->valid_sdl = ( record->flags & INDEX_VALID_SDL ) ? 1 : 0;
+                if( record->flags & INDEX_HAS_SELECTION ) {
+                        file_list->valid_imagick = ( record->flags & INDEX_VALID_IMAGICK ) ? 1 : 0;
+                        file_list->sel_x = record->sel_x;
+                        file_list->sel_y = record->sel_y;
+                        file_list->sel_w = record->sel_w;
+                        file_list->sel_h = record->sel_h;
+                        file_list->sel_placed = ( record->flags & INDEX_SEL_PLACED ) ? 1 : 0;
+                }
+                /* Otherwise leave valid_imagick clear so imagick_test() resets the selection. */
+                return 0;
+        }
+
+        /* New or changed. Forget whatever was known and let it be probed again. */
+        if( record == NULL ) {
+                r = index_add( index, name );
+                if( r < 0 ) return 0;
+                record = &index->records[r];
+        }
+        record->ino = ino;
+        record->size = size;
+        record->mtime = mtime;
+        record->format = format_unknown;
+        record->flags = INDEX_SEEN;
+        return 0;
+}
+
+FILE_LIST * index_apply( INDEX * index, FILE_LIST * file_list ) {
+        if( index == NULL || file_list == NULL ) return file_list;
+
+        int remaining = 0;
+        FILE_LIST * current = file_list;
+        do {
+                remaining += 1;
+                current = current->next;
+        } while( current != file_list );
+
+        int reused = index->reused;
+        for( int i = remaining; i > 0; i-- ) {
+                FILE_LIST * next = current->next;
+                struct stat st;
+                if( stat( current->path, &st ) == 0 && index_match( index, current, st.st_ino, st.st_size,
+                                        (Sint64) st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec ) ) {
+                        if( current == file_list ) file_list = ( remaining > 1 ) ? next : NULL;
+                        /* Fresh from a scan, so there is no decoded image to free. */
+                        unlink_file_from_list( current );
+                        remaining -= 1;
+                }
+                current = next;
+        }
+
+        if( SGK_DEBUG ) printf( "DEBUG: Reused cached metadata for %d files\n", index->reused - reused );
+
+        return file_list;
+}
+
+void index_save( INDEX * index, FILE_LIST * file_list ) {
+        if( index == NULL ) return;
+
+        /*
+         * Entries probed as not being images leave the list but stay in the file table as tombstones. Go
+         * through those first, since the list holds the current entry for any path replaced since.
+         */
+        for( int id = 0; id < table_count(); id++ ) {
+                FILE_LIST * entry = table_get( id );
+                if( ! entry->deleted || entry->format != format_none ) continue;
+                int r = index_find( index, index_relative( index, entry ) );
+                if( r >= 0 && ( index->records[r].flags & INDEX_SEEN ) ) {
+                        index->records[r].flags = INDEX_SEEN | INDEX_FRESH;
+                        index->records[r].format = format_none;
+                }
+        }
+
+        /* Refresh records from the list. */
+        if( file_list != NULL ) {
+                FILE_LIST * current = file_list;
+                do {
+                        int r = index_find( index, index_relative( index, current ) );
+                        if( r >= 0 && ( index->records[r].flags & INDEX_SEEN ) ) {
+                                INDEX_RECORD * record = &index->records[r];
+                                record->flags = INDEX_SEEN | INDEX_FRESH;
+                                record->format = current->format;
+                                record->img_w = current->img_w;
+                                record->img_h = current->img_h;
+                                record->mcu_w = current->mcu_w;
+                                record->mcu_h = current->mcu_h;
+                                if( current->valid_sdl ) record->flags |= INDEX_VALID_SDL;
+                                if( current->valid_imagick ) {
+                                        record->flags |= INDEX_VALID_IMAGICK | INDEX_HAS_SELECTION;
+                                        record->sel_x = current->sel_x;
+                                        record->sel_y = current->sel_y;
+                                        record->sel_w = current->sel_w;
+                                        record->sel_h = current->sel_h;
+                                        if( current->sel_placed ) record->flags |= INDEX_SEL_PLACED;
+                                }
+                        }
+                        current = current->next;
+                } while( current != file_list );
+        }
+
+        /* 
+         * Records seen at startup but not refreshed, such as files the scan found but never handed over,
+         * keep what they held when loaded; those matched unchanged are still right, and the rest are left
+         * out. Files not seen at all have left the directory.
+         */
+        INDEX_HEADER header;
+        memcpy( header.magic, INDEX_MAGIC, 4 );
+        header.version = INDEX_VERSION;
+        header.count = 0;
+        header.pool_size = 0;
+        header.aspect = index->aspect;
+        for( int r = 0; r < index->count; r++ ) {
+                INDEX_RECORD * record = &index->records[r];
+                if( !( record->flags & INDEX_SEEN ) || record->format == format_unknown ) continue;
+                header.count += 1;
+                header.pool_size += strlen( index->pool + record->name ) + 1;
+        }
+
+        char * path = index_path( index, "" );
+        char * temp_path = index_path( index, ".tmp" );
+        FILE * file = ( path && temp_path ) ? fopen( temp_path, "wb" ) : NULL;
+        if( file == NULL ) {
+                fprintf( stderr, "WARN: Unable to write metadata index in %s\n", index->dir );
+                free( path );
+                free( temp_path );
+                return;
+        }
+
+        /* Write to a temporary file and rename it over the old index, so a crash never leaves half an index. */
+        int failed = ( fwrite( &header, sizeof( header ), 1, file ) != 1 );
+        Uint32 offset = 0;
+        for( int r = 0; r < index->count && !failed; r++ ) {
+                INDEX_RECORD record = index->records[r];
+                if( !( record.flags & INDEX_SEEN ) || record.format == format_unknown ) continue;
+                record.flags &= ~INDEX_SESSION_FLAGS;
+                if( r == index->cursor ) record.flags |= INDEX_CURSOR;
+                record.name = offset;
+                offset += strlen( index->pool + index->records[r].name ) + 1;
+                failed = ( fwrite( &record, sizeof( record ), 1, file ) != 1 );
+        }
+        for( int r = 0; r < index->count && !failed; r++ ) {
+                INDEX_RECORD * record = &index->records[r];
+                if( !( record->flags & INDEX_SEEN ) || record->format == format_unknown ) continue;
+                const char * name = index->pool + record->name;
+                failed = ( fwrite( name, strlen( name ) + 1, 1, file ) != 1 );
+        }
+        if( fclose( file ) != 0 ) failed = 1;
+
+        if( failed || rename( temp_path, path ) != 0 ) {
+                fprintf( stderr, "WARN: Unable to write metadata index in %s\n", index->dir );
+                remove( temp_path );
+        } else if( SGK_DEBUG ) {
+                printf( "DEBUG: Saved %u records to metadata index in %s\n", header.count, index->dir );
+        }
+
+        /* Clear per-save state so the index can be saved again later. */
+        for( int r = 0; r < index->count; r++ ) index->records[r].flags &= ~INDEX_FRESH;
+
+        free( path );
+        free( temp_path );
+}
+
+void index_set_cursor( INDEX * index, FILE_LIST * file_list ) {
+        if( index == NULL || file_list == NULL ) return;
+
+        /* Files never probed are left out of the index, and the cursor with them. */
+        probe_entry( file_list );
+        int r = index_find( index, index_relative( index, file_list ) );
+        if( r >= 0 ) index->cursor = r;
+}
+
+char * index_cursor( INDEX * index ) {
+        if( index == NULL || index->cursor < 0 ) return NULL;
+
+        const char * name = index->pool + index->records[index->cursor].name;
+        int len = strlen( index->dir ) + 1 + strlen( name ) + 1;
+        char * path = malloc( len );
+        if( path == NULL ) {
+                fprintf( stderr, "ERROR: Unable to malloc for index path.\n" );
+        } else {
+                snprintf( path, len, "%s/%s", index->dir, name );
+        }
+        return path;
+}
+
+void index_free( INDEX * index ) {
+        if( index == NULL ) return;
+        free( index->dir );
+        free( index->records );
+        free( index->pool );
+        free( index->buckets );
+        free( index );
+}
@@ -0,0 +1,53 @@
+/* See LICENSE file for copyright and license details. */
+
+#ifndef INDEX_H
+#define INDEX_H
+
+/*
+ * Loads INDEX_FILENAME from directory 'dir'. A missing, stale or corrupt index yields an empty one.
+ * Cached selection boxes are only used when they were made for the same 'aspect'. An 'aspect' of zero
+ * keeps the index's own aspect ratio, for tools that don't touch selection boxes.
+ * Returns NULL only if memory cannot be allocated. This function mallocs memory.
+ */
+INDEX * index_load( char * dir, double aspect );
+
+/*
+ * Copies cached metadata into the entry 'file_list' if its path and the inode 'ino', size 'size' and
+ * modification time 'mtime' (in nanoseconds) of the file are unchanged. The entry is not linked or unlinked.
+ * Returns 1 if the index already knows the file is not an image, so the caller should drop it, otherwise 0.
+ * Not thread safe; callers on several threads must take turns.
+ */
+int index_match( INDEX * index, FILE_LIST * file_list, Uint64 ino, Sint64 size, Sint64 mtime );
+
+/*
+ * Stats every entry of 'file_list' and passes it through index_match(), removing entries the index
+ * already knows are not images.
+ * Returns the (possibly different) current entry, or NULL if no entries remain.
+ */
+FILE_LIST * index_apply( INDEX * index, FILE_LIST * file_list );
+
+/*
+ * Records the current metadata of every entry in 'file_list' and writes the index back to its directory.
+ * Entries probed as not being images, left in the file table as tombstones, are remembered as such. Files
+ * matched but never handed over keep their records unchanged. 'file_list' may be NULL.
+ */
+void index_save( INDEX * index, FILE_LIST * file_list );
+
+/*
+ * Remembers 'file_list' as the file on screen, for index_save() to record and the next session to resume
+ * from. Probes 'file_list' if needed, since only probed files are saved.
+ */
+void index_set_cursor( INDEX * index, FILE_LIST * file_list );
+
+/*
+ * Returns the path of the file that was on screen when the last session ended, or NULL if there is none.
+ * This function mallocs memory.
+ */
+char * index_cursor( INDEX * index );
+
+/*
+ * Frees memory held by 'index'. Accepts NULL.
+ */
+void index_free( INDEX * index );
+
+#endif
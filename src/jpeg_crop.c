@@ -0,0 +1,150 @@
+/* See LICENSE file for copyright and license details. */
+
+#include <stdio.h>
+#include <setjmp.h>
+#include <string.h>
+#include <strings.h>
+#include <jpeglib.h>
+#include "data_structures.h"
+#include "config.h"
+#include "jpeg_crop.h"
+
+/* libjpeg reports fatal errors by calling error_exit(), which must not return. Jump back instead. */
+struct jpeg_crop_error {
+        struct jpeg_error_mgr pub;
+        jmp_buf * escape;       /* Shared by the source and destination, so there is one setjmp() */
+};
+
+static void jpeg_crop_error_exit( j_common_ptr cinfo ) {
+        struct jpeg_crop_error * err = (struct jpeg_crop_error *) cinfo->err;
+        if( SGK_DEBUG ) ( *cinfo->err->output_message )( cinfo );
+        longjmp( *err->escape, 1 );
+}
+
+static JDIMENSION round_up( JDIMENSION value, JDIMENSION multiple ) {
+        return ( ( value + multiple - 1 ) / multiple ) * multiple;
+}
+
+int jpeg_crop_extension( char * path ) {
+        char * dot = strrchr( path, '.' );
+        if( dot == NULL ) return 0;
+        return strcasecmp( dot, ".jpg" ) == 0 || strcasecmp( dot, ".jpeg" ) == 0 || strcasecmp( dot, ".jpe" ) == 0;
+}
+
+int jpeg_crop_lossless( unsigned char * bytes, size_t length, char * dest_path, int x, int y, int w, int h ) {
+        struct jpeg_decompress_struct src;
+        struct jpeg_compress_struct dst;
+        struct jpeg_crop_error src_err;
+        struct jpeg_crop_error dst_err;
+        jmp_buf escape;
+        jvirt_barray_ptr dst_coefs[MAX_COMPONENTS];
+        /* Volatile, since they change between setjmp() and a possible longjmp(). */
+        FILE * volatile file = NULL;
+        volatile int dst_created = 0;
+
+        if( length < 4 || bytes[0] != 0xFF || bytes[1] != 0xD8 || x < 0 || y < 0 || w <= 0 || h <= 0 ) return 1;
+
+        src.err = jpeg_std_error( &src_err.pub );
+        src_err.pub.error_exit = jpeg_crop_error_exit;
+        src_err.escape = &escape;
+        dst.err = jpeg_std_error( &dst_err.pub );
+        dst_err.pub.error_exit = jpeg_crop_error_exit;
+        dst_err.escape = &escape;
+        jpeg_create_decompress( &src );
+
+        if( setjmp( escape ) ) {
+                if( dst_created ) jpeg_destroy_compress( &dst );
+                jpeg_destroy_decompress( &src );
+                if( file != NULL ) {
+                        fclose( file );
+                        remove( dest_path );
+                }
+                return 1;
+        }
+
+        jpeg_mem_src( &src, bytes, length );
+        /* Keep comments and application markers (EXIF, ICC profiles, ...) to copy them over. */
+        jpeg_save_markers( &src, JPEG_COM, 0xFFFF );
+        for( int m = 0; m < 16; m++ ) jpeg_save_markers( &src, JPEG_APP0 + m, 0xFFFF );
+        jpeg_read_header( &src, TRUE );
+
+        int mcu_w = src.max_h_samp_factor * DCTSIZE;
+        int mcu_h = src.max_v_samp_factor * DCTSIZE;
+        if( x % mcu_w != 0 || y % mcu_h != 0 || (JDIMENSION) ( x + w ) > src.image_width 
+                        || (JDIMENSION) ( y + h ) > src.image_height ) {
+                jpeg_destroy_decompress( &src );
+                return 1;
+        }
+
+        /* 
+         * Destination coefficient arrays must be requested before the source coefficients are read, which
+         * is when libjpeg allocates every array. Sizes are rounded up to whole MCUs, like the source's.
+         */
+        for( int ci = 0; ci < src.num_components; ci++ ) {
+                jpeg_component_info * comp = &src.comp_info[ci];
+                JDIMENSION width_blocks = round_up( ( w + mcu_w - 1 ) / mcu_w * comp->h_samp_factor, 
+                                comp->h_samp_factor );
+                JDIMENSION height_blocks = round_up( ( h + mcu_h - 1 ) / mcu_h * comp->v_samp_factor, 
+                                comp->v_samp_factor );
+                dst_coefs[ci] = ( *src.mem->request_virt_barray )( (j_common_ptr) &src, JPOOL_IMAGE, TRUE,
+                                width_blocks, height_blocks, comp->v_samp_factor );
+        }
+        jvirt_barray_ptr * src_coefs = jpeg_read_coefficients( &src );
+
+        /* Copy the blocks covering the crop. */
+        for( int ci = 0; ci < src.num_components; ci++ ) {
+                jpeg_component_info * comp = &src.comp_info[ci];
+                JDIMENSION x_blocks = ( x / mcu_w ) * comp->h_samp_factor;
+                JDIMENSION y_blocks = ( y / mcu_h ) * comp->v_samp_factor;
+                JDIMENSION width_blocks = round_up( ( w + mcu_w - 1 ) / mcu_w * comp->h_samp_factor,
+                                comp->h_samp_factor );
+                JDIMENSION height_blocks = round_up( ( h + mcu_h - 1 ) / mcu_h * comp->v_samp_factor,
+                                comp->v_samp_factor );
+                for( JDIMENSION row = 0; row < height_blocks; row += comp->v_samp_factor ) {
+                        JBLOCKARRAY dst_rows = ( *src.mem->access_virt_barray )( (j_common_ptr) &src, dst_coefs[ci],
+                                        row, comp->v_samp_factor, TRUE );
+                        JBLOCKARRAY src_rows = ( *src.mem->access_virt_barray )( (j_common_ptr) &src, src_coefs[ci],
+                                        row + y_blocks, comp->v_samp_factor, FALSE );
+                        for( int r = 0; r < comp->v_samp_factor; r++ ) {
+                                memcpy( dst_rows[r], src_rows[r] + x_blocks, width_blocks * sizeof( JBLOCK ) );
+                        }
+                }
+        }
+
+        /* Write the copied blocks with the source's quantization tables and sampling. */
+        file = fopen( dest_path, "wb" );
+        if( file == NULL ) {
+                fprintf( stderr, "WARN: Unable to open %s for writing.\n", dest_path );
+                jpeg_destroy_decompress( &src );
+                return 1;
+        }
+        jpeg_create_compress( &dst );
+        dst_created = 1;
+        jpeg_stdio_dest( &dst, file );
+        jpeg_copy_critical_parameters( &src, &dst );
+        dst.image_width = w;
+        dst.image_height = h;
+        jpeg_write_coefficients( &dst, dst_coefs );
+
+        /* libjpeg writes its own JFIF and Adobe markers; copy everything else. */
+        for( jpeg_saved_marker_ptr marker = src.marker_list; marker != NULL; marker = marker->next ) {
+                if( dst.write_JFIF_header && marker->marker == JPEG_APP0 && marker->data_length >= 5 
+                                && memcmp( marker->data, "JFIF", 5 ) == 0 ) continue;
+                if( dst.write_Adobe_marker && marker->marker == JPEG_APP0 + 14 && marker->data_length >= 5 
+                                && memcmp( marker->data, "Adobe", 5 ) == 0 ) continue;
+                jpeg_write_marker( &dst, marker->marker, marker->data, marker->data_length );
+        }
+
+        jpeg_finish_compress( &dst );
+        jpeg_destroy_compress( &dst );
+        jpeg_finish_decompress( &src );
+        jpeg_destroy_decompress( &src );
+
+        int ret_val = 0;
+        if( fclose( file ) != 0 ) {
+                remove( dest_path );
+                ret_val = 1;
+        }
+
+        return ret_val;
+}
@@ -0,0 +1,20 @@
+/* See LICENSE file for copyright and license details. */
+
+#ifndef JPEG_CROP_H
+#define JPEG_CROP_H
+
+/*
+ * Crops the JPEG held in 'bytes' to the 'w'x'h' region at 'x','y' by copying its DCT coefficient
+ * blocks into 'dest_path', without decoding or re-encoding. Everything inside the region is bit-exact.
+ * 'x' and 'y' must lie on the source's MCU grid. Metadata markers are carried over.
+ * Returns 1 if the crop is not possible or fails, in which case nothing usable is left at 'dest_path'.
+ * Safe to call from any thread.
+ */
+int jpeg_crop_lossless( unsigned char * bytes, size_t length, char * dest_path, int x, int y, int w, int h );
+
+/*
+ * Returns 1 if 'path' names a JPEG file by its extension, otherwise 0.
+ */
+int jpeg_crop_extension( char * path );
+
+#endif
@@ -0,0 +1,281 @@
+/* See LICENSE file for copyright and license details. */
+
+#include <errno.h>
+#include "wand/magick_wand.h"
+#include "data_structures.h"
+#include "config.h"
+#include "file_io.h"
+#include "image.h"
+#include "scale.h"
+#include "trace.h"
+#include "ladder.h"
+
+/* One output size, encoded on its own thread. */
+typedef struct LADDERENCODE {
+        SDL_Thread * thread;
+        SDL_Surface * surface;  /* Pixels to encode, owned by ladder_export() */
+        char * path;
+        int alpha;              /* Set to 1 to keep the alpha channel */
+        size_t quality;         /* Crop compression quality, or 0 for ImageMagick's default */
+        int status;
+} LADDER_ENCODE;
+
+static int ladder_compare( const void * a, const void * b ) {
+        const EXPORT_SIZE * sa = a;
+        const EXPORT_SIZE * sb = b;
+        Sint64 area_a = (Sint64) sa->w * sa->h;
+        Sint64 area_b = (Sint64) sb->w * sb->h;
+        return ( area_a < area_b ) - ( area_a > area_b );
+}
+
+int ladder_parse( char * spec, EXPORT_SIZE ** sizes, int * count ) {
+        *sizes = NULL;
+        *count = 0;
+        if( spec == NULL || *spec == '\0' ) return 0;
+
+        int capacity = 1;
+        for( char * c = spec; *c; c++ ) if( *c == ',' ) capacity += 1;
+        *sizes = calloc( capacity, sizeof( EXPORT_SIZE ) );
+        if( *sizes == NULL ) {
+                fprintf( stderr, "ERROR: Unable to malloc for export sizes.\n" );
+                return 1;
+        }
+
+        char * item = spec;
+        while( *count < capacity ) {
+                int len = strcspn( item, "," );
+                EXPORT_SIZE * size = &( *sizes )[*count];
+                char * end = NULL;
+                size->w = strtol( item, &end, 10 );
+                if( end == item || ( *end != 'x' && *end != 'X' )) break;
+                char * h_start = end + 1;
+                size->h = strtol( h_start, &end, 10 );
+                if( end == h_start || size->w <= 0 || size->h <= 0 ) break;
+                /* Anything between the height and the comma must be an extension. */
+                int ext_len = len - ( end - item );
+                if( ext_len > 0 ) {
+                        if( *end != '.' || ext_len == 1 ) break;
+                        size->ext = malloc( ext_len + 1 );
+                        if( size->ext == NULL ) break;
+                        memcpy( size->ext, end, ext_len );
+                        size->ext[ext_len] = '\0';
+                }
+                *count += 1;
+                if( item[len] == '\0' ) {
+                        /* Largest first, so that each size can be shrunk from the one before it. */
+                        qsort( *sizes, *count, sizeof( EXPORT_SIZE ), ladder_compare );
+                        return 0;
+                }
+                item += len + 1;
+        }
+
+        fprintf( stderr, "ERROR: Unable to parse export size: %.*s\n", (int) strcspn( item, "," ), item );
+        ladder_free( *sizes, capacity );
+        *sizes = NULL;
+        *count = 0;
+        return 1;
+}
+
+void ladder_free( EXPORT_SIZE * sizes, int count ) {
+        if( sizes == NULL ) return;
+        for( int i = 0; i < count; i++ ) free( sizes[i].ext );
+        free( sizes );
+}
+
+/*
+ * Returns the malloc'd path of 'size' for 'dest_path', which lies in 'dst': the same path below a directory
+ * of 'dst' named after the size, with the extension of 'size', if any. Creates the directories leading up
+ * to it if 'create' is set. Returns NULL on failure.
+ */
+static char * ladder_path( char * dst, char * dest_path, EXPORT_SIZE * size, int create ) {
+        size_t dst_len = strlen( dst );
+        char * name = ( strncmp( dest_path, dst, dst_len ) == 0 && dest_path[dst_len] == '/' )
+                ? dest_path + dst_len + 1 : dest_path;
+        char * slash = strrchr( name, '/' );
+        char * file = ( slash == NULL ) ? name : slash + 1;
+        char * dot = strrchr( file, '.' );
+        int stem_len = ( dot == NULL || size->ext == NULL ) ? (int) strlen( name ) : dot - name;
+        char * ext = ( size->ext == NULL ) ? "" : size->ext;
+
+        int len = dst_len + 1 + 2 * 12 + 1 + stem_len + strlen( ext ) + 1;
+        char * path = malloc( len );
+        if( path == NULL ) {
+                fprintf( stderr, "ERROR: Unable to malloc for export path.\n" );
+                return NULL;
+        }
+        snprintf( path, len, "%s/%dx%d/%.*s%s", dst, size->w, size->h, stem_len, name, ext );
+        if( create && make_parent_dirs( path )) {
+                free( path );
+                return NULL;
+        }
+        return path;
+}
+
+/*
+ * Sets up 'magick_wand' to read back the crop at 'dest_path' in less than STREAM_CROP_MPX, so that a
+ * streamed or lossless crop of a huge source doesn't bring back the memory it avoided. JPEG is decoded at
+ * a reduced scale, still covering 'largest'. Returns 1 if the crop can't be read back that small.
+ */
+static int ladder_limit( MagickWand * magick_wand, char * dest_path, EXPORT_SIZE * largest ) {
+        MagickWand * ping_wand = NewMagickWand();
+        if( MagickPingImage( ping_wand, dest_path ) == MagickFalse ) {
+                /* Reading it fails just the same, and says so. */
+                DestroyMagickWand( ping_wand );
+                return 0;
+        }
+        double pixels = (double) MagickGetImageWidth( ping_wand ) * MagickGetImageHeight( ping_wand );
+        char * format = MagickGetImageFormat( ping_wand );
+        int jpeg = ( format != NULL && strcmp( format, "JPEG" ) == 0 );
+        if( format != NULL ) MagickRelinquishMemory( format );
+        DestroyMagickWand( ping_wand );
+
+        double limit = STREAM_CROP_MPX * 1000000.0;
+        if( pixels < limit ) return 0;
+        /* libjpeg decodes at down to 1/8 scale each way, and never below the size asked for. */
+        if( jpeg && pixels / 64.0 < limit && (double) largest->w * largest->h * 4.0 < limit ) {
+                char size[32];
+                snprintf( size, sizeof( size ), "%dx%d", largest->w, largest->h );
+                MagickSetOption( magick_wand, "jpeg:size", size );
+                return 0;
+        }
+
+        fprintf( stderr, "WARN: Crop %s is too large to read back for export. Skipping its exported sizes.\n", dest_path );
+        return 1;
+}
+
+/*
+ * Returns a new IMAGE_PIXELFORMAT surface holding the crop, taken from 'crop_wand' or, if that is NULL,
+ * read back from 'dest_path' within STREAM_CROP_MPX. Sizes up to 'largest' can be shrunk from it.
+ * Returns NULL on failure, with 'skipped' set if the crop was too large to read back.
+ */
+static SDL_Surface * ladder_decode( MagickWand * crop_wand, char * dest_path, EXPORT_SIZE * largest,
+                int * alpha, size_t * quality, int * skipped ) {
+        MagickWand * magick_wand = crop_wand;
+        if( magick_wand == NULL ) {
+                magick_wand = NewMagickWand();
+                if(( *skipped = ladder_limit( magick_wand, dest_path, largest ))) {
+                        DestroyMagickWand( magick_wand );
+                        return NULL;
+                }
+                if( MagickReadImage( magick_wand, dest_path ) == MagickFalse ) {
+                        fprintf( stderr, "ERROR: Unable to read back %s for export.\n", dest_path );
+                        DestroyMagickWand( magick_wand );
+                        return NULL;
+                }
+        }
+
+        int w = MagickGetImageWidth( magick_wand );
+        int h = MagickGetImageHeight( magick_wand );
+        int masks_bpp = 0;
+        Uint32 r_mask, g_mask, b_mask, a_mask;
+        SDL_PixelFormatEnumToMasks( IMAGE_PIXELFORMAT, &masks_bpp, &r_mask, &g_mask, &b_mask, &a_mask );
+        SDL_Surface * surface = SDL_CreateRGBSurface( 0, w, h, 32, r_mask, g_mask, b_mask, a_mask );
+        /* IMAGE_PIXELFORMAT is R,G,B,A in memory, and SDL never pads 32 bit rows, so the pixels go straight in. */
+        if( surface == NULL ) {
+                fprintf( stderr, "ERROR: Unable to allocate memory for exported image.\n" );
+        } else if( MagickExportImagePixels( magick_wand, 0, 0, w, h, "RGBA", CharPixel, surface->pixels ) == MagickFalse ) {
+                fprintf( stderr, "ERROR: Unable to decode %s for export.\n", dest_path );
+                SDL_FreeSurface( surface );
+                surface = NULL;
+        } else {
+                *alpha = MagickGetImageAlphaChannel( magick_wand ) == MagickTrue;
+                *quality = MagickGetImageCompressionQuality( magick_wand );
+        }
+
+        if( magick_wand != crop_wand ) DestroyMagickWand( magick_wand );
+        return surface;
+}
+
+static int ladder_encode_thread( void * data ) {
+        LADDER_ENCODE * encode = data;
+        MagickWand * magick_wand = NewMagickWand();
+        encode->status = 1;
+        if( MagickConstituteImage( magick_wand, encode->surface->w, encode->surface->h, "RGBA", CharPixel,
+                                encode->surface->pixels ) == MagickTrue ) {
+                if( ! encode->alpha ) MagickSetImageAlphaChannel( magick_wand, DeactivateAlphaChannel );
+                if( encode->quality > 0 ) MagickSetImageCompressionQuality( magick_wand, encode->quality );
+                if( MagickWriteImage( magick_wand, encode->path ) == MagickTrue ) encode->status = 0;
+        }
+        if( encode->status ) fprintf( stderr, "WARN: Problem saving exported image %s\n", encode->path );
+        DestroyMagickWand( magick_wand );
+        return 0;
+}
+
+int ladder_export( MagickWand * crop_wand, char * dst, char * dest_path, EXPORT_SIZE * sizes, int count, int id ) {
+        if( count <= 0 ) return 0;
+
+        Uint64 span = trace_begin();
+        int alpha = 0;
+        size_t quality = 0;
+        int skipped = 0;
+        SDL_Surface * crop = ladder_decode( crop_wand, dest_path, &sizes[0], &alpha, &quality, &skipped );
+        if( crop == NULL ) return ! skipped;
+        trace_end( "export_decode", span, id, -1 );
+        int w = crop->w;
+        int h = crop->h;
+
+        LADDER_ENCODE * encodes = calloc( count, sizeof( LADDER_ENCODE ) );
+        if( encodes == NULL ) {
+                fprintf( stderr, "ERROR: Unable to malloc for export jobs.\n" );
+                SDL_FreeSurface( crop );
+                return 1;
+        }
+
+        int ret_val = 0;
+        for( int i = 0; i < count; i++ ) {
+                /* Fit the region inside the size, keeping its aspect ratio. */
+                int out_w = sizes[i].w;
+                int out_h = (int) ( (double) h * out_w / w + 0.5 );
+                if( out_h > sizes[i].h ) {
+                        out_h = sizes[i].h;
+                        out_w = (int) ( (double) w * out_h / h + 0.5 );
+                }
+                if( out_w < 1 ) out_w = 1;
+                if( out_h < 1 ) out_h = 1;
+                if( out_w > w || out_h > h ) {
+                        if( SGK_DEBUG ) printf( "DEBUG: Crop too small to export at %dx%d.\n", sizes[i].w, sizes[i].h );
+                        continue;
+                }
+
+                /* Shrink from the smallest size made so far that still covers this one. */
+                SDL_Surface * from = crop;
+                for( int j = 0; j < i; j++ ) {
+                        SDL_Surface * made = encodes[j].surface;
+                        if( made != NULL && made->w >= out_w && made->h >= out_h ) from = made;
+                }
+                span = trace_begin();
+                encodes[i].surface = scale_surface( from, out_w, out_h );
+                trace_end( "export_scale", span, id, -1 );
+                encodes[i].path = ladder_path( dst, dest_path, &sizes[i], 1 );
+                if( encodes[i].surface == NULL || encodes[i].path == NULL ) {
+                        ret_val = 1;
+                        continue;
+                }
+                encodes[i].alpha = alpha;
+                encodes[i].quality = quality;
+
+                /* Encode alongside the next shrink. Without a thread, encode here. */
+                encodes[i].thread = SDL_CreateThread( ladder_encode_thread, "export", &encodes[i] );
+                if( encodes[i].thread == NULL ) ladder_encode_thread( &encodes[i] );
+        }
+
+        for( int i = 0; i < count; i++ ) {
+                if( encodes[i].thread != NULL ) SDL_WaitThread( encodes[i].thread, NULL );
+                if( encodes[i].path != NULL && encodes[i].status ) ret_val = 1;
+                SDL_FreeSurface( encodes[i].surface );
+                free( encodes[i].path );
+        }
+        free( encodes );
+        SDL_FreeSurface( crop );
+
+        return ret_val;
+}
+
+void ladder_delete( char * dst, char * dest_path, EXPORT_SIZE * sizes, int count ) {
+        for( int i = 0; i < count; i++ ) {
+                char * path = ladder_path( dst, dest_path, &sizes[i], 0 );
+                if( path == NULL ) continue;
+                if( remove( path ) != 0 && errno != ENOENT ) fprintf( stderr, "WARN: Unable to delete image: %s\n", path );
+                free( path );
+        }
+}
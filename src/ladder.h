@@ -0,0 +1,37 @@
+/* See LICENSE file for copyright and license details. */
+
+#ifndef LADDER_H
+#define LADDER_H
+
+/*
+ * Parses 'spec', a comma separated list of output sizes such as "3840x2400,2560x1600.webp,1280x800",
+ * into a malloc'd array stored in 'sizes' and its length in 'count'. A size may end in an extension
+ * naming the output format; otherwise the source's format is kept. An empty 'spec' gives no sizes.
+ * Returns 1 on a malformed 'spec', otherwise 0. The caller must ladder_free() the result.
+ */
+int ladder_parse( char * spec, EXPORT_SIZE ** sizes, int * count );
+
+/*
+ * Frees 'count' sizes returned by ladder_parse(). Accepts NULL.
+ */
+void ladder_free( EXPORT_SIZE * sizes, int count );
+
+/*
+ * Writes the crop just saved to 'dest_path' once per entry in 'sizes', each below a directory of 'dst'
+ * named after the size, such as dst/1920x1200/subdir/file.jpg for dst/subdir/file.jpg. The crop pixels come from 'crop_wand' when
+ * the caller still holds them, otherwise the written crop is read back; the source is never decoded again.
+ * A crop read back is kept under STREAM_CROP_MPX, decoding JPEG at a reduced scale, and its sizes are
+ * skipped with a warning, not an error, when that isn't possible.
+ * Each size is shrunk from the smallest larger one already made, never enlarged, keeping the crop's aspect
+ * ratio within the size, and encoded on its own thread while the next is shrunk. Sizes larger than the
+ * crop are left out. Trace spans carry 'id', the FILE_LIST id of the image.
+ * Returns 1 if any output failed, otherwise 0. Safe to call from any thread.
+ */
+int ladder_export( MagickWand * crop_wand, char * dst, char * dest_path, EXPORT_SIZE * sizes, int count, int id );
+
+/*
+ * Removes every output ladder_export() would write for 'dest_path' in 'dst'. Missing files are not an error.
+ */
+void ladder_delete( char * dst, char * dest_path, EXPORT_SIZE * sizes, int count );
+
+#endif
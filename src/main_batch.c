@@ -0,0 +1,583 @@
+/*
+ * =====================================================================================================================
+ * See LICENSE file for copyright and license details.
+ *
+ * wp_batch: Crop images listed in a manifest, without a GUI
+ * =====================================================================================================================
+ */
+
+#include <unistd.h>
+#include "wand/magick_wand.h"
+#include "data_structures.h"
+#include "config.h"
+#include "file_io.h"
+#include "file_list.h"
+#include "ladder.h"
+#include "probe.h"
+#include "selection_box.h"
+#include "trace.h"
+
+static void print_batch_usage( char * argv[] ) {
+        printf( "batch %d.%d (www.subgeniuskitty.com)\n"
+                "Usage: %s [options] <manifest> <destination>\n"
+                "  manifest:    File listing the crops, one image per line, or - for standard input\n"
+                "  destination: Directory to contain cropped images\n"
+                "Manifest lines are either CSV or JSON objects:\n"
+                "  path,x,y,w,h                                  Crop the given box, in image pixels\n"
+                "  path,aspect                                   Crop the largest centered box of that aspect\n"
+                "  {\"file\": path, \"x\": x, \"y\": y, \"w\": w, \"h\": h}\n"
+                "  {\"file\": path, \"aspect\": aspect}\n"
+                "  Blank lines and lines starting with # are skipped.\n"
+                "  Crops keep the source filename; later images of the same name are numbered, as in file-2.jpg.\n"
+                "Options:\n"
+                "  -j <jobs>    Number of worker threads (default: one per CPU)\n"
+                "  -q           Quiet: no progress report, only the summary\n"
+                "  -l <sizes>   Also write each crop at these sizes, such as 3840x2400,1920x1200.webp\n"
+                "               Each size goes to a directory of that name inside the destination\n"
+                , VER_MAJOR, VER_MINOR, argv[0] );
+}
+
+/*
+ * Manifest parsing
+ */
+
+/* Returns 1 if all of 'text', ignoring surrounding whitespace, is an integer, storing it in 'value'. */
+static int parse_int( char * text, int * value ) {
+        char * end = NULL;
+        long result = strtol( text, &end, 10 );
+        if( end == text ) return 0;
+        while( *end == ' ' || *end == '\t' ) end++;
+        if( *end != '\0' ) return 0;
+        *value = result;
+        return 1;
+}
+
+/* Returns 1 if all of 'text', ignoring surrounding whitespace, is a number, storing it in 'value'. */
+static int parse_double( char * text, double * value ) {
+        char * end = NULL;
+        double result = strtod( text, &end );
+        if( end == text ) return 0;
+        while( *end == ' ' || *end == '\t' ) end++;
+        if( *end != '\0' ) return 0;
+        *value = result;
+        return 1;
+}
+
+/* Returns a malloc'd copy of the 'len' characters at 'text'. */
+static char * copy_string( char * text, int len ) {
+        char * copy = malloc( len + 1 );
+        if( copy == NULL ) {
+                fprintf( stderr, "ERROR: Unable to malloc for manifest string.\n" );
+                return NULL;
+        }
+        memcpy( copy, text, len );
+        copy[len] = '\0';
+        return copy;
+}
+
+/*
+ * Parses 'path,x,y,w,h' or 'path,aspect' into 'entry'. Fields are taken from the right, so the path
+ * may itself contain commas. Returns 1 on error, otherwise 0.
+ */
+static int parse_csv( char * line, FILE_LIST * entry ) {
+        char * fields[4];
+        int count = 0;
+        char * comma = NULL;
+        while( count < 4 && ( comma = strrchr( line, ',' )) != NULL ) {
+                *comma = '\0';
+                fields[count++] = comma + 1;
+        }
+
+        /* fields[] runs right to left: h, w, y, x. */
+        if( count == 4 && parse_int( fields[3], &entry->sel_x ) && parse_int( fields[2], &entry->sel_y )
+                        && parse_int( fields[1], &entry->sel_w ) && parse_int( fields[0], &entry->sel_h ) ) {
+                entry->path = copy_string( line, strlen( line ) );
+                return entry->path == NULL;
+        }
+
+        /* Not a box. Put the commas back, so everything but the last field is the path. */
+        for( int i = 1; i < count; i++ ) fields[i][-1] = ',';
+        if( count >= 1 && parse_double( fields[0], &entry->aspect ) ) {
+                entry->sel_x = entry->sel_y = entry->sel_w = entry->sel_h = 0;
+                entry->path = copy_string( line, strlen( line ) );
+                return entry->path == NULL;
+        }
+
+        return 1;
+}
+
+/* Returns 'text' past any spaces and tabs. */
+static char * json_skip_space( char * text ) {
+        while( *text == ' ' || *text == '\t' ) text++;
+        return text;
+}
+
+/* Returns a pointer just past the JSON string starting at the quote 'text', or NULL if it never ends. */
+static char * json_skip_string( char * text ) {
+        for( text++; *text != '"'; text++ ) {
+                if( *text == '\0' ) return NULL;
+                if( *text == '\\' && *++text == '\0' ) return NULL;
+        }
+        return text + 1;
+}
+
+/*
+ * Returns a pointer to the value of "key" in the flat JSON object 'line', or NULL if the key is absent.
+ * Only keys are compared, so the same text inside a string value never matches.
+ */
+static char * json_value( char * line, char * key ) {
+        int len = strlen( key );
+        char * c = line;
+        if( *c++ != '{' ) return NULL;
+        while( 1 ) {
+                c = json_skip_space( c );
+                if( *c != '"' ) return NULL;
+                char * name = c + 1;
+                if(( c = json_skip_string( c )) == NULL ) return NULL;
+                int match = ( c - 1 - name == len && strncmp( name, key, len ) == 0 );
+                c = json_skip_space( c );
+                if( *c != ':' ) return NULL;
+                c = json_skip_space( c + 1 );
+                if( match ) return c;
+
+                /* Step over the value to the next key. */
+                if( *c == '"' ) {
+                        if(( c = json_skip_string( c )) == NULL ) return NULL;
+                } else {
+                        while( *c != ',' && *c != '}' && *c != '\0' ) c++;
+                }
+                c = json_skip_space( c );
+                if( *c != ',' ) return NULL;
+                c++;
+        }
+}
+
+/* Returns a malloc'd, unescaped copy of the JSON string starting at 'value', or NULL. */
+static char * json_string( char * value ) {
+        if( value == NULL || *value != '"' ) return NULL;
+        char * string = copy_string( value + 1, strlen( value + 1 ));
+        if( string == NULL ) return NULL;
+
+        char * src = value + 1;
+        char * dst = string;
+        while( *src != '"' ) {
+                if( *src == '\0' ) {
+                        free( string );
+                        return NULL;
+                }
+                if( *src == '\\' ) {
+                        src++;
+                        switch( *src ) {
+                                case 'n': *dst++ = '\n'; break;
+                                case 't': *dst++ = '\t'; break;
+                                case '\0':
+                                        free( string );
+                                        return NULL;
+                                default: *dst++ = *src; break; /* \" \\ \/ */
+                        }
+                        src++;
+                } else {
+                        *dst++ = *src++;
+                }
+        }
+        *dst = '\0';
+
+        return string;
+}
+
+/* Parses a JSON number at 'value' into 'number'. Returns 1 on success. */
+static int json_number( char * value, double * number ) {
+        if( value == NULL ) return 0;
+        char * end = NULL;
+        *number = strtod( value, &end );
+        return end != value;
+}
+
+/*
+ * Parses a flat JSON object with "file" and either "x","y","w","h" or "aspect" into 'entry'.
+ * Returns 1 on error, otherwise 0.
+ */
+static int parse_json( char * line, FILE_LIST * entry ) {
+        double x, y, w, h, aspect;
+        if( json_number( json_value( line, "x" ), &x ) && json_number( json_value( line, "y" ), &y )
+                        && json_number( json_value( line, "w" ), &w ) && json_number( json_value( line, "h" ), &h )) {
+                entry->sel_x = x;
+                entry->sel_y = y;
+                entry->sel_w = w;
+                entry->sel_h = h;
+        } else if( json_number( json_value( line, "aspect" ), &aspect )) {
+                entry->aspect = aspect;
+        } else {
+                return 1;
+        }
+
+        entry->path = json_string( json_value( line, "file" ));
+        return entry->path == NULL;
+}
+
+/*
+ * Builds an entry from manifest line 'line', numbered 'id'. Returns NULL and complains if the line is invalid.
+ */
+static FILE_LIST * parse_line( char * line, int id ) {
+        FILE_LIST * entry = malloc( sizeof( FILE_LIST ) );
+        if( entry == NULL ) {
+                fprintf( stderr, "ERROR: Unable to malloc for manifest entry.\n" );
+                return NULL;
+        }
+        clear_filelist_struct( entry );
+        entry->id = id;
+
+        int ret_val = ( line[0] == '{' ) ? parse_json( line, entry ) : parse_csv( line, entry );
+        if( ret_val == 0 && entry->sel_w > 0 && entry->sel_h > 0 ) {
+                /* An explicit box is its own aspect ratio. sel_sanitize() keeps it while clamping. */
+                entry->aspect = (double) entry->sel_w / (double) entry->sel_h;
+        }
+        if( ret_val != 0 || entry->aspect <= 0 ) {
+                fprintf( stderr, "WARN: Skipping invalid manifest line %d.\n", id );
+                free( entry->path );
+                free( entry );
+                return NULL;
+        }
+
+        /* Cropped images keep their source filename. */
+        char * slash = strrchr( entry->path, '/' );
+        char * file = ( slash == NULL ) ? entry->path : slash + 1;
+        entry->file = copy_string( file, strlen( file ));
+        if( entry->file == NULL ) {
+                free( entry->path );
+                free( entry );
+                return NULL;
+        }
+        entry->name = entry->file;
+
+        return entry;
+}
+
+/*
+ * Destination names
+ */
+
+/*
+ * Names handed out so far, without their extensions, in an open-addressed hash table. Extensions are left
+ * out since exported sizes may all be written in one format.
+ */
+typedef struct BATCHNAMES {
+        char ** slots;
+        int count;
+        int capacity;
+} BATCH_NAMES;
+
+static Uint32 names_hash( const char * name, int len ) {
+        /* FNV-1a */
+        Uint32 hash = 2166136261u;
+        for( int i = 0; i < len; i++ ) {
+                hash ^= (unsigned char) name[i];
+                hash *= 16777619u;
+        }
+        return hash;
+}
+
+/* Length of 'name' without its extension. */
+static int names_stem( const char * name ) {
+        const char * dot = strrchr( name, '.' );
+        return ( dot == NULL || dot == name ) ? (int) strlen( name ) : dot - name;
+}
+
+/*
+ * Records 'name', which must outlive 'names'. Returns 1 if a name with the same stem was already
+ * recorded, -1 on error, otherwise 0.
+ */
+static int names_add( BATCH_NAMES * names, char * name ) {
+        if(( names->count + 1 ) * 2 > names->capacity ) {
+                int capacity = ( names->capacity == 0 ) ? 1024 : names->capacity * 2;
+                char ** slots = calloc( capacity, sizeof( char * ) );
+                if( slots == NULL ) {
+                        fprintf( stderr, "ERROR: Unable to malloc for destination names.\n" );
+                        return -1;
+                }
+                for( int i = 0; i < names->capacity; i++ ) {
+                        if( names->slots[i] == NULL ) continue;
+                        Uint32 b = names_hash( names->slots[i], names_stem( names->slots[i] )) & ( capacity - 1 );
+                        while( slots[b] != NULL ) b = ( b + 1 ) & ( capacity - 1 );
+                        slots[b] = names->slots[i];
+                }
+                free( names->slots );
+                names->slots = slots;
+                names->capacity = capacity;
+        }
+
+        int len = names_stem( name );
+        Uint32 b = names_hash( name, len ) & ( names->capacity - 1 );
+        for( ; names->slots[b] != NULL; b = ( b + 1 ) & ( names->capacity - 1 )) {
+                if( names_stem( names->slots[b] ) == len && strncmp( names->slots[b], name, len ) == 0 ) return 1;
+        }
+        names->slots[b] = name;
+        names->count += 1;
+        return 0;
+}
+
+/*
+ * Gives 'entry' a destination name no other entry has, so no two workers ever write the same file. The
+ * first image of each filename keeps it; the rest get a number, as in file-2.jpg.
+ * Returns 1 on error, otherwise 0.
+ */
+static int unique_name( BATCH_NAMES * names, FILE_LIST * entry ) {
+        int status = names_add( names, entry->file );
+        if( status <= 0 ) return status < 0;
+
+        int stem = names_stem( entry->file );
+        int len = strlen( entry->file ) + 12;
+        char * name = malloc( len );
+        if( name == NULL ) {
+                fprintf( stderr, "ERROR: Unable to malloc for destination name.\n" );
+                return 1;
+        }
+        for( int n = 2; status == 1; n++ ) {
+                snprintf( name, len, "%.*s-%d%s", stem, entry->file, n, entry->file + stem );
+                status = names_add( names, name );
+        }
+        if( status < 0 ) {
+                free( name );
+                return 1;
+        }
+        fprintf( stderr, "WARN: Saving %s as %s, since an earlier manifest line uses its name.\n", entry->path, name );
+        entry->name = name;
+        return 0;
+}
+
+/*
+ * Cropping
+ */
+
+/*
+ * Probes one entry, settles its selection box and crops it. Returns 1 on error, otherwise 0.
+ */
+static int batch_crop( FILE_LIST * entry, CMD_LINE_ARGS * cmd_line_args ) {
+        if( probe_entry( entry ) ) {
+                fprintf( stderr, "WARN: Not a readable image: %s\n", entry->path );
+                return 1;
+        }
+
+        if( entry->sel_w > 0 ) {
+                /*
+                 * Boxes decided upstream are kept exact instead of snapped to the JPEG block grid.
+                 * The lossless path still applies whenever they happen to be aligned.
+                 */
+                entry->mcu_w = 0;
+                entry->mcu_h = 0;
+                SDL_Rect box = { entry->sel_x, entry->sel_y, entry->sel_w, entry->sel_h };
+                sel_sanitize( &box, entry );
+                if( box.x != entry->sel_x || box.y != entry->sel_y || box.w != entry->sel_w || box.h != entry->sel_h ) {
+                        fprintf( stderr, "WARN: Crop box clamped to fit within image: %s\n", entry->path );
+                }
+                entry->sel_x = box.x;
+                entry->sel_y = box.y;
+                entry->sel_w = box.w;
+                entry->sel_h = box.h;
+        } else {
+                reset_sel_box( entry );
+        }
+
+        if( crop_save( entry, cmd_line_args ) ) {
+                fprintf( stderr, "WARN: Unable to crop image: %s\n", entry->path );
+                return 1;
+        }
+
+        return 0;
+}
+
+/*
+ * Each worker claims one entry at a time, so a slow image never holds up the others.
+ */
+static int batch_worker( void * data ) {
+        BATCH_WORK * work = data;
+        int i;
+        trace_thread( "batch" );
+        while(( i = SDL_AtomicAdd( &work->next, 1 )) < work->count ) {
+                if( batch_crop( work->entries[i], work->cmd_line_args ) ) SDL_AtomicAdd( &work->failed, 1 );
+                SDL_AtomicAdd( &work->done, 1 );
+        }
+        SDL_SemPost( work->finished );
+        return 0;
+}
+
+int main( int argc, char * argv[] ) {
+
+        /*
+         * Command line options
+         */
+
+        int jobs = SDL_GetCPUCount();
+        int quiet = 0;
+        char * ladder = EXPORT_LADDER;
+        int opt;
+        while(( opt = getopt( argc, argv, "j:l:q" )) != -1 ) {
+                switch( opt ) {
+                        case 'j':
+                                jobs = atoi( optarg );
+                                break;
+                        case 'l':
+                                ladder = optarg;
+                                break;
+                        case 'q':
+                                quiet = 1;
+                                break;
+                        default:
+                                print_batch_usage( argv );
+                                exit(EXIT_FAILURE);
+                }
+        }
+        if( argc - optind != 2 ) {
+                print_batch_usage( argv );
+                exit(EXIT_FAILURE);
+        }
+        if( jobs < 1 ) jobs = 1;
+
+        /*
+         * Variables/Initialization
+         */
+
+        /* Before any worker thread exists. */
+        if( trace_init() ) exit(EXIT_FAILURE);
+        CMD_LINE_ARGS cmd_line_args = { NULL, NULL, 0.0, NULL, 0 };
+        if( ladder_parse( ladder, &cmd_line_args.ladder, &cmd_line_args.ladder_count ) ) {
+                print_batch_usage( argv );
+                exit(EXIT_FAILURE);
+        }
+        cmd_line_args.dst = sanitize_path( argv[optind+1] );
+        if( cmd_line_args.dst == NULL ) {
+                fprintf( stderr, "ERROR: Unable to open destination directory: %s\n", argv[optind+1] );
+                exit(EXIT_FAILURE);
+        }
+
+        FILE * manifest = stdin;
+        if( strcmp( argv[optind], "-" ) != 0 ) manifest = fopen( argv[optind], "r" );
+        if( manifest == NULL ) {
+                fprintf( stderr, "ERROR: Unable to open manifest: %s\n", argv[optind] );
+                exit(EXIT_FAILURE);
+        }
+
+        BATCH_WORK work;
+        work.entries = NULL;
+        work.count = 0;
+        work.cmd_line_args = &cmd_line_args;
+        SDL_AtomicSet( &work.next, 0 );
+        SDL_AtomicSet( &work.done, 0 );
+        SDL_AtomicSet( &work.failed, 0 );
+        work.finished = SDL_CreateSemaphore( 0 );
+        if( work.finished == NULL ) {
+                fprintf( stderr, "ERROR: Unable to create semaphore: %s\n", SDL_GetError() );
+                exit(EXIT_FAILURE);
+        }
+
+        /* Read the whole manifest up front, so workers never wait on it. */
+        BATCH_NAMES names = { NULL, 0, 0 };
+        int capacity = 0;
+        int line_number = 0;
+        int skipped = 0;
+        char * line = NULL;
+        size_t line_size = 0;
+        ssize_t len;
+        while(( len = getline( &line, &line_size, manifest )) != -1 ) {
+                line_number += 1;
+                while( len > 0 && ( line[len-1] == '\n' || line[len-1] == '\r' )) line[--len] = '\0';
+                char * start = line;
+                while( *start == ' ' || *start == '\t' ) start++;
+                if( *start == '\0' || *start == '#' ) continue;
+
+                FILE_LIST * entry = parse_line( start, line_number );
+                if( entry == NULL ) {
+                        skipped += 1;
+                        continue;
+                }
+                if( unique_name( &names, entry ) ) exit(EXIT_FAILURE);
+                if( work.count == capacity ) {
+                        capacity = ( capacity == 0 ) ? 1024 : capacity * 2;
+                        FILE_LIST ** entries = realloc( work.entries, capacity * sizeof( FILE_LIST * ) );
+                        if( entries == NULL ) {
+                                fprintf( stderr, "ERROR: Unable to malloc for list of entries.\n" );
+                                exit(EXIT_FAILURE);
+                        }
+                        work.entries = entries;
+                }
+                work.entries[work.count++] = entry;
+        }
+        free( line );
+        free( names.slots );
+        if( manifest != stdin ) fclose( manifest );
+
+        /*
+         * ImageMagick only encodes here. One image per worker keeps every core busy, so its own
+         * threads would only oversubscribe them.
+         */
+        MagickWandGenesis();
+        MagickSetResourceLimit( ThreadResource, 1 );
+
+        /*
+         * Crop every entry in parallel, reporting progress from this thread.
+         */
+
+        Uint32 start_ticks = SDL_GetTicks();
+        if( jobs > work.count ) jobs = work.count;
+        SDL_Thread ** workers = malloc( ( jobs > 0 ? jobs : 1 ) * sizeof( SDL_Thread * ) );
+        if( workers == NULL ) {
+                fprintf( stderr, "ERROR: Unable to malloc for worker threads.\n" );
+                exit(EXIT_FAILURE);
+        }
+        int started = 0;
+        for( int i = 0; i < jobs; i++ ) {
+                workers[i] = SDL_CreateThread( batch_worker, "batch", &work );
+                if( workers[i] == NULL ) {
+                        fprintf( stderr, "WARN: Unable to create worker thread: %s\n", SDL_GetError() );
+                } else {
+                        started += 1;
+                }
+        }
+        /* Without any workers, this thread does the work itself. */
+        if( started == 0 ) {
+                batch_worker( &work );
+                started = 1;
+        }
+
+        /* Report twice a second until every worker has run out of entries. */
+        int progress = ( quiet == 0 && isatty( fileno( stderr )));
+        int finished = 0;
+        while( finished < started ) {
+                if( SDL_SemWaitTimeout( work.finished, 500 ) == 0 ) {
+                        finished += 1;
+                } else if( progress ) {
+                        int done = SDL_AtomicGet( &work.done );
+                        double seconds = ( SDL_GetTicks() - start_ticks ) / 1000.0;
+                        fprintf( stderr, "\rwp_batch: %d/%d images, %d failed -- %.1f images/s   ", done, work.count,
+                                        SDL_AtomicGet( &work.failed ), seconds > 0 ? done / seconds : 0.0 );
+                }
+        }
+        for( int i = 0; i < jobs; i++ ) {
+                if( workers[i] != NULL ) SDL_WaitThread( workers[i], NULL );
+        }
+        free( workers );
+
+        double seconds = ( SDL_GetTicks() - start_ticks ) / 1000.0;
+        int failed = SDL_AtomicGet( &work.failed );
+        fprintf( stderr, "%swp_batch: %d images cropped, %d failed, %d manifest lines skipped -- %.1f s, %.1f images/s\n",
+                        progress ? "\n" : "", work.count - failed, failed, skipped, seconds,
+                        seconds > 0 ? work.count / seconds : 0.0 );
+
+        /*
+         * Free memory, close subsystems and exit.
+         */
+
+        for( int i = 0; i < work.count; i++ ) {
+                if( work.entries[i]->name != work.entries[i]->file ) free( work.entries[i]->name );
+                free( work.entries[i]->path );
+                free( work.entries[i]->file );
+                free( work.entries[i] );
+        }
+        free( work.entries );
+        free( cmd_line_args.dst );
+        ladder_free( cmd_line_args.ladder, cmd_line_args.ladder_count );
+        SDL_DestroySemaphore( work.finished );
+        trace_terminate();
+        MagickWandTerminus();
+        exit( failed > 0 || skipped > 0 ? EXIT_FAILURE : EXIT_SUCCESS );
+}
@@ -0,0 +1,763 @@
+/*
+ * =====================================================================================================================
+ * See LICENSE file for copyright and license details.
+ *
+ * wp_bench: Generate a synthetic image corpus and time wallproc's hot paths on it
+ * =====================================================================================================================
+ */
+
+#include <stdio.h>
+#include <math.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <jpeglib.h>
+#include "wand/magick_wand.h"
+#include "data_structures.h"
+#include "config.h"
+#include "file_io.h"
+#include "file_list.h"
+#include "imagick.h"
+#include "ladder.h"
+#include "cache.h"
+#include "image.h"
+#include "prefetch.h"
+#include "save.h"
+#include "scan.h"
+#include "sdl.h"
+#include "selection_box.h"
+#include "table.h"
+#include "trace.h"
+#include "ui.h"
+#include "validate.h"
+
+/* ImageMagick holds a whole image in memory while encoding, so PNG and WebP stay below this many megapixels. */
+#define BENCH_MAGICK_MAX_MP 16.0
+
+/* Name of the file recording the parameters a corpus was generated with. */
+#define BENCH_MARKER ".wp_corpus"
+
+/* Repetitions of the whole-corpus benchmarks, and caps on the per-image ones. */
+#define BENCH_REPEAT 3
+#define BENCH_DRAWS 100
+#define BENCH_CROPS 20
+#define BENCH_SEL_CALLS 100000
+
+/* Time the user spends looking at each image in the paced draw() benchmark, in milliseconds. */
+#define BENCH_DWELL_MS 100
+
+static void print_bench_usage( char * argv[] ) {
+        printf( "wp_bench %d.%d (www.subgeniuskitty.com)\n"
+                "Usage: %s -g <count> [options] <corpus>\n"
+                "       %s [options] <corpus>\n"
+                "  corpus:      Directory of images to generate, or to benchmark against\n"
+                "Generator options:\n"
+                "  -g <count>   Generate a corpus of <count> files. Nothing is done if it already exists\n"
+                "  -u <unique>  Number of distinct files; the rest are hard links to them (default: 32)\n"
+                "  -m <mp>      Largest image size in megapixels; sizes are log-uniform from 1 (default: 200)\n"
+                "  -D <count>   Files per subdirectory, or 0 to keep the corpus flat (default: 0)\n"
+                "  -s <seed>    Random seed; the same parameters always give the same corpus (default: 1)\n"
+                "Benchmark options:\n"
+                "  -o <file>    Write the results as JSON to <file> (default: bench.json)\n"
+                "  -M <path>    wp_minsize executable to time end to end (default: ./wp_minsize)\n"
+                "  -a <aspect>  Aspect ratio for selection boxes and crops (default: 1.6)\n"
+                , VER_MAJOR, VER_MINOR, argv[0], argv[0] );
+}
+
+/*
+ * Corpus generation
+ */
+
+/* xorshift64*: small, fast and the same on every platform, which is all a reproducible corpus needs. */
+static Uint64 bench_rand( Uint64 * state ) {
+        *state ^= *state >> 12;
+        *state ^= *state << 25;
+        *state ^= *state >> 27;
+        return *state * 2685821657736338717ULL;
+}
+
+/* Returns a double in [0,1). */
+static double bench_uniform( Uint64 * state ) {
+        return ( bench_rand( state ) >> 11 ) * ( 1.0 / 9007199254740992.0 );
+}
+
+/*
+ * Fills one RGB row: smooth gradients over most of the image and a noisy patch somewhere in it, so that
+ * file sizes are realistic and selection boxes have something to find.
+ */
+static void gen_row( unsigned char * row, int w, int h, int y, Uint64 seed ) {
+        int patch_x = ( seed >> 8 ) % ( w / 2 + 1 );
+        int patch_y = ( seed >> 24 ) % ( h / 2 + 1 );
+        int in_rows = ( y >= patch_y && y < patch_y + h / 3 );
+        for( int x = 0; x < w; x++ ) {
+                unsigned char * p = row + x * 3;
+                p[0] = ( x * 255 / w + seed ) & 0xFF;
+                p[1] = ( y * 255 / h + ( seed >> 16 ) ) & 0xFF;
+                p[2] = 128;
+                if( in_rows && x >= patch_x && x < patch_x + w / 3 ) {
+                        Uint32 noise = ( x * 73856093u ) ^ ( y * 19349663u ) ^ (Uint32) seed;
+                        noise *= 2654435761u;
+                        p[0] = noise >> 24;
+                        p[1] = noise >> 16;
+                        p[2] = noise >> 8;
+                }
+        }
+}
+
+/* Encodes a 'w'x'h' JPEG one row at a time, so even 200 MP images need only a row of memory. */
+static int gen_jpeg( char * path, int w, int h, Uint64 seed ) {
+        FILE * file = fopen( path, "wb" );
+        unsigned char * row = malloc( (size_t) w * 3 );
+        if( file == NULL || row == NULL ) {
+                fprintf( stderr, "ERROR: Unable to create %s\n", path );
+                if( file != NULL ) fclose( file );
+                free( row );
+                return 1;
+        }
+
+        struct jpeg_compress_struct cinfo;
+        struct jpeg_error_mgr jerr;
+        cinfo.err = jpeg_std_error( &jerr );
+        jpeg_create_compress( &cinfo );
+        jpeg_stdio_dest( &cinfo, file );
+        cinfo.image_width = w;
+        cinfo.image_height = h;
+        cinfo.input_components = 3;
+        cinfo.in_color_space = JCS_RGB;
+        jpeg_set_defaults( &cinfo );
+        jpeg_set_quality( &cinfo, 85, TRUE );
+        jpeg_start_compress( &cinfo, TRUE );
+        while( cinfo.next_scanline < cinfo.image_height ) {
+                gen_row( row, w, h, cinfo.next_scanline, seed );
+                JSAMPROW rows[1] = { row };
+                jpeg_write_scanlines( &cinfo, rows, 1 );
+        }
+        jpeg_finish_compress( &cinfo );
+        jpeg_destroy_compress( &cinfo );
+
+        free( row );
+        return fclose( file ) != 0;
+}
+
+/* Encodes a 'w'x'h' image through ImageMagick in 'format', such as "PNG" or "WEBP". */
+static int gen_magick( char * path, char * format, int w, int h, Uint64 seed ) {
+        unsigned char * pixels = malloc( (size_t) w * h * 3 );
+        if( pixels == NULL ) {
+                fprintf( stderr, "ERROR: Unable to malloc for %dx%d image.\n", w, h );
+                return 1;
+        }
+        for( int y = 0; y < h; y++ ) gen_row( pixels + (size_t) y * w * 3, w, h, y, seed );
+
+        MagickWand * magick_wand = NewMagickWand();
+        int ret_val = ( MagickConstituteImage( magick_wand, w, h, "RGB", CharPixel, pixels ) == MagickFalse
+                        || MagickSetImageFormat( magick_wand, format ) == MagickFalse
+                        || MagickWriteImage( magick_wand, path ) == MagickFalse );
+        DestroyMagickWand( magick_wand );
+        free( pixels );
+
+        if( ret_val ) {
+                /* Usually a missing WebP delegate. A mislabelled JPEG still tests that headers beat extensions. */
+                fprintf( stderr, "WARN: Unable to write %s as %s. Writing a JPEG instead.\n", path, format );
+                ret_val = gen_jpeg( path, w, h, seed );
+        }
+        return ret_val;
+}
+
+/* Writes 'length' bytes of 'byte_seed' noise to 'path', optionally preceded by a JPEG start-of-image marker. */
+static int gen_garbage( char * path, int length, int jpeg_marker, Uint64 byte_seed ) {
+        FILE * file = fopen( path, "wb" );
+        if( file == NULL ) {
+                fprintf( stderr, "ERROR: Unable to create %s\n", path );
+                return 1;
+        }
+        if( jpeg_marker ) fwrite( "\xFF\xD8\xFF\xE0", 1, 4, file );
+        for( int i = 0; i < length; i++ ) fputc( (int) ( bench_rand( &byte_seed ) >> 56 ), file );
+        return fclose( file ) != 0;
+}
+
+/* Kinds of file in a corpus, picked per distinct file. */
+typedef enum { gen_jpg, gen_png, gen_webp, gen_truncated, gen_corrupt, gen_text } GEN_KIND;
+
+static const char * gen_extension( GEN_KIND kind ) {
+        switch( kind ) {
+                case gen_png:
+                        return "png";
+                case gen_webp:
+                        return "webp";
+                case gen_text:
+                        return "txt";
+                case gen_jpg:
+                case gen_truncated:
+                case gen_corrupt:
+                        break;
+        }
+        return "jpg";
+}
+
+/* Derives the kind, size and content seed of distinct file 'slot'. */
+static GEN_KIND gen_slot( int slot, Uint64 seed, double max_mp, int * w, int * h, Uint64 * content ) {
+        Uint64 state = ( seed + 1 ) * 0x9E3779B97F4A7C15ULL ^ (Uint64) ( slot + 1 ) * 0xBF58476D1CE4E5B9ULL;
+        bench_rand( &state );
+        *content = bench_rand( &state );
+
+        /* About 90% images, split evenly between the formats; the rest broken or not images at all. */
+        int roll = bench_rand( &state ) % 100;
+        GEN_KIND kind = gen_jpg + bench_rand( &state ) % 3;
+        if( roll < 4 ) kind = gen_truncated;
+        else if( roll < 7 ) kind = gen_corrupt;
+        else if( roll < 10 ) kind = gen_text;
+
+        double mp = pow( max_mp, bench_uniform( &state ));
+        if(( kind == gen_png || kind == gen_webp ) && mp > BENCH_MAGICK_MAX_MP ) mp = BENCH_MAGICK_MAX_MP;
+        static const double aspects[] = { 16.0 / 9.0, 16.0 / 10.0, 4.0 / 3.0, 3.0 / 2.0, 1.0, 9.0 / 16.0, 21.0 / 9.0 };
+        double aspect = aspects[bench_rand( &state ) % ( sizeof( aspects ) / sizeof( aspects[0] ))];
+        *w = sqrt( mp * 1000000.0 * aspect );
+        *h = *w / aspect;
+        if( *w < 16 ) *w = 16;
+        if( *h < 16 ) *h = 16;
+
+        return kind;
+}
+
+/* Builds the path of file 'i' of a corpus. This function mallocs memory. */
+static char * gen_path( char * dir, int i, int per_dir, GEN_KIND kind ) {
+        int len = strlen( dir ) + 32;
+        char * path = malloc( len );
+        if( path == NULL ) {
+                fprintf( stderr, "ERROR: Unable to malloc for corpus path.\n" );
+        } else if( per_dir > 0 ) {
+                snprintf( path, len, "%s/d%04d/img%07d.%s", dir, i / per_dir, i, gen_extension( kind ));
+        } else {
+                snprintf( path, len, "%s/img%07d.%s", dir, i, gen_extension( kind ));
+        }
+        return path;
+}
+
+/*
+ * Writes 'unique' distinct files, then hard-links them round-robin until there are 'count' entries.
+ * Links cost no disk space and no encoding time, so even a million entries build quickly.
+ * Returns 1 on error, otherwise 0.
+ */
+static int bench_generate( char * dir, int count, int unique, double max_mp, int per_dir, Uint64 seed ) {
+        if( unique < 1 ) unique = 1;
+        if( unique > count ) unique = count;
+        if( max_mp < 1.0 ) max_mp = 1.0;
+
+        /* The marker holds the parameters, so a matching corpus is reused as is. */
+        char params[128];
+        snprintf( params, sizeof( params ), "%d %d %.3f %d %llu\n", count, unique, max_mp, per_dir,
+                        (unsigned long long) seed );
+        char * marker = build_dest_path( dir, BENCH_MARKER );
+        if( marker == NULL ) return 1;
+        char existing[128] = "";
+        FILE * file = fopen( marker, "r" );
+        if( file != NULL ) {
+                if( fgets( existing, sizeof( existing ), file ) == NULL ) existing[0] = '\0';
+                fclose( file );
+        }
+        if( strcmp( existing, params ) == 0 ) {
+                fprintf( stderr, "wp_bench: corpus %s is up to date\n", dir );
+                free( marker );
+                return 0;
+        }
+        if( existing[0] != '\0' ) {
+                fprintf( stderr, "ERROR: %s holds a corpus with different parameters. Remove it first.\n", dir );
+                free( marker );
+                return 1;
+        }
+        mkdir( dir, 0755 );
+
+        int failed = 0;
+        for( int i = 0; i < count && ! failed; i++ ) {
+                int slot = i % unique;
+                int w = 0;
+                int h = 0;
+                Uint64 content = 0;
+                GEN_KIND kind = gen_slot( slot, seed, max_mp, &w, &h, &content );
+                char * path = gen_path( dir, i, per_dir, kind );
+                if( path == NULL ) return 1;
+                if( per_dir > 0 && i % per_dir == 0 ) {
+                        char * slash = strrchr( path, '/' );
+                        *slash = '\0';
+                        mkdir( path, 0755 );
+                        *slash = '/';
+                }
+
+                if( i < unique ) {
+                        fprintf( stderr, "wp_bench: writing %d/%d: %s", i + 1, unique, path );
+                        if( kind <= gen_truncated ) fprintf( stderr, " (%dx%d)", w, h );
+                        fprintf( stderr, "\n" );
+                        switch( kind ) {
+                                case gen_jpg:
+                                        failed = gen_jpeg( path, w, h, content );
+                                        break;
+                                case gen_png:
+                                        failed = gen_magick( path, "PNG", w, h, content );
+                                        break;
+                                case gen_webp:
+                                        failed = gen_magick( path, "WEBP", w, h, content );
+                                        break;
+                                case gen_truncated: {
+                                        /* A valid header whose body stops halfway. */
+                                        struct stat st;
+                                        failed = gen_jpeg( path, w, h, content );
+                                        if( ! failed && stat( path, &st ) == 0 ) failed = truncate( path, st.st_size / 2 ) != 0;
+                                        break;
+                                }
+                                case gen_corrupt:
+                                        failed = gen_garbage( path, 4096, 1, content );
+                                        break;
+                                case gen_text:
+                                        failed = gen_garbage( path, 256, 0, content );
+                                        break;
+                        }
+                } else {
+                        char * target = gen_path( dir, slot, per_dir, kind );
+                        unlink( path );
+                        failed = ( target == NULL || link( target, path ) != 0 );
+                        if( failed ) fprintf( stderr, "ERROR: Unable to link %s\n", path );
+                        free( target );
+                }
+                free( path );
+        }
+
+        if( ! failed ) {
+                file = fopen( marker, "w" );
+                failed = ( file == NULL || fputs( params, file ) < 0 );
+                if( file != NULL ) failed |= ( fclose( file ) != 0 );
+        }
+        free( marker );
+        return failed;
+}
+
+/*
+ * Measurement
+ */
+
+static long bench_peak_rss( void ) {
+        struct rusage usage;
+        getrusage( RUSAGE_SELF, &usage );
+        return usage.ru_maxrss;
+}
+
+static void bench_sample( BENCH_RESULT * result, Uint64 ticks ) {
+        if( result->count == result->capacity ) {
+                int capacity = ( result->capacity == 0 ) ? 1024 : result->capacity * 2;
+                Uint64 * samples = realloc( result->samples, capacity * sizeof( Uint64 ));
+                if( samples == NULL ) return;
+                result->samples = samples;
+                result->capacity = capacity;
+        }
+        result->samples[result->count++] = ticks;
+}
+
+static int compare_ticks( const void * a, const void * b ) {
+        Uint64 ticks_a = *(const Uint64 *) a;
+        Uint64 ticks_b = *(const Uint64 *) b;
+        return ( ticks_a > ticks_b ) - ( ticks_a < ticks_b );
+}
+
+/* Returns the 'q' quantile of the samples in microseconds, by nearest rank. Sorts the samples. */
+static double bench_quantile( BENCH_RESULT * result, double q ) {
+        if( result->count == 0 ) return 0.0;
+        qsort( result->samples, result->count, sizeof( Uint64 ), compare_ticks );
+        Uint64 ticks = result->samples[(int) ( q * ( result->count - 1 ) + 0.5 )];
+        return ticks * 1000000.0 / SDL_GetPerformanceFrequency();
+}
+
+static void bench_begin( BENCH_RESULT * result, const char * name ) {
+        memset( result, 0, sizeof( BENCH_RESULT ));
+        result->name = name;
+        fprintf( stderr, "wp_bench: running %s\n", name );
+}
+
+static void bench_report( BENCH_RESULT * result, FILE * json, int first ) {
+        double p50 = bench_quantile( result, 0.50 );
+        double p99 = bench_quantile( result, 0.99 );
+        double throughput = ( result->seconds > 0 ) ? result->items / result->seconds : 0.0;
+        if( result->peak_rss_kb == 0 ) result->peak_rss_kb = bench_peak_rss();
+
+        fprintf( stderr, "%-16s %8d ops %12.1f items/s  p50 %10.1f us  p99 %10.1f us  peak RSS %7.1f MB\n",
+                        result->name, result->count, throughput, p50, p99, result->peak_rss_kb / 1024.0 );
+        if( json != NULL ) {
+                fprintf( json, "%s    {\"name\": \"%s\", \"ops\": %d, \"items\": %.0f, \"seconds\": %.6f, "
+                                "\"throughput\": %.3f, \"p50_us\": %.3f, \"p99_us\": %.3f, \"peak_rss_kb\": %ld}",
+                                first ? "" : ",\n", result->name, result->count, result->items, result->seconds,
+                                throughput, p50, p99, result->peak_rss_kb );
+        }
+        free( result->samples );
+        result->samples = NULL;
+}
+
+/* Counts the entries of the loop 'file_list'. */
+static int bench_length( FILE_LIST * file_list ) {
+        int count = 0;
+        FILE_LIST * current = file_list;
+        if( current != NULL ) {
+                do {
+                        count += 1;
+                        current = current->next;
+                } while( current != file_list );
+        }
+        return count;
+}
+
+/*
+ * Benchmarks
+ */
+
+/* build_file_list() over the whole corpus, from an empty file table each time. */
+static void bench_scan( BENCH_RESULT * result, char * corpus, double aspect ) {
+        Uint64 start = SDL_GetPerformanceCounter();
+        for( int i = 0; i < BENCH_REPEAT; i++ ) {
+                if( table_init() ) return;
+                Uint64 t0 = SDL_GetPerformanceCounter();
+                FILE_LIST * file_list = build_file_list( corpus, aspect );
+                bench_sample( result, SDL_GetPerformanceCounter() - t0 );
+                result->items += bench_length( file_list );
+                table_terminate();
+        }
+        result->seconds = (double) ( SDL_GetPerformanceCounter() - start ) / SDL_GetPerformanceFrequency();
+}
+
+/* sdl_test() and imagick_test() on every entry, inline, as step() does for entries the validators missed. */
+static FILE_LIST * bench_validate( BENCH_RESULT * result, FILE_LIST * file_list, SDL_POINTERS * sdl_pointers ) {
+        int count = table_count();
+        Uint64 start = SDL_GetPerformanceCounter();
+        for( int id = 0; id < count; id++ ) {
+                FILE_LIST * entry = table_get( id );
+                if( entry->deleted ) continue;
+                /* Never remove the last entry, or there would be no loop left to draw. */
+                if( entry->next == entry ) break;
+                if( entry == file_list ) file_list = file_list->next;
+                Uint64 t0 = SDL_GetPerformanceCounter();
+                sdl_test( entry, sdl_pointers );
+                if( ! entry->deleted ) imagick_test( entry );
+                bench_sample( result, SDL_GetPerformanceCounter() - t0 );
+                result->items += 1;
+        }
+        result->seconds = (double) ( SDL_GetPerformanceCounter() - start ) / SDL_GetPerformanceFrequency();
+        return file_list;
+}
+
+/* draw() stepping right, back to back, or with the user looking at each image for 'dwell' ms. */
+static FILE_LIST * bench_draw( BENCH_RESULT * result, FILE_LIST * file_list, SDL_POINTERS * sdl_pointers, int dwell ) {
+        int draws = bench_length( file_list );
+        if( draws > BENCH_DRAWS ) draws = BENCH_DRAWS;
+
+        file_list = draw( none, file_list, sdl_pointers );
+        Uint64 start = SDL_GetPerformanceCounter();
+        Uint64 paused = 0;
+        for( int i = 0; i < draws; i++ ) {
+                Uint64 t0 = SDL_GetPerformanceCounter();
+                file_list = draw( right, file_list, sdl_pointers );
+                Uint64 t1 = SDL_GetPerformanceCounter();
+                bench_sample( result, t1 - t0 );
+                result->items += 1;
+                if( dwell > 0 ) {
+                        SDL_Delay( dwell );
+                        paused += SDL_GetPerformanceCounter() - t1;
+                }
+                /* Background work announces itself with events nobody else is reading here. */
+                SDL_FlushEvents( SDL_FIRSTEVENT, SDL_LASTEVENT );
+        }
+        result->seconds = (double) ( SDL_GetPerformanceCounter() - start - paused ) / SDL_GetPerformanceFrequency();
+        return file_list;
+}
+
+/* sel_resize() and sel_sanitize() on one image, timed in groups of 100 calls. */
+static void bench_selection( BENCH_RESULT * resize, BENCH_RESULT * sanitize, FILE_LIST * entry ) {
+        Uint64 start = SDL_GetPerformanceCounter();
+        for( int i = 0; i < BENCH_SEL_CALLS; i += 100 ) {
+                Uint64 t0 = SDL_GetPerformanceCounter();
+                for( int j = 0; j < 100; j++ ) sel_resize(( j & 1 ) ? up : down, entry );
+                bench_sample( resize, ( SDL_GetPerformanceCounter() - t0 ) / 100 );
+                resize->items += 100;
+        }
+        resize->seconds = (double) ( SDL_GetPerformanceCounter() - start ) / SDL_GetPerformanceFrequency();
+
+        start = SDL_GetPerformanceCounter();
+        for( int i = 0; i < BENCH_SEL_CALLS; i += 100 ) {
+                Uint64 t0 = SDL_GetPerformanceCounter();
+                for( int j = 0; j < 100; j++ ) {
+                        /* Oversized and off the edge, so every clamp has work to do. */
+                        SDL_Rect params = { entry->img_w / 2, entry->img_h / 2, entry->img_w + j, entry->img_h + j };
+                        sel_sanitize( &params, entry );
+                }
+                bench_sample( sanitize, ( SDL_GetPerformanceCounter() - t0 ) / 100 );
+                sanitize->items += 100;
+        }
+        sanitize->seconds = (double) ( SDL_GetPerformanceCounter() - start ) / SDL_GetPerformanceFrequency();
+}
+
+/* Removes the directories leading to 'path' below 'dst', innermost first, as long as they are empty. */
+static void bench_prune( char * dst, char * path ) {
+        size_t dst_len = strlen( dst );
+        char * slash = NULL;
+        while(( slash = strrchr( path, '/' )) != NULL && (size_t) ( slash - path ) > dst_len ) {
+                *slash = '\0';
+                if( rmdir( path ) != 0 ) break;
+        }
+}
+
+/* crop_save() of the first valid entries into a scratch directory, with the EXPORT_LADDER sizes. */
+static void bench_crop( BENCH_RESULT * result, FILE_LIST * file_list, double aspect ) {
+        char dst[] = "/tmp/wp_bench.XXXXXX";
+        if( mkdtemp( dst ) == NULL ) {
+                fprintf( stderr, "WARN: Unable to create scratch directory. Skipping crop_save().\n" );
+                return;
+        }
+        CMD_LINE_ARGS cmd_line_args = { NULL, dst, aspect, NULL, 0 };
+        if( ladder_parse( EXPORT_LADDER, &cmd_line_args.ladder, &cmd_line_args.ladder_count ) ) {
+                rmdir( dst );
+                return;
+        }
+
+        Uint64 start = SDL_GetPerformanceCounter();
+        FILE_LIST * current = file_list;
+        int crops = 0;
+        do {
+                if( current->valid_imagick == 1 ) {
+                        Uint64 t0 = SDL_GetPerformanceCounter();
+                        int failed = crop_save( current, &cmd_line_args );
+                        Uint64 t1 = SDL_GetPerformanceCounter();
+                        if( failed ) {
+                                fprintf( stderr, "WARN: Unable to crop %s. Not counted.\n", current->path );
+                        } else {
+                                bench_sample( result, t1 - t0 );
+                                result->items += 1;
+                                crops += 1;
+                        }
+                        /* Remove the crop, its exported sizes, and the subdirectories made for them. */
+                        del_img( current, &cmd_line_args );
+                        char * path = build_dest_path( dst, current->name );
+                        if( path != NULL ) bench_prune( dst, path );
+                        free( path );
+                        for( int i = 0; i < cmd_line_args.ladder_count; i++ ) {
+                                char size[2 * 12 + 1];
+                                snprintf( size, sizeof( size ), "%dx%d", cmd_line_args.ladder[i].w, cmd_line_args.ladder[i].h );
+                                char * size_dir = build_dest_path( dst, size );
+                                path = ( size_dir == NULL ) ? NULL : build_dest_path( size_dir, current->name );
+                                if( path != NULL ) bench_prune( dst, path );
+                                free( path );
+                                free( size_dir );
+                        }
+                }
+                current = current->next;
+        } while( current != file_list && crops < BENCH_CROPS );
+        result->seconds = (double) ( SDL_GetPerformanceCounter() - start ) / SDL_GetPerformanceFrequency();
+
+        ladder_free( cmd_line_args.ladder, cmd_line_args.ladder_count );
+        if( rmdir( dst ) != 0 ) fprintf( stderr, "WARN: Unable to remove scratch directory %s\n", dst );
+}
+
+/* wp_minsize end to end, listing every image, with its own peak RSS. */
+static void bench_minsize( BENCH_RESULT * result, char * minsize, char * corpus, int entries ) {
+        if( access( minsize, X_OK ) != 0 ) {
+                fprintf( stderr, "WARN: %s not found. Skipping wp_minsize.\n", minsize );
+                return;
+        }
+
+        Uint64 start = SDL_GetPerformanceCounter();
+        for( int i = 0; i < BENCH_REPEAT; i++ ) {
+                Uint64 t0 = SDL_GetPerformanceCounter();
+                pid_t pid = fork();
+                if( pid == 0 ) {
+                        if( freopen( "/dev/null", "w", stdout ) == NULL ) _exit( EXIT_FAILURE );
+                        execl( minsize, minsize, corpus, "1000000", (char *) NULL );
+                        _exit( EXIT_FAILURE );
+                }
+                int status = 0;
+                struct rusage usage;
+                if( pid < 0 || wait4( pid, &status, 0, &usage ) < 0 ) {
+                        fprintf( stderr, "WARN: Unable to run %s\n", minsize );
+                        return;
+                }
+                bench_sample( result, SDL_GetPerformanceCounter() - t0 );
+                result->items += entries;
+                if( usage.ru_maxrss > result->peak_rss_kb ) result->peak_rss_kb = usage.ru_maxrss;
+        }
+        result->seconds = (double) ( SDL_GetPerformanceCounter() - start ) / SDL_GetPerformanceFrequency();
+}
+
+int main( int argc, char * argv[] ) {
+
+        /*
+         * Command line options
+         */
+
+        int generate = 0;
+        int unique = 32;
+        double max_mp = 200.0;
+        int per_dir = 0;
+        Uint64 seed = 1;
+        char * output = "bench.json";
+        char * minsize = "./wp_minsize";
+        double aspect = 1.6;
+        int opt;
+        while(( opt = getopt( argc, argv, "g:u:m:D:s:o:M:a:" )) != -1 ) {
+                switch( opt ) {
+                        case 'g':
+                                generate = atoi( optarg );
+                                break;
+                        case 'u':
+                                unique = atoi( optarg );
+                                break;
+                        case 'm':
+                                max_mp = strtod( optarg, NULL );
+                                break;
+                        case 'D':
+                                per_dir = atoi( optarg );
+                                break;
+                        case 's':
+                                seed = strtoull( optarg, NULL, 10 );
+                                break;
+                        case 'o':
+                                output = optarg;
+                                break;
+                        case 'M':
+                                minsize = optarg;
+                                break;
+                        case 'a':
+                                aspect = strtod( optarg, NULL );
+                                break;
+                        default:
+                                print_bench_usage( argv );
+                                exit(EXIT_FAILURE);
+                }
+        }
+        if( argc - optind != 1 || aspect <= 0 ) {
+                print_bench_usage( argv );
+                exit(EXIT_FAILURE);
+        }
+
+        /*
+         * Corpus generation
+         */
+
+        if( generate > 0 ) {
+                MagickWandGenesis();
+                int failed = bench_generate( argv[optind], generate, unique, max_mp, per_dir, seed );
+                MagickWandTerminus();
+                exit( failed ? EXIT_FAILURE : EXIT_SUCCESS );
+        }
+
+        /*
+         * Variables/Initialization
+         */
+
+        char * corpus = sanitize_path( argv[optind] );
+        if( corpus == NULL ) {
+                fprintf( stderr, "ERROR: Unable to open corpus directory: %s\n", argv[optind] );
+                exit(EXIT_FAILURE);
+        }
+        if( trace_init() ) exit(EXIT_FAILURE);
+        FILE * json = fopen( output, "w" );
+        if( json == NULL ) {
+                fprintf( stderr, "ERROR: Unable to write results to %s\n", output );
+                exit(EXIT_FAILURE);
+        }
+
+        /* A hidden window is enough to render into. Without a display, fall back to SDL's dummy driver. */
+        if( SDL_Init( SDL_INIT_VIDEO ) != 0 ) {
+                setenv( "SDL_VIDEODRIVER", "dummy", 1 );
+                if( SDL_Init( SDL_INIT_VIDEO ) != 0 ) {
+                        fprintf( stderr, "ERROR: Unable to initialize SDL: %s\n", SDL_GetError() );
+                        exit(EXIT_FAILURE);
+                }
+        }
+        SDL_POINTERS sdl_pointers;
+        memset( &sdl_pointers, 0, sizeof( sdl_pointers ));
+        if( SDL_CreateWindowAndRenderer( 1280, 800, SDL_WINDOW_HIDDEN, &sdl_pointers.window, &sdl_pointers.renderer )) {
+                fprintf( stderr, "ERROR: Unable to create SDL window: %s\n", SDL_GetError() );
+                exit(EXIT_FAILURE);
+        }
+        sdl_pointers.sel_color.r = 255;
+        sdl_pointers.sel_color.g = 255;
+        sdl_pointers.sel_color.b = 255;
+        sdl_pointers.sel_color.a = 255;
+        if( imagick_init() || prefetch_init() || save_init() ) {
+                fprintf( stderr, "ERROR: Unable to start background threads.\n" );
+                exit(EXIT_FAILURE);
+        }
+
+        fprintf( json, "{\n  \"tool\": \"wp_bench\",\n  \"version\": \"%d.%d\",\n  \"corpus\": \"", VER_MAJOR, VER_MINOR );
+        for( char * c = corpus; *c != '\0'; c++ ) {
+                if( *c == '"' || *c == '\\' ) fputc( '\\', json );
+                fputc( *c, json );
+        }
+        fprintf( json, "\",\n  \"results\": [\n" );
+
+        /*
+         * Run the benchmarks, cheapest state first: the scan needs an empty table, and everything after it
+         * shares one list.
+         */
+
+        BENCH_RESULT result;
+        BENCH_RESULT sanitize;
+        bench_begin( &result, "build_file_list" );
+        bench_scan( &result, corpus, aspect );
+        int entries = ( result.count > 0 ) ? result.items / result.count : 0;
+        bench_report( &result, json, 1 );
+
+        if( table_init() || validate_init() ) exit(EXIT_FAILURE);
+        FILE_LIST * file_list = build_file_list( corpus, aspect );
+        if( file_list == NULL ) {
+                fprintf( stderr, "ERROR: No files in corpus %s\n", corpus );
+                exit(EXIT_FAILURE);
+        }
+
+        bench_begin( &result, "validate" );
+        file_list = bench_validate( &result, file_list, &sdl_pointers );
+        bench_report( &result, json, 0 );
+        if( file_list->valid_sdl != 1 || file_list->valid_imagick != 1 ) {
+                /* draw() would search forever for an image to show. */
+                fprintf( stderr, "ERROR: No valid images in corpus %s\n", corpus );
+                exit(EXIT_FAILURE);
+        }
+
+        bench_begin( &result, "draw" );
+        file_list = bench_draw( &result, file_list, &sdl_pointers, 0 );
+        bench_report( &result, json, 0 );
+
+        bench_begin( &result, "draw_paced" );
+        file_list = bench_draw( &result, file_list, &sdl_pointers, BENCH_DWELL_MS );
+        bench_report( &result, json, 0 );
+
+        bench_begin( &result, "sel_resize" );
+        bench_begin( &sanitize, "sel_sanitize" );
+        bench_selection( &result, &sanitize, file_list );
+        bench_report( &result, json, 0 );
+        bench_report( &sanitize, json, 0 );
+
+        bench_begin( &result, "crop_save" );
+        bench_crop( &result, file_list, aspect );
+        bench_report( &result, json, 0 );
+
+        bench_begin( &result, "wp_minsize" );
+        bench_minsize( &result, minsize, corpus, entries );
+        bench_report( &result, json, 0 );
+
+        fprintf( json, "\n  ]\n}\n" );
+        fclose( json );
+        fprintf( stderr, "wp_bench: results written to %s\n", output );
+
+        /*
+         * Free memory, close subsystems and exit.
+         */
+
+        save_terminate();
+        validate_terminate();
+        prefetch_terminate();
+        trace_terminate();
+        for( int id = 0; id < table_count(); id++ ) image_free( table_get( id )->image );
+        table_terminate();
+        cache_terminate();
+        SDL_DestroyRenderer( sdl_pointers.renderer );
+        SDL_DestroyWindow( sdl_pointers.window );
+        SDL_Quit();
+        free( corpus );
+        MagickWandTerminus();
+        exit(EXIT_SUCCESS);
+}
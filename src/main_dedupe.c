@@ -0,0 +1,368 @@
+/*
+ * =====================================================================================================================
+ * See LICENSE file for copyright and license details.
+ *
+ * wp_dedupe: Find near-duplicate images by perceptual hash
+ * =====================================================================================================================
+ */
+
+#include <unistd.h>
+#include "data_structures.h"
+#include "config.h"
+#include "file_list.h"
+#include "index.h"
+#include "phash.h"
+#include "probe.h"
+#include "scan.h"
+#include "table.h"
+#include "trace.h"
+#include "wand/magick_wand.h"
+
+/*
+ * Multi-index hashing: every hash is split into DEDUPE_TABLES substrings of DEDUPE_SUB_BITS bits, each with
+ * a table of its own. Two hashes within distance r differ in at most r / DEDUPE_TABLES bits of some
+ * substring, so looking up every substring within that many bits finds all of them, and little else.
+ */
+#define DEDUPE_TABLES 4
+#define DEDUPE_SUB_BITS 16
+
+/* A hash shared by one or more entries. */
+struct dedupe_item {
+        Uint64 hash;
+        int entry;              /* Index into DEDUPE_WORK entries */
+};
+
+/* The distinct hashes, their lookup tables and the groups they have been joined into so far. */
+struct dedupe_index {
+        Uint64 * hashes;
+        int count;
+        int * offsets[DEDUPE_TABLES];   /* Start of each substring value's run in 'members' */
+        int * members[DEDUPE_TABLES];   /* Indices into 'hashes', ordered by substring value */
+        int * parent;                   /* Union-find forest over 'hashes' */
+        int radius;
+};
+
+static void print_dedupe_usage( char * argv[] ) {
+        printf( "dedupe %d.%d (www.subgeniuskitty.com)\n"
+                "Usage: %s [options] <source>\n"
+                "  source:      Directory containing images to be processed\n"
+                "Prints each group of near-duplicate images, highest resolution first, one group per paragraph.\n"
+                "Options:\n"
+                "  -d <bits>    Largest perceptual hash distance between duplicates, 0 to 64 (default: %d)\n"
+                "  -j <jobs>    Number of worker threads (default: one per CPU)\n"
+                "  -m           Machine-readable output: group, megapixels, width, height and path, tab separated\n"
+                , VER_MAJOR, VER_MINOR, argv[0], DEDUPE_RADIUS );
+}
+
+/*
+ * Each worker claims one entry at a time, reads its header if the index didn't know it yet, and hashes
+ * a reduced-scale decode of it.
+ */
+static int dedupe_worker( void * data ) {
+        DEDUPE_WORK * work = data;
+        int i;
+        trace_thread( "dedupe" );
+        while(( i = SDL_AtomicAdd( &work->next, 1 )) < work->count ) {
+                FILE_LIST * entry = work->entries[i];
+                if( probe_entry( entry )) continue;
+                Uint64 start = trace_begin();
+                if( phash_file( entry->path, entry->img_w, entry->img_h, &work->hashes[i] ) == 0 ) {
+                        work->hashed[i] = 1;
+                } else if( SGK_DEBUG ) {
+                        printf( "DEBUG: Unable to hash %s\n", entry->path );
+                }
+                trace_end( "phash", start, entry->id, -1 );
+        }
+        return 0;
+}
+
+static int compare_items( const void * a, const void * b ) {
+        const struct dedupe_item * ia = a;
+        const struct dedupe_item * ib = b;
+        if( ia->hash != ib->hash ) return ( ia->hash > ib->hash ) - ( ia->hash < ib->hash );
+        return ia->entry - ib->entry;
+}
+
+static Uint32 dedupe_substring( Uint64 hash, int table ) {
+        return ( hash >> ( table * DEDUPE_SUB_BITS )) & ( ( 1u << DEDUPE_SUB_BITS ) - 1 );
+}
+
+static int dedupe_root( int * parent, int i ) {
+        while( parent[i] != i ) {
+                parent[i] = parent[parent[i]];
+                i = parent[i];
+        }
+        return i;
+}
+
+/* Sorts the distinct hashes into one table per substring. Returns 1 if memory ran out, otherwise 0. */
+static int dedupe_build( struct dedupe_index * index ) {
+        for( int t = 0; t < DEDUPE_TABLES; t++ ) {
+                index->offsets[t] = calloc( ( 1 << DEDUPE_SUB_BITS ) + 1, sizeof( int ));
+                index->members[t] = malloc( ( index->count > 0 ? index->count : 1 ) * sizeof( int ));
+                if( index->offsets[t] == NULL || index->members[t] == NULL ) return 1;
+
+                /* Counting sort: count each value, turn the counts into starts, then place every hash. */
+                int * offsets = index->offsets[t];
+                for( int k = 0; k < index->count; k++ ) offsets[dedupe_substring( index->hashes[k], t ) + 1] += 1;
+                for( int v = 0; v < ( 1 << DEDUPE_SUB_BITS ); v++ ) offsets[v + 1] += offsets[v];
+                for( int k = 0; k < index->count; k++ ) {
+                        Uint32 v = dedupe_substring( index->hashes[k], t );
+                        index->members[t][offsets[v]++] = k;
+                }
+                /* Placing moved every start to the next one's; shift them back. */
+                for( int v = 1 << DEDUPE_SUB_BITS; v > 0; v-- ) offsets[v] = offsets[v - 1];
+                offsets[0] = 0;
+        }
+        return 0;
+}
+
+/*
+ * Joins hash 'k' with every later hash within the radius whose substring in 'table' is 'value', then
+ * recurses into the values flipping up to 'flips' more bits, each above bit 'from'.
+ */
+static void dedupe_search( struct dedupe_index * index, int k, int table, Uint32 value, int from, int flips ) {
+        int * offsets = index->offsets[table];
+        for( int o = offsets[value]; o < offsets[value + 1]; o++ ) {
+                int m = index->members[table][o];
+                if( m <= k || phash_distance( index->hashes[k], index->hashes[m] ) > index->radius ) continue;
+                int root_k = dedupe_root( index->parent, k );
+                int root_m = dedupe_root( index->parent, m );
+                if( root_k < root_m ) index->parent[root_m] = root_k;
+                if( root_m < root_k ) index->parent[root_k] = root_m;
+        }
+        if( flips == 0 ) return;
+        for( int bit = from; bit < DEDUPE_SUB_BITS; bit++ ) {
+                dedupe_search( index, k, table, value ^ ( 1u << bit ), bit + 1, flips - 1 );
+        }
+}
+
+static double megapixels( FILE_LIST * entry ) {
+        return ( (double) entry->img_w * (double) entry->img_h ) / 1000000.0;
+}
+
+/* Prints one member of duplicate group number 'group', indented unless it is the one to keep. */
+static void print_entry( FILE_LIST * entry, int group, int machine, int duplicate ) {
+        if( machine ) {
+                printf( "%d\t%.6f\t%d\t%d\t%s\n", group, megapixels( entry ), entry->img_w, entry->img_h, entry->path );
+        } else {
+                printf( "%s%s (%dx%d)\n", duplicate ? "\t" : "", entry->path, entry->img_w, entry->img_h );
+        }
+}
+
+int main( int argc, char * argv[] ) {
+
+        /*
+         * Command line options
+         */
+
+        int radius = DEDUPE_RADIUS;
+        int jobs = SDL_GetCPUCount();
+        int machine = 0;
+        int opt;
+        while(( opt = getopt( argc, argv, "d:j:m" )) != -1 ) {
+                switch( opt ) {
+                        case 'd':
+                                radius = atoi( optarg );
+                                break;
+                        case 'j':
+                                jobs = atoi( optarg );
+                                break;
+                        case 'm':
+                                machine = 1;
+                                break;
+                        default:
+                                print_dedupe_usage( argv );
+                                exit(EXIT_FAILURE);
+                }
+        }
+        if( argc - optind != 1 || radius < 0 || radius > 64 ) {
+                print_dedupe_usage( argv );
+                exit(EXIT_FAILURE);
+        }
+        if( jobs < 1 ) jobs = 1;
+
+        /*
+         * Variables/Initialization
+         */
+
+        /* Before any scan or worker thread exists. */
+        if( trace_init() ) exit(EXIT_FAILURE);
+        Uint32 start_ticks = SDL_GetTicks();
+        char * path = sanitize_path( argv[optind] );
+        if( path == NULL ) {
+                fprintf( stderr, "ERROR: Unable to open source directory: %s\n", argv[optind] );
+                exit(EXIT_FAILURE);
+        }
+        if( table_init() ) exit(EXIT_FAILURE);
+        FILE_LIST * file_list = build_file_list( path, 1.0 );
+        /* Files unchanged since the last run (of any of the programs) need not be probed again. */
+        INDEX * index = index_load( path, 0.0 );
+        file_list = index_apply( index, file_list );
+        free(path);
+        if( file_list == NULL ) {
+                index_free( index );
+                trace_terminate();
+                exit(EXIT_SUCCESS);
+        }
+
+        /* Flatten the ring into an array so workers can claim entries by index. */
+        DEDUPE_WORK work;
+        work.count = 0;
+        FILE_LIST * current = file_list;
+        do {
+                work.count += 1;
+                current = current->next;
+        } while( current != file_list );
+        work.entries = malloc( work.count * sizeof( FILE_LIST * ) );
+        work.hashes = calloc( work.count, sizeof( Uint64 ) );
+        work.hashed = calloc( work.count, sizeof( Uint8 ) );
+        if( work.entries == NULL || work.hashes == NULL || work.hashed == NULL ) {
+                fprintf( stderr, "ERROR: Unable to malloc for list of entries.\n" );
+                exit(EXIT_FAILURE);
+        }
+        for( int i = 0; i < work.count; i++ ) {
+                work.entries[i] = current;
+                current = current->next;
+        }
+        SDL_AtomicSet( &work.next, 0 );
+
+        /* ImageMagick is only needed to ping formats the header parser doesn't recognize. */
+        MagickWandGenesis();
+
+        /*
+         * Hash every entry in parallel
+         */
+
+        if( jobs > work.count ) jobs = work.count;
+        SDL_Thread ** workers = malloc( jobs * sizeof( SDL_Thread * ) );
+        if( workers == NULL ) {
+                fprintf( stderr, "ERROR: Unable to malloc for worker threads.\n" );
+                exit(EXIT_FAILURE);
+        }
+        for( int i = 0; i < jobs; i++ ) {
+                workers[i] = SDL_CreateThread( dedupe_worker, "dedupe", &work );
+                if( workers[i] == NULL ) {
+                        /* Carry on with however many threads we got; this thread helps out below. */
+                        fprintf( stderr, "WARN: Unable to create worker thread: %s\n", SDL_GetError() );
+                }
+        }
+        dedupe_worker( &work );
+        for( int i = 0; i < jobs; i++ ) {
+                if( workers[i] != NULL ) SDL_WaitThread( workers[i], NULL );
+        }
+        free( workers );
+
+        /*
+         * Group near duplicates. Entries with the very same hash are grouped by sorting, so only
+         * distinct hashes go through the tables.
+         */
+
+        struct dedupe_item * items = malloc( ( work.count > 0 ? work.count : 1 ) * sizeof( struct dedupe_item ) );
+        int * distinct = malloc( work.count * sizeof( int ) );  /* Distinct hash of each entry, or -1 */
+        struct dedupe_index dedupe;
+        memset( &dedupe, 0, sizeof( dedupe ));
+        dedupe.hashes = malloc( ( work.count > 0 ? work.count : 1 ) * sizeof( Uint64 ) );
+        dedupe.parent = malloc( ( work.count > 0 ? work.count : 1 ) * sizeof( int ) );
+        dedupe.radius = radius;
+        if( items == NULL || distinct == NULL || dedupe.hashes == NULL || dedupe.parent == NULL ) {
+                fprintf( stderr, "ERROR: Unable to malloc for hash tables.\n" );
+                exit(EXIT_FAILURE);
+        }
+        int hashed = 0;
+        for( int i = 0; i < work.count; i++ ) {
+                distinct[i] = -1;
+                if( ! work.hashed[i] ) continue;
+                items[hashed].hash = work.hashes[i];
+                items[hashed].entry = i;
+                hashed += 1;
+        }
+        qsort( items, hashed, sizeof( struct dedupe_item ), compare_items );
+        for( int i = 0; i < hashed; i++ ) {
+                if( i == 0 || items[i].hash != items[i - 1].hash ) {
+                        dedupe.hashes[dedupe.count] = items[i].hash;
+                        dedupe.parent[dedupe.count] = dedupe.count;
+                        dedupe.count += 1;
+                }
+                distinct[items[i].entry] = dedupe.count - 1;
+        }
+        free( items );
+
+        if( dedupe_build( &dedupe )) {
+                fprintf( stderr, "ERROR: Unable to malloc for hash tables.\n" );
+                exit(EXIT_FAILURE);
+        }
+        for( int k = 0; k < dedupe.count; k++ ) {
+                for( int t = 0; t < DEDUPE_TABLES; t++ ) {
+                        dedupe_search( &dedupe, k, t, dedupe_substring( dedupe.hashes[k], t ), 0, radius / DEDUPE_TABLES );
+                }
+        }
+
+        /*
+         * Print every group of two or more, its highest resolution member first and the rest in list order.
+         */
+
+        int * size = calloc( dedupe.count > 0 ? dedupe.count : 1, sizeof( int ) );      /* Entries per group root */
+        int * best = malloc( ( dedupe.count > 0 ? dedupe.count : 1 ) * sizeof( int ) ); /* Largest entry per root */
+        int * next = malloc( work.count * sizeof( int ) );      /* Next entry of the same group, or -1 */
+        int * first = malloc( ( dedupe.count > 0 ? dedupe.count : 1 ) * sizeof( int ) );/* First entry per root */
+        if( size == NULL || best == NULL || next == NULL || first == NULL ) {
+                fprintf( stderr, "ERROR: Unable to malloc for duplicate groups.\n" );
+                exit(EXIT_FAILURE);
+        }
+        for( int k = 0; k < dedupe.count; k++ ) {
+                best[k] = -1;
+                first[k] = -1;
+        }
+        /* Walk backwards, so each group's chain ends up in list order and ties go to the earliest entry. */
+        for( int i = work.count - 1; i >= 0; i-- ) {
+                next[i] = -1;
+                if( distinct[i] < 0 ) continue;
+                int root = dedupe_root( dedupe.parent, distinct[i] );
+                next[i] = first[root];
+                first[root] = i;
+                size[root] += 1;
+                if( best[root] < 0 || megapixels( work.entries[i] ) >= megapixels( work.entries[best[root]] )) best[root] = i;
+        }
+
+        int groups = 0;
+        int duplicates = 0;
+        for( int i = 0; i < work.count; i++ ) {
+                if( distinct[i] < 0 ) continue;
+                int root = dedupe_root( dedupe.parent, distinct[i] );
+                if( size[root] < 2 || first[root] != i ) continue;
+                groups += 1;
+                duplicates += size[root] - 1;
+                if( ! machine && groups > 1 ) printf( "\n" );
+                print_entry( work.entries[best[root]], groups, machine, 0 );
+                for( int j = i; j >= 0; j = next[j] ) {
+                        if( j != best[root] ) print_entry( work.entries[j], groups, machine, 1 );
+                }
+        }
+        fprintf( stderr, "wp_dedupe: %d of %d files hashed, %d groups holding %d duplicates -- %.1f s\n", hashed,
+                        work.count, groups, duplicates, ( SDL_GetTicks() - start_ticks ) / 1000.0 );
+
+        /*
+         * Free memory, close subsystems and exit.
+         */
+
+        index_save( index, file_list );
+        index_free( index );
+        for( int t = 0; t < DEDUPE_TABLES; t++ ) {
+                free( dedupe.offsets[t] );
+                free( dedupe.members[t] );
+        }
+        free( dedupe.hashes );
+        free( dedupe.parent );
+        free( size );
+        free( best );
+        free( next );
+        free( first );
+        free( distinct );
+        free( work.entries );
+        free( work.hashes );
+        free( work.hashed );
+        trace_terminate();
+        MagickWandTerminus();
+        exit(EXIT_SUCCESS);
+}
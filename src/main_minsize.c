@@ -6,59 +6,200 @@
  * =====================================================================================================================
  */
 
+#include <unistd.h>
 #include "data_structures.h"
 #include "config.h"
-#include "file_io.h"
+#include "file_list.h"
+#include "index.h"
+#include "probe.h"
+#include "scan.h"
+#include "table.h"
+#include "trace.h"
 #include "wand/magick_wand.h"
 
+static void print_minsize_usage( char * argv[] ) {
+        printf( "min_size %d.%d (www.subgeniuskitty.com)\n"
+                "Usage: %s [options] <source> <size>\n"
+                "  source:      Directory containing images to be processed\n"
+                "    size:      Minimum acceptable image size, in megapixels, as a float\n"
+                "               Images smaller than this are printed. Use a large size to list every image.\n"
+                "Options:\n"
+                "  -s           Sort by pixel count, smallest first\n"
+                "  -r           Sort by pixel count, largest first\n"
+                "  -k <count>   Print at most <count> images (with -s or -r, the bottom-K or top-K)\n"
+                "  -j <jobs>    Number of worker threads (default: one per CPU)\n"
+                "  -m           Machine-readable output: megapixels, width, height and path, tab separated\n"
+                , VER_MAJOR, VER_MINOR, argv[0] );
+}
+
+/*
+ * Each worker claims one entry at a time and probes its header, so memory per worker stays constant
+ * no matter how large the directory or the images are.
+ */
+static int minsize_worker( void * data ) {
+        MINSIZE_WORK * work = data;
+        int i;
+        trace_thread( "minsize" );
+        while(( i = SDL_AtomicAdd( &work->next, 1 )) < work->count ) {
+                probe_entry( work->entries[i] );
+        }
+        return 0;
+}
+
+static double megapixels( FILE_LIST * entry ) {
+        return ( (double) entry->img_w * (double) entry->img_h ) / 1000000.0;
+}
+
+static int compare_ascending( const void * a, const void * b ) {
+        double size_a = megapixels( *(FILE_LIST **) a );
+        double size_b = megapixels( *(FILE_LIST **) b );
+        return ( size_a > size_b ) - ( size_a < size_b );
+}
+
+static int compare_descending( const void * a, const void * b ) {
+        return compare_ascending( b, a );
+}
+
 int main( int argc, char * argv[] ) {
 
-        if( argc != 3 ) {
-                printf( "min_size %d.%d (www.subgeniuskitty.com)\n"
-                        "Usage: %s <source> <size>\n"
-                        "  source:      Directory containing images to be processed\n"
-                        "    size:      Minimum acceptable image size, in megapixels, as a float\n"
-                        , VER_MAJOR, VER_MINOR, argv[0] );
+        /*
+         * Command line options
+         */
+
+        int sort = 0;           /* 0 for list order, 1 for ascending, -1 for descending */
+        int limit = -1;         /* Maximum number of results to print, or -1 for no limit */
+        int jobs = SDL_GetCPUCount();
+        int machine = 0;
+        int opt;
+        while(( opt = getopt( argc, argv, "srk:j:m" )) != -1 ) {
+                switch( opt ) {
+                        case 's':
+                                sort = 1;
+                                break;
+                        case 'r':
+                                sort = -1;
+                                break;
+                        case 'k':
+                                limit = atoi( optarg );
+                                break;
+                        case 'j':
+                                jobs = atoi( optarg );
+                                break;
+                        case 'm':
+                                machine = 1;
+                                break;
+                        default:
+                                print_minsize_usage( argv );
+                                exit(EXIT_FAILURE);
+                }
+        }
+        if( argc - optind != 2 ) {
+                print_minsize_usage( argv );
                 exit(EXIT_FAILURE);
         }
+        if( jobs < 1 ) jobs = 1;
 
         /*
          * Variables/Initialization
          */
 
-        double min_size = strtof( argv[2], NULL );
-        char * path = sanitize_path( argv[1] );
+        /* Before any scan or worker thread exists. */
+        if( trace_init() ) exit(EXIT_FAILURE);
+        double min_size = strtof( argv[optind+1], NULL );
+        char * path = sanitize_path( argv[optind] );
+        if( path == NULL ) {
+                fprintf( stderr, "ERROR: Unable to open source directory: %s\n", argv[optind] );
+                exit(EXIT_FAILURE);
+        }
+        if( table_init() ) exit(EXIT_FAILURE);
         FILE_LIST * file_list = build_file_list( path, 1.0 );
+        /* Files unchanged since the last run (of either program) need not be probed again. */
+        INDEX * index = index_load( path, 0.0 );
+        file_list = index_apply( index, file_list );
         free(path);
-        FILE_LIST * last_element = file_list->prev;
-        MagickBooleanType status;
-        int w, h;
-        double img_size;
+        if( file_list == NULL ) {
+                index_free( index );
+                trace_terminate();
+                exit(EXIT_SUCCESS);
+        }
+
+        /* Flatten the ring into an array so workers can claim entries by index. */
+        MINSIZE_WORK work;
+        work.count = 0;
+        FILE_LIST * current = file_list;
+        do {
+                work.count += 1;
+                current = current->next;
+        } while( current != file_list );
+        work.entries = malloc( work.count * sizeof( FILE_LIST * ) );
+        if( work.entries == NULL ) {
+                fprintf( stderr, "ERROR: Unable to malloc for list of entries.\n" );
+                exit(EXIT_FAILURE);
+        }
+        for( int i = 0; i < work.count; i++ ) {
+                work.entries[i] = current;
+                current = current->next;
+        }
+        SDL_AtomicSet( &work.next, 0 );
+
+        /* ImageMagick is only needed to ping formats the header parser doesn't recognize. */
         MagickWandGenesis();
-        MagickWand * wand = NewMagickWand();
 
         /*
-         * Main program loop
+         * Probe every entry in parallel
          */
 
-        while( file_list != last_element ) {
-                status = MagickReadImage( wand, file_list->path );
-                if( status == MagickTrue ) {
-                        w = MagickGetImageWidth( wand );
-                        h = MagickGetImageHeight( wand );
-                        img_size = (w * h) / 1000000.0;
-                        if( img_size < min_size ) {
-                                printf( "%s\n", file_list->path );
-                        }
+        if( jobs > work.count ) jobs = work.count;
+        SDL_Thread ** workers = malloc( jobs * sizeof( SDL_Thread * ) );
+        if( workers == NULL ) {
+                fprintf( stderr, "ERROR: Unable to malloc for worker threads.\n" );
+                exit(EXIT_FAILURE);
+        }
+        for( int i = 0; i < jobs; i++ ) {
+                workers[i] = SDL_CreateThread( minsize_worker, "minsize", &work );
+                if( workers[i] == NULL ) {
+                        /* Carry on with however many threads we got; this thread helps out below. */
+                        fprintf( stderr, "WARN: Unable to create worker thread: %s\n", SDL_GetError() );
+                }
+        }
+        minsize_worker( &work );
+        for( int i = 0; i < jobs; i++ ) {
+                if( workers[i] != NULL ) SDL_WaitThread( workers[i], NULL );
+        }
+        free( workers );
+
+        /*
+         * Filter, sort and print
+         */
+
+        int matches = 0;
+        for( int i = 0; i < work.count; i++ ) {
+                FILE_LIST * entry = work.entries[i];
+                if( entry->format != format_none && megapixels( entry ) < min_size ) {
+                        work.entries[matches++] = entry;
+                }
+        }
+        if( sort == 1 ) qsort( work.entries, matches, sizeof( FILE_LIST * ), compare_ascending );
+        if( sort == -1 ) qsort( work.entries, matches, sizeof( FILE_LIST * ), compare_descending );
+        if( limit >= 0 && limit < matches ) matches = limit;
+
+        for( int i = 0; i < matches; i++ ) {
+                FILE_LIST * entry = work.entries[i];
+                if( machine ) {
+                        printf( "%.6f\t%d\t%d\t%s\n", megapixels( entry ), entry->img_w, entry->img_h, entry->path );
+                } else {
+                        printf( "%s\n", entry->path );
                 }
-                file_list = file_list->next;
         }
 
         /*
          * Free memory, close subsystems and exit.
          */
-        
-        DestroyMagickWand( wand );
+
+        index_save( index, file_list );
+        index_free( index );
+        free( work.entries );
+        trace_terminate();
         MagickWandTerminus();
         exit(EXIT_SUCCESS);
 }
@@ -9,6 +9,7 @@
 #include "data_structures.h"
 #include "startup_shutdown.h"
 #include "misc.h"
+#include "ui.h"
 
 #include "SDL.h"
 
@@ -18,7 +19,7 @@ int main( int argc, char * argv[] ) {
          */
 
         /* The init_pointers struct is only intended to keep main() clean. */
-        INIT_POINTERS init_pointers = {NULL, NULL, NULL};
+        INIT_POINTERS init_pointers = {NULL, NULL, NULL, NULL};
         /* Initializes everything that needs it. */
         initialize( &init_pointers, argc, argv );
         /* Contains sanitized and typed command line arguments. */
@@ -27,6 +28,8 @@ int main( int argc, char * argv[] ) {
         FILE_LIST * file_list = init_pointers.file_list;
         /* Contains window, renderer and texture pointers for SDL. */
         SDL_POINTERS * sdl_pointers = init_pointers.sdl_pointers;
+        /* Metadata cached between runs. */
+        INDEX * index = init_pointers.index;
 
         // TODO: Draw first element. Make sure a valid element actually exists. Perhaps put this in the init section?
         //       Consider using SDL_PushEvent() to push a '->' arrow key press onto the event queue.
@@ -40,12 +43,20 @@ int main( int argc, char * argv[] ) {
         SDL_Event event;
         while( quit == 0 ) {
                 if( SDL_WaitEvent( &event ) ) {
-                        temp = process_sdl_event( &event, file_list, sdl_pointers, cmd_line_args );
-                        if( temp == NULL ) {
-                                quit = 1;
-                        } else {
-                                file_list = temp;
-                        }
+                        /* 
+                         * Drain everything already queued before painting. A burst of KEY_NEXT repeats only
+                         * steps over header-checked entries, and a storm of window events collapses into 
+                         * one repaint, so only the image the cursor lands on is ever decoded.
+                         */
+                        do {
+                                temp = process_sdl_event( &event, file_list, sdl_pointers, cmd_line_args );
+                                if( temp == NULL ) {
+                                        quit = 1;
+                                } else {
+                                        file_list = temp;
+                                }
+                        } while( quit == 0 && SDL_PollEvent( &event ) );
+                        if( quit == 0 ) file_list = repaint( file_list, sdl_pointers );
                 }
         }
 
@@ -54,6 +65,6 @@ int main( int argc, char * argv[] ) {
          * Free memory, close subsystems and exit.
          */
 
-        terminate( cmd_line_args, file_list, sdl_pointers );
+        terminate( cmd_line_args, file_list, sdl_pointers, index );
         exit(EXIT_SUCCESS);
 }
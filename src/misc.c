@@ -6,6 +6,11 @@
 #include "ui.h"
 #include "file_io.h"
 #include "selection_box.h"
+#include "save.h"
+#include "scan.h"
+#include "view.h"
+#include "validate.h"
+#include "watch.h"
 #include "misc.h"
 
 void print_usage( char * argv[] ) {
@@ -26,17 +31,46 @@ FILE_LIST * process_sdl_event( SDL_Event * event, FILE_LIST * file_list,
                         file_list = NULL;
                         break;
                 case SDL_WINDOWEVENT:
-                        if( event->window.event == SDL_WINDOWEVENT_SHOWN
-                                || event->window.event == SDL_WINDOWEVENT_EXPOSED
-                                || event->window.event == SDL_WINDOWEVENT_MOVED
-                                || event->window.event == SDL_WINDOWEVENT_RESIZED
+                        /* Only a new window size needs the image layer again. Anything else just recomposites. */
+                        if( event->window.event == SDL_WINDOWEVENT_RESIZED
                                 || event->window.event == SDL_WINDOWEVENT_MAXIMIZED
                                 || event->window.event == SDL_WINDOWEVENT_RESTORED
                                 ) {
-                                file_list = draw( none, file_list, sdl_pointers );
+                                sdl_pointers->damage |= damage_image;
+                        } else if( event->window.event == SDL_WINDOWEVENT_SHOWN
+                                || event->window.event == SDL_WINDOWEVENT_EXPOSED
+                                || event->window.event == SDL_WINDOWEVENT_MOVED
+                                ) {
+                                sdl_pointers->damage |= damage_overlay;
+                        }
+                        break;
+                case SDL_TEXTINPUT:
+                        if( prompt_is_open() ) {
+                                prompt_edit( event->text.text );
+                                update_titlebar( file_list, sdl_pointers );
                         }
                         break;
                 case SDL_KEYDOWN:
+                        if( prompt_is_open() ) {
+                                /* Keys edit the jump text instead of acting, so typing a 'q' doesn't quit. */
+                                switch( event->key.keysym.sym ) {
+                                        case SDLK_RETURN:
+                                        case SDLK_KP_ENTER:
+                                                file_list = jump( file_list, view_jump_text( file_list, prompt_close() ), 
+                                                                sdl_pointers );
+                                                sdl_pointers->damage |= damage_overlay;
+                                                break;
+                                        case SDLK_ESCAPE:
+                                                prompt_close();
+                                                sdl_pointers->damage |= damage_overlay;
+                                                break;
+                                        case SDLK_BACKSPACE:
+                                                prompt_edit( NULL );
+                                                update_titlebar( file_list, sdl_pointers );
+                                                break;
+                                }
+                                break;
+                        }
                         switch( event->key.keysym.sym ) {
                                 case KEY_QUIT:
                                         file_list = NULL;
@@ -44,48 +78,79 @@ FILE_LIST * process_sdl_event( SDL_Event * event, FILE_LIST * file_list,
                                 case KEY_HELP:
                                         break;
                                 case KEY_SAVE:
-                                        crop_save( file_list, cmd_line_args );
+                                        save_submit( file_list, cmd_line_args );
+                                        update_titlebar( file_list, sdl_pointers );
                                         break;
                                 case KEY_UNDO:
-                                        del_img( file_list, cmd_line_args );
+                                        save_delete( file_list, cmd_line_args );
+                                        update_titlebar( file_list, sdl_pointers );
                                         break;
                                 case KEY_NEXT:
-                                        file_list = draw( right, file_list, sdl_pointers );
+                                        file_list = step( right, file_list, sdl_pointers );
                                         break;
                                 case KEY_PREV:
-                                        file_list = draw( left, file_list, sdl_pointers );
+                                        file_list = step( left, file_list, sdl_pointers );
                                         break;
                                 case KEY_SIZEUP:
                                         sel_resize( up, file_list );
-                                        file_list = draw( none, file_list, sdl_pointers );
+                                        sdl_pointers->damage |= damage_overlay;
                                         break;
                                 case KEY_SIZEDOWN:
                                         sel_resize( down, file_list );
-                                        file_list = draw( none, file_list, sdl_pointers );
+                                        sdl_pointers->damage |= damage_overlay;
                                         break;
                                 case KEY_LEFT:
                                         sel_move( left, file_list );
-                                        file_list = draw( none, file_list, sdl_pointers );
+                                        sdl_pointers->damage |= damage_overlay;
                                         break;
                                 case KEY_RIGHT:
                                         sel_move( right, file_list );
-                                        file_list = draw( none, file_list, sdl_pointers );
+                                        sdl_pointers->damage |= damage_overlay;
                                         break;
                                 case KEY_UP:
                                         sel_move( up, file_list );
-                                        file_list = draw( none, file_list, sdl_pointers );
+                                        sdl_pointers->damage |= damage_overlay;
                                         break;
                                 case KEY_DOWN:
                                         sel_move( down, file_list );
-                                        file_list = draw( none, file_list, sdl_pointers );
+                                        sdl_pointers->damage |= damage_overlay;
                                         break;
                                 case KEY_SELECTIONBOX_RESET:
                                         reset_sel_box( file_list );
-                                        file_list = draw( none, file_list, sdl_pointers );
+                                        sdl_pointers->damage |= damage_overlay;
+                                        break;
+                                case KEY_SORT:
+                                        file_list = jump( file_list, view_apply( file_list, 
+                                                                ( view_sort() + 1 ) % sort_count, view_filter() ), sdl_pointers );
+                                        sdl_pointers->damage |= damage_overlay;
+                                        break;
+                                case KEY_FILTER:
+                                        file_list = jump( file_list, view_apply( file_list, 
+                                                                view_sort(), ( view_filter() + 1 ) % filter_count ), sdl_pointers );
+                                        sdl_pointers->damage |= damage_overlay;
+                                        break;
+                                case KEY_JUMP:
+                                        prompt_open();
+                                        /* The key's own character is already queued as text. Don't let it in. */
+                                        SDL_FlushEvent( SDL_TEXTINPUT );
+                                        update_titlebar( file_list, sdl_pointers );
+                                        break;
+                                case KEY_FIRST:
+                                        file_list = jump( file_list, view_jump( file_list, 0 ), sdl_pointers );
+                                        break;
+                                case KEY_LAST:
+                                        file_list = jump( file_list, view_jump( file_list, view_count() - 1 ), sdl_pointers );
+                                        break;
+                                case KEY_SKIP:
+                                        file_list = jump( file_list, view_jump_unprocessed( file_list ), sdl_pointers );
                                         break;
                                 case KEY_TOGGLE_OUTLINE_COLOR:
-                                        toggle_selection_color( file_list );
-                                        file_list = draw( none, file_list, sdl_pointers );
+                                        toggle_selection_color( sdl_pointers );
+                                        sdl_pointers->damage |= damage_overlay;
+                                        break;
+                                case KEY_HUD:
+                                        sdl_pointers->hud = ! sdl_pointers->hud;
+                                        sdl_pointers->damage |= damage_overlay;
                                         break;
                                 default:
                                         // TODO: Should I display help if unrecognized key is pressed?
@@ -94,6 +159,25 @@ FILE_LIST * process_sdl_event( SDL_Event * event, FILE_LIST * file_list,
                         }
                         break;
                 default:
+                        if( event->type == save_event_type() ) {
+                                /* A background save finished. The overlay counts queued saves, too. */
+                                update_titlebar( file_list, sdl_pointers );
+                                if( sdl_pointers->hud ) sdl_pointers->damage |= damage_overlay;
+                        } else if( event->type == scan_event_type() ) {
+                                /* The directory scan found more files, or finished. New files join the end of the view. */
+                                file_list = view_add( file_list, scan_take( 0 ) );
+                                file_list = apply_changes( file_list, sdl_pointers );
+                                update_titlebar( file_list, sdl_pointers );
+                        } else if( event->type == watch_event_type() ) {
+                                /* Files in the source tree were written, moved or deleted. */
+                                file_list = apply_changes( file_list, sdl_pointers );
+                                update_titlebar( file_list, sdl_pointers );
+                        } else if( event->type == validate_event_type() ) {
+                                /* Headers near the cursor were checked. Drop the broken files and look further out. */
+                                validate_collect( file_list );
+                                file_list = view_settle( file_list );
+                                validate_update( file_list );
+                        }
                         /* Ignore all other SDL events. */
                         break;
         }
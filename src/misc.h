@@ -10,6 +10,7 @@ void print_usage( char * argv[] );
 
 /* 
  * Processes a single SDL event (user command), initiating whatever action the event requires.
+ * Screen updates are only recorded as damage in 'sdl_pointers'; the caller repaint()s once the queue is drained.
  * Returns NULL if program should terminate, otherwise returns FILE_LIST* to most current file_list.
  */
 FILE_LIST * process_sdl_event( SDL_Event * event, FILE_LIST * file_list, 
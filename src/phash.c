@@ -0,0 +1,125 @@
+/* See LICENSE file for copyright and license details. */
+
+#include <math.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "SDL.h"
+#include "wand/magick_wand.h"
+#include "data_structures.h"
+#include "config.h"
+#include "image.h"
+#include "scale.h"
+#include "phash.h"
+
+/*
+ * The hash is taken from the PHASH_BITS x PHASH_BITS frequencies just above the lowest of a
+ * PHASH_SIZE point DCT, so only PHASH_BITS rows of the DCT matrix are ever needed.
+ */
+#define PHASH_SIZE 32
+#define PHASH_BITS 8
+
+/* Fills 'dct' with rows 1 to PHASH_BITS of the orthonormal DCT-II matrix. Cheap next to any decode. */
+static void phash_dct( float dct[PHASH_BITS][PHASH_SIZE] ) {
+        for( int u = 0; u < PHASH_BITS; u++ ) {
+                for( int i = 0; i < PHASH_SIZE; i++ ) {
+                        dct[u][i] = sqrt( 2.0 / PHASH_SIZE ) * cos( M_PI * ( u + 1 ) * ( 2 * i + 1 ) / ( 2.0 * PHASH_SIZE ));
+                }
+        }
+}
+
+/*
+ * Transforms the PHASH_SIZE x PHASH_SIZE 'gray' pixels into the 'out' frequencies: first every column
+ * against each DCT row, then each of those against every DCT row again.
+ */
+static void phash_transform( float gray[PHASH_SIZE][PHASH_SIZE], float out[PHASH_BITS][PHASH_BITS] ) {
+        float dct[PHASH_BITS][PHASH_SIZE];
+        phash_dct( dct );
+
+        float cols[PHASH_BITS][PHASH_SIZE];
+        for( int u = 0; u < PHASH_BITS; u++ ) {
+                int j = 0;
+#ifdef __SSE2__
+                for( ; j < PHASH_SIZE; j += 4 ) {
+                        __m128 sum = _mm_setzero_ps();
+                        for( int i = 0; i < PHASH_SIZE; i++ ) {
+                                sum = _mm_add_ps( sum, _mm_mul_ps( _mm_set1_ps( dct[u][i] ), _mm_loadu_ps( &gray[i][j] )));
+                        }
+                        _mm_storeu_ps( &cols[u][j], sum );
+                }
+#endif
+                for( ; j < PHASH_SIZE; j++ ) {
+                        float sum = 0.0f;
+                        for( int i = 0; i < PHASH_SIZE; i++ ) sum += dct[u][i] * gray[i][j];
+                        cols[u][j] = sum;
+                }
+        }
+
+        for( int u = 0; u < PHASH_BITS; u++ ) {
+                for( int v = 0; v < PHASH_BITS; v++ ) {
+#ifdef __SSE2__
+                        __m128 sum = _mm_setzero_ps();
+                        for( int j = 0; j < PHASH_SIZE; j += 4 ) {
+                                sum = _mm_add_ps( sum, _mm_mul_ps( _mm_loadu_ps( &cols[u][j] ), _mm_loadu_ps( &dct[v][j] )));
+                        }
+                        float lanes[4];
+                        _mm_storeu_ps( lanes, sum );
+                        out[u][v] = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+#else
+                        float sum = 0.0f;
+                        for( int j = 0; j < PHASH_SIZE; j++ ) sum += cols[u][j] * dct[v][j];
+                        out[u][v] = sum;
+#endif
+                }
+        }
+}
+
+static int phash_compare( const void * a, const void * b ) {
+        float fa = *(const float *) a;
+        float fb = *(const float *) b;
+        return ( fa > fb ) - ( fa < fb );
+}
+
+int phash_file( char * path, int w, int h, Uint64 * hash ) {
+        if( w < PHASH_SIZE || h < PHASH_SIZE ) return 1;
+
+        /* Decode just large enough that the short side still covers PHASH_SIZE pixels. */
+        int fit = (int) ceil( (double) PHASH_SIZE * ( w > h ? w : h ) / ( w < h ? w : h ));
+        IMAGE * image = image_load( path, fit, fit );
+        if( image == NULL ) return 1;
+        SDL_Surface * small = NULL;
+        if( image->surface->w >= PHASH_SIZE && image->surface->h >= PHASH_SIZE ) {
+                small = scale_surface( image->surface, PHASH_SIZE, PHASH_SIZE );
+        }
+        image_free( image );
+        if( small == NULL ) return 1;
+
+        /* IMAGE_PIXELFORMAT is R,G,B,A in memory. */
+        float gray[PHASH_SIZE][PHASH_SIZE];
+        for( int y = 0; y < PHASH_SIZE; y++ ) {
+                unsigned char * px = (unsigned char *) small->pixels + (size_t) y * small->pitch;
+                for( int x = 0; x < PHASH_SIZE; x++, px += 4 ) {
+                        gray[y][x] = 0.299f * px[0] + 0.587f * px[1] + 0.114f * px[2];
+                }
+        }
+        SDL_FreeSurface( small );
+
+        float freq[PHASH_BITS][PHASH_BITS];
+        float sorted[PHASH_BITS * PHASH_BITS];
+        phash_transform( gray, freq );
+        memcpy( sorted, freq, sizeof( sorted ));
+        qsort( sorted, PHASH_BITS * PHASH_BITS, sizeof( float ), phash_compare );
+        float median = ( sorted[PHASH_BITS * PHASH_BITS / 2 - 1] + sorted[PHASH_BITS * PHASH_BITS / 2] ) / 2.0f;
+
+        *hash = 0;
+        for( int u = 0; u < PHASH_BITS; u++ ) {
+                for( int v = 0; v < PHASH_BITS; v++ ) {
+                        if( freq[u][v] > median ) *hash |= (Uint64) 1 << ( u * PHASH_BITS + v );
+                }
+        }
+        return 0;
+}
+
+int phash_distance( Uint64 a, Uint64 b ) {
+        return __builtin_popcountll( a ^ b );
+}
@@ -0,0 +1,20 @@
+/* See LICENSE file for copyright and license details. */
+
+#ifndef PHASH_H
+#define PHASH_H
+
+/*
+ * Computes the perceptual hash of the 'w'x'h' image at 'path' and stores it in 'hash'. The image is
+ * decoded at reduced scale, squashed to 32x32 gray and transformed with a DCT. Each of the 8x8 lowest
+ * frequencies after the first row and column sets one bit when it is above their median. Rescaled and
+ * recompressed copies of an image hash a few bits apart at most.
+ * Returns 1 if the image cannot be decoded or is smaller than 32x32, otherwise 0. Safe to call from any thread.
+ */
+int phash_file( char * path, int w, int h, Uint64 * hash );
+
+/*
+ * Returns the number of bits in which 'a' and 'b' differ.
+ */
+int phash_distance( Uint64 a, Uint64 b );
+
+#endif
@@ -0,0 +1,261 @@
+/* See LICENSE file for copyright and license details. */
+
+#include "SDL_image.h"
+#include "wand/magick_wand.h"
+#include "data_structures.h"
+#include "config.h"
+#include "image.h"
+#include "queue.h"
+#include "stats.h"
+#include "prefetch.h"
+#include "trace.h"
+
+/*
+ * Jobs may still be in flight for images the cursor has already left behind, so the table holds
+ * enough room for two full windows of neighbors plus slack.
+ */
+#define PREFETCH_SLOTS ( 4 * PREFETCH_DEPTH + 2 )
+
+static SDL_Thread * decoder = NULL;
+static SDL_sem * job_sem = NULL;        /* Posted once per job handed to the decoder. */
+static SDL_sem * done_sem = NULL;       /* Posted once per job handed back by the decoder. */
+static SDL_atomic_t quit;
+static SPSC_QUEUE jobs;                 /* UI thread -> decoder thread */
+static SPSC_QUEUE results;              /* Decoder thread -> UI thread */
+static PREFETCH_JOB * slots[PREFETCH_SLOTS]; /* Every job in existence. Touched only by the UI thread. */
+
+static int prefetch_thread( void * data ) {
+        PREFETCH_JOB * job = NULL;
+        trace_thread( "prefetch" );
+
+        while( 1 ) {
+                SDL_SemWait( job_sem );
+                if( SDL_AtomicGet( &quit ) ) break;
+                job = spsc_pop( &jobs );
+                if( job == NULL ) continue;
+                if( SDL_AtomicGet( &job->cancelled ) == 0 ) {
+                        Uint64 start = SDL_GetPerformanceCounter();
+                        job->image = image_load( job->path, job->max_w, job->max_h );
+                        stats_record( stat_decode, start );
+                        trace_end( "decode", start, job->id, job->image != NULL ? (Sint64) job->image->length : -1 );
+                        if( SGK_DEBUG ) {
+                                printf( "DEBUG: Prefetched image %s -- %s\n", job->path,
+                                                job->image == NULL ? "failure" : "success" );
+                        }
+                }
+                /* Never full, since the results queue has room for every slot. */
+                spsc_push( &results, job );
+                SDL_SemPost( done_sem );
+        }
+
+        return 0;
+}
+
+static void prefetch_release( int slot ) {
+        PREFETCH_JOB * job = slots[slot];
+        image_free( job->image );
+        free( job->path );
+        free( job );
+        slots[slot] = NULL;
+}
+
+/* Returns the slot holding a wanted (not cancelled) job for 'id', or -1 if there is none. */
+static int prefetch_find( int id ) {
+        for( int i = 0; i < PREFETCH_SLOTS; i++ ) {
+                if( slots[i] != NULL && slots[i]->id == id && SDL_AtomicGet( &slots[i]->cancelled ) == 0 ) {
+                        return i;
+                }
+        }
+        return -1;
+}
+
+/* Marks every job returned by the decoder as done, freeing those nobody wants anymore. */
+static void prefetch_collect( void ) {
+        PREFETCH_JOB * job = NULL;
+
+        while(( job = spsc_pop( &results )) != NULL ) {
+                job->done = 1;
+                if( SDL_AtomicGet( &job->cancelled ) ) {
+                        for( int i = 0; i < PREFETCH_SLOTS; i++ ) {
+                                if( slots[i] == job ) prefetch_release( i );
+                        }
+                }
+        }
+}
+
+/* Blocks until the job in 'slot' has come back from the decoder. */
+static void prefetch_wait( int slot ) {
+        PREFETCH_JOB * job = slots[slot];
+        while( job->done == 0 ) {
+                SDL_SemWait( done_sem );
+                prefetch_collect();
+        }
+}
+
+int prefetch_init( void ) {
+        if( SGK_DEBUG ) printf( "DEBUG: Starting background decoder -- depth %d\n", PREFETCH_DEPTH );
+
+        for( int i = 0; i < PREFETCH_SLOTS; i++ ) slots[i] = NULL;
+        SDL_AtomicSet( &quit, 0 );
+
+        if( spsc_init( &jobs, PREFETCH_SLOTS ) || spsc_init( &results, PREFETCH_SLOTS ) ) return 1;
+
+        job_sem = SDL_CreateSemaphore( 0 );
+        done_sem = SDL_CreateSemaphore( 0 );
+        if( job_sem == NULL || done_sem == NULL ) {
+                fprintf( stderr, "ERROR: Unable to create prefetch semaphores: %s\n", SDL_GetError() );
+                return 1;
+        }
+
+        /* Load the codec libraries here so the decoder thread never races the UI thread to do it. */
+        IMG_Init( IMG_INIT_JPG | IMG_INIT_PNG | IMG_INIT_TIF | IMG_INIT_WEBP );
+
+        decoder = SDL_CreateThread( prefetch_thread, "prefetch", NULL );
+        if( decoder == NULL ) {
+                fprintf( stderr, "ERROR: Unable to create prefetch thread: %s\n", SDL_GetError() );
+                return 1;
+        }
+
+        return 0;
+}
+
+void prefetch_update( FILE_LIST * file_list, int max_w, int max_h ) {
+        prefetch_collect();
+
+        /* Gather the neighbors of 'file_list', nearest first, alternating forward and backward. */
+        FILE_LIST * wanted[2 * PREFETCH_DEPTH];
+        FILE_LIST * ahead = file_list;
+        FILE_LIST * behind = file_list;
+        int count = 0;
+        for( int i = 0; i < PREFETCH_DEPTH; i++ ) {
+                ahead = ahead->next;
+                behind = behind->prev;
+                wanted[count++] = ahead;
+                wanted[count++] = behind;
+        }
+
+        /* Cancel everything outside the window, or decoded for a different window size. */
+        for( int i = 0; i < PREFETCH_SLOTS; i++ ) {
+                if( slots[i] == NULL ) continue;
+                int keep = 0;
+                for( int j = 0; j < count; j++ ) {
+                        if( slots[i]->id == wanted[j]->id ) keep = 1;
+                }
+                if( slots[i]->max_w != max_w || slots[i]->max_h != max_h ) keep = 0;
+                if( keep == 0 ) {
+                        SDL_AtomicSet( &slots[i]->cancelled, 1 );
+                        if( slots[i]->done ) prefetch_release( i );
+                }
+        }
+
+        /* Queue whatever in the window is not already decoded or in progress. */
+        for( int j = 0; j < count; j++ ) {
+                if( wanted[j] == file_list || prefetch_find( wanted[j]->id ) >= 0 ) continue;
+
+                int slot = -1;
+                for( int i = 0; i < PREFETCH_SLOTS; i++ ) {
+                        if( slots[i] == NULL ) {
+                                slot = i;
+                                break;
+                        }
+                }
+                if( slot < 0 ) break; /* Table full of in-flight cancelled jobs. Try again next move. */
+
+                PREFETCH_JOB * job = malloc( sizeof( PREFETCH_JOB ) );
+                int len = strlen( wanted[j]->path ) + 1;
+                char * path = malloc( len );
+                if( job == NULL || path == NULL ) {
+                        fprintf( stderr, "ERROR: Unable to malloc for prefetch job.\n" );
+                        free( job );
+                        free( path );
+                        break;
+                }
+                snprintf( path, len, "%s", wanted[j]->path );
+                job->id = wanted[j]->id;
+                job->path = path;
+                job->image = NULL;
+                job->max_w = max_w;
+                job->max_h = max_h;
+                job->done = 0;
+                SDL_AtomicSet( &job->cancelled, 0 );
+
+                slots[slot] = job;
+                if( spsc_push( &jobs, job ) ) {
+                        prefetch_release( slot );
+                        break;
+                }
+                SDL_SemPost( job_sem );
+        }
+}
+
+IMAGE * prefetch_take( FILE_LIST * file_list ) {
+        prefetch_collect();
+
+        int slot = prefetch_find( file_list->id );
+        if( slot < 0 ) return NULL;
+        prefetch_wait( slot );
+
+        IMAGE * image = slots[slot]->image;
+        slots[slot]->image = NULL;
+        prefetch_release( slot );
+
+        return image;
+}
+
+void prefetch_forget( int id ) {
+        prefetch_collect();
+
+        /* A decode still in flight comes back cancelled and is freed by prefetch_collect(). */
+        int slot = prefetch_find( id );
+        if( slot < 0 ) return;
+        SDL_AtomicSet( &slots[slot]->cancelled, 1 );
+        if( slots[slot]->done ) prefetch_release( slot );
+}
+
+int prefetch_attach( FILE_LIST * file_list, int max_w, int max_h ) {
+        /* A preview decoded for a smaller window would look soft. Decode again at the new size. */
+        if( file_list->image != NULL && ! image_fits( file_list->image, max_w, max_h ) ) {
+                image_free( file_list->image );
+                file_list->image = NULL;
+        }
+        if( file_list->image == NULL ) {
+                file_list->image = prefetch_take( file_list );
+                if( file_list->image != NULL && ! image_fits( file_list->image, max_w, max_h ) ) {
+                        image_free( file_list->image );
+                        file_list->image = NULL;
+                }
+        }
+        if( file_list->image == NULL ) {
+                stats_count( counter_prefetch_miss );
+                Uint64 start = SDL_GetPerformanceCounter();
+                file_list->image = image_load( file_list->path, max_w, max_h );
+                stats_record( stat_decode, start );
+                trace_end( "decode", start, file_list->id,
+                                file_list->image != NULL ? (Sint64) file_list->image->length : -1 );
+        } else {
+                stats_count( counter_prefetch_hit );
+        }
+
+        return file_list->image == NULL;
+}
+
+void prefetch_terminate( void ) {
+        if( decoder != NULL ) {
+                SDL_AtomicSet( &quit, 1 );
+                SDL_SemPost( job_sem );
+                SDL_WaitThread( decoder, NULL );
+                decoder = NULL;
+        }
+
+        /* The decoder is gone, so every job is ours to free whether or not it came back. */
+        for( int i = 0; i < PREFETCH_SLOTS; i++ ) {
+                if( slots[i] != NULL ) prefetch_release( i );
+        }
+
+        spsc_free( &jobs );
+        spsc_free( &results );
+        SDL_DestroySemaphore( job_sem );
+        SDL_DestroySemaphore( done_sem );
+        job_sem = NULL;
+        done_sem = NULL;
+}
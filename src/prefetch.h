@@ -0,0 +1,45 @@
+/* See LICENSE file for copyright and license details. */
+
+#ifndef PREFETCH_H
+#define PREFETCH_H
+
+/*
+ * Starts the background decoder thread.
+ * Returns 1 on program-halting error, otherwise 0.
+ */
+int prefetch_init( void );
+
+/*
+ * Queues the images within PREFETCH_DEPTH of 'file_list' for background decoding at a size to fill a
+ * 'max_w'x'max_h' window, nearest first, and cancels or discards decoded images that are no longer
+ * near 'file_list' or were decoded for another window size.
+ * Called from the UI thread after the cursor moves.
+ */
+void prefetch_update( FILE_LIST * file_list, int max_w, int max_h );
+
+/*
+ * Returns the decoded image for 'file_list' and forgets it, waiting for the decoder if the image is
+ * still in progress. Returns NULL if the image was never queued or failed to decode.
+ * The caller must image_free() the result.
+ */
+IMAGE * prefetch_take( FILE_LIST * file_list );
+
+/*
+ * Cancels or discards the image decoded for FILE_LIST id 'id', such as when its file has changed.
+ * Never waits for the decoder.
+ */
+void prefetch_forget( int id );
+
+/*
+ * Makes sure 'file_list->image' holds the image decoded large enough for a 'max_w'x'max_h' window,
+ * taking it from the background decoder if possible and otherwise decoding it now.
+ * Returns 1 if the image could not be decoded, otherwise 0.
+ */
+int prefetch_attach( FILE_LIST * file_list, int max_w, int max_h );
+
+/*
+ * Stops the decoder thread and frees all decoded images.
+ */
+void prefetch_terminate( void );
+
+#endif
@@ -0,0 +1,220 @@
+/* See LICENSE file for copyright and license details. */
+
+#include <fcntl.h>
+#include <unistd.h>
+#include "SDL_image.h"
+#include "wand/magick_wand.h"
+#include "data_structures.h"
+#include "config.h"
+#include "probe.h"
+#include "stats.h"
+#include "trace.h"
+
+/* Enough to cover every fixed-position header field below. */
+#define PROBE_HEADER_BYTES 32
+
+static unsigned int be16( unsigned char * b ) { return ( b[0] << 8 ) | b[1]; }
+static unsigned int le16( unsigned char * b ) { return b[0] | ( b[1] << 8 ); }
+static unsigned int le24( unsigned char * b ) { return b[0] | ( b[1] << 8 ) | ( b[2] << 16 ); }
+static unsigned int be32( unsigned char * b ) { return ( (unsigned int) b[0] << 24 ) | ( b[1] << 16 ) | ( b[2] << 8 ) | b[3]; }
+static unsigned int le32( unsigned char * b ) { return b[0] | ( b[1] << 8 ) | ( b[2] << 16 ) | ( (unsigned int) b[3] << 24 ); }
+
+/* 
+ * Walks JPEG marker segments until the first start-of-frame, which holds the dimensions.
+ * Segment bodies are skipped with their length field, so large EXIF blocks cost nothing.
+ */
+static int probe_jpeg( int fd, int * w, int * h, int * mcu_w, int * mcu_h ) {
+        unsigned char b[10 + 3 * 4];
+        off_t pos = 2;
+
+        while( 1 ) {
+                if( pread( fd, b, 4, pos ) != 4 || b[0] != 0xFF ) return 1;
+                unsigned char marker = b[1];
+                if( marker == 0xFF ) {
+                        /* Fill byte. */
+                        pos += 1;
+                        continue;
+                }
+                if( marker == 0x01 || ( marker >= 0xD0 && marker <= 0xD8 ) ) {
+                        /* Standalone marker without a length field. */
+                        pos += 2;
+                        continue;
+                }
+                if( marker == 0xD9 || marker == 0xDA ) return 1; /* Image data began without a frame header. */
+                unsigned int len = be16( b + 2 );
+                if( len < 2 ) return 1;
+                if( marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC ) {
+                        if( pread( fd, b, 10, pos ) != 10 ) return 1;
+                        *h = be16( b + 5 );
+                        *w = be16( b + 7 );
+                        /* The MCU spans eight pixels per unit of the largest sampling factor on each axis. */
+                        int components = b[9];
+                        if( components < 1 || components > 4 ) return 1;
+                        if( pread( fd, b + 10, 3 * components, pos + 10 ) != 3 * components ) return 1;
+                        int max_h = 1;
+                        int max_v = 1;
+                        for( int c = 0; c < components; c++ ) {
+                                int samp = b[10 + 3 * c + 1];
+                                if( ( samp >> 4 ) > max_h ) max_h = samp >> 4;
+                                if( ( samp & 0x0F ) > max_v ) max_v = samp & 0x0F;
+                        }
+                        *mcu_w = 8 * max_h;
+                        *mcu_h = 8 * max_v;
+                        return 0;
+                }
+                pos += 2 + len;
+        }
+}
+
+static int probe_webp( unsigned char * b, int * w, int * h ) {
+        if( memcmp( b + 12, "VP8 ", 4 ) == 0 ) {
+                /* Lossy: a three byte frame tag, then the 9D 01 2A start code, then 14 bit dimensions. */
+                if( b[23] != 0x9D || b[24] != 0x01 || b[25] != 0x2A ) return 1;
+                *w = le16( b + 26 ) & 0x3FFF;
+                *h = le16( b + 28 ) & 0x3FFF;
+                return 0;
+        }
+        if( memcmp( b + 12, "VP8L", 4 ) == 0 ) {
+                /* Lossless: a signature byte, then width-1 and height-1 packed into 14 bits each. */
+                if( b[20] != 0x2F ) return 1;
+                unsigned int bits = le32( b + 21 );
+                *w = ( bits & 0x3FFF ) + 1;
+                *h = ( ( bits >> 14 ) & 0x3FFF ) + 1;
+                return 0;
+        }
+        if( memcmp( b + 12, "VP8X", 4 ) == 0 ) {
+                /* Extended: canvas width-1 and height-1 as 24 bit fields. */
+                *w = le24( b + 24 ) + 1;
+                *h = le24( b + 27 ) + 1;
+                return 0;
+        }
+        return 1;
+}
+
+static int probe_bmp( unsigned char * b, int * w, int * h ) {
+        unsigned int dib_size = le32( b + 14 );
+        if( dib_size == 12 ) {
+                /* OS/2 core header with 16 bit dimensions. */
+                *w = le16( b + 18 );
+                *h = le16( b + 20 );
+        } else if( dib_size >= 40 ) {
+                /* Height is negative for top-down bitmaps. */
+                *w = (int) le32( b + 18 );
+                *h = (int) le32( b + 22 );
+                if( *h < 0 ) *h = -*h;
+        } else {
+                return 1;
+        }
+        return 0;
+}
+
+static IMAGE_FORMAT probe_magick( char * path, int * w, int * h ) {
+        IMAGE_FORMAT format = format_none;
+        MagickWand * magick_wand = NewMagickWand();
+        if( MagickPingImage( magick_wand, path ) == MagickTrue ) {
+                *w = MagickGetImageWidth( magick_wand );
+                *h = MagickGetImageHeight( magick_wand );
+                format = format_other;
+        }
+        DestroyMagickWand( magick_wand );
+        return format;
+}
+
+IMAGE_FORMAT probe_signature( unsigned char * b, size_t length ) {
+        /* Sniff magic bytes; never trust the extension. */
+        if( length >= 3 && b[0] == 0xFF && b[1] == 0xD8 && b[2] == 0xFF ) return format_jpeg;
+        if( length >= 8 && memcmp( b, "\x89PNG\r\n\x1a\n", 8 ) == 0 ) return format_png;
+        if( length >= 6 && ( memcmp( b, "GIF87a", 6 ) == 0 || memcmp( b, "GIF89a", 6 ) == 0 ) ) return format_gif;
+        if( length >= 12 && memcmp( b, "RIFF", 4 ) == 0 && memcmp( b + 8, "WEBP", 4 ) == 0 ) return format_webp;
+        if( length >= 2 && b[0] == 'B' && b[1] == 'M' ) return format_bmp;
+        return format_unknown;
+}
+
+IMAGE_FORMAT probe_image( char * path, int * w, int * h, int * mcu_w, int * mcu_h ) {
+        unsigned char b[PROBE_HEADER_BYTES];
+        IMAGE_FORMAT format = format_unknown;
+        int failed = 1;
+
+        *w = 0;
+        *h = 0;
+        *mcu_w = 0;
+        *mcu_h = 0;
+
+        int fd = open( path, O_RDONLY );
+        if( fd < 0 ) return format_none;
+        ssize_t got = pread( fd, b, sizeof( b ), 0 );
+        if( got < 0 ) got = 0;
+        memset( b + got, 0, sizeof( b ) - got );
+
+        format = probe_signature( b, got );
+        if( format == format_jpeg && got >= 4 ) {
+                failed = probe_jpeg( fd, w, h, mcu_w, mcu_h );
+        } else if( format == format_png && got >= 24 && memcmp( b + 12, "IHDR", 4 ) == 0 ) {
+                *w = be32( b + 16 );
+                *h = be32( b + 20 );
+                failed = 0;
+        } else if( format == format_gif && got >= 10 ) {
+                *w = le16( b + 6 );
+                *h = le16( b + 8 );
+                failed = 0;
+        } else if( format == format_webp && got >= 30 ) {
+                failed = probe_webp( b, w, h );
+        } else if( format == format_bmp && got >= 26 ) {
+                failed = probe_bmp( b, w, h );
+        }
+        close( fd );
+
+        if( failed || *w <= 0 || *h <= 0 ) {
+                /* Unrecognized or unusual header. Let ImageMagick have a look without decoding pixels. */
+                format = probe_magick( path, w, h );
+                *mcu_w = 0;
+                *mcu_h = 0;
+                if( *w <= 0 || *h <= 0 ) format = format_none;
+        }
+
+        return format;
+}
+
+int probe_entry( FILE_LIST * file_list ) {
+        if( file_list->format == format_unknown ) {
+                Uint64 start = SDL_GetPerformanceCounter();
+                file_list->format = probe_image( file_list->path, &file_list->img_w, &file_list->img_h,
+                                &file_list->mcu_w, &file_list->mcu_h );
+                stats_record( stat_probe, start );
+                trace_end( "probe", start, file_list->id, -1 );
+                if( SGK_DEBUG ) {
+                        printf( "DEBUG: Probed %s -- format %d, %dx%d\n", file_list->path, file_list->format,
+                                        file_list->img_w, file_list->img_h );
+                }
+        }
+
+        return file_list->format == format_none;
+}
+
+int probe_sdl_native( IMAGE_FORMAT format ) {
+        switch( format ) {
+                case format_jpeg:
+                case format_png:
+                case format_gif:
+                case format_webp:
+                case format_bmp:
+                        return 1;
+                case format_unknown:
+                case format_none:
+                case format_other:
+                        break;
+        }
+        return 0;
+}
+
+int probe_sdl_readable( char * path ) {
+        /* The same signature checks IMG_Load_RW() picks a loader with. Each is 0 if SDL_image lacks that loader. */
+        SDL_RWops * src = SDL_RWFromFile( path, "rb" );
+        if( src == NULL ) return 0;
+        int readable = IMG_isJPG( src ) || IMG_isPNG( src ) || IMG_isGIF( src ) || IMG_isWEBP( src )
+                        || IMG_isBMP( src ) || IMG_isTIF( src ) || IMG_isPNM( src ) || IMG_isPCX( src )
+                        || IMG_isLBM( src ) || IMG_isXCF( src ) || IMG_isXPM( src ) || IMG_isXV( src )
+                        || IMG_isICO( src ) || IMG_isCUR( src );
+        SDL_RWclose( src );
+        return readable;
+}
@@ -0,0 +1,37 @@
+/* See LICENSE file for copyright and license details. */
+
+#ifndef PROBE_H
+#define PROBE_H
+
+/*
+ * Identifies an image format from the first 'length' bytes of a file, 'b'. Only the formats whose headers
+ * are parsed directly are recognized; returns format_unknown for anything else.
+ */
+IMAGE_FORMAT probe_signature( unsigned char * b, size_t length );
+
+/*
+ * Identifies the image at 'path' from its header alone and stores its dimensions in 'w' and 'h'.
+ * For JPEG, the size of a minimum coded unit goes in 'mcu_w' and 'mcu_h'; otherwise they are set to 0.
+ * JPEG, PNG, GIF, WebP and BMP headers are parsed directly; anything else is pinged with ImageMagick.
+ * Returns format_none if the file is not a readable image. Safe to call from any thread.
+ */
+IMAGE_FORMAT probe_image( char * path, int * w, int * h, int * mcu_w, int * mcu_h );
+
+/*
+ * Probes 'file_list' unless it has already been probed, filling format, img_w, img_h, mcu_w and mcu_h.
+ * Returns 1 if the file is not a readable image, otherwise 0.
+ */
+int probe_entry( FILE_LIST * file_list );
+
+/*
+ * Returns 1 if SDL_image decodes 'format' natively, otherwise 0.
+ */
+int probe_sdl_native( IMAGE_FORMAT format );
+
+/*
+ * Returns 1 if SDL_image has a loader for the file at 'path', judging by its header alone, otherwise 0.
+ * For formats probe_image() leaves to ImageMagick. Safe to call from any thread.
+ */
+int probe_sdl_readable( char * path );
+
+#endif
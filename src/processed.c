@@ -0,0 +1,224 @@
+/* See LICENSE file for copyright and license details. */
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include "data_structures.h"
+#include "config.h"
+#include "processed.h"
+
+/*
+ * One name ever seen in the destination, as a path below it like FILE_LIST 'name'. Names are only ever
+ * marked absent, never taken out of the set.
+ */
+typedef struct PROCESSEDNAME {
+        Uint32 name;            /* Offset of the name in the string pool */
+        Uint8 present;          /* Set to 1 while the destination holds a file of this name */
+} PROCESSED_NAME;
+
+/*
+ * Written by the UI thread only. The view's sort threads read the set while the UI thread waits for them,
+ * so there is nothing to lock.
+ */
+static PROCESSED_NAME * names = NULL;
+static int count = 0;
+static int capacity = 0;
+static char * pool = NULL;              /* File names, NUL terminated */
+static size_t pool_size = 0;
+static size_t pool_capacity = 0;
+static int * buckets = NULL;            /* Open addressing hash table of name numbers plus one, zero when empty */
+static int bucket_count = 0;            /* Always a power of two */
+static int skipping = 0;                /* Set to 1 when the walk passes over directory 'skip_dev','skip_ino' */
+static dev_t skip_dev;
+static ino_t skip_ino;
+
+static Uint32 processed_hash( const char * name ) {
+        /* FNV-1a */
+        Uint32 hash = 2166136261u;
+        while( *name ) {
+                hash ^= (unsigned char) *name++;
+                hash *= 16777619u;
+        }
+        return hash;
+}
+
+/* Returns the number of 'name', or -1 if it was never seen. */
+static int processed_find( const char * name ) {
+        if( bucket_count == 0 ) return -1;
+        Uint32 mask = bucket_count - 1;
+        for( Uint32 b = processed_hash( name ) & mask; buckets[b] != 0; b = ( b + 1 ) & mask ) {
+                int n = buckets[b] - 1;
+                if( strcmp( pool + names[n].name, name ) == 0 ) return n;
+        }
+        return -1;
+}
+
+static int processed_rehash( int new_count ) {
+        int * table = calloc( new_count, sizeof( int ) );
+        if( table == NULL ) {
+                fprintf( stderr, "ERROR: Unable to malloc for processed files hash table.\n" );
+                return 1;
+        }
+        free( buckets );
+        buckets = table;
+        bucket_count = new_count;
+
+        Uint32 mask = bucket_count - 1;
+        for( int n = 0; n < count; n++ ) {
+                Uint32 b = processed_hash( pool + names[n].name ) & mask;
+                while( buckets[b] != 0 ) b = ( b + 1 ) & mask;
+                buckets[b] = n + 1;
+        }
+        return 0;
+}
+
+/* Appends 'name', absent, and returns its number, or -1 on failure. */
+static int processed_add( const char * name ) {
+        size_t len = strlen( name ) + 1;
+
+        if( count == capacity ) {
+                int new_capacity = capacity ? capacity * 2 : 1024;
+                PROCESSED_NAME * temp = realloc( names, new_capacity * sizeof( PROCESSED_NAME ) );
+                if( temp == NULL ) {
+                        fprintf( stderr, "ERROR: Unable to malloc for processed files.\n" );
+                        return -1;
+                }
+                names = temp;
+                capacity = new_capacity;
+        }
+        if( pool_size + len > pool_capacity ) {
+                size_t new_capacity = pool_capacity ? pool_capacity * 2 : 65536;
+                while( pool_size + len > new_capacity ) new_capacity *= 2;
+                char * temp = realloc( pool, new_capacity );
+                if( temp == NULL ) {
+                        fprintf( stderr, "ERROR: Unable to malloc for processed files string pool.\n" );
+                        return -1;
+                }
+                pool = temp;
+                pool_capacity = new_capacity;
+        }
+        /* Keep the hash table at most half full. */
+        if( ( count + 1 ) * 2 > bucket_count ) {
+                if( processed_rehash( bucket_count ? bucket_count * 2 : 1024 ) ) return -1;
+        }
+
+        int n = count++;
+        names[n].name = pool_size;
+        names[n].present = 0;
+        memcpy( pool + pool_size, name, len );
+        pool_size += len;
+
+        Uint32 mask = bucket_count - 1;
+        Uint32 b = processed_hash( name ) & mask;
+        while( buckets[b] != 0 ) b = ( b + 1 ) & mask;
+        buckets[b] = n + 1;
+
+        return n;
+}
+
+/* Returns 1 if 'name' is the directory of one of the 'count' sizes in 'ladder'. */
+static int processed_ladder_dir( char * name, EXPORT_SIZE * ladder, int count ) {
+        char size[2 * 12 + 1];
+        for( int i = 0; i < count; i++ ) {
+                snprintf( size, sizeof( size ), "%dx%d", ladder[i].w, ladder[i].h );
+                if( strcmp( name, size ) == 0 ) return 1;
+        }
+        return 0;
+}
+
+/*
+ * Adds every file below directory 'path' to the set, named by their path below the destination, whose
+ * own path is 'root_len' long. Returns 1 on program-halting error, otherwise 0.
+ */
+static int processed_walk( char * path, int root_len, EXPORT_SIZE * ladder, int ladder_count ) {
+        int top = ( (int) strlen( path ) == root_len );
+        DIR * dir = opendir( path );
+        if( dir == NULL ) {
+                fprintf( stderr, "WARN: Unable to read destination directory: %s\n", path );
+                return 0;
+        }
+
+        int ret_val = 0;
+        struct dirent * ent = NULL;
+        while( ret_val == 0 && ( ent = readdir( dir )) != NULL ) {
+                char * name = ent->d_name;
+                if( name[0] == '.' && ( name[1] == '\0' || ( name[1] == '.' && name[2] == '\0' ))) continue;
+                unsigned char type = ent->d_type;
+                if( type == DT_UNKNOWN ) {
+                        struct stat st;
+                        if( fstatat( dirfd( dir ), name, &st, AT_SYMLINK_NOFOLLOW ) != 0 ) continue;
+                        type = S_ISDIR( st.st_mode ) ? DT_DIR : DT_REG;
+                }
+                /* Directories at the top named after EXPORT_LADDER sizes hold copies, not crops. */
+                if( type == DT_DIR && ( ! SCAN_RECURSIVE || ( top && processed_ladder_dir( name, ladder, ladder_count )))) {
+                        continue;
+                }
+                /* The source, when it lies inside the destination, holds originals, not crops. */
+                if( type == DT_DIR && skipping ) {
+                        struct stat st;
+                        if( fstatat( dirfd( dir ), name, &st, AT_SYMLINK_NOFOLLOW ) == 0 && st.st_dev == skip_dev
+                                        && st.st_ino == skip_ino ) continue;
+                }
+
+                int len = strlen( path ) + 1 + strlen( name ) + 1;
+                char * sub = malloc( len );
+                if( sub == NULL ) {
+                        fprintf( stderr, "ERROR: Unable to malloc for destination path.\n" );
+                        ret_val = 1;
+                        break;
+                }
+                snprintf( sub, len, "%s/%s", path, name );
+                if( type == DT_DIR ) {
+                        ret_val = processed_walk( sub, root_len, ladder, ladder_count );
+                } else {
+                        int n = processed_add( sub + root_len + 1 );
+                        if( n < 0 ) ret_val = 1;
+                        else names[n].present = 1;
+                }
+                free( sub );
+        }
+        closedir( dir );
+
+        return ret_val;
+}
+
+int processed_init( char * dst, char * skip, EXPORT_SIZE * ladder, int ladder_count ) {
+        Uint32 start_ticks = SDL_GetTicks();
+        struct stat st;
+        if( skip != NULL && stat( skip, &st ) == 0 ) {
+                skipping = 1;
+                skip_dev = st.st_dev;
+                skip_ino = st.st_ino;
+        }
+        if( processed_rehash( 1024 ) ) return 1;
+        if( processed_walk( dst, strlen( dst ), ladder, ladder_count ) ) return 1;
+
+        if( SGK_DEBUG ) printf( "DEBUG: Found %d processed files in %s -- %u ms\n", count, dst, SDL_GetTicks() - start_ticks );
+        return 0;
+}
+
+int processed_has( char * file ) {
+        int n = processed_find( file );
+        return n >= 0 && names[n].present;
+}
+
+void processed_set( char * file, int present ) {
+        int n = processed_find( file );
+        if( n < 0 && present ) n = processed_add( file );
+        if( n >= 0 ) names[n].present = present ? 1 : 0;
+}
+
+void processed_terminate( void ) {
+        free( names );
+        free( pool );
+        free( buckets );
+        names = NULL;
+        pool = NULL;
+        buckets = NULL;
+        count = 0;
+        capacity = 0;
+        pool_size = 0;
+        pool_capacity = 0;
+        bucket_count = 0;
+        skipping = 0;
+}
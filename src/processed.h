@@ -0,0 +1,31 @@
+/* See LICENSE file for copyright and license details. */
+
+#ifndef PROCESSED_H
+#define PROCESSED_H
+
+/*
+ * Reads the path of every file below directory 'dst' into a set, once, so that finding out whether an
+ * image already has a crop never touches the disk. The directories of the 'ladder_count' sizes in
+ * 'ladder' are left out, and so is the directory 'skip', if not NULL, when it appears inside 'dst'.
+ * An unreadable 'dst' gives an empty set.
+ * Returns 1 on program-halting error, otherwise 0.
+ */
+int processed_init( char * dst, char * skip, EXPORT_SIZE * ladder, int ladder_count );
+
+/*
+ * Returns 1 if the destination holds a crop at 'file', a FILE_LIST 'name', otherwise 0. Safe to call from any thread
+ * while the UI thread is not in processed_set().
+ */
+int processed_has( char * file );
+
+/*
+ * Records that the crop at 'file', a FILE_LIST 'name', was saved ('present' set) or deleted. Call from the UI thread only.
+ */
+void processed_set( char * file, int present );
+
+/*
+ * Frees the set.
+ */
+void processed_terminate( void );
+
+#endif
@@ -0,0 +1,55 @@
+/* See LICENSE file for copyright and license details. */
+
+#include "SDL.h"
+#include "data_structures.h"
+#include "queue.h"
+
+int spsc_init( SPSC_QUEUE * queue, int size ) {
+        int slots = 1;
+        while( slots < size ) slots *= 2;
+
+        queue->slots = malloc( slots * sizeof( void * ) );
+        if( queue->slots == NULL ) {
+                fprintf( stderr, "ERROR: Unable to malloc for queue slots.\n" );
+                return 1;
+        }
+        queue->size = slots;
+        SDL_AtomicSet( &queue->head, 0 );
+        SDL_AtomicSet( &queue->tail, 0 );
+
+        return 0;
+}
+
+int spsc_push( SPSC_QUEUE * queue, void * item ) {
+        unsigned int tail = SDL_AtomicGet( &queue->tail );
+        unsigned int head = SDL_AtomicGet( &queue->head );
+
+        /* Indices run freely and wrap; the difference is the number of queued items. */
+        if( tail - head >= (unsigned int) queue->size ) return 1;
+
+        queue->slots[tail & (queue->size - 1)] = item;
+        /* The slot must be visible to the consumer before the new tail is. */
+        SDL_MemoryBarrierRelease();
+        SDL_AtomicSet( &queue->tail, (int) (tail + 1) );
+
+        return 0;
+}
+
+void * spsc_pop( SPSC_QUEUE * queue ) {
+        unsigned int head = SDL_AtomicGet( &queue->head );
+        unsigned int tail = SDL_AtomicGet( &queue->tail );
+
+        if( head == tail ) return NULL;
+
+        SDL_MemoryBarrierAcquire();
+        void * item = queue->slots[head & (queue->size - 1)];
+        SDL_AtomicSet( &queue->head, (int) (head + 1) );
+
+        return item;
+}
+
+void spsc_free( SPSC_QUEUE * queue ) {
+        free( queue->slots );
+        queue->slots = NULL;
+        queue->size = 0;
+}
@@ -0,0 +1,35 @@
+/* See LICENSE file for copyright and license details. */
+
+#ifndef QUEUE_H
+#define QUEUE_H
+
+/*
+ * Single-producer, single-consumer lock-free queue of pointers.
+ * Exactly one thread may push and exactly one (possibly different) thread may pop.
+ */
+
+/*
+ * Prepares 'queue' to hold at least 'size' items. 'size' is rounded up to a power of two.
+ * Returns 1 on error, otherwise 0.
+ * This function mallocs memory.
+ */
+int spsc_init( SPSC_QUEUE * queue, int size );
+
+/*
+ * Appends 'item' to 'queue'. Called only from the producer thread.
+ * Returns 1 if the queue is full, otherwise 0.
+ */
+int spsc_push( SPSC_QUEUE * queue, void * item );
+
+/*
+ * Removes and returns the oldest item in 'queue'. Called only from the consumer thread.
+ * Returns NULL if the queue is empty.
+ */
+void * spsc_pop( SPSC_QUEUE * queue );
+
+/*
+ * Frees memory held by 'queue'. Items still in the queue are not freed.
+ */
+void spsc_free( SPSC_QUEUE * queue );
+
+#endif
@@ -0,0 +1,121 @@
+/* See LICENSE file for copyright and license details. */
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "SDL.h"
+#include "data_structures.h"
+#include "config.h"
+#include "scale.h"
+#include "saliency.h"
+
+/* Longest side of the luminance plane. Box placement needs only coarse detail. */
+#define SALIENCY_SIZE 128
+
+/*
+ * Computes |dx| + |dy| for row 'y' of the luminance plane 'luma', saturating at 255. Rows are 'stride'
+ * bytes apart, and both the row and the one below it are padded by 16 bytes past the last pixel.
+ */
+static void saliency_gradient( unsigned char * energy, unsigned char * luma, int stride, int w, int y ) {
+        unsigned char * row = luma + (size_t) y * stride;
+        unsigned char * below = row + stride;
+        int x = 0;
+#ifdef __SSE2__
+        for( ; x + 16 <= w; x += 16 ) {
+                __m128i here = _mm_loadu_si128( (__m128i *) ( row + x ) );
+                __m128i right = _mm_loadu_si128( (__m128i *) ( row + x + 1 ) );
+                __m128i down = _mm_loadu_si128( (__m128i *) ( below + x ) );
+                __m128i dx = _mm_or_si128( _mm_subs_epu8( here, right ), _mm_subs_epu8( right, here ));
+                __m128i dy = _mm_or_si128( _mm_subs_epu8( here, down ), _mm_subs_epu8( down, here ));
+                _mm_storeu_si128( (__m128i *) ( energy + x ), _mm_adds_epu8( dx, dy ));
+        }
+#endif
+        for( ; x < w; x++ ) {
+                int e = abs( row[x] - row[x + 1] ) + abs( row[x] - below[x] );
+                energy[x] = e > 255 ? 255 : e;
+        }
+}
+
+void saliency_profile( IMAGE * image ) {
+        SDL_Surface * surface = image->surface;
+        int w = surface->w;
+        int h = surface->h;
+        if( w > SALIENCY_SIZE || h > SALIENCY_SIZE ) {
+                double scale = (double) SALIENCY_SIZE / ( w > h ? w : h );
+                w = w * scale + 0.5;
+                h = h * scale + 0.5;
+                if( w < 1 ) w = 1;
+                if( h < 1 ) h = 1;
+                surface = scale_surface( image->surface, w, h );
+                if( surface == NULL ) return;
+        }
+
+        /* One spare row and 16 spare columns, so the gradient never reads outside the plane. */
+        int stride = w + 16;
+        unsigned char * luma = malloc( (size_t) stride * ( h + 1 ));
+        unsigned char * energy = malloc( stride );
+        float * cols = calloc( w, sizeof( float ));
+        float * rows = calloc( h, sizeof( float ));
+        if( luma == NULL || energy == NULL || cols == NULL || rows == NULL ) {
+                fprintf( stderr, "ERROR: Unable to allocate memory for saliency profile.\n" );
+                free( cols );
+                free( rows );
+        } else {
+                /* IMAGE_PIXELFORMAT is R,G,B,A in memory. Edges are replicated so they add no gradient. */
+                for( int y = 0; y < h; y++ ) {
+                        unsigned char * src = (unsigned char *) surface->pixels + (size_t) y * surface->pitch;
+                        unsigned char * dst = luma + (size_t) y * stride;
+                        for( int x = 0; x < w; x++ ) {
+                                dst[x] = ( 77 * src[x * 4] + 150 * src[x * 4 + 1] + 29 * src[x * 4 + 2] ) >> 8;
+                        }
+                        memset( dst + w, dst[w - 1], stride - w );
+                }
+                memcpy( luma + (size_t) h * stride, luma + (size_t) ( h - 1 ) * stride, stride );
+
+                for( int y = 0; y < h; y++ ) {
+                        saliency_gradient( energy, luma, stride, w, y );
+                        for( int x = 0; x < w; x++ ) {
+                                cols[x] += energy[x];
+                                rows[y] += energy[x];
+                        }
+                }
+
+                image->energy_cols = cols;
+                image->energy_rows = rows;
+                image->energy_w = w;
+                image->energy_h = h;
+        }
+
+        free( luma );
+        free( energy );
+        if( surface != image->surface ) SDL_FreeSurface( surface );
+}
+
+int saliency_offset( float * energy, int n, int img, int sel ) {
+        int centered = ( img - sel ) / 2;
+        int window = (int) ( (double) sel * n / img + 0.5 );
+        if( window < 1 ) window = 1;
+        if( window >= n ) return centered;
+
+        /* Slide a window of the box's size across the profile. */
+        double sum = 0.0;
+        for( int i = 0; i < window; i++ ) sum += energy[i];
+        int middle = ( n - window ) / 2;
+        int best = 0;
+        double best_sum = sum;
+        double middle_sum = ( middle == 0 ) ? sum : 0.0;
+        for( int start = 1; start <= n - window; start++ ) {
+                sum += energy[start + window - 1] - energy[start - 1];
+                if( start == middle ) middle_sum = sum;
+                if( sum > best_sum ) {
+                        best_sum = sum;
+                        best = start;
+                }
+        }
+        if( best_sum <= middle_sum * SALIENT_MARGIN ) return centered;
+
+        int offset = (int) ( (double) best * img / n + 0.5 );
+        if( offset > img - sel ) offset = img - sel;
+        if( offset < 0 ) offset = 0;
+        return offset;
+}
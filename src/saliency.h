@@ -0,0 +1,20 @@
+/* See LICENSE file for copyright and license details. */
+
+#ifndef SALIENCY_H
+#define SALIENCY_H
+
+/*
+ * Fills 'image->energy_cols' and 'image->energy_rows' with the column and row sums of luminance gradient
+ * energy over a small copy of 'image->surface', for placing selection boxes over the busy part of an image.
+ * Leaves them NULL on failure. Safe to call from any thread.
+ */
+void saliency_profile( IMAGE * image );
+
+/*
+ * Returns the offset of a 'sel'-pixel span within an 'img'-pixel axis that covers the most of 'energy',
+ * whose 'n' samples span the whole axis. Returns the centered offset unless another one holds at least
+ * SALIENT_MARGIN times as much energy, so that flat or evenly busy images stay centered.
+ */
+int saliency_offset( float * energy, int n, int img, int sel );
+
+#endif
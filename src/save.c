@@ -0,0 +1,221 @@
+/* See LICENSE file for copyright and license details. */
+
+#include "wand/magick_wand.h"
+#include "data_structures.h"
+#include "config.h"
+#include "file_io.h"
+#include "image.h"
+#include "ladder.h"
+#include "processed.h"
+#include "save.h"
+#include "stats.h"
+#include "trace.h"
+
+/*
+ * Each writer thread owns a FIFO of jobs. Jobs are routed by destination path, so every job touching
+ * the same output file lands on the same thread and runs in submission order.
+ */
+static SDL_Thread * writers[SAVE_THREADS];
+static SAVE_JOB * heads[SAVE_THREADS];
+static SAVE_JOB * tails[SAVE_THREADS];
+static SDL_mutex * lock = NULL;
+static SDL_cond * work_cond = NULL;     /* Signalled when a job is queued or the writers must quit */
+static int queued = 0;                  /* Jobs waiting or running. Protected by 'lock' */
+static int quit = 0;                    /* Protected by 'lock' */
+static SDL_atomic_t done;
+static SDL_atomic_t failed;
+static Uint32 event_type = (Uint32) -1;
+
+static void save_free_job( SAVE_JOB * job ) {
+        image_free( job->image );
+        free( job->src_path );
+        free( job->dest_path );
+        free( job );
+}
+
+static int save_thread( void * data ) {
+        int self = (int) (intptr_t) data;
+        trace_thread( "save" );
+
+        SDL_LockMutex( lock );
+        while( 1 ) {
+                while( heads[self] == NULL && quit == 0 ) SDL_CondWait( work_cond, lock );
+                if( heads[self] == NULL ) break; /* Quitting with nothing left to do. */
+                SAVE_JOB * job = heads[self];
+                SDL_UnlockMutex( lock );
+
+                Uint64 start = SDL_GetPerformanceCounter();
+                int status = 0;
+                if( job->remove ) {
+                        status = del_img_path( job->dest_path );
+                        ladder_delete( job->dst, job->dest_path, job->ladder, job->ladder_count );
+                } else {
+                        status = crop_save_image( job->image, job->src_path, job->dst, job->dest_path, job->sel_x,
+                                        job->sel_y, job->sel_w, job->sel_h, job->ladder, job->ladder_count, job->id );
+                        stats_record( stat_save, start );
+                }
+                trace_end( job->remove ? "delete" : "save", start, job->id, -1 );
+                SDL_AtomicAdd( status ? &failed : &done, 1 );
+
+                /* Only dequeue once finished, so a later job for the same file can never overtake it. */
+                SDL_LockMutex( lock );
+                heads[self] = job->next;
+                if( heads[self] == NULL ) tails[self] = NULL;
+                queued -= 1;
+                SDL_UnlockMutex( lock );
+
+                save_free_job( job );
+                if( event_type != (Uint32) -1 ) {
+                        SDL_Event event;
+                        memset( &event, 0, sizeof( event ) );
+                        event.type = event_type;
+                        SDL_PushEvent( &event );
+                }
+
+                SDL_LockMutex( lock );
+        }
+        SDL_UnlockMutex( lock );
+
+        return 0;
+}
+
+static void save_queue( SAVE_JOB * job ) {
+        /* Route by destination path; see the comment at the top of this file. */
+        Uint32 hash = 2166136261u;
+        for( char * c = job->dest_path; *c; c++ ) {
+                hash ^= (unsigned char) *c;
+                hash *= 16777619u;
+        }
+        int writer = hash % SAVE_THREADS;
+
+        SDL_LockMutex( lock );
+        /*
+         * Never wait for room, so KEY_SAVE can't freeze the window. Past SAVE_QUEUE_DEPTH a job lets go of
+         * its decoded image and the writer reads the file instead, which keeps memory bounded.
+         */
+        IMAGE * image = NULL;
+        if( queued >= SAVE_QUEUE_DEPTH ) {
+                image = job->image;
+                job->image = NULL;
+        }
+        job->next = NULL;
+        if( tails[writer] == NULL ) {
+                heads[writer] = job;
+        } else {
+                tails[writer]->next = job;
+        }
+        tails[writer] = job;
+        queued += 1;
+        SDL_CondBroadcast( work_cond );
+        SDL_UnlockMutex( lock );
+        image_free( image );
+}
+
+static SAVE_JOB * save_new_job( FILE_LIST * file_list, CMD_LINE_ARGS * cmd_line_args ) {
+        SAVE_JOB * job = calloc( 1, sizeof( SAVE_JOB ) );
+        if( job == NULL ) {
+                fprintf( stderr, "ERROR: Unable to malloc for save job.\n" );
+                return NULL;
+        }
+        int len = strlen( file_list->path ) + 1;
+        job->src_path = malloc( len );
+        job->dest_path = build_dest_path( cmd_line_args->dst, file_list->name );
+        if( job->src_path == NULL || job->dest_path == NULL ) {
+                fprintf( stderr, "ERROR: Unable to malloc for save job paths.\n" );
+                save_free_job( job );
+                return NULL;
+        }
+        snprintf( job->src_path, len, "%s", file_list->path );
+        job->dst = cmd_line_args->dst;
+        job->id = file_list->id;
+        job->ladder = cmd_line_args->ladder;
+        job->ladder_count = cmd_line_args->ladder_count;
+        return job;
+}
+
+int save_init( void ) {
+        lock = SDL_CreateMutex();
+        work_cond = SDL_CreateCond();
+        if( lock == NULL || work_cond == NULL ) {
+                fprintf( stderr, "ERROR: Unable to create save queue locks: %s\n", SDL_GetError() );
+                return 1;
+        }
+        SDL_AtomicSet( &done, 0 );
+        SDL_AtomicSet( &failed, 0 );
+        event_type = SDL_RegisterEvents( 1 );
+
+        for( int i = 0; i < SAVE_THREADS; i++ ) {
+                heads[i] = NULL;
+                tails[i] = NULL;
+                writers[i] = SDL_CreateThread( save_thread, "save", (void *) (intptr_t) i );
+                if( writers[i] == NULL ) {
+                        fprintf( stderr, "ERROR: Unable to create save thread: %s\n", SDL_GetError() );
+                        return 1;
+                }
+        }
+
+        return 0;
+}
+
+void save_submit( FILE_LIST * file_list, CMD_LINE_ARGS * cmd_line_args ) {
+        SAVE_JOB * job = save_new_job( file_list, cmd_line_args );
+        if( job == NULL ) return;
+
+        /*
+         * Share the decoded image rather than copying it; the writer drops its reference when done. After a
+         * texture cache hit nothing is decoded, and the writer reads the file on its own thread instead.
+         */
+        job->image = image_ref( file_list->image );
+        job->sel_x = file_list->sel_x;
+        job->sel_y = file_list->sel_y;
+        job->sel_w = file_list->sel_w;
+        job->sel_h = file_list->sel_h;
+
+        if( SGK_DEBUG ) printf( "DEBUG: Queueing save of %s\n", job->dest_path );
+        save_queue( job );
+        processed_set( file_list->name, 1 );
+}
+
+void save_delete( FILE_LIST * file_list, CMD_LINE_ARGS * cmd_line_args ) {
+        SAVE_JOB * job = save_new_job( file_list, cmd_line_args );
+        if( job == NULL ) return;
+        job->remove = 1;
+
+        if( SGK_DEBUG ) printf( "DEBUG: Queueing deletion of %s\n", job->dest_path );
+        save_queue( job );
+        processed_set( file_list->name, 0 );
+}
+
+void save_status( int * pending, int * done_count, int * failed_count ) {
+        SDL_LockMutex( lock );
+        *pending = queued;
+        SDL_UnlockMutex( lock );
+        *done_count = SDL_AtomicGet( &done );
+        *failed_count = SDL_AtomicGet( &failed );
+}
+
+Uint32 save_event_type( void ) {
+        return event_type;
+}
+
+void save_terminate( void ) {
+        if( lock == NULL ) return;
+
+        /* Writers keep going until their queues are empty, so nothing the user saved is lost. */
+        SDL_LockMutex( lock );
+        if( queued > 0 ) fprintf( stderr, "WARN: Waiting for %d queued save(s) to finish.\n", queued );
+        quit = 1;
+        SDL_CondBroadcast( work_cond );
+        SDL_UnlockMutex( lock );
+        for( int i = 0; i < SAVE_THREADS; i++ ) {
+                if( writers[i] != NULL ) SDL_WaitThread( writers[i], NULL );
+                writers[i] = NULL;
+        }
+        /* No more events will be consumed. */
+        event_type = (Uint32) -1;
+
+        SDL_DestroyCond( work_cond );
+        SDL_DestroyMutex( lock );
+        work_cond = NULL;
+        lock = NULL;
+}
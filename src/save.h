@@ -0,0 +1,40 @@
+/* See LICENSE file for copyright and license details. */
+
+#ifndef SAVE_H
+#define SAVE_H
+
+/*
+ * Starts SAVE_THREADS writer threads.
+ * Returns 1 on program-halting error, otherwise 0.
+ */
+int save_init( void );
+
+/*
+ * Queues a crop of 'file_list', as selected right now, to be written to 'cmd_line_args->dst', and counts
+ * it as processed from now on. Never waits; the titlebar counts the saves still pending.
+ */
+void save_submit( FILE_LIST * file_list, CMD_LINE_ARGS * cmd_line_args );
+
+/*
+ * Queues deletion of the cropped version of 'file_list' in 'cmd_line_args->dst', which then no longer
+ * counts as processed.
+ * The deletion happens after every save of the same file queued before it.
+ */
+void save_delete( FILE_LIST * file_list, CMD_LINE_ARGS * cmd_line_args );
+
+/*
+ * Reports the number of jobs still queued or running, finished successfully, and failed.
+ */
+void save_status( int * pending, int * done, int * failed );
+
+/*
+ * Returns the SDL event type pushed whenever a job finishes, so the UI can refresh its status.
+ */
+Uint32 save_event_type( void );
+
+/*
+ * Finishes every queued job, then stops the writer threads.
+ */
+void save_terminate( void );
+
+#endif
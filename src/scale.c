@@ -0,0 +1,133 @@
+/* See LICENSE file for copyright and license details. */
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "SDL.h"
+#include "data_structures.h"
+#include "config.h"
+#include "scale.h"
+
+/*
+ * Builds the coverage weights for shrinking 'src_n' pixels to 'dst_n' along one axis.
+ * Output pixel 'o' reads 'count[o]' source pixels from 'start[o]', weighted by 'weights[o*stride]' onward.
+ * Returns the stride, or 0 if memory ran out.
+ */
+static int scale_spans( int src_n, int dst_n, int ** start, int ** count, float ** weights ) {
+        double ratio = (double) src_n / (double) dst_n;
+        int stride = (int) ratio + 2;
+
+        *start = malloc( dst_n * sizeof( int ) );
+        *count = malloc( dst_n * sizeof( int ) );
+        *weights = malloc( (size_t) dst_n * stride * sizeof( float ) );
+        if( *start == NULL || *count == NULL || *weights == NULL ) return 0;
+
+        for( int o = 0; o < dst_n; o++ ) {
+                double lo = o * ratio;
+                double hi = ( o + 1 ) * ratio;
+                int first = (int) lo;
+                int last = (int) hi;
+                if( last < hi ) last += 1;
+                if( last > src_n ) last = src_n;
+                (*start)[o] = first;
+                (*count)[o] = last - first;
+                for( int i = first; i < last; i++ ) {
+                        double overlap = ( hi < i + 1 ? hi : i + 1 ) - ( lo > i ? lo : i );
+                        (*weights)[o * stride + ( i - first )] = overlap / ratio;
+                }
+        }
+
+        return stride;
+}
+
+/* Adds 'weight' times the 'n' pixels at 'src' to the float channels at 'acc'. */
+static void scale_accumulate( float * acc, unsigned char * src, int n, float weight ) {
+        int c = 0;
+#ifdef __SSE2__
+        __m128 w = _mm_set1_ps( weight );
+        __m128i zero = _mm_setzero_si128();
+        for( ; c + 16 <= n * 4; c += 16 ) {
+                __m128i px = _mm_loadu_si128( (__m128i *) ( src + c ) );
+                __m128i lo = _mm_unpacklo_epi8( px, zero );
+                __m128i hi = _mm_unpackhi_epi8( px, zero );
+                float * a = acc + c;
+                _mm_storeu_ps( a, _mm_add_ps( _mm_loadu_ps( a ),
+                                _mm_mul_ps( _mm_cvtepi32_ps( _mm_unpacklo_epi16( lo, zero )), w )));
+                _mm_storeu_ps( a + 4, _mm_add_ps( _mm_loadu_ps( a + 4 ),
+                                _mm_mul_ps( _mm_cvtepi32_ps( _mm_unpackhi_epi16( lo, zero )), w )));
+                _mm_storeu_ps( a + 8, _mm_add_ps( _mm_loadu_ps( a + 8 ),
+                                _mm_mul_ps( _mm_cvtepi32_ps( _mm_unpacklo_epi16( hi, zero )), w )));
+                _mm_storeu_ps( a + 12, _mm_add_ps( _mm_loadu_ps( a + 12 ),
+                                _mm_mul_ps( _mm_cvtepi32_ps( _mm_unpackhi_epi16( hi, zero )), w )));
+        }
+#endif
+        for( ; c < n * 4; c++ ) acc[c] += src[c] * weight;
+}
+
+/* Writes one output pixel: the weighted sum of 'count' accumulated pixels starting at 'acc'. */
+static void scale_resolve( unsigned char * dst, float * acc, int count, float * weights ) {
+#ifdef __SSE2__
+        __m128 sum = _mm_setzero_ps();
+        for( int k = 0; k < count; k++ ) {
+                sum = _mm_add_ps( sum, _mm_mul_ps( _mm_loadu_ps( acc + k * 4 ), _mm_set1_ps( weights[k] )));
+        }
+        __m128i px = _mm_cvtps_epi32( sum );
+        px = _mm_packs_epi32( px, px );
+        px = _mm_packus_epi16( px, px );
+        *(Uint32 *) dst = _mm_cvtsi128_si32( px );
+#else
+        for( int c = 0; c < 4; c++ ) {
+                float sum = 0.0f;
+                for( int k = 0; k < count; k++ ) sum += acc[k * 4 + c] * weights[k];
+                int value = (int) ( sum + 0.5f );
+                dst[c] = value < 0 ? 0 : ( value > 255 ? 255 : value );
+        }
+#endif
+}
+
+SDL_Surface * scale_surface( SDL_Surface * src, int w, int h ) {
+        if( src->format->BytesPerPixel != 4 || w <= 0 || h <= 0 || w > src->w || h > src->h ) return NULL;
+
+        SDL_Surface * dst = SDL_CreateRGBSurface( 0, w, h, 32, src->format->Rmask, src->format->Gmask,
+                        src->format->Bmask, src->format->Amask );
+        int * x_start = NULL;
+        int * x_count = NULL;
+        float * x_weights = NULL;
+        int * y_start = NULL;
+        int * y_count = NULL;
+        float * y_weights = NULL;
+        int x_stride = scale_spans( src->w, w, &x_start, &x_count, &x_weights );
+        int y_stride = scale_spans( src->h, h, &y_start, &y_count, &y_weights );
+        /* One source row's worth of float channels. Rows are summed into it, then columns out of it. */
+        float * acc = malloc( (size_t) src->w * 4 * sizeof( float ) );
+
+        if( dst == NULL || x_stride == 0 || y_stride == 0 || acc == NULL ) {
+                fprintf( stderr, "ERROR: Unable to allocate memory for scaling image.\n" );
+                SDL_FreeSurface( dst );
+                dst = NULL;
+        } else {
+                for( int oy = 0; oy < h; oy++ ) {
+                        memset( acc, 0, (size_t) src->w * 4 * sizeof( float ) );
+                        for( int k = 0; k < y_count[oy]; k++ ) {
+                                unsigned char * row = (unsigned char *) src->pixels 
+                                                    + (size_t) ( y_start[oy] + k ) * src->pitch;
+                                scale_accumulate( acc, row, src->w, y_weights[oy * y_stride + k] );
+                        }
+                        unsigned char * out = (unsigned char *) dst->pixels + (size_t) oy * dst->pitch;
+                        for( int ox = 0; ox < w; ox++ ) {
+                                scale_resolve( out + ox * 4, acc + x_start[ox] * 4, x_count[ox], 
+                                                x_weights + ox * x_stride );
+                        }
+                }
+        }
+
+        free( acc );
+        free( x_start );
+        free( x_count );
+        free( x_weights );
+        free( y_start );
+        free( y_count );
+        free( y_weights );
+
+        return dst;
+}
@@ -0,0 +1,14 @@
+/* See LICENSE file for copyright and license details. */
+
+#ifndef SCALE_H
+#define SCALE_H
+
+/*
+ * Returns a new 'w'x'h' copy of the four byte per pixel surface 'src', shrunk with an area filter:
+ * every output pixel is the average of the source pixels it covers, weighted by coverage.
+ * 'w' and 'h' must not exceed the source dimensions. Returns NULL on failure.
+ * Safe to call from any thread. The caller must SDL_FreeSurface() the result.
+ */
+SDL_Surface * scale_surface( SDL_Surface * src, int w, int h );
+
+#endif
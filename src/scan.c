@@ -0,0 +1,491 @@
+/* See LICENSE file for copyright and license details. */
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include "data_structures.h"
+#include "config.h"
+#include "file_list.h"
+#include "index.h"
+#include "probe.h"
+#include "scan.h"
+#include "stats.h"
+#include "table.h"
+#include "trace.h"
+
+/* Entries handed over at once. Small enough that the first image shows early even in a huge directory. */
+#define SCAN_BATCH 256
+
+/*
+ * Directories waiting to be read form a stack, so the walk goes depth first and keeps the number of
+ * pending paths small. Workers quit when the stack is empty and nobody is reading a directory, since
+ * only a directory being read can add to it.
+ */
+static SDL_Thread * workers[SCAN_THREADS];
+static SDL_mutex * lock = NULL;
+static SDL_cond * work_cond = NULL;     /* Signalled when a directory is queued or the scan ends */
+static SDL_cond * found_cond = NULL;    /* Signalled when entries are ready or the scan ends */
+static SCAN_DIR * dirs = NULL;          /* Protected by 'lock' */
+static int reading = 0;                 /* Directories being read right now. Protected by 'lock' */
+static int finished = 0;                /* Protected by 'lock' */
+static int quit = 0;                    /* Protected by 'lock' */
+static FILE_LIST * found_head = NULL;   /* Chain of ready entries, linked by 'next'. Protected by 'lock' */
+static FILE_LIST * found_tail = NULL;
+static Uint64 * visited = NULL;         /* Open-addressed set of device,inode pairs. Protected by 'lock' */
+static int visited_count = 0;
+static int visited_capacity = 0;
+static double scan_aspect = 0.0;
+static int root_len = 0;                /* Length of the source directory path */
+static INDEX * scan_index = NULL;
+static SDL_mutex * index_lock = NULL;   /* Taken by workers in turn around index_match() */
+static void ( *on_dir )( char * path ) = NULL;
+static SDL_atomic_t count;
+static SDL_atomic_t notified;           /* Set while an event is in the SDL queue, so only one ever is */
+static Uint32 event_type = (Uint32) -1;
+
+/* Adds 'dev','ino' to the visited set. Returns 1 if it was already there. Call with 'lock' held. */
+static int scan_visit( Uint64 dev, Uint64 ino ) {
+        if( ( visited_count + 1 ) * 2 > visited_capacity ) {
+                int capacity = ( visited_capacity == 0 ) ? 1024 : visited_capacity * 2;
+                Uint64 * table = calloc( (size_t) capacity * 2, sizeof( Uint64 ) );
+                if( table == NULL ) {
+                        fprintf( stderr, "ERROR: Unable to malloc for visited directories.\n" );
+                        return 0;
+                }
+                for( int i = 0; i < visited_capacity; i++ ) {
+                        if( visited[i * 2] == 0 && visited[i * 2 + 1] == 0 ) continue;
+                        Uint64 slot = ( visited[i * 2] * 31 + visited[i * 2 + 1] ) & ( capacity - 1 );
+                        while( table[slot * 2] != 0 || table[slot * 2 + 1] != 0 ) slot = ( slot + 1 ) & ( capacity - 1 );
+                        table[slot * 2] = visited[i * 2];
+                        table[slot * 2 + 1] = visited[i * 2 + 1];
+                }
+                free( visited );
+                visited = table;
+                visited_capacity = capacity;
+        }
+
+        /* A pair of zeros marks an empty slot. No real directory has device 0 and inode 0 at once. */
+        Uint64 slot = ( dev * 31 + ino ) & ( visited_capacity - 1 );
+        while( visited[slot * 2] != 0 || visited[slot * 2 + 1] != 0 ) {
+                if( visited[slot * 2] == dev && visited[slot * 2 + 1] == ino ) return 1;
+                slot = ( slot + 1 ) & ( visited_capacity - 1 );
+        }
+        visited[slot * 2] = dev;
+        visited[slot * 2 + 1] = ino;
+        visited_count += 1;
+        return 0;
+}
+
+/* Returns 1 if the file 'name' in directory 'dir_fd' passes SCAN_FILTER. */
+static int scan_filter( int dir_fd, char * name ) {
+        if( SCAN_FILTER == 1 ) {
+                char * dot = strrchr( name, '.' );
+                if( dot == NULL ) return 0;
+                /* SCAN_EXTENSIONS is a list like ".jpg.png.gif"; match whole entries only. */
+                int len = strlen( dot );
+                for( char * ext = strchr( SCAN_EXTENSIONS, '.' ); ext != NULL; ext = strchr( ext + 1, '.' ) ) {
+                        if( strncasecmp( ext, dot, len ) == 0 && ( ext[len] == '.' || ext[len] == '\0' ) ) return 1;
+                }
+                return 0;
+        }
+        if( SCAN_FILTER == 2 ) {
+                unsigned char bytes[16];
+                int fd = openat( dir_fd, name, O_RDONLY );
+                if( fd < 0 ) return 0;
+                ssize_t length = read( fd, bytes, sizeof( bytes ) );
+                close( fd );
+                return length > 0 && probe_signature( bytes, length ) != format_unknown;
+        }
+        return 1;
+}
+
+/* Queues the directory 'path'. Takes ownership of 'path'. Call with 'lock' held. */
+static void scan_push_dir( char * path ) {
+        SCAN_DIR * dir = malloc( sizeof( SCAN_DIR ) );
+        if( dir == NULL ) {
+                fprintf( stderr, "ERROR: Unable to malloc for directory to scan.\n" );
+                free( path );
+                return;
+        }
+        dir->path = path;
+        dir->next = dirs;
+        dirs = dir;
+        SDL_CondSignal( work_cond );
+}
+
+/* Pushes the scan event, unless one is already waiting in the SDL queue. */
+static void scan_notify( void ) {
+        if( event_type != (Uint32) -1 && SDL_AtomicCAS( &notified, 0, 1 ) ) {
+                SDL_Event event;
+                memset( &event, 0, sizeof( event ) );
+                event.type = event_type;
+                /* A full queue drops the event; the entries then wait for the next scan_take(). */
+                if( SDL_PushEvent( &event ) <= 0 ) SDL_AtomicSet( &notified, 0 );
+        }
+}
+
+/* Hands the chain 'head'..'tail' to scan_take() and wakes whoever waits for it. */
+static void scan_publish( FILE_LIST * head, FILE_LIST * tail, int added ) {
+        if( head == NULL ) return;
+
+        SDL_LockMutex( lock );
+        if( found_tail == NULL ) {
+                found_head = head;
+        } else {
+                found_tail->next = head;
+        }
+        found_tail = tail;
+        SDL_CondSignal( found_cond );
+        SDL_UnlockMutex( lock );
+        SDL_AtomicAdd( &count, added );
+        scan_notify();
+}
+
+/*
+ * Copies cached metadata into 'entry', whose file has status 'st'. Returns 1 if the index knows it is not
+ * an image, leaving the entry in the table as a tombstone, otherwise 0.
+ */
+static int scan_match( FILE_LIST * entry, struct stat * st ) {
+        if( scan_index == NULL ) return 0;
+
+        SDL_LockMutex( index_lock );
+        int drop = index_match( scan_index, entry, st->st_ino, st->st_size,
+                        (Sint64) st->st_mtim.tv_sec * 1000000000 + st->st_mtim.tv_nsec );
+        SDL_UnlockMutex( index_lock );
+        if( drop ) entry->deleted = 1;
+        return drop;
+}
+
+/* Joins 'dir' and 'name' into a new path. This function mallocs memory. */
+static char * scan_join( char * dir, char * name ) {
+        int len = strlen( dir ) + 1 + strlen( name ) + 1;
+        char * path = malloc( len );
+        if( path == NULL ) {
+                fprintf( stderr, "ERROR: Unable to malloc for directory path.\n" );
+        } else {
+                snprintf( path, len, "%s/%s", dir, name );
+        }
+        return path;
+}
+
+/*
+ * Handles one directory entry: queues subdirectories and appends accepted files to the chain at '*tail'.
+ * 'type' is the dirent type, which may be DT_UNKNOWN on filesystems that don't report one.
+ * Returns 1 if a file was appended.
+ */
+static int scan_entry( int dir_fd, char * dir, char * name, unsigned char type,
+                FILE_LIST ** head, FILE_LIST ** tail ) {
+        if( name[0] == '.' && ( name[1] == '\0' || ( name[1] == '.' && name[2] == '\0' ))) return 0;
+
+        /* Only pay for a stat when the directory listing didn't already say what this is. */
+        struct stat st;
+        int have_stat = 0;
+        if( type == DT_UNKNOWN || ( type == DT_LNK && SCAN_FOLLOW_SYMLINKS )) {
+                if( fstatat( dir_fd, name, &st, SCAN_FOLLOW_SYMLINKS ? 0 : AT_SYMLINK_NOFOLLOW ) != 0 ) return 0;
+                have_stat = 1;
+                if( S_ISDIR( st.st_mode )) type = DT_DIR;
+                else if( S_ISREG( st.st_mode )) type = DT_REG;
+                else return 0;
+        }
+
+        if( type == DT_DIR ) {
+                if( SCAN_RECURSIVE ) {
+                        char * path = scan_join( dir, name );
+                        if( path != NULL ) {
+                                SDL_LockMutex( lock );
+                                scan_push_dir( path );
+                                SDL_UnlockMutex( lock );
+                        }
+                }
+                return 0;
+        }
+        if( type != DT_REG || ! scan_filter( dir_fd, name )) return 0;
+        /* The index is matched here, relative to the open directory, so the UI thread never stats a file. */
+        if( scan_index != NULL && ! have_stat
+                        && fstatat( dir_fd, name, &st, SCAN_FOLLOW_SYMLINKS ? 0 : AT_SYMLINK_NOFOLLOW ) != 0 ) return 0;
+
+        FILE_LIST * entry = table_add( dir, name, root_len );
+        if( entry == NULL ) return 0;
+        entry->aspect = scan_aspect;
+        if( scan_match( entry, &st )) return 0;
+        if( *tail == NULL ) {
+                *head = entry;
+        } else {
+                (*tail)->next = entry;
+        }
+        *tail = entry;
+        return 1;
+}
+
+/* Reads every entry of the directory 'path', publishing files in batches as it goes. */
+static void scan_directory( char * path ) {
+        Uint64 start = SDL_GetPerformanceCounter();
+        Sint64 bytes = -1;
+        int dir_fd = open( path, O_RDONLY | O_DIRECTORY );
+        if( dir_fd < 0 ) {
+                fprintf( stderr, "WARN: Unable to open directory: %s\n", path );
+                return;
+        }
+
+        /* Symlinks and bind mounts can lead back to a directory already read. */
+        struct stat st;
+        int seen = 1;
+        if( fstat( dir_fd, &st ) == 0 ) {
+                SDL_LockMutex( lock );
+                seen = scan_visit( st.st_dev, st.st_ino );
+                SDL_UnlockMutex( lock );
+        }
+        if( seen ) {
+                close( dir_fd );
+                return;
+        }
+        /* Hand over before reading, so a watch sees anything written meanwhile. */
+        if( on_dir != NULL ) on_dir( path );
+
+        FILE_LIST * head = NULL;
+        FILE_LIST * tail = NULL;
+        int added = 0;
+#ifdef SYS_getdents64
+        /* Read the raw directory stream in large chunks; no DIR buffer or per-entry library calls. */
+        struct linux_dirent64 {
+                Uint64 d_ino;
+                Sint64 d_off;
+                unsigned short d_reclen;
+                unsigned char d_type;
+                char d_name[];
+        };
+        char buffer[64 * 1024] __attribute__(( aligned( 8 )));
+        long length;
+        bytes = 0;
+        while(( length = syscall( SYS_getdents64, dir_fd, buffer, sizeof( buffer ))) > 0 ) {
+                bytes += length;
+                for( long offset = 0; offset < length; ) {
+                        struct linux_dirent64 * ent = (struct linux_dirent64 *) ( buffer + offset );
+                        offset += ent->d_reclen;
+                        added += scan_entry( dir_fd, path, ent->d_name, ent->d_type, &head, &tail );
+                        if( added >= SCAN_BATCH ) {
+                                scan_publish( head, tail, added );
+                                head = tail = NULL;
+                                added = 0;
+                        }
+                }
+        }
+        close( dir_fd );
+#else
+        DIR * dir = fdopendir( dir_fd );
+        if( dir == NULL ) {
+                close( dir_fd );
+                return;
+        }
+        struct dirent * ent = NULL;
+        while(( ent = readdir( dir )) != NULL ) {
+                added += scan_entry( dir_fd, path, ent->d_name, ent->d_type, &head, &tail );
+                if( added >= SCAN_BATCH ) {
+                        scan_publish( head, tail, added );
+                        head = tail = NULL;
+                        added = 0;
+                }
+        }
+        closedir( dir );
+#endif
+        scan_publish( head, tail, added );
+        stats_record( stat_scan, start );
+        trace_end( "scan", start, -1, bytes );
+}
+
+static int scan_thread( void * data ) {
+        trace_thread( "scan" );
+        SDL_LockMutex( lock );
+        while( 1 ) {
+                while( dirs == NULL && reading > 0 && quit == 0 ) SDL_CondWait( work_cond, lock );
+                if( quit || dirs == NULL ) break;
+                SCAN_DIR * dir = dirs;
+                dirs = dir->next;
+                reading += 1;
+                SDL_UnlockMutex( lock );
+
+                scan_directory( dir->path );
+                free( dir->path );
+                free( dir );
+
+                SDL_LockMutex( lock );
+                reading -= 1;
+        }
+
+        /* The last worker out marks the scan complete and lets everyone else go. */
+        int last = 0;
+        if( dirs == NULL && reading == 0 && finished == 0 ) {
+                finished = 1;
+                last = 1;
+                SDL_CondBroadcast( work_cond );
+                SDL_CondBroadcast( found_cond );
+                if( SGK_DEBUG ) {
+                        printf( "DEBUG: Scan finished -- %d files, %d with cached metadata\n", SDL_AtomicGet( &count ),
+                                        scan_index != NULL ? scan_index->reused : 0 );
+                }
+        }
+        SDL_UnlockMutex( lock );
+        /* The titlebar stops reporting the scan, and changes held back until now can be applied. */
+        if( last ) scan_notify();
+
+        return 0;
+}
+
+int scan_start( char * source, char * skip, double aspect, INDEX * index, int notify,
+                void ( *dir_hook )( char * path ) ) {
+        if( SGK_DEBUG ) printf( "DEBUG: Scanning directory: %s\n", source );
+
+        lock = SDL_CreateMutex();
+        index_lock = SDL_CreateMutex();
+        work_cond = SDL_CreateCond();
+        found_cond = SDL_CreateCond();
+        if( lock == NULL || index_lock == NULL || work_cond == NULL || found_cond == NULL ) {
+                fprintf( stderr, "ERROR: Unable to create scan locks: %s\n", SDL_GetError() );
+                return 1;
+        }
+        scan_aspect = aspect;
+        root_len = strlen( source );
+        scan_index = index;
+        on_dir = dir_hook;
+        SDL_AtomicSet( &count, 0 );
+        SDL_AtomicSet( &notified, 0 );
+        if( notify ) event_type = SDL_RegisterEvents( 1 );
+
+        char * path = scan_join( source, "" );
+        if( path == NULL ) return 1;
+        path[strlen( path ) - 1] = '\0'; /* Drop the separator scan_join() added. */
+        SDL_LockMutex( lock );
+        /* Counting 'skip' as read already keeps the walk out of it, unless it is the source itself. */
+        struct stat skip_st, source_st;
+        if( skip != NULL && stat( skip, &skip_st ) == 0 && stat( source, &source_st ) == 0
+                        && ( skip_st.st_dev != source_st.st_dev || skip_st.st_ino != source_st.st_ino )) {
+                scan_visit( skip_st.st_dev, skip_st.st_ino );
+        }
+        scan_push_dir( path );
+        SDL_UnlockMutex( lock );
+
+        for( int i = 0; i < SCAN_THREADS; i++ ) {
+                workers[i] = SDL_CreateThread( scan_thread, "scan", NULL );
+                if( workers[i] == NULL ) {
+                        fprintf( stderr, "ERROR: Unable to create scan thread: %s\n", SDL_GetError() );
+                        return 1;
+                }
+        }
+
+        return 0;
+}
+
+FILE_LIST * scan_take( int wait ) {
+        SDL_LockMutex( lock );
+        SDL_AtomicSet( &notified, 0 );
+        while( wait && found_head == NULL && finished == 0 ) SDL_CondWait( found_cond, lock );
+        FILE_LIST * head = found_head;
+        FILE_LIST * tail = found_tail;
+        found_head = NULL;
+        found_tail = NULL;
+        SDL_UnlockMutex( lock );
+        if( head == NULL ) return NULL;
+
+        /* Close the chain into a loop. */
+        FILE_LIST * prev = tail;
+        for( FILE_LIST * current = head; ; current = current->next ) {
+                current->prev = prev;
+                prev = current;
+                if( current == tail ) break;
+        }
+        tail->next = head;
+
+        return head;
+}
+
+FILE_LIST * scan_file( char * dir, char * name ) {
+        int dir_fd = open( dir, O_RDONLY | O_DIRECTORY );
+        if( dir_fd < 0 ) return NULL;
+        struct stat st;
+        int wanted = fstatat( dir_fd, name, &st, SCAN_FOLLOW_SYMLINKS ? 0 : AT_SYMLINK_NOFOLLOW ) == 0
+                && S_ISREG( st.st_mode ) && scan_filter( dir_fd, name );
+        close( dir_fd );
+        if( ! wanted ) return NULL;
+
+        FILE_LIST * entry = table_add( dir, name, root_len );
+        if( entry == NULL || scan_match( entry, &st )) return NULL;
+        entry->aspect = scan_aspect;
+        entry->next = entry;
+        entry->prev = entry;
+        return entry;
+}
+
+FILE_LIST * build_file_list( char * source, double aspect ) {
+        FILE_LIST * file_list = NULL;
+
+        if( scan_start( source, NULL, aspect, NULL, 0, NULL ) == 0 ) {
+                FILE_LIST * batch = NULL;
+                while(( batch = scan_take( 1 )) != NULL ) file_list = splice_file_list( file_list, batch );
+        }
+        scan_terminate();
+
+        return file_list;
+}
+
+int scan_done( void ) {
+        if( lock == NULL ) return 1;
+        SDL_LockMutex( lock );
+        int ret_val = finished;
+        SDL_UnlockMutex( lock );
+        return ret_val;
+}
+
+int scan_count( void ) {
+        return SDL_AtomicGet( &count );
+}
+
+Uint32 scan_event_type( void ) {
+        return event_type;
+}
+
+void scan_terminate( void ) {
+        if( lock == NULL ) return;
+
+        SDL_LockMutex( lock );
+        quit = 1;
+        SDL_CondBroadcast( work_cond );
+        SDL_UnlockMutex( lock );
+        for( int i = 0; i < SCAN_THREADS; i++ ) {
+                if( workers[i] != NULL ) SDL_WaitThread( workers[i], NULL );
+                workers[i] = NULL;
+        }
+
+        /* Nobody is left to read or take these. */
+        while( dirs != NULL ) {
+                SCAN_DIR * dir = dirs;
+                dirs = dir->next;
+                free( dir->path );
+                free( dir );
+        }
+        while( found_head != NULL ) {
+                found_head->deleted = 1;
+                found_head = found_head->next;
+        }
+        found_tail = NULL;
+        free( visited );
+        visited = NULL;
+        visited_count = 0;
+        visited_capacity = 0;
+
+        SDL_DestroyCond( work_cond );
+        SDL_DestroyCond( found_cond );
+        SDL_DestroyMutex( lock );
+        SDL_DestroyMutex( index_lock );
+        work_cond = NULL;
+        found_cond = NULL;
+        lock = NULL;
+        index_lock = NULL;
+        reading = 0;
+        finished = 0;
+        quit = 0;
+        event_type = (Uint32) -1;
+        on_dir = NULL;
+}
@@ -0,0 +1,62 @@
+/* See LICENSE file for copyright and license details. */
+
+#ifndef SCAN_H
+#define SCAN_H
+
+/*
+ * Starts SCAN_THREADS threads walking the tree under 'source' (just 'source' itself unless SCAN_RECURSIVE),
+ * adding a file table entry with aspect ratio 'aspect' for every file that passes SCAN_FILTER.
+ * Directories are tracked by device and inode, so symlink loops and repeated mounts are read only once.
+ * The directory 'skip', if not NULL, is never read, so crops saved inside the source aren't found again.
+ * Entries found are matched against 'index' (if not NULL) by the scan threads, and those it knows are
+ * not images are left out. With 'notify' set, pushes a scan_event_type() event whenever new entries are
+ * ready and once the scan is complete; this requires the SDL event subsystem to be initialized. Each
+ * directory is handed to 'dir_hook' (if not NULL), such as watch_add(), on a scan thread just before it
+ * is read.
+ * Returns 1 on program-halting error, otherwise 0.
+ */
+int scan_start( char * source, char * skip, double aspect, INDEX * index, int notify,
+                void ( *dir_hook )( char * path ) );
+
+/*
+ * Returns a loop of the entries found since the last call, with cached metadata applied.
+ * With 'wait' set, blocks until some are ready, returning NULL only once the scan is complete.
+ * Without it, returns NULL when nothing is ready. Call from one thread only.
+ */
+FILE_LIST * scan_take( int wait );
+
+/*
+ * Checks the file 'name' in directory 'dir' the way the scan checks every file, and adds it to the file
+ * table. Returns it as a loop of one with cached metadata applied, ready for view_add(), or NULL if the
+ * scan would have passed it over. For files that appear after the scan is complete.
+ */
+FILE_LIST * scan_file( char * dir, char * name );
+
+/* 
+ * Builds a linked list of all files under 'source' that pass SCAN_FILTER, waiting for the whole scan.
+ * The entries live in the file table, so table_init() must be called first.
+ * Returns NULL if no items found; otherwise returns pointer to the linked list.
+ */
+FILE_LIST * build_file_list( char * source, double aspect );
+
+/*
+ * Returns 1 once every directory has been read, otherwise 0.
+ */
+int scan_done( void );
+
+/*
+ * Returns the number of files found so far that passed the filter.
+ */
+int scan_count( void );
+
+/*
+ * Returns the SDL event type pushed when new entries are ready for scan_take().
+ */
+Uint32 scan_event_type( void );
+
+/*
+ * Stops the scan threads, abandoning any directories not yet read, and marks entries never taken as deleted.
+ */
+void scan_terminate( void );
+
+#endif
@@ -5,6 +5,7 @@
 #include "config.h"
 #include "file_io.h"
 #include "sdl.h"
+#include "probe.h"
 
 int sdl_clear( SDL_POINTERS * sdl_pointers ) {
         int ret_val = 0;
@@ -20,7 +21,6 @@ int sdl_clear( SDL_POINTERS * sdl_pointers ) {
                 fprintf( stderr, "ERROR: Unable to clear renderer: %s\n", SDL_GetError() );
                 ret_val = 1;
         }
-        SDL_RenderPresent( sdl_pointers->renderer );
 
         return ret_val;
 }
@@ -80,12 +80,20 @@ int sdl_init( SDL_POINTERS * sdl_pointers ) {
                 fprintf( stderr, "ERROR: Unable to create SDL window: %s\n", SDL_GetError() );
                 ret_val = 1;
         }
+        sdl_pointers->texture = NULL;
+        sdl_pointers->damage = damage_none;
+        sdl_pointers->sel_color.r = 255;
+        sdl_pointers->sel_color.g = 255;
+        sdl_pointers->sel_color.b = 255;
+        sdl_pointers->sel_color.a = 255;
+        sdl_pointers->hud = 0;
         /* Clear window so it appears normal to user. */
         temp = sdl_clear( sdl_pointers );
         if( temp != 0 ) {
                 fprintf( stderr, "ERROR: Unable to clear SDL window: %s\n", SDL_GetError() );
                 /* Not a fatal error. Do not flag. */
         }
+        SDL_RenderPresent( sdl_pointers->renderer );
 
         return ret_val;
 }
@@ -96,16 +104,22 @@ void sdl_test( FILE_LIST * file_list, SDL_POINTERS * sdl_pointers ) {
                 if( SGK_DEBUG ) printf( " -- already tested\n" );
                 return;
         }
-        SDL_DestroyTexture( sdl_pointers->texture );
-        sdl_pointers->texture = NULL;
-        sdl_pointers->texture = IMG_LoadTexture( sdl_pointers->renderer, file_list->path );
-        if( sdl_pointers->texture == NULL ) {
+        /* 
+         * A well-formed header is enough. Formats SDL_image decodes natively are parsed directly; for the
+         * rest, ImageMagick pings the file and SDL_image checks it has a loader for it. Nothing is decoded
+         * here, so stepping never stalls on a large TIFF. draw() drops the entry later if the body turns
+         * out to be corrupt.
+         */
+        if( probe_entry( file_list ) ) {
                 if( SGK_DEBUG ) printf( " -- failure\n" );
                 del_file_from_list( file_list );
-        } else {
+        } else if( probe_sdl_native( file_list->format ) || probe_sdl_readable( file_list->path ) ) {
                 if( SGK_DEBUG ) printf( " -- success\n" );
                 file_list->valid_sdl = 1;
-                SDL_DestroyTexture( sdl_pointers->texture );
+        } else {
+                if( SGK_DEBUG ) printf( " -- failure\n" );
+                file_list->format = format_none;
+                del_file_from_list( file_list );
         }
 }
 
@@ -4,7 +4,7 @@
 #define SDL_H
 
 /* 
- * Set SDL window solid gray.
+ * Clear the SDL renderer to solid gray. The caller presents it.
  */
 int sdl_clear( SDL_POINTERS * sdl_pointers );
 
@@ -17,6 +17,8 @@ int sdl_init( SDL_POINTERS * sdl_pointers );
 /* 
  * Attempts to load the file referenced in 'file_list' with SDL.
  * On failure, removes file_list from the FILE_LIST struct loop.
+ * Files are accepted from their header alone. Formats not parsed directly are pinged with ImageMagick
+ * and must have a loader in SDL_image.
  * On success, sets file_list->valid_sdl = 1.
  */
 void sdl_test( FILE_LIST * file_list, SDL_POINTERS * sdl_pointers );
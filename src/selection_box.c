@@ -3,8 +3,18 @@
 #include "data_structures.h"
 #include "config.h"
 #include "sdl.h"
+#include "saliency.h"
 #include "selection_box.h"
 
+/* 
+ * Rounds 'offset' down to the JPEG block grid when lossless JPEG cropping applies to 'file_list'.
+ * Lossless crops can only start on a block boundary; the far edges may fall anywhere.
+ */
+static int sel_snap( int offset, int mcu, FILE_LIST * file_list ) {
+        if( LOSSLESS_JPEG_CROP && file_list->format == format_jpeg && mcu > 1 ) offset -= offset % mcu;
+        return offset;
+}
+
 void reset_sel_box( FILE_LIST * file_list ) {
         if( SGK_DEBUG ) printf( "DEBUG: Resetting selection box for file: %s\n", file_list->path );
 
@@ -21,22 +31,24 @@ void reset_sel_box( FILE_LIST * file_list ) {
                 file_list->sel_h = file_list->sel_w / file_list->aspect;
         }
 
-        /* Center selection box */
-        file_list->sel_x = ( file_list->img_w - file_list->sel_w ) / 2;
-        file_list->sel_y = ( file_list->img_h - file_list->sel_h ) / 2;
+        /* Center selection box, or move it over the busiest part of the image once it has been decoded. */
+        int x = ( file_list->img_w - file_list->sel_w ) / 2;
+        int y = ( file_list->img_h - file_list->sel_h ) / 2;
+        IMAGE * image = file_list->image;
+        if( SALIENT_SELECTION && image != NULL && image->energy_cols != NULL ) {
+                x = saliency_offset( image->energy_cols, image->energy_w, file_list->img_w, file_list->sel_w );
+                y = saliency_offset( image->energy_rows, image->energy_h, file_list->img_h, file_list->sel_h );
+        }
+        file_list->sel_x = sel_snap( x, file_list->mcu_w, file_list );
+        file_list->sel_y = sel_snap( y, file_list->mcu_h, file_list );
 }
 
-void toggle_selection_color( FILE_LIST * file_list ) {
+void toggle_selection_color( SDL_POINTERS * sdl_pointers ) {
         /* For now, we only toggle between black and white selection boxes. */
-        if( file_list->sel_r == 0 ) {
-                file_list->sel_r = 255;
-                file_list->sel_g = 255;
-                file_list->sel_b = 255;
-        } else {
-                file_list->sel_r = 0;
-                file_list->sel_g = 0;
-                file_list->sel_b = 0;
-        }
+        Uint8 value = ( sdl_pointers->sel_color.r == 0 ) ? 255 : 0;
+        sdl_pointers->sel_color.r = value;
+        sdl_pointers->sel_color.g = value;
+        sdl_pointers->sel_color.b = value;
 }
 
 void sdl_selection_rect( SDL_Rect * sel_rect, FILE_LIST * file_list, SDL_POINTERS * sdl_pointers ) {
@@ -98,6 +110,9 @@ void sel_sanitize( SDL_Rect * params, FILE_LIST * file_list ) {
         if( (params->x+params->w) > file_list->img_w ) params->x = file_list->img_w - params->w;
         if( params->x < 0 ) params->x = 0;
 
+        /* Snap the offset to the JPEG block grid when cropping losslessly. Snapping down stays in bounds. */
+        params->x = sel_snap( params->x, file_list->mcu_w, file_list );
+        params->y = sel_snap( params->y, file_list->mcu_h, file_list );
 }
 
 void sel_resize( DIRECTION dir, FILE_LIST * file_list ) {
@@ -142,6 +157,7 @@ void sel_resize( DIRECTION dir, FILE_LIST * file_list ) {
         file_list->sel_h = temp.h;
         file_list->sel_x = temp.x;
         file_list->sel_y = temp.y;
+        file_list->sel_placed = 1;
 }
 
 void sel_move( DIRECTION dir, FILE_LIST * file_list ) {
@@ -186,4 +202,5 @@ void sel_move( DIRECTION dir, FILE_LIST * file_list ) {
         /* Store temporary values as new selection box offsets. */
         file_list->sel_x = temp.x;
         file_list->sel_y = temp.y;
+        file_list->sel_placed = 1;
 }
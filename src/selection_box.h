@@ -5,14 +5,15 @@
 
 /* 
  * Set defaults for the following elements of the file_list struct: sel_h, sel_w, sel_x, sel_y.
+ * The box is centered, or with SALIENT_SELECTION placed over the busiest part of 'file_list->image' if decoded.
  * Requires that img_h and img_w are already set.
  */
 void reset_sel_box( FILE_LIST * file_list );
 
 /* 
- * Toggles selection box color as stored in file_list.
+ * Toggles selection box color as stored in sdl_pointers. The color applies to every image.
  */
-void toggle_selection_color( FILE_LIST * file_list );
+void toggle_selection_color( SDL_POINTERS * sdl_pointers );
 
 /* 
  * Populates 'sel_rect' with dimensions and offset from 'file_list', but scaled to
@@ -22,7 +23,7 @@ void sdl_selection_rect( SDL_Rect * sel_rect, FILE_LIST * file_list, SDL_POINTER
 
 /*
  * Modifies scaled selection box rectangle 'params' such that it respects SDL window dimensions
- * and boundaries for a given image 'file_list'.
+ * and boundaries for a given image 'file_list'. With LOSSLESS_JPEG_CROP, JPEG offsets snap to the block grid.
  */
 void sel_sanitize( SDL_Rect * params, FILE_LIST * file_list );
 
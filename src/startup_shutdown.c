@@ -5,9 +5,24 @@
 #include "data_structures.h"
 #include "config.h"
 #include "file_io.h"
+#include "file_list.h"
 #include "sdl.h"
 #include "imagick.h"
 #include "misc.h"
+#include "image.h"
+#include "index.h"
+#include "ladder.h"
+#include "prefetch.h"
+#include "processed.h"
+#include "save.h"
+#include "scan.h"
+#include "table.h"
+#include "view.h"
+#include "validate.h"
+#include "cache.h"
+#include "stats.h"
+#include "trace.h"
+#include "watch.h"
 #include "startup_shutdown.h"
 
 void initialize( INIT_POINTERS * init_pointers, int argc, char * argv[] ) {
@@ -17,6 +32,11 @@ void initialize( INIT_POINTERS * init_pointers, int argc, char * argv[] ) {
                 print_usage(argv);
                 exit(EXIT_FAILURE);
         }
+        /* Start tracing if asked to, before any other thread exists. */
+        if( trace_init() ) {
+                fprintf( stderr, "ERROR: Unable to start tracing.\n" );
+                exit(EXIT_FAILURE);
+        }
         /* Malloc space to hold the command line arguements struct. */
         init_pointers->cmd_line_args = malloc(sizeof(CMD_LINE_ARGS));
         if( init_pointers->cmd_line_args == NULL ) {
@@ -28,22 +48,38 @@ void initialize( INIT_POINTERS * init_pointers, int argc, char * argv[] ) {
                 fprintf( stderr, "ERROR: Unable to process command line arguments.\n" );
                 exit(EXIT_FAILURE);
         }
-        /* Build the list of images in 'source' command line argument. */
-        init_pointers->file_list = build_file_list( init_pointers->cmd_line_args->src, 
-                        init_pointers->cmd_line_args->aspect );
-        if( init_pointers->file_list == NULL ) {
-                fprintf( stderr, "ERROR: Failed to build list of files.\n" );
+        /* Note which images already have a crop, once, so the view never has to look. */
+        if( processed_init( init_pointers->cmd_line_args->dst, init_pointers->cmd_line_args->src,
+                                init_pointers->cmd_line_args->ladder, init_pointers->cmd_line_args->ladder_count ) ) {
+                fprintf( stderr, "ERROR: Unable to read destination directory.\n" );
                 exit(EXIT_FAILURE);
         }
-        /* Check (print) the files in file_list. */
-        if( SGK_DEBUG ) {
-                printf( "DEBUG: Files in file list:\n" );
-                FILE_LIST * start = init_pointers->file_list;
-                FILE_LIST * current = init_pointers->file_list;
-                do {
-                        printf( "DEBUG:  -- %s\n", current->path );
-                        current = current->next;
-                } while ( current != start );
+        /* Reserve the table holding every file entry. */
+        if( table_init() ) {
+                fprintf( stderr, "ERROR: Unable to create file table.\n" );
+                exit(EXIT_FAILURE);
+        }
+        /* Reuse metadata cached by earlier runs for files that haven't changed. */
+        init_pointers->index = index_load( init_pointers->cmd_line_args->src, init_pointers->cmd_line_args->aspect );
+        /* The watcher and the scan push events from their first moment, so the queue must exist before them. */
+        if( SDL_InitSubSystem( SDL_INIT_EVENTS ) ) {
+                fprintf( stderr, "ERROR: Unable to initialize SDL events: %s\n", SDL_GetError() );
+                exit(EXIT_FAILURE);
+        }
+        /* 
+         * Start watching for changes, so the scan can watch each directory as it reads it. The destination
+         * is passed over if it lies inside the source.
+         */
+        if( watch_init( init_pointers->cmd_line_args->dst ) ) {
+                fprintf( stderr, "ERROR: Unable to watch source directory %s for changes outside of %s.\n",
+                                init_pointers->cmd_line_args->src, init_pointers->cmd_line_args->dst );
+                exit(EXIT_FAILURE);
+        }
+        /* Start reading the 'source' command line argument. It runs on while SDL starts up. */
+        if( scan_start( init_pointers->cmd_line_args->src, init_pointers->cmd_line_args->dst,
+                                init_pointers->cmd_line_args->aspect, init_pointers->index, 1, watch_add ) ) {
+                fprintf( stderr, "ERROR: Failed to build list of files.\n" );
+                exit(EXIT_FAILURE);
         }
         /* Malloc space to hold the SDL pointers struct. */
         init_pointers->sdl_pointers = malloc(sizeof(SDL_POINTERS));
@@ -56,11 +92,59 @@ void initialize( INIT_POINTERS * init_pointers, int argc, char * argv[] ) {
                 fprintf( stderr, "ERROR: Unable to initialize SDL.\n" );
                 exit(EXIT_FAILURE);
         }
+        /* Start the background decoder */
+        if( prefetch_init() ) {
+                fprintf( stderr, "ERROR: Unable to start background decoder.\n" );
+                exit(EXIT_FAILURE);
+        }
         /* Initialize ImageMagick */
         if( imagick_init() ) {
                 fprintf( stderr, "ERROR: Unable to initialize ImageMagick.\n" );
                 exit(EXIT_FAILURE);
         }
+        /* Start checking headers around the cursor. Requires ImageMagick and the file table. */
+        if( validate_init() ) {
+                fprintf( stderr, "ERROR: Unable to start background validator.\n" );
+                exit(EXIT_FAILURE);
+        }
+        /* Start the background writers. Requires ImageMagick. */
+        if( save_init() ) {
+                fprintf( stderr, "ERROR: Unable to start background writers.\n" );
+                exit(EXIT_FAILURE);
+        }
+        /* Wait for the first images only. The rest of the list arrives in the background. */
+        view_init( init_pointers->cmd_line_args->aspect );
+        FILE_LIST * batch = NULL;
+        while( init_pointers->file_list == NULL && ( batch = scan_take( 1 )) != NULL ) {
+                init_pointers->file_list = view_add( NULL, batch );
+        }
+        if( init_pointers->file_list == NULL ) {
+                fprintf( stderr, "ERROR: No images found in source directory.\n" );
+                exit(EXIT_FAILURE);
+        }
+        /* Resume where the last session ended. Only the part of the scan up to that image is waited for. */
+        char * resume = RESUME_SESSION ? index_cursor( init_pointers->index ) : NULL;
+        if( resume != NULL ) {
+                FILE_LIST * target = view_find( resume );
+                while( target == NULL && ( batch = scan_take( 1 )) != NULL ) {
+                        init_pointers->file_list = view_add( init_pointers->file_list, batch );
+                        target = view_find( resume );
+                }
+                if( target != NULL && target->view_pos >= 0 ) init_pointers->file_list = target;
+                if( SGK_DEBUG ) printf( "DEBUG: Resuming at %s -- %s\n", resume, target != NULL ? "found" : "gone" );
+                free( resume );
+        }
+        validate_update( init_pointers->file_list );
+        /* Check (print) the files in file_list. */
+        if( SGK_DEBUG ) {
+                printf( "DEBUG: Files in first batch of file list:\n" );
+                FILE_LIST * start = init_pointers->file_list;
+                FILE_LIST * current = init_pointers->file_list;
+                do {
+                        printf( "DEBUG:  -- %s\n", current->path );
+                        current = current->next;
+                } while ( current != start );
+        }
 }
 
 int process_argv( CMD_LINE_ARGS * cmd_line_args, char ** argv ) {
@@ -81,34 +165,57 @@ int process_argv( CMD_LINE_ARGS * cmd_line_args, char ** argv ) {
         cmd_line_args->dst = sanitize_path( argv[2] );
         if( cmd_line_args->dst == NULL ) ret_val = 1;
 
+        /* Extra output sizes come from the configuration. */
+        if( ladder_parse( EXPORT_LADDER, &cmd_line_args->ladder, &cmd_line_args->ladder_count ) ) ret_val = 1;
+
         if( SGK_DEBUG ) {
                 printf( "DEBUG: Processing command line arguments.\n" );
                 printf( "DEBUG:  -- Aspect Ratio = %f\n", cmd_line_args->aspect );
                 printf( "DEBUG:  -- Source = %s\n", cmd_line_args->src );
                 printf( "DEBUG:  -- Destination = %s\n", cmd_line_args->dst );
+                printf( "DEBUG:  -- Export sizes = %d\n", cmd_line_args->ladder_count );
         }
 
         return ret_val;
 }
 
-void terminate( CMD_LINE_ARGS * cmd_line_args, FILE_LIST * file_list, SDL_POINTERS * sdl_pointers ) {
+void terminate( CMD_LINE_ARGS * cmd_line_args, FILE_LIST * file_list, SDL_POINTERS * sdl_pointers, INDEX * index ) {
+        /* Let queued saves finish before anything they use goes away. */
+        save_terminate();
+        /* Abandon whatever part of the tree has not been read yet, and any headers not yet checked. */
+        scan_terminate();
+        validate_terminate();
+        watch_terminate();
+
+        /* Remember what was learned about each file for the next run, including files the view left out. */
+        index_set_cursor( index, file_list );
+        file_list = view_all();
+        index_save( index, file_list );
+        index_free( index );
+        view_terminate();
+
         /* Free memory related to command line arguments. */
         free( cmd_line_args->src );
         free( cmd_line_args->dst );
+        ladder_free( cmd_line_args->ladder, cmd_line_args->ladder_count );
         free( cmd_line_args );
 
-        /* Free memory related to list of files. */
-        FILE_LIST * current = file_list->next;
-        file_list->next = NULL;
-        while( current->next != NULL ) {
-                free( current->path );
-                free( current->file );
-                current = current->next;
-                free( current->prev );
+        /* Free memory related to list of files. Only decoded images are held outside the table. */
+        for( int id = 0; id < table_count(); id++ ) {
+                image_free( table_get( id )->image );
         }
+        table_terminate();
+        processed_terminate();
+
+        /* Stop the background decoder. */
+        prefetch_terminate();
+
+        /* Every other thread is gone, so the trace and the latency figures are complete. */
+        trace_terminate();
+        if( STATS_SUMMARY ) stats_summary( stdout );
 
-        /* Terminate SDL. */
-        SDL_DestroyTexture( sdl_pointers->texture );
+        /* Terminate SDL. The displayed texture belongs to the cache. */
+        cache_terminate();
         sdl_pointers->texture = NULL;
         SDL_DestroyRenderer( sdl_pointers->renderer );
         sdl_pointers->renderer = NULL;
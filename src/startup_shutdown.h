@@ -16,9 +16,9 @@ void initialize( INIT_POINTERS * init_pointers, int argc, char * argv[] );
 int process_argv( CMD_LINE_ARGS * cmd_line_args, char ** argv );
 
 /* 
- * Frees relevant memory and prepares program for imminent termination.
+ * Saves the metadata index, frees relevant memory and prepares program for imminent termination.
  * No return since we intend to exit promptly after this function is finished.
  */
-void terminate( CMD_LINE_ARGS * cmd_line_args, FILE_LIST * file_list, SDL_POINTERS * sdl_pointers );
+void terminate( CMD_LINE_ARGS * cmd_line_args, FILE_LIST * file_list, SDL_POINTERS * sdl_pointers, INDEX * index );
 
 #endif
@@ -0,0 +1,111 @@
+/* See LICENSE file for copyright and license details. */
+
+#include <limits.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include "data_structures.h"
+#include "config.h"
+#include "stats.h"
+
+/*
+ * Samples are counted in microseconds, in buckets laid out like an HDR histogram: values below 32 get a
+ * bucket each, and every power of two above that is split into 16 equal buckets. Any value is then
+ * known to within 1/16 of itself, and 640 buckets reach past a hundred days.
+ */
+#define STATS_SUB_BITS 4
+#define STATS_SUB (1 << STATS_SUB_BITS)
+#define STATS_BUCKETS 640
+
+static const char * stage_names[stat_count] = { "scan", "probe", "decode", "upload", "frame", "save" };
+static SDL_atomic_t buckets[stat_count][STATS_BUCKETS];
+static SDL_atomic_t last_us[stat_count];        /* Latest sample + 1, so that 0 means none yet */
+static SDL_atomic_t counters[counter_count];
+
+static int stats_bucket( Uint64 us ) {
+        if( us < 2 * STATS_SUB ) return (int) us;
+        int msb = 63 - __builtin_clzll( us );
+        int shift = msb - STATS_SUB_BITS;
+        int bucket = ( shift + 1 ) * STATS_SUB + (int) ( us >> shift ) - STATS_SUB;
+        return bucket < STATS_BUCKETS ? bucket : STATS_BUCKETS - 1;
+}
+
+/* Returns the largest value counted in 'bucket'. */
+static double stats_bucket_max( int bucket ) {
+        if( bucket < 2 * STATS_SUB ) return bucket;
+        int shift = bucket / STATS_SUB - 1;
+        Uint64 low = (Uint64) ( bucket % STATS_SUB + STATS_SUB ) << shift;
+        return low + ( (Uint64) 1 << shift ) - 1;
+}
+
+void stats_record( STATS_STAGE stage, Uint64 start ) {
+        Uint64 us = ( SDL_GetPerformanceCounter() - start ) * 1000000.0 / SDL_GetPerformanceFrequency();
+        SDL_AtomicAdd( &buckets[stage][stats_bucket( us )], 1 );
+        SDL_AtomicSet( &last_us[stage], us < INT_MAX ? (int) us + 1 : INT_MAX );
+}
+
+void stats_count( STATS_COUNTER counter ) {
+        SDL_AtomicAdd( &counters[counter], 1 );
+}
+
+double stats_last_ms( STATS_STAGE stage ) {
+        int last = SDL_AtomicGet( &last_us[stage] );
+        return last == 0 ? -1.0 : ( last - 1 ) / 1000.0;
+}
+
+double stats_hit_rate( STATS_COUNTER hit, STATS_COUNTER miss ) {
+        int hits = SDL_AtomicGet( &counters[hit] );
+        int total = hits + SDL_AtomicGet( &counters[miss] );
+        return total == 0 ? -1.0 : 100.0 * hits / total;
+}
+
+long stats_rss_kb( void ) {
+        /* The second field is the resident size in pages. Without /proc, settle for the peak. */
+        long pages = 0;
+        FILE * file = fopen( "/proc/self/statm", "r" );
+        if( file != NULL ) {
+                if( fscanf( file, "%*d %ld", &pages ) != 1 ) pages = 0;
+                fclose( file );
+        }
+        if( pages > 0 ) return pages * ( sysconf( _SC_PAGESIZE ) / 1024 );
+
+        struct rusage usage;
+        getrusage( RUSAGE_SELF, &usage );
+        return usage.ru_maxrss;
+}
+
+void stats_summary( FILE * file ) {
+        static const double quantiles[] = { 0.50, 0.90, 0.99 };
+        int header = 0;
+        for( int stage = 0; stage < stat_count; stage++ ) {
+                /* Copy first; other threads may still be recording. */
+                int counts[STATS_BUCKETS];
+                long total = 0;
+                int max = 0;
+                for( int i = 0; i < STATS_BUCKETS; i++ ) {
+                        counts[i] = SDL_AtomicGet( &buckets[stage][i] );
+                        total += counts[i];
+                        if( counts[i] > 0 ) max = i;
+                }
+                if( total == 0 ) continue;
+
+                if( ! header ) {
+                        fprintf( file, "%-8s %10s %10s %10s %10s %10s   (ms)\n", "stage", "count", "p50", "p90", "p99", "max" );
+                        header = 1;
+                }
+                fprintf( file, "%-8s %10ld", stage_names[stage], total );
+                for( int q = 0; q < (int) ( sizeof( quantiles ) / sizeof( quantiles[0] )); q++ ) {
+                        long rank = (long) ( quantiles[q] * total + 0.5 );
+                        if( rank < 1 ) rank = 1;
+                        long seen = 0;
+                        int i = 0;
+                        while(( seen += counts[i] ) < rank ) i++;
+                        fprintf( file, " %10.3f", stats_bucket_max( i ) / 1000.0 );
+                }
+                fprintf( file, " %10.3f\n", stats_bucket_max( max ) / 1000.0 );
+        }
+
+        double prefetch = stats_hit_rate( counter_prefetch_hit, counter_prefetch_miss );
+        double cache = stats_hit_rate( counter_cache_hit, counter_cache_miss );
+        if( prefetch >= 0 ) fprintf( file, "prefetch hit rate %.1f%%\n", prefetch );
+        if( cache >= 0 ) fprintf( file, "texture cache hit rate %.1f%%\n", cache );
+}
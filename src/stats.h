@@ -0,0 +1,41 @@
+/* See LICENSE file for copyright and license details. */
+
+#ifndef STATS_H
+#define STATS_H
+
+/*
+ * Latency histograms per stage and hit counters, always on. Every function is safe to call from any
+ * thread and none of them block.
+ */
+
+/*
+ * Records a sample for 'stage' lasting from 'start', a performance counter reading, until now.
+ */
+void stats_record( STATS_STAGE stage, Uint64 start );
+
+/*
+ * Adds one to 'counter'.
+ */
+void stats_count( STATS_COUNTER counter );
+
+/*
+ * Returns the latest sample of 'stage' in milliseconds, or -1 if there is none yet.
+ */
+double stats_last_ms( STATS_STAGE stage );
+
+/*
+ * Returns 'hit' as a percentage of 'hit' plus 'miss', or -1 if both are still 0.
+ */
+double stats_hit_rate( STATS_COUNTER hit, STATS_COUNTER miss );
+
+/*
+ * Returns the resident set size of this process in kilobytes.
+ */
+long stats_rss_kb( void );
+
+/*
+ * Prints count, percentiles and maximum of every stage with samples to 'file'.
+ */
+void stats_summary( FILE * file );
+
+#endif
@@ -0,0 +1,278 @@
+/* See LICENSE file for copyright and license details. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <setjmp.h>
+#include <string.h>
+#include <strings.h>
+#include <jpeglib.h>
+#include <png.h>
+#include "wand/magick_wand.h"
+#include "data_structures.h"
+#include "config.h"
+#include "jpeg_crop.h"
+#include "probe.h"
+#include "stream_crop.h"
+
+/*
+ * Everything one crop holds, on the heap so that it survives the longjmp() out of a libjpeg or libpng
+ * error. Either library may sit on either side, and both report fatal errors by jumping to 'escape'.
+ */
+struct stream_crop {
+        jmp_buf escape;
+        FILE * src_file;
+        FILE * dst_file;
+        unsigned char * row;                    /* One decoded source row */
+        int row_offset;                         /* Bytes from the start of 'row' to the region */
+        int channels;                           /* Samples per pixel in 'row': 1 to 4 */
+        struct jpeg_decompress_struct jpeg_src;
+        struct jpeg_error_mgr jpeg_src_err;
+        int jpeg_src_created;
+        struct jpeg_compress_struct jpeg_dst;
+        struct jpeg_error_mgr jpeg_dst_err;
+        int jpeg_dst_created;
+        png_structp png_src;
+        png_infop png_src_info;
+        png_structp png_dst;
+        png_infop png_dst_info;
+};
+
+static void stream_crop_jpeg_error( j_common_ptr cinfo ) {
+        struct stream_crop * crop = cinfo->client_data;
+        if( SGK_DEBUG ) ( *cinfo->err->output_message )( cinfo );
+        longjmp( crop->escape, 1 );
+}
+
+static void stream_crop_png_error( png_structp png, png_const_charp message ) {
+        struct stream_crop * crop = png_get_error_ptr( png );
+        if( SGK_DEBUG ) printf( "DEBUG: libpng: %s\n", message );
+        longjmp( crop->escape, 1 );
+}
+
+static void stream_crop_png_warning( png_structp png, png_const_charp message ) {
+        if( SGK_DEBUG ) printf( "DEBUG: libpng: %s\n", message );
+}
+
+/*
+ * Releases everything in 'crop'. A failed crop also removes whatever was written to 'dest_path'.
+ * Returns 1 if the crop failed or the destination couldn't be closed, otherwise 0.
+ */
+static int stream_crop_free( struct stream_crop * crop, char * dest_path, int failed ) {
+        if( crop->jpeg_dst_created ) jpeg_destroy_compress( &crop->jpeg_dst );
+        if( crop->jpeg_src_created ) jpeg_destroy_decompress( &crop->jpeg_src );
+        if( crop->png_dst != NULL ) png_destroy_write_struct( &crop->png_dst, &crop->png_dst_info );
+        if( crop->png_src != NULL ) png_destroy_read_struct( &crop->png_src, &crop->png_src_info, NULL );
+        if( crop->src_file != NULL ) fclose( crop->src_file );
+        if( crop->dst_file != NULL && fclose( crop->dst_file ) != 0 ) failed = 1;
+        if( failed && crop->dst_file != NULL ) remove( dest_path );
+        free( crop->row );
+        free( crop );
+        return failed;
+}
+
+/*
+ * Opens the JPEG source and moves to the first row of the region. With libjpeg-turbo only the iMCU
+ * columns covering the region are decoded and the rows above it are skipped by entropy decoding alone.
+ * Returns 1 if the source can't be streamed here, otherwise 0.
+ */
+static int stream_crop_jpeg_open( struct stream_crop * crop, int keep_markers, int x, int y, int w, int h ) {
+        struct jpeg_decompress_struct * src = &crop->jpeg_src;
+        src->err = jpeg_std_error( &crop->jpeg_src_err );
+        crop->jpeg_src_err.error_exit = stream_crop_jpeg_error;
+        jpeg_create_decompress( src );
+        crop->jpeg_src_created = 1;
+        src->client_data = crop;
+        jpeg_stdio_src( src, crop->src_file );
+        if( keep_markers ) {
+                jpeg_save_markers( src, JPEG_COM, 0xFFFF );
+                for( int m = 0; m < 16; m++ ) jpeg_save_markers( src, JPEG_APP0 + m, 0xFFFF );
+        }
+        jpeg_read_header( src, TRUE );
+        if( (JDIMENSION) ( x + w ) > src->image_width || (JDIMENSION) ( y + h ) > src->image_height ) return 1;
+
+        /* CMYK and YCCK sources are left to ImageMagick, which knows what to do with their profiles. */
+        if( src->jpeg_color_space == JCS_GRAYSCALE ) {
+                src->out_color_space = JCS_GRAYSCALE;
+        } else if( src->jpeg_color_space == JCS_YCbCr || src->jpeg_color_space == JCS_RGB ) {
+                src->out_color_space = JCS_RGB;
+        } else {
+                return 1;
+        }
+        jpeg_start_decompress( src );
+
+        JDIMENSION offset = 0;
+#ifdef LIBJPEG_TURBO_VERSION
+        offset = x;
+        JDIMENSION width = w;
+        jpeg_crop_scanline( src, &offset, &width );
+#endif
+        crop->channels = src->output_components;
+        crop->row_offset = ( x - offset ) * crop->channels;
+        crop->row = malloc( (size_t) src->output_width * src->output_components );
+        if( crop->row == NULL ) return 1;
+#ifdef LIBJPEG_TURBO_VERSION
+        if( y > 0 ) jpeg_skip_scanlines( src, y );
+#else
+        for( int r = 0; r < y; r++ ) jpeg_read_scanlines( src, &crop->row, 1 );
+#endif
+        return 0;
+}
+
+/*
+ * Opens the PNG source and reads past the rows above the region. Interlaced images spread every row
+ * over seven passes, so they can't be streamed. Alpha is dropped when writing JPEG.
+ * Returns 1 if the source can't be streamed here, otherwise 0.
+ */
+static int stream_crop_png_open( struct stream_crop * crop, int keep_alpha, int x, int y, int w, int h ) {
+        crop->png_src = png_create_read_struct( PNG_LIBPNG_VER_STRING, crop,
+                        stream_crop_png_error, stream_crop_png_warning );
+        if( crop->png_src == NULL ) return 1;
+        crop->png_src_info = png_create_info_struct( crop->png_src );
+        if( crop->png_src_info == NULL ) return 1;
+        png_init_io( crop->png_src, crop->src_file );
+        png_read_info( crop->png_src, crop->png_src_info );
+        if( (png_uint_32) ( x + w ) > png_get_image_width( crop->png_src, crop->png_src_info )
+                        || (png_uint_32) ( y + h ) > png_get_image_height( crop->png_src, crop->png_src_info )
+                        || png_get_interlace_type( crop->png_src, crop->png_src_info ) != PNG_INTERLACE_NONE ) {
+                return 1;
+        }
+
+        /* Palettes and low bit depths become 8 bit gray or RGB, and transparency an alpha channel. */
+        png_set_expand( crop->png_src );
+        png_set_strip_16( crop->png_src );
+        if( ! keep_alpha ) png_set_strip_alpha( crop->png_src );
+        png_read_update_info( crop->png_src, crop->png_src_info );
+
+        crop->channels = png_get_channels( crop->png_src, crop->png_src_info );
+        crop->row_offset = x * crop->channels;
+        crop->row = malloc( png_get_rowbytes( crop->png_src, crop->png_src_info ));
+        if( crop->row == NULL ) return 1;
+        for( int r = 0; r < y; r++ ) png_read_row( crop->png_src, crop->row, NULL );
+        return 0;
+}
+
+/* Returns the quality 'path' was saved at, so the crop doesn't change it, or ImageMagick's default. */
+static int stream_crop_quality( char * path ) {
+        size_t quality = 0;
+        MagickWand * ping_wand = NewMagickWand();
+        if( MagickPingImage( ping_wand, path ) == MagickTrue ) quality = MagickGetImageCompressionQuality( ping_wand );
+        DestroyMagickWand( ping_wand );
+        return quality > 0 && quality <= 100 ? (int) quality : 92;
+}
+
+/* Starts the JPEG destination, copying the source's metadata markers when it is a JPEG too. */
+static void stream_crop_jpeg_start( struct stream_crop * crop, char * path, int w, int h ) {
+        struct jpeg_compress_struct * dst = &crop->jpeg_dst;
+        dst->err = jpeg_std_error( &crop->jpeg_dst_err );
+        crop->jpeg_dst_err.error_exit = stream_crop_jpeg_error;
+        jpeg_create_compress( dst );
+        crop->jpeg_dst_created = 1;
+        dst->client_data = crop;
+        jpeg_stdio_dest( dst, crop->dst_file );
+        dst->image_width = w;
+        dst->image_height = h;
+        dst->input_components = crop->channels;
+        dst->in_color_space = crop->channels == 1 ? JCS_GRAYSCALE : JCS_RGB;
+        jpeg_set_defaults( dst );
+        jpeg_set_quality( dst, stream_crop_quality( path ), TRUE );
+        jpeg_start_compress( dst, TRUE );
+
+        if( ! crop->jpeg_src_created ) return;
+        jpeg_saved_marker_ptr marker = crop->jpeg_src.marker_list;
+        for( ; marker != NULL; marker = marker->next ) {
+                if( dst->write_JFIF_header && marker->marker == JPEG_APP0 && marker->data_length >= 5
+                                && memcmp( marker->data, "JFIF", 5 ) == 0 ) continue;
+                if( dst->write_Adobe_marker && marker->marker == JPEG_APP0 + 14 && marker->data_length >= 5
+                                && memcmp( marker->data, "Adobe", 5 ) == 0 ) continue;
+                jpeg_write_marker( dst, marker->marker, marker->data, marker->data_length );
+        }
+}
+
+static int stream_crop_png_start( struct stream_crop * crop, int w, int h ) {
+        static const int color_types[] = { PNG_COLOR_TYPE_GRAY, PNG_COLOR_TYPE_GRAY_ALPHA,
+                        PNG_COLOR_TYPE_RGB, PNG_COLOR_TYPE_RGB_ALPHA };
+        crop->png_dst = png_create_write_struct( PNG_LIBPNG_VER_STRING, crop,
+                        stream_crop_png_error, stream_crop_png_warning );
+        if( crop->png_dst == NULL ) return 1;
+        crop->png_dst_info = png_create_info_struct( crop->png_dst );
+        if( crop->png_dst_info == NULL ) return 1;
+        png_init_io( crop->png_dst, crop->dst_file );
+        png_set_IHDR( crop->png_dst, crop->png_dst_info, w, h, 8, color_types[crop->channels - 1],
+                        PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT );
+        png_write_info( crop->png_dst, crop->png_dst_info );
+        return 0;
+}
+
+int stream_crop( char * path, char * dest_path, int x, int y, int w, int h ) {
+        if( x < 0 || y < 0 || w <= 0 || h <= 0 ) return 1;
+        int dst_jpeg = jpeg_crop_extension( dest_path );
+        char * dot = strrchr( dest_path, '.' );
+        if( ! dst_jpeg && ( dot == NULL || strcasecmp( dot, ".png" ) != 0 )) return 1;
+
+        struct stream_crop * crop = calloc( 1, sizeof( struct stream_crop ));
+        if( crop == NULL ) return 1;
+        crop->src_file = fopen( path, "rb" );
+        if( crop->src_file == NULL ) {
+                free( crop );
+                return 1;
+        }
+        unsigned char signature[16];
+        size_t length = fread( signature, 1, sizeof( signature ), crop->src_file );
+        IMAGE_FORMAT format = probe_signature( signature, length );
+        rewind( crop->src_file );
+
+        /* Anything below may jump straight back here. */
+        if( setjmp( crop->escape )) {
+                stream_crop_free( crop, dest_path, 1 );
+                return 1;
+        }
+
+        int ret_val = 1;
+        if( format == format_jpeg ) {
+                ret_val = stream_crop_jpeg_open( crop, dst_jpeg, x, y, w, h );
+        } else if( format == format_png ) {
+                ret_val = stream_crop_png_open( crop, ! dst_jpeg, x, y, w, h );
+        }
+        if( ret_val != 0 ) {
+                stream_crop_free( crop, dest_path, 1 );
+                return 1;
+        }
+
+        crop->dst_file = fopen( dest_path, "wb" );
+        if( crop->dst_file == NULL ) {
+                fprintf( stderr, "WARN: Unable to open %s for writing.\n", dest_path );
+                stream_crop_free( crop, dest_path, 1 );
+                return 1;
+        }
+        if( dst_jpeg ) {
+                stream_crop_jpeg_start( crop, path, w, h );
+        } else if( stream_crop_png_start( crop, w, h ) != 0 ) {
+                stream_crop_free( crop, dest_path, 1 );
+                return 1;
+        }
+
+        /* One row in, one row out. */
+        unsigned char * region = crop->row + crop->row_offset;
+        for( int r = 0; r < h; r++ ) {
+                if( crop->jpeg_src_created ) {
+                        jpeg_read_scanlines( &crop->jpeg_src, &crop->row, 1 );
+                } else {
+                        png_read_row( crop->png_src, crop->row, NULL );
+                }
+                if( dst_jpeg ) {
+                        jpeg_write_scanlines( &crop->jpeg_dst, &region, 1 );
+                } else {
+                        png_write_row( crop->png_dst, region );
+                }
+        }
+
+        /* The rows below the region are never read, so the source is abandoned rather than finished. */
+        if( dst_jpeg ) {
+                jpeg_finish_compress( &crop->jpeg_dst );
+        } else {
+                png_write_end( crop->png_dst, NULL );
+        }
+        if( crop->jpeg_src_created ) jpeg_abort_decompress( &crop->jpeg_src );
+
+        return stream_crop_free( crop, dest_path, 0 );
+}
@@ -0,0 +1,17 @@
+/* See LICENSE file for copyright and license details. */
+
+#ifndef STREAM_CROP_H
+#define STREAM_CROP_H
+
+/*
+ * Crops the image at 'path' to the 'w'x'h' region at 'x','y' and writes it to 'dest_path', one row at a
+ * time, so that no more than a row of the source is ever held in memory. Rows above the region are
+ * skipped without being fully decoded where libjpeg-turbo allows it, and so are columns beside it.
+ * Handles JPEG and non-interlaced PNG sources, written to a '.jpg' or '.png' 'dest_path'; 16 bit PNG
+ * samples are reduced to 8 bits. JPEG metadata markers are carried over.
+ * Returns 1 if the crop does not apply or fails, in which case nothing is left at 'dest_path'.
+ * Safe to call from any thread.
+ */
+int stream_crop( char * path, char * dest_path, int x, int y, int w, int h );
+
+#endif
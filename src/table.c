@@ -0,0 +1,99 @@
+/* See LICENSE file for copyright and license details. */
+
+#include <unistd.h>
+#include <sys/mman.h>
+#include "data_structures.h"
+#include "config.h"
+#include "file_list.h"
+#include "table.h"
+
+/*
+ * Entries and their path strings live in one anonymous mapping: FILE_TABLE_MAX records, then the string
+ * pool. Nothing is ever moved or freed individually, so pointers to entries stay valid for the whole run
+ * and an id is simply an index into 'records'. Records are whole FILE_LIST structs rather than per-field
+ * arrays, and the list is still walked through their 'next' and 'prev' pointers rather than by index.
+ */
+static SDL_mutex * lock = NULL;
+static void * arena = NULL;
+static size_t arena_size = 0;
+static FILE_LIST * records = NULL;
+static char * pool = NULL;
+static size_t pool_size = 0;
+static size_t pool_used = 0;    /* Protected by 'lock' */
+static int added = 0;           /* Protected by 'lock' */
+static SDL_atomic_t count;      /* Copy of 'added' for readers */
+
+int table_init( void ) {
+        if( arena != NULL ) return 0;
+
+        size_t page = sysconf( _SC_PAGESIZE );
+        size_t records_size = ( (size_t) FILE_TABLE_MAX * sizeof( FILE_LIST ) + page - 1 ) / page * page;
+        pool_size = (size_t) FILE_TABLE_POOL_MB * 1024 * 1024;
+        arena_size = records_size + pool_size;
+        arena = mmap( NULL, arena_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0 );
+        if( arena == MAP_FAILED ) {
+                fprintf( stderr, "ERROR: Unable to map %zu bytes for file table.\n", arena_size );
+                arena = NULL;
+                return 1;
+        }
+        records = arena;
+        pool = (char *) arena + records_size;
+        pool_used = 0;
+        added = 0;
+        SDL_AtomicSet( &count, 0 );
+
+        lock = SDL_CreateMutex();
+        if( lock == NULL ) {
+                fprintf( stderr, "ERROR: Unable to create file table lock: %s\n", SDL_GetError() );
+                return 1;
+        }
+
+        return 0;
+}
+
+FILE_LIST * table_add( char * dir, char * name, int root_len ) {
+        size_t dir_len = strlen( dir );
+        size_t len = dir_len + 1 + strlen( name ) + 1; /* +2 for '/' separator and '\0' */
+
+        SDL_LockMutex( lock );
+        if( added >= FILE_TABLE_MAX || pool_used + len > pool_size ) {
+                SDL_UnlockMutex( lock );
+                fprintf( stderr, "ERROR: File table full. Skipping: %s/%s\n", dir, name );
+                return NULL;
+        }
+        FILE_LIST * ent = &records[added];
+        clear_filelist_struct( ent );
+        ent->path = pool + pool_used;
+        snprintf( ent->path, len, "%s/%s", dir, name );
+        ent->file = ent->path + dir_len + 1;
+        ent->name = ( (size_t) root_len <= dir_len ) ? ent->path + root_len + 1 : ent->file;
+        ent->id = added;
+        added += 1;
+        pool_used += len;
+        /* Readers only ever see entries that are filled in. */
+        SDL_AtomicSet( &count, added );
+        SDL_UnlockMutex( lock );
+
+        return ent;
+}
+
+FILE_LIST * table_get( int id ) {
+        if( id < 0 || id >= SDL_AtomicGet( &count )) return NULL;
+        return &records[id];
+}
+
+int table_count( void ) {
+        return SDL_AtomicGet( &count );
+}
+
+void table_terminate( void ) {
+        if( arena == NULL ) return;
+
+        if( SGK_DEBUG ) printf( "DEBUG: Freeing file table -- %d entries, %zu bytes of paths\n", added, pool_used );
+        munmap( arena, arena_size );
+        arena = NULL;
+        records = NULL;
+        pool = NULL;
+        SDL_DestroyMutex( lock );
+        lock = NULL;
+}
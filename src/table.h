@@ -0,0 +1,37 @@
+/* See LICENSE file for copyright and license details. */
+
+#ifndef TABLE_H
+#define TABLE_H
+
+/*
+ * Reserves address space for FILE_TABLE_MAX entries and a FILE_TABLE_POOL_MB string pool in one mapping.
+ * Pages are only backed by memory once entries are added.
+ * Returns 1 on program-halting error, otherwise 0.
+ */
+int table_init( void );
+
+/*
+ * Adds an entry for the file 'name' in directory 'dir', with its id set to its index in the table.
+ * 'root_len' is the length of the source directory 'dir' lies in, which starts the entry's own 'name'.
+ * 'path', 'file' and 'name' point into the string pool, so the path is stored once. Safe to call from any
+ * thread. Returns NULL if the table is full.
+ */
+FILE_LIST * table_add( char * dir, char * name, int root_len );
+
+/*
+ * Returns the entry with id 'id', or NULL if there is none. Removed entries stay in place as tombstones,
+ * flagged 'deleted'.
+ */
+FILE_LIST * table_get( int id );
+
+/*
+ * Returns the number of entries ever added, including tombstones.
+ */
+int table_count( void );
+
+/*
+ * Releases every entry and string at once. Decoded images attached to entries must be freed first.
+ */
+void table_terminate( void );
+
+#endif
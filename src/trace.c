@@ -0,0 +1,236 @@
+/* See LICENSE file for copyright and license details. */
+
+#include <signal.h>
+#include <unistd.h>
+#include "data_structures.h"
+#include "config.h"
+#include "trace.h"
+
+/*
+ * Each thread owns one ring and is its only writer, so recording a span takes no lock. A thread's ring is
+ * given back when it exits and handed to the next new thread, preferably one of the same name, so short
+ * lived workers don't use up TRACE_THREADS. Spans already in a ring stay until overwritten. A span's slot
+ * holds its ring position + 1 in 'seq' once written and 0 while being written. The dumper copies a slot
+ * and keeps it only if 'seq' was the expected value both before and after, so spans overwritten
+ * mid-copy are dropped rather than torn.
+ */
+static int enabled = 0;                 /* Set once by trace_init(), before any other thread exists */
+static char * path = NULL;              /* Trace file, from the TRACE_ENV environment variable */
+static Uint64 epoch = 0;                /* Performance counter at trace_init(). Timestamps count from here */
+static SDL_TLSID ring_key = 0;          /* Calling thread's ring, or NULL until it records its first span */
+static TRACE_RING rings[TRACE_THREADS];
+static SDL_atomic_t ring_count;         /* Rings claimed so far, possibly more than TRACE_THREADS */
+static SDL_atomic_t ring_ready[TRACE_THREADS]; /* Set once a ring's events are allocated */
+static SDL_Thread * dumper = NULL;
+static SDL_atomic_t quit;
+
+/* Gives 'data', the ring of a thread that is exiting, back for reuse. */
+static void trace_release( void * data ) {
+        TRACE_RING * ring = data;
+        SDL_AtomicSet( &ring->owned, 0 );
+}
+
+/* Claims a ring given back by an exited thread, one named 'name' if 'same_name' is set. Returns NULL if none is free. */
+static TRACE_RING * trace_reuse( const char * name, int same_name ) {
+        int count = SDL_AtomicGet( &ring_count );
+        if( count > TRACE_THREADS ) count = TRACE_THREADS;
+        for( int r = 0; r < count; r++ ) {
+                if( SDL_AtomicGet( &ring_ready[r] ) == 0 ) continue;
+                TRACE_RING * ring = &rings[r];
+                if( same_name && ring->name != name ) continue;
+                if( SDL_AtomicCAS( &ring->owned, 0, 1 )) return ring;
+        }
+        return NULL;
+}
+
+/* Returns the calling thread's ring, claiming one named 'name' first. Returns NULL once every ring is taken. */
+static TRACE_RING * trace_ring( const char * name ) {
+        TRACE_RING * ring = SDL_TLSGet( ring_key );
+        if( ring != NULL ) return ring;
+
+        /* Workers started over and over, such as sort workers, take back the ring of the last one. */
+        ring = trace_reuse( name, 1 );
+        if( ring == NULL && SDL_AtomicGet( &ring_count ) < TRACE_THREADS ) {
+                int slot = SDL_AtomicAdd( &ring_count, 1 );
+                if( slot < TRACE_THREADS ) {
+                        ring = &rings[slot];
+                        ring->events = calloc( TRACE_RING_SIZE, sizeof( TRACE_EVENT ));
+                        if( ring->events == NULL ) {
+                                fprintf( stderr, "WARN: Unable to malloc for trace ring. This thread is not traced.\n" );
+                                return NULL;
+                        }
+                        SDL_AtomicSet( &ring->head, 0 );
+                        SDL_AtomicSet( &ring->owned, 1 );
+                        SDL_AtomicSet( &ring_ready[slot], 1 );
+                }
+        }
+        if( ring == NULL ) ring = trace_reuse( name, 0 );
+        if( ring == NULL ) return NULL;
+        ring->name = name;
+        SDL_TLSSet( ring_key, ring, trace_release );
+
+        return ring;
+}
+
+static int trace_dump_thread( void * data ) {
+        sigset_t set;
+        sigemptyset( &set );
+        sigaddset( &set, TRACE_SIGNAL );
+        int sig = 0;
+        while( sigwait( &set, &sig ) == 0 && SDL_AtomicGet( &quit ) == 0 ) trace_dump();
+
+        return 0;
+}
+
+int trace_init( void ) {
+        char * env = getenv( TRACE_ENV );
+        if( env == NULL || env[0] == '\0' ) return 0;
+
+        int len = strlen( env ) + 1;
+        path = malloc( len );
+        if( path == NULL ) {
+                fprintf( stderr, "ERROR: Unable to malloc for trace path.\n" );
+                return 1;
+        }
+        snprintf( path, len, "%s", env );
+        ring_key = SDL_TLSCreate();
+        SDL_AtomicSet( &ring_count, 0 );
+        SDL_AtomicSet( &quit, 0 );
+        for( int i = 0; i < TRACE_THREADS; i++ ) SDL_AtomicSet( &ring_ready[i], 0 );
+        epoch = SDL_GetPerformanceCounter();
+
+        /* Every thread created from here on inherits the blocked signal. Only sigwait() picks it up. */
+        sigset_t set;
+        sigemptyset( &set );
+        sigaddset( &set, TRACE_SIGNAL );
+        if( ring_key == 0 || pthread_sigmask( SIG_BLOCK, &set, NULL ) != 0 ) {
+                fprintf( stderr, "ERROR: Unable to set up tracing.\n" );
+                return 1;
+        }
+        dumper = SDL_CreateThread( trace_dump_thread, "trace", NULL );
+        if( dumper == NULL ) {
+                fprintf( stderr, "ERROR: Unable to create trace thread: %s\n", SDL_GetError() );
+                return 1;
+        }
+        enabled = 1;
+        trace_thread( "main" );
+        fprintf( stderr, "Tracing to %s. Send signal %d to process %d to write it early.\n",
+                        path, TRACE_SIGNAL, (int) getpid() );
+
+        return 0;
+}
+
+void trace_thread( const char * name ) {
+        if( enabled ) trace_ring( name );
+}
+
+Uint64 trace_begin( void ) {
+        if( ! enabled ) return 0;
+        return SDL_GetPerformanceCounter();
+}
+
+void trace_end( const char * name, Uint64 start, int id, Sint64 bytes ) {
+        if( start == 0 || ! enabled ) return;
+        Uint64 end = SDL_GetPerformanceCounter();
+        TRACE_RING * ring = trace_ring( NULL );
+        if( ring == NULL ) return;
+
+        unsigned int head = SDL_AtomicGet( &ring->head );
+        TRACE_EVENT * event = &ring->events[head & ( TRACE_RING_SIZE - 1 )];
+        SDL_AtomicSet( &event->seq, 0 );
+        event->name = name;
+        event->start = start;
+        event->ticks = end - start;
+        event->id = id;
+        event->bytes = bytes;
+        /* The span must be complete before the dumper can see it as such. */
+        SDL_MemoryBarrierRelease();
+        SDL_AtomicSet( &event->seq, (int) ( head + 1 ));
+        SDL_AtomicSet( &ring->head, (int) ( head + 1 ));
+}
+
+void trace_dump( void ) {
+        if( ! enabled ) return;
+
+        int len = strlen( path ) + 5;
+        char * temp_path = malloc( len );
+        if( temp_path == NULL ) {
+                fprintf( stderr, "ERROR: Unable to malloc for trace path.\n" );
+                return;
+        }
+        /* Written aside and renamed into place, so a viewer never opens half a trace. */
+        snprintf( temp_path, len, "%s.tmp", path );
+        FILE * file = fopen( temp_path, "w" );
+        if( file == NULL ) {
+                fprintf( stderr, "WARN: Unable to write trace to %s\n", temp_path );
+                free( temp_path );
+                return;
+        }
+
+        double us_per_tick = 1000000.0 / SDL_GetPerformanceFrequency();
+        int pid = getpid();
+        int spans = 0;
+        fprintf( file, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n" );
+        fprintf( file, "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": %d, \"tid\": 0, "
+                        "\"args\": {\"name\": \"wallproc\"}}", pid );
+        int count = SDL_AtomicGet( &ring_count );
+        if( count > TRACE_THREADS ) count = TRACE_THREADS;
+        for( int r = 0; r < count; r++ ) {
+                if( SDL_AtomicGet( &ring_ready[r] ) == 0 ) continue;
+                TRACE_RING * ring = &rings[r];
+                fprintf( file, ",\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": %d, \"tid\": %d, "
+                                "\"args\": {\"name\": \"%s\"}}", pid, r, ring->name != NULL ? ring->name : "thread" );
+
+                unsigned int head = SDL_AtomicGet( &ring->head );
+                unsigned int first = ( head > TRACE_RING_SIZE ) ? head - TRACE_RING_SIZE : 0;
+                for( unsigned int i = first; i < head; i++ ) {
+                        TRACE_EVENT * slot = &ring->events[i & ( TRACE_RING_SIZE - 1 )];
+                        if( (unsigned int) SDL_AtomicGet( &slot->seq ) != i + 1 ) continue;
+                        SDL_MemoryBarrierAcquire();
+                        TRACE_EVENT event = *slot;
+                        SDL_MemoryBarrierAcquire();
+                        if( (unsigned int) SDL_AtomicGet( &slot->seq ) != i + 1 ) continue;
+
+                        fprintf( file, ",\n{\"name\": \"%s\", \"ph\": \"X\", \"pid\": %d, \"tid\": %d, "
+                                        "\"ts\": %.3f, \"dur\": %.3f, \"args\": {", event.name, pid, r,
+                                        (Sint64) ( event.start - epoch ) * us_per_tick, event.ticks * us_per_tick );
+                        if( event.id >= 0 ) fprintf( file, "\"id\": %d", event.id );
+                        if( event.bytes >= 0 ) {
+                                fprintf( file, "%s\"bytes\": %lld", event.id >= 0 ? ", " : "", (long long) event.bytes );
+                        }
+                        fprintf( file, "}}" );
+                        spans += 1;
+                }
+        }
+        fprintf( file, "\n]}\n" );
+
+        if( fclose( file ) != 0 || rename( temp_path, path ) != 0 ) {
+                fprintf( stderr, "WARN: Unable to write trace to %s\n", path );
+                remove( temp_path );
+        } else if( SGK_DEBUG ) {
+                printf( "DEBUG: Wrote %d spans to %s\n", spans, path );
+        }
+        free( temp_path );
+}
+
+void trace_terminate( void ) {
+        if( ! enabled ) return;
+
+        /* The signal is blocked everywhere but in sigwait(), so it can only wake the dump thread. */
+        SDL_AtomicSet( &quit, 1 );
+        kill( getpid(), TRACE_SIGNAL );
+        SDL_WaitThread( dumper, NULL );
+        dumper = NULL;
+
+        trace_dump();
+        enabled = 0;
+        int count = SDL_AtomicGet( &ring_count );
+        if( count > TRACE_THREADS ) count = TRACE_THREADS;
+        for( int r = 0; r < count; r++ ) {
+                free( rings[r].events );
+                rings[r].events = NULL;
+                rings[r].name = NULL;
+        }
+        free( path );
+        path = NULL;
+}
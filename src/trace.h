@@ -0,0 +1,50 @@
+/* See LICENSE file for copyright and license details. */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+/*
+ * Spans recorded per thread into lock-free rings and written out as Chrome trace JSON.
+ * While tracing is off, every function below returns at once.
+ */
+
+/*
+ * Turns tracing on if the environment variable TRACE_ENV names an output file, and starts the thread
+ * that writes the trace on TRACE_SIGNAL. Call before creating any other thread: the signal is blocked
+ * here, and threads inherit that, so only the dump thread ever receives it.
+ * Returns 1 on program-halting error, otherwise 0.
+ */
+int trace_init( void );
+
+/*
+ * Names the calling thread in the trace. 'name' must be a string constant. Call before the thread
+ * records its first span; a thread that never calls this shows up as "thread".
+ */
+void trace_thread( const char * name );
+
+/*
+ * Returns the start of a span, to be handed to trace_end(). Returns 0 while tracing is off.
+ */
+Uint64 trace_begin( void );
+
+/*
+ * Records the span 'name', a string constant, from 'start' until now on the calling thread's ring.
+ * 'start' comes from trace_begin(), or from SDL_GetPerformanceCounter() where the time is wanted anyway.
+ * 'id' is the FILE_LIST id worked on and 'bytes' the bytes read or written; pass -1 where they don't apply.
+ * Never blocks. Does nothing while tracing is off or if 'start' is 0.
+ */
+void trace_end( const char * name, Uint64 start, int id, Sint64 bytes );
+
+/*
+ * Writes every span still held in the rings to the trace file. Safe while other threads record spans;
+ * any span overwritten during the dump is left out.
+ */
+void trace_dump( void );
+
+/*
+ * Stops the dump thread, writes the final trace and frees the rings. Call after every other thread
+ * that records spans has exited.
+ */
+void trace_terminate( void );
+
+#endif
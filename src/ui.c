@@ -1,35 +1,88 @@
 /* See LICENSE file for copyright and license details. */
 
 #include "SDL_image.h"
+#include "wand/magick_wand.h"
 #include "data_structures.h"
 #include "config.h"
 #include "sdl.h"
 #include "imagick.h"
 #include "file_io.h"
 #include "selection_box.h"
+#include "image.h"
+#include "prefetch.h"
+#include "save.h"
+#include "cache.h"
+#include "scan.h"
+#include "view.h"
+#include "validate.h"
+#include "hud.h"
+#include "processed.h"
+#include "stats.h"
+#include "table.h"
+#include "trace.h"
+#include "watch.h"
 #include "ui.h"
 
+/* Text typed after KEY_JUMP, shown in the titlebar until Enter or Escape. */
+static char prompt[64] = "";
+static int prompting = 0;
+
 void update_titlebar( FILE_LIST * file_list, SDL_POINTERS * sdl_pointers ) {
         /* First, calculate the selection size in megapixels. */
         double sel_size = (file_list->sel_w * file_list->sel_h) / 1000000.0;
 
+        /* Report background saves while any are queued or have failed. */
+        char status[128] = "";
+        int pending = 0;
+        int done = 0;
+        int failed = 0;
+        save_status( &pending, &done, &failed );
+        if( pending > 0 || failed > 0 ) {
+                snprintf( status, sizeof( status ), " -- Saves: %d pending, %d done, %d failed", pending, done, failed );
+        }
+
+        /* Report the directory scan while it is still finding files. */
+        if( ! scan_done() ) {
+                int used = strlen( status );
+                snprintf( status + used, sizeof( status ) - used, " -- Scanning: %d found", scan_count() );
+        }
+
+        /* Name the view unless it is the plain one, and show any jump being typed. */
+        char view[128] = "";
+        if( view_sort() != sort_scan || view_filter() != filter_all ) {
+                snprintf( view, sizeof( view ), " (%s, %s)", view_sort_name( view_sort() ), view_filter_name( view_filter() ));
+        }
+        if( processed_has( file_list->name )) {
+                int used = strlen( view );
+                snprintf( view + used, sizeof( view ) - used, " -- Cropped" );
+        }
+        if( prompting ) {
+                int used = strlen( view );
+                snprintf( view + used, sizeof( view ) - used, " -- Jump to: %s_", prompt );
+        }
+
         /* Now build the titlebar string and display it. */
         char * title = NULL;
-        int length = snprintf( title, 0, "wallproc -- Image: %d -- Size: %.3f Mpx -- Selection: %dx%d -- File: %s", 
-                        file_list->id, sel_size, file_list->sel_w, file_list->sel_h, file_list->path );
+        int length = snprintf( title, 0, "wallproc -- Image: %d/%d%s -- Size: %.3f Mpx -- Selection: %dx%d%s -- File: %s", 
+                        file_list->view_pos + 1, view_count(), view, sel_size, file_list->sel_w, file_list->sel_h, 
+                        status, file_list->path );
         title = malloc( length+1 );
         if( title == NULL ) {
                 SDL_SetWindowTitle( sdl_pointers->window, "wallproc" );
         } else {
-                snprintf( title, length+1, "wallproc -- Image %d -- Size: %.3f Mpx -- Selection: %dx%d -- File: %s",
-                                file_list->id, sel_size, file_list->sel_w, file_list->sel_h, file_list->path );
+                snprintf( title, length+1, "wallproc -- Image: %d/%d%s -- Size: %.3f Mpx -- Selection: %dx%d%s -- File: %s",
+                                file_list->view_pos + 1, view_count(), view, sel_size, file_list->sel_w, file_list->sel_h, 
+                                status, file_list->path );
                 SDL_SetWindowTitle( sdl_pointers->window, title );
                 free(title);
         }
 }
 
-FILE_LIST * draw( DIRECTION dir, FILE_LIST * file_list, SDL_POINTERS * sdl_pointers ) {
-        if( SGK_DEBUG ) printf( "DEBUG: Entering function draw().\n" );
+FILE_LIST * step( DIRECTION dir, FILE_LIST * file_list, SDL_POINTERS * sdl_pointers ) {
+        FILE_LIST * previous = file_list;
+
+        /* Usually the validator threads got here first, and the loops below find nothing left to test. */
+        validate_collect( file_list );
 
         switch( dir ) { /* Traverse file_list in requested direction until a valid image is found. */
                 case left:
@@ -52,50 +105,245 @@ FILE_LIST * draw( DIRECTION dir, FILE_LIST * file_list, SDL_POINTERS * sdl_point
                         break;
         }
 
-        /* Clear the screen. */
-        sdl_clear( sdl_pointers );
+        /* The decoded image is only held while its entry is on screen. Its texture lives on in the cache. */
+        if( previous != file_list ) {
+                image_free( previous->image );
+                previous->image = NULL;
+                sdl_pointers->damage |= damage_image;
+                validate_update( file_list );
+        }
+
+        return file_list;
+}
+
+FILE_LIST * jump( FILE_LIST * file_list, FILE_LIST * target, SDL_POINTERS * sdl_pointers ) {
+        if( target == file_list ) return file_list;
+
+        /* Land just before the target and step onto it, so it is validated like any other move. */
+        image_free( file_list->image );
+        file_list->image = NULL;
+        sdl_pointers->damage |= damage_image;
+        return step( right, target->prev, sdl_pointers );
+}
+
+/* Takes 'entry', whose file is gone, out of the list, moving the cursor off it first. Returns the cursor. */
+static FILE_LIST * forget_entry( FILE_LIST * file_list, FILE_LIST * entry, SDL_POINTERS * sdl_pointers ) {
+        if( entry == file_list ) {
+                file_list = step( right, file_list, sdl_pointers );
+                /* With nothing else left to show, the last image stays up until another arrives. */
+                if( file_list == entry ) return file_list;
+                sdl_pointers->texture = NULL;
+        }
+        cache_drop( entry->id );
+        prefetch_forget( entry->id );
+        if( entry->view_pos < 0 ) {
+                /* Left out of the view, so its links are stale. Only the tombstone is needed. */
+                image_free( entry->image );
+                entry->image = NULL;
+                entry->deleted = 1;
+        } else {
+                del_file_from_list( entry );
+        }
+        return file_list;
+}
+
+/* Forgets everything read from the file of 'entry', which was written again, so it is probed and decoded afresh. */
+static void refresh_entry( FILE_LIST * file_list, FILE_LIST * entry, SDL_POINTERS * sdl_pointers ) {
+        entry->format = format_unknown;
+        entry->mcu_w = 0;
+        entry->mcu_h = 0;
+        entry->valid_sdl = 0;
+        entry->valid_imagick = 0;
+        entry->sel_placed = 0;
+        image_free( entry->image );
+        entry->image = NULL;
+        cache_drop( entry->id );
+        prefetch_forget( entry->id );
+        if( entry == file_list ) {
+                sdl_pointers->texture = NULL;
+                sdl_pointers->damage |= damage_image;
+        }
+}
+
+FILE_LIST * apply_changes( FILE_LIST * file_list, SDL_POINTERS * sdl_pointers ) {
+        /* A change to a file the scan has yet to hand over would add it twice. The end of the scan calls again. */
+        if( ! scan_done() ) return file_list;
+        file_list = view_add( file_list, scan_take( 0 ));
+
+        int applied = 0;
+        WATCH_CHANGE * next = NULL;
+        for( WATCH_CHANGE * change = watch_take(); change != NULL; change = next ) {
+                next = change->next;
+                FILE_LIST * entry = view_find( change->path );
+                switch( change->kind ) {
+                        case watch_written:
+                                if( entry == NULL ) {
+                                        file_list = view_add( file_list, scan_file( change->dir, change->name ));
+                                } else {
+                                        refresh_entry( file_list, entry, sdl_pointers );
+                                }
+                                break;
+                        case watch_removed:
+                                if( entry != NULL ) file_list = forget_entry( file_list, entry, sdl_pointers );
+                                break;
+                        case watch_removed_dir: {
+                                /* Everything below the directory went with it. */
+                                int len = strlen( change->path );
+                                for( int id = 0; id < table_count(); id++ ) {
+                                        entry = table_get( id );
+                                        if( entry->deleted || strncmp( entry->path, change->path, len ) != 0
+                                                        || entry->path[len] != '/' ) continue;
+                                        file_list = forget_entry( file_list, entry, sdl_pointers );
+                                }
+                                break;
+                        }
+                }
+                applied += 1;
+                free( change );
+        }
+
+        if( applied > 0 ) {
+                if( SGK_DEBUG ) printf( "DEBUG: Applied %d changes to the source directory\n", applied );
+                /* Rewritten neighbors need probing again. */
+                validate_update( file_list );
+        }
+        return file_list;
+}
+
+void prompt_open( void ) {
+        prompt[0] = '\0';
+        prompting = 1;
+}
+
+int prompt_is_open( void ) {
+        return prompting;
+}
+
+void prompt_edit( const char * text ) {
+        int used = strlen( prompt );
+        if( text != NULL ) {
+                snprintf( prompt + used, sizeof( prompt ) - used, "%s", text );
+        } else if( used > 0 ) {
+                /* Erase a whole UTF-8 character, continuation bytes first. */
+                used -= 1;
+                while( used > 0 && ( prompt[used] & 0xC0 ) == 0x80 ) used -= 1;
+                prompt[used] = '\0';
+        }
+}
 
-        /* Load the image texture. */
+char * prompt_close( void ) {
+        prompting = 0;
+        return prompt;
+}
+
+FILE_LIST * draw( DIRECTION dir, FILE_LIST * file_list, SDL_POINTERS * sdl_pointers ) {
+        if( SGK_DEBUG ) printf( "DEBUG: Entering function draw().\n" );
+
+        file_list = step( dir, file_list, sdl_pointers );
+
+        /* Load the image layer. */
         int window_w = 0;
         int window_h = 0;
         int temp = 0;
         SDL_GetWindowSize( sdl_pointers->window, &window_w, &window_h );
         temp = SDL_RenderSetLogicalSize( sdl_pointers->renderer, window_w, window_h );
         if( temp ) fprintf( stderr, "ERROR: Unable to set renderer size: %s\n", SDL_GetError() );
-        SDL_DestroyTexture( sdl_pointers->texture );
-        sdl_pointers->texture = IMG_LoadTexture( sdl_pointers->renderer, file_list->path );
+        cache_resize( window_w, window_h );
+        sdl_pointers->texture = cache_get( file_list->id );
+        stats_count( sdl_pointers->texture != NULL ? counter_cache_hit : counter_cache_miss );
+        if( sdl_pointers->texture == NULL && prefetch_attach( file_list, window_w, window_h ) == 0 ) {
+                /* 
+                 * Usually decoded in the background already. Only the upload of the window-sized preview
+                 * remains; the renderer maps it onto the full resolution image's box.
+                 */
+                Uint64 start = SDL_GetPerformanceCounter();
+                size_t bytes = (size_t) file_list->image->surface->w * file_list->image->surface->h * 4;
+                sdl_pointers->texture = SDL_CreateTextureFromSurface( sdl_pointers->renderer, 
+                                file_list->image->surface );
+                stats_record( stat_upload, start );
+                trace_end( "upload", start, file_list->id, bytes );
+                if( sdl_pointers->texture != NULL ) cache_put( file_list->id, sdl_pointers->texture, bytes );
+                if( file_list->img_w != file_list->image->w || file_list->img_h != file_list->image->h ) {
+                        /* The header lied about the dimensions. Trust the decoder. */
+                        file_list->img_w = file_list->image->w;
+                        file_list->img_h = file_list->image->h;
+                        reset_sel_box( file_list );
+                }
+                if( file_list->sel_placed == 0 ) {
+                        /* First sight of the decoded image. Let its content place the selection box. */
+                        reset_sel_box( file_list );
+                        file_list->sel_placed = 1;
+                }
+        }
         if( sdl_pointers->texture == NULL ) {
                 /* 
                  * The texture *should* always load since we loaded it before setting the valid_sdl flag.
                  * However, if the texture fails to load, try to draw() in the same direction, and then 
-                 * remove the failed image file_list struct.
+                 * remove the failed image file_list struct. Redraws in place move on to the right.
                  */
                 FILE_LIST * bad = file_list;
-                file_list = draw( dir, file_list, sdl_pointers );
+                file_list = draw( dir == left ? left : right, file_list, sdl_pointers );
+                /* The index remembers it as unreadable. */
+                bad->format = format_none;
                 del_file_from_list( bad );
         } else {
-                /* Texture loaded successfully. */
+                /* Texture loaded successfully. Composite it with the overlay. */
+                redraw( file_list, sdl_pointers );
+                /* Start decoding the neighbors while the user looks at this image. */
+                prefetch_update( file_list, window_w, window_h );
+        }
+        
+        if( SGK_DEBUG ) printf( "DEBUG: Leaving function draw().\n" );
+
+        return file_list;
+}
+
+void redraw( FILE_LIST * file_list, SDL_POINTERS * sdl_pointers ) {
+        Uint64 span = trace_begin();
+        int temp = 0;
+
+        /* Image layer. The texture is retained from the last draw(). */
+        sdl_clear( sdl_pointers );
+        if( sdl_pointers->texture != NULL ) {
                 /* Calculate scaling to load texture in current SDL window. */
                 SDL_Rect texture_dest_box = {0,0,0,0};
                 sdl_texture_rect( &texture_dest_box, file_list, sdl_pointers );
                 /* Load texture to renderer. */
                 temp = SDL_RenderCopy( sdl_pointers->renderer, sdl_pointers->texture, NULL, &texture_dest_box );
                 if( temp ) fprintf( stderr, "ERROR: Unable to copy texture to renderer: %s\n", SDL_GetError() );
-                /* Calculate scaling to draw selection box in current SDL window. */
-                SDL_Rect selection_dest_box = {0,0,0,0};
-                sdl_selection_rect( &selection_dest_box, file_list, sdl_pointers );
-                /* Load selection box to renderer. */
-                temp = SDL_SetRenderDrawColor( sdl_pointers->renderer, file_list->sel_r, file_list->sel_g, 
-                                file_list->sel_b, file_list->sel_a );
-                if( temp ) fprintf( stderr, "ERROR: Unable to set renderer color: %s\n", SDL_GetError() );
-                temp = SDL_RenderDrawRect( sdl_pointers->renderer, &selection_dest_box );
-                if( temp ) fprintf( stderr, "ERROR: Unable to draw rectangle on renderer: %s\n", SDL_GetError() );
-                /* Update titlebar and render SDL renderer to SDL window. */
-                update_titlebar( file_list, sdl_pointers );
-                SDL_RenderPresent( sdl_pointers->renderer );
         }
-        
-        if( SGK_DEBUG ) printf( "DEBUG: Leaving function draw().\n" );
+
+        /* Overlay layer. */
+        /* Calculate scaling to draw selection box in current SDL window. */
+        SDL_Rect selection_dest_box = {0,0,0,0};
+        sdl_selection_rect( &selection_dest_box, file_list, sdl_pointers );
+        /* Load selection box to renderer. */
+        temp = SDL_SetRenderDrawColor( sdl_pointers->renderer, sdl_pointers->sel_color.r, sdl_pointers->sel_color.g, 
+                        sdl_pointers->sel_color.b, sdl_pointers->sel_color.a );
+        if( temp ) fprintf( stderr, "ERROR: Unable to set renderer color: %s\n", SDL_GetError() );
+        temp = SDL_RenderDrawRect( sdl_pointers->renderer, &selection_dest_box );
+        if( temp ) fprintf( stderr, "ERROR: Unable to draw rectangle on renderer: %s\n", SDL_GetError() );
+        /* Performance overlay, if enabled. */
+        hud_draw( sdl_pointers );
+        /* Update titlebar and render SDL renderer to SDL window. */
+        update_titlebar( file_list, sdl_pointers );
+        SDL_RenderPresent( sdl_pointers->renderer );
+
+        sdl_pointers->damage = damage_none;
+        trace_end( "render", span, file_list->id, -1 );
+}
+
+FILE_LIST * repaint( FILE_LIST * file_list, SDL_POINTERS * sdl_pointers ) {
+        Uint64 start = SDL_GetPerformanceCounter();
+        /* The first expose finds no image layer yet, so it needs a full draw() too. */
+        if( sdl_pointers->damage & damage_image 
+                        || ( sdl_pointers->damage != damage_none && sdl_pointers->texture == NULL )) {
+                file_list = draw( none, file_list, sdl_pointers );
+                stats_record( stat_frame, start );
+        } else if( sdl_pointers->damage & damage_overlay ) {
+                redraw( file_list, sdl_pointers );
+                stats_record( stat_frame, start );
+        }
 
         return file_list;
 }
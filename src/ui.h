@@ -4,13 +4,69 @@
 #define UI_H
 
 /* 
- * Updates titlebar of SDL window for currently displayed image.
+ * Updates titlebar of SDL window for currently displayed image, including its position in the view and the
+ * state of background saves.
  */
 void update_titlebar( FILE_LIST * file_list, SDL_POINTERS * sdl_pointers );
 
+/* 
+ * Moves from 'file_list' to the next/prev valid image (based on 'dir') without drawing anything, and returns
+ * a FILE_LIST* to it. Entries are normally validated in the background already; any that aren't are tested
+ * here, which reads only a header. Flags image damage when the cursor moved, leaving the decode to the next
+ * repaint().
+ */
+FILE_LIST * step( DIRECTION dir, FILE_LIST * file_list, SDL_POINTERS * sdl_pointers );
+
+/* 
+ * Moves from 'file_list' to 'target' without drawing anything, like step(). If 'target' fails validation,
+ * the cursor lands on the next valid image after it. Returns a FILE_LIST* to the new position.
+ */
+FILE_LIST * jump( FILE_LIST * file_list, FILE_LIST * target, SDL_POINTERS * sdl_pointers );
+
+/*
+ * Applies the changes watch_take() reports to the source tree once the scan is complete: new files join
+ * the end of the view, deleted files leave the list, and rewritten files lose their cached metadata,
+ * texture and decoded images. Flags image damage if the image on screen changed or went away.
+ * Returns a FILE_LIST* to the cursor.
+ */
+FILE_LIST * apply_changes( FILE_LIST * file_list, SDL_POINTERS * sdl_pointers );
+
+/*
+ * Starts collecting text for KEY_JUMP, shown in the titlebar.
+ */
+void prompt_open( void );
+
+/*
+ * Returns 1 while jump text is being collected, otherwise 0.
+ */
+int prompt_is_open( void );
+
+/*
+ * Appends UTF-8 'text' to the jump text, or erases its last character if 'text' is NULL.
+ */
+void prompt_edit( const char * text );
+
+/*
+ * Stops collecting jump text and returns it. The text stays valid until the next prompt_open().
+ */
+char * prompt_close( void );
+
 /* 
  * Draws the next/prev/current image (based on 'dir') and returns a FILE_LIST* to the file_list that was drawn.
+ * Fetches the image layer from the texture cache or the decoder, then composites it with redraw().
  */
 FILE_LIST * draw( DIRECTION dir, FILE_LIST * file_list, SDL_POINTERS * sdl_pointers );
 
+/* 
+ * Composites the retained image layer and the selection box overlay for 'file_list' and presents them.
+ * Never decodes or uploads an image, so it is cheap enough for every selection box change.
+ */
+void redraw( FILE_LIST * file_list, SDL_POINTERS * sdl_pointers );
+
+/* 
+ * Repaints whatever 'sdl_pointers->damage' says has changed, then clears it. Image damage means a full
+ * draw(); overlay damage only a redraw(). Returns a FILE_LIST* to the file_list on screen.
+ */
+FILE_LIST * repaint( FILE_LIST * file_list, SDL_POINTERS * sdl_pointers );
+
 #endif
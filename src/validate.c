@@ -0,0 +1,241 @@
+/* See LICENSE file for copyright and license details. */
+
+#include "data_structures.h"
+#include "config.h"
+#include "file_io.h"
+#include "probe.h"
+#include "selection_box.h"
+#include "stats.h"
+#include "table.h"
+#include "trace.h"
+#include "validate.h"
+
+/*
+ * Threads only read the header of an entry, through its path in the file table, which never changes
+ * or moves. Everything the results change, the list links included, is written by the UI thread in
+ * validate_collect(), so navigation never races a removal.
+ */
+static SDL_Thread * workers[VALIDATE_THREADS];
+static SDL_mutex * lock = NULL;
+static SDL_cond * work_cond = NULL;             /* Signalled when entries are queued or the threads must quit */
+static int pending[2 * VALIDATE_DEPTH];         /* Ids to probe, nearest the cursor first. Protected by 'lock' */
+static int pending_count = 0;
+static int pending_next = 0;
+static int * requested = NULL;                  /* Ids to probe once 'pending' is empty. Protected by 'lock' */
+static int requested_count = 0;
+static int requested_next = 0;
+static int requested_capacity = 0;
+static int running[VALIDATE_THREADS];          /* Id each thread is probing, or -1. Protected by 'lock' */
+static VALIDATE_RESULT * results = NULL;        /* Finished probes. Protected by 'lock' */
+static int quit = 0;                            /* Protected by 'lock' */
+static SDL_atomic_t notified;                   /* Set while an event is in the SDL queue, so only one ever is */
+static Uint32 event_type = (Uint32) -1;
+
+static int validate_thread( void * data ) {
+        int self = (int) (intptr_t) data;
+        trace_thread( "validate" );
+
+        SDL_LockMutex( lock );
+        while( 1 ) {
+                while( pending_next == pending_count && requested_next == requested_count && quit == 0 ) {
+                        SDL_CondWait( work_cond, lock );
+                }
+                if( quit ) break;
+                /* The cursor's neighbors come first. Requests wait for a quiet moment. */
+                int id;
+                if( pending_next < pending_count ) {
+                        id = pending[pending_next++];
+                } else {
+                        id = requested[requested_next++];
+                        if( requested_next == requested_count ) requested_next = requested_count = 0;
+                }
+                running[self] = id;
+                SDL_UnlockMutex( lock );
+
+                VALIDATE_RESULT * result = malloc( sizeof( VALIDATE_RESULT ));
+                if( result == NULL ) {
+                        fprintf( stderr, "ERROR: Unable to malloc for validation result.\n" );
+                } else {
+                        Uint64 start = SDL_GetPerformanceCounter();
+                        result->id = id;
+                        char * path = table_get( id )->path;
+                        result->format = probe_image( path, &result->img_w, &result->img_h, &result->mcu_w,
+                                        &result->mcu_h );
+                        /* ImageMagick vouched for it, but the window can only show what SDL_image decodes. */
+                        if( result->format == format_other && ! probe_sdl_readable( path )) result->format = format_none;
+                        stats_record( stat_probe, start );
+                        trace_end( "probe", start, id, -1 );
+                }
+
+                SDL_LockMutex( lock );
+                running[self] = -1;
+                if( result != NULL ) {
+                        result->next = results;
+                        results = result;
+                        if( SDL_AtomicCAS( &notified, 0, 1 )) {
+                                SDL_Event event;
+                                memset( &event, 0, sizeof( event ));
+                                event.type = event_type;
+                                if( SDL_PushEvent( &event ) <= 0 ) SDL_AtomicSet( &notified, 0 );
+                        }
+                }
+        }
+        SDL_UnlockMutex( lock );
+
+        return 0;
+}
+
+/* Marks 'entry' valid once its format is known to be an image. */
+static void validate_settle( FILE_LIST * entry ) {
+        /* A header SDL_image has a loader for is enough. draw() drops the entry if the body is corrupt. */
+        if( probe_sdl_native( entry->format ) || entry->format == format_other ) entry->valid_sdl = 1;
+        if( entry->valid_imagick != 1 ) {
+                reset_sel_box( entry );
+                entry->valid_imagick = 1;
+        }
+}
+
+/* Returns 1 if 'id' is queued, being probed or waiting to be collected. Call with 'lock' held. */
+static int validate_known( int id ) {
+        for( int i = pending_next; i < pending_count; i++ ) {
+                if( pending[i] == id ) return 1;
+        }
+        for( int i = 0; i < VALIDATE_THREADS; i++ ) {
+                if( running[i] == id ) return 1;
+        }
+        for( VALIDATE_RESULT * result = results; result != NULL; result = result->next ) {
+                if( result->id == id ) return 1;
+        }
+        return 0;
+}
+
+/* Queues 'entry' for probing unless that is unnecessary. Call with 'lock' held. */
+static void validate_want( FILE_LIST * entry ) {
+        if( entry->valid_sdl == 1 && entry->valid_imagick == 1 ) return;
+        if( entry->format == format_none ) return;
+        if( entry->format != format_unknown ) {
+                /* Known from the index. Nothing to read. */
+                validate_settle( entry );
+                return;
+        }
+        if( pending_count < 2 * VALIDATE_DEPTH && ! validate_known( entry->id )) pending[pending_count++] = entry->id;
+}
+
+int validate_init( void ) {
+        lock = SDL_CreateMutex();
+        work_cond = SDL_CreateCond();
+        if( lock == NULL || work_cond == NULL ) {
+                fprintf( stderr, "ERROR: Unable to create validator locks: %s\n", SDL_GetError() );
+                return 1;
+        }
+        SDL_AtomicSet( &notified, 0 );
+        event_type = SDL_RegisterEvents( 1 );
+
+        for( int i = 0; i < VALIDATE_THREADS; i++ ) {
+                running[i] = -1;
+                workers[i] = SDL_CreateThread( validate_thread, "validate", (void *) (intptr_t) i );
+                if( workers[i] == NULL ) {
+                        fprintf( stderr, "ERROR: Unable to create validator thread: %s\n", SDL_GetError() );
+                        return 1;
+                }
+        }
+
+        return 0;
+}
+
+void validate_update( FILE_LIST * file_list ) {
+        FILE_LIST * ahead = file_list;
+        FILE_LIST * behind = file_list;
+
+        SDL_LockMutex( lock );
+        /* Whatever was queued for the old cursor position is no longer the most urgent. */
+        pending_count = 0;
+        pending_next = 0;
+        for( int i = 0; i < VALIDATE_DEPTH; i++ ) {
+                ahead = ahead->next;
+                behind = behind->prev;
+                validate_want( ahead );
+                validate_want( behind );
+        }
+        if( pending_count > 0 ) SDL_CondBroadcast( work_cond );
+        SDL_UnlockMutex( lock );
+}
+
+void validate_request( FILE_LIST * entry ) {
+        SDL_LockMutex( lock );
+        if( requested_count == requested_capacity ) {
+                int capacity = ( requested_capacity == 0 ) ? 1024 : requested_capacity * 2;
+                int * temp = realloc( requested, capacity * sizeof( int ));
+                if( temp == NULL ) {
+                        fprintf( stderr, "ERROR: Unable to malloc for validation requests.\n" );
+                        SDL_UnlockMutex( lock );
+                        return;
+                }
+                requested = temp;
+                requested_capacity = capacity;
+        }
+        requested[requested_count++] = entry->id;
+        SDL_CondSignal( work_cond );
+        SDL_UnlockMutex( lock );
+}
+
+void validate_collect( FILE_LIST * file_list ) {
+        SDL_LockMutex( lock );
+        SDL_AtomicSet( &notified, 0 );
+        VALIDATE_RESULT * result = results;
+        results = NULL;
+        SDL_UnlockMutex( lock );
+
+        int removed = 0;
+        while( result != NULL ) {
+                VALIDATE_RESULT * next = result->next;
+                FILE_LIST * entry = table_get( result->id );
+                if( ! entry->deleted && entry->format == format_unknown ) {
+                        entry->format = result->format;
+                        entry->img_w = result->img_w;
+                        entry->img_h = result->img_h;
+                        entry->mcu_w = result->mcu_w;
+                        entry->mcu_h = result->mcu_h;
+                }
+                if( entry->deleted || entry == file_list ) {
+                        /* Already dealt with on the UI thread. */
+                } else if( entry->format == format_none ) {
+                        del_file_from_list( entry );
+                        removed += 1;
+                } else {
+                        validate_settle( entry );
+                }
+                free( result );
+                result = next;
+        }
+
+        if( SGK_DEBUG && removed > 0 ) printf( "DEBUG: Validator removed %d files\n", removed );
+}
+
+Uint32 validate_event_type( void ) {
+        return event_type;
+}
+
+void validate_terminate( void ) {
+        SDL_LockMutex( lock );
+        quit = 1;
+        SDL_CondBroadcast( work_cond );
+        SDL_UnlockMutex( lock );
+        for( int i = 0; i < VALIDATE_THREADS; i++ ) {
+                if( workers[i] != NULL ) SDL_WaitThread( workers[i], NULL );
+                workers[i] = NULL;
+        }
+
+        while( results != NULL ) {
+                VALIDATE_RESULT * next = results->next;
+                free( results );
+                results = next;
+        }
+        free( requested );
+        requested = NULL;
+        requested_count = requested_next = requested_capacity = 0;
+        SDL_DestroyCond( work_cond );
+        SDL_DestroyMutex( lock );
+        work_cond = NULL;
+        lock = NULL;
+}
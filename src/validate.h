@@ -0,0 +1,40 @@
+/* See LICENSE file for copyright and license details. */
+
+#ifndef VALIDATE_H
+#define VALIDATE_H
+
+/*
+ * Starts VALIDATE_THREADS threads probing entries near the cursor. Requires SDL and the file table.
+ * Returns 1 on program-halting error, otherwise 0.
+ */
+int validate_init( void );
+
+/*
+ * Replaces the queue of entries to probe with the VALIDATE_DEPTH entries on each side of 'file_list',
+ * nearest first. Entries whose format is already known are marked valid right away.
+ */
+void validate_update( FILE_LIST * file_list );
+
+/*
+ * Queues 'entry' to be probed whenever the entries near the cursor are done, such as a new arrival the view
+ * holds back until its header is known. The result comes back through validate_collect() like any other.
+ */
+void validate_request( FILE_LIST * entry );
+
+/*
+ * Applies finished probes: entries that are images are marked valid and get a selection box, and the
+ * rest are removed from the list. Never removes 'file_list' itself. Call from the UI thread only.
+ */
+void validate_collect( FILE_LIST * file_list );
+
+/*
+ * Returns the SDL event type pushed when probes are ready for validate_collect().
+ */
+Uint32 validate_event_type( void );
+
+/*
+ * Stops the validator threads and discards results not yet collected.
+ */
+void validate_terminate( void );
+
+#endif
@@ -0,0 +1,533 @@
+/* See LICENSE file for copyright and license details. */
+
+#include <ctype.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include "data_structures.h"
+#include "config.h"
+#include "probe.h"
+#include "processed.h"
+#include "validate.h"
+#include "view.h"
+
+/*
+ * The view is an array of entries in display order, so a position is just an index. The FILE_LIST loop
+ * is relinked to follow the same order, so stepping and prefetching need not know about views at all.
+ * Entries removed later stay in the array as tombstones until the next view_apply().
+ */
+static FILE_LIST ** seen = NULL;        /* Every entry taken from the scan, in scan order */
+static int seen_count = 0;
+static int seen_capacity = 0;
+static FILE_LIST ** order = NULL;       /* The active view */
+static int order_count = 0;
+static int order_capacity = 0;
+static int head = 0;                    /* No live entries before this position */
+static VIEW_SORT sort = sort_scan;
+static VIEW_FILTER filter = filter_all;
+static VIEW_SORT key_sort = sort_scan;  /* Order being built, read by the sort threads */
+static VIEW_FILTER key_filter = filter_all;
+static int * paths = NULL;              /* Open-addressed set of positions in 'seen', hashed by path, or -1 */
+static int paths_capacity = 0;
+static int paths_count = 0;             /* Entries of 'seen' in 'paths' so far */
+static FILE_LIST ** waiting = NULL;     /* New arrivals held back until the validator reads their headers */
+static int waiting_count = 0;
+static int waiting_capacity = 0;
+static double target_aspect = 1.0;
+
+/* Grows '*array' to hold at least 'need' pointers. Returns 1 on error, otherwise 0. */
+static int view_reserve( FILE_LIST *** array, int * capacity, int need ) {
+        if( need <= *capacity ) return 0;
+        int size = ( *capacity == 0 ) ? 1024 : *capacity;
+        while( size < need ) size *= 2;
+        FILE_LIST ** temp = realloc( *array, size * sizeof( FILE_LIST * ) );
+        if( temp == NULL ) {
+                fprintf( stderr, "ERROR: Unable to malloc for view.\n" );
+                return 1;
+        }
+        *array = temp;
+        *capacity = size;
+        return 0;
+}
+
+/* Hashes 'path' with FNV-1a. */
+static Uint32 view_hash( const char * path ) {
+        Uint32 hash = 2166136261u;
+        for( ; *path != '\0'; path++ ) hash = ( hash ^ (unsigned char) *path ) * 16777619u;
+        return hash;
+}
+
+/* Compares paths so that "img9" comes before "img10". */
+static int view_natural( const char * a, const char * b ) {
+        while( *a != '\0' && *b != '\0' ) {
+                if( isdigit( (unsigned char) *a ) && isdigit( (unsigned char) *b )) {
+                        while( *a == '0' ) a++;
+                        while( *b == '0' ) b++;
+                        const char * end_a = a;
+                        const char * end_b = b;
+                        while( isdigit( (unsigned char) *end_a )) end_a++;
+                        while( isdigit( (unsigned char) *end_b )) end_b++;
+                        /* Without leading zeros, the longer number is the larger one. */
+                        if( end_a - a != end_b - b ) return ( end_a - a < end_b - b ) ? -1 : 1;
+                        int diff = strncmp( a, b, end_a - a );
+                        if( diff != 0 ) return diff;
+                        a = end_a;
+                        b = end_b;
+                } else {
+                        int diff = tolower( (unsigned char) *a ) - tolower( (unsigned char) *b );
+                        if( diff != 0 ) return diff;
+                        a++;
+                        b++;
+                }
+        }
+        return (unsigned char) *a - (unsigned char) *b;
+}
+
+static int view_compare( const void * a, const void * b ) {
+        const VIEW_KEY * key_a = a;
+        const VIEW_KEY * key_b = b;
+        if( key_sort == sort_name ) {
+                int diff = view_natural( key_a->entry->path, key_b->entry->path );
+                if( diff != 0 ) return diff;
+        } else if( key_a->key != key_b->key ) {
+                return ( key_a->key > key_b->key ) - ( key_a->key < key_b->key );
+        }
+        /* Ties keep scan order, so every sort is stable. */
+        return ( key_a->entry->id > key_b->entry->id ) - ( key_a->entry->id < key_b->entry->id );
+}
+
+/*
+ * Returns 1 if 'entry' belongs in a view limited by 'with', otherwise 0. Reads the file header if the
+ * filter needs it and 'probe' is set; otherwise returns -1 when the header is not known yet.
+ */
+static int view_keep( FILE_LIST * entry, VIEW_FILTER with, int probe ) {
+        if( entry->deleted || entry->format == format_none ) return 0;
+        if( ! probe && entry->format == format_unknown && ( with == filter_small || with == filter_aspect )) return -1;
+
+        switch( with ) {
+                case filter_unprocessed:
+                        return ! processed_has( entry->name );
+                case filter_small:
+                        if( probe_entry( entry )) return 0;
+                        return (double) entry->img_w * entry->img_h < VIEW_SMALL_MPX * 1000000.0;
+                case filter_aspect:
+                        if( probe_entry( entry )) return 0;
+                        double aspect = (double) entry->img_w / (double) entry->img_h;
+                        return aspect < target_aspect * ( 1.0 - VIEW_ASPECT_TOLERANCE )
+                                || aspect > target_aspect * ( 1.0 + VIEW_ASPECT_TOLERANCE );
+                case filter_all:
+                case filter_count:
+                        break;
+        }
+        return 1;
+}
+
+/* Fills in the sort key of 'key->entry'. Returns 1 if the entry turned out to be unusable. */
+static int view_key( VIEW_KEY * key ) {
+        FILE_LIST * entry = key->entry;
+        struct stat st;
+
+        key->key = 0;
+        switch( key_sort ) {
+                case sort_scan:
+                        key->key = entry->id;
+                        break;
+                case sort_mtime:
+                        if( stat( entry->path, &st ) != 0 ) return 1;
+                        key->key = (Sint64) st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+                        break;
+                case sort_size:
+                        if( stat( entry->path, &st ) != 0 ) return 1;
+                        key->key = st.st_size;
+                        break;
+                case sort_pixels:
+                        if( probe_entry( entry )) return 1;
+                        key->key = (Sint64) entry->img_w * entry->img_h;
+                        break;
+                case sort_name:
+                case sort_count:
+                        break;
+        }
+        return 0;
+}
+
+/*
+ * Filters one slice of the keys, packing the survivors at its front, then fills in and sorts their keys.
+ * Slices are disjoint, so any number of these run at once.
+ */
+static int view_worker( void * data ) {
+        VIEW_WORK * work = data;
+        work->kept = 0;
+        for( int i = 0; i < work->count; i++ ) {
+                VIEW_KEY key = work->keys[i];
+                if( view_keep( key.entry, key_filter, 1 ) != 1 || view_key( &key )) continue;
+                work->keys[work->kept++] = key;
+        }
+        qsort( work->keys, work->kept, sizeof( VIEW_KEY ), view_compare );
+        return 0;
+}
+
+/* Merges the sorted runs of 'keys' between 'bounds' pairwise until one run is left. */
+static void view_merge( VIEW_KEY * keys, int * bounds, int runs ) {
+        VIEW_KEY * temp = malloc( bounds[runs] * sizeof( VIEW_KEY ));
+        if( temp == NULL ) {
+                /* Slower, but still correct. */
+                qsort( keys, bounds[runs], sizeof( VIEW_KEY ), view_compare );
+                return;
+        }
+
+        while( runs > 1 ) {
+                int merged = 0;
+                for( int r = 0; r < runs; r += 2 ) {
+                        int start = bounds[r];
+                        if( r + 1 < runs ) {
+                                int a = bounds[r];
+                                int b = bounds[r + 1];
+                                int out = start;
+                                while( a < bounds[r + 1] && b < bounds[r + 2] ) {
+                                        temp[out++] = ( view_compare( &keys[b], &keys[a] ) < 0 ) ? keys[b++] : keys[a++];
+                                }
+                                while( a < bounds[r + 1] ) temp[out++] = keys[a++];
+                                while( b < bounds[r + 2] ) temp[out++] = keys[b++];
+                                memcpy( keys + start, temp + start, ( out - start ) * sizeof( VIEW_KEY ));
+                        }
+                        /* Only bounds already read are overwritten. */
+                        bounds[merged++] = start;
+                }
+                bounds[merged] = bounds[runs];
+                runs = merged;
+        }
+
+        free( temp );
+}
+
+/* Returns the first live entry of the view, or NULL if there is none. */
+static FILE_LIST * view_head( void ) {
+        while( head < order_count && order[head]->deleted ) head++;
+        return ( head < order_count ) ? order[head] : NULL;
+}
+
+void view_init( double aspect ) {
+        target_aspect = aspect;
+        sort = sort_scan;
+        filter = filter_all;
+}
+
+/* Puts 'entry' at the end of the view, just before it wraps around to the start. Returns the cursor. */
+static FILE_LIST * view_append( FILE_LIST * file_list, FILE_LIST * entry ) {
+        FILE_LIST * anchor = view_head();
+        if( anchor == NULL ) anchor = file_list;
+        if( anchor == NULL ) {
+                entry->next = entry;
+                entry->prev = entry;
+        } else {
+                entry->prev = anchor->prev;
+                entry->next = anchor;
+                anchor->prev->next = entry;
+                anchor->prev = entry;
+        }
+        entry->view_pos = order_count;
+        order[order_count++] = entry;
+        return ( file_list == NULL ) ? entry : file_list;
+}
+
+FILE_LIST * view_add( FILE_LIST * file_list, FILE_LIST * batch ) {
+        if( batch == NULL ) return file_list;
+
+        /* Break the loop open and take the entries one by one. */
+        batch->prev->next = NULL;
+        FILE_LIST * next = NULL;
+        for( FILE_LIST * entry = batch; entry != NULL; entry = next ) {
+                next = entry->next;
+                entry->view_pos = -1;
+                if( view_reserve( &seen, &seen_capacity, seen_count + 1 )
+                                || view_reserve( &order, &order_capacity, order_count + 1 )) {
+                        entry->deleted = 1;
+                        continue;
+                }
+                seen[seen_count++] = entry;
+                int keep = view_keep( entry, filter, 0 );
+                if( keep < 0 && view_reserve( &waiting, &waiting_capacity, waiting_count + 1 ) == 0 ) {
+                        /*
+                         * The filter needs the header, which is read on a validator thread rather than here.
+                         * Linked only to itself, the entry can be dropped like any other if it is no image.
+                         */
+                        entry->next = entry;
+                        entry->prev = entry;
+                        waiting[waiting_count++] = entry;
+                        validate_request( entry );
+                        continue;
+                }
+                if( keep == 1 ) file_list = view_append( file_list, entry );
+        }
+
+        return file_list;
+}
+
+FILE_LIST * view_settle( FILE_LIST * file_list ) {
+        int still = 0;
+        for( int i = 0; i < waiting_count; i++ ) {
+                FILE_LIST * entry = waiting[i];
+                int keep = view_keep( entry, filter, 0 );
+                if( keep < 0 ) {
+                        waiting[still++] = entry;
+                } else if( keep == 1 && view_reserve( &order, &order_capacity, order_count + 1 ) == 0 ) {
+                        file_list = view_append( file_list, entry );
+                }
+        }
+        waiting_count = still;
+        return file_list;
+}
+
+FILE_LIST * view_apply( FILE_LIST * file_list, VIEW_SORT new_sort, VIEW_FILTER new_filter ) {
+        Uint32 start_ticks = SDL_GetTicks();
+
+        VIEW_KEY * keys = malloc( seen_count * sizeof( VIEW_KEY ));
+        int threads = ( seen_count > VIEW_PARALLEL_MIN ) ? SDL_GetCPUCount() : 1;
+        if( threads < 1 ) threads = 1;
+        VIEW_WORK * work = malloc( threads * sizeof( VIEW_WORK ));
+        SDL_Thread ** workers = malloc( threads * sizeof( SDL_Thread * ));
+        int * bounds = malloc(( threads + 1 ) * sizeof( int ));
+        if( keys == NULL || work == NULL || workers == NULL || bounds == NULL
+                        || view_reserve( &order, &order_capacity, seen_count )) {
+                fprintf( stderr, "ERROR: Unable to malloc for view.\n" );
+                free( keys );
+                free( work );
+                free( workers );
+                free( bounds );
+                return file_list;
+        }
+
+        /* Gather keys and sort each slice on its own thread; this thread takes the first slice. */
+        key_sort = new_sort;
+        key_filter = new_filter;
+        for( int i = 0; i < seen_count; i++ ) keys[i].entry = seen[i];
+        for( int t = 0; t < threads; t++ ) {
+                int begin = (Sint64) seen_count * t / threads;
+                int end = (Sint64) seen_count * ( t + 1 ) / threads;
+                work[t].keys = keys + begin;
+                work[t].count = end - begin;
+                work[t].kept = 0;
+                workers[t] = NULL;
+                if( t > 0 ) {
+                        workers[t] = SDL_CreateThread( view_worker, "view", &work[t] );
+                        /* Carry on without the thread; this thread sorts its slice below. */
+                        if( workers[t] == NULL ) fprintf( stderr, "WARN: Unable to create view thread: %s\n", SDL_GetError() );
+                }
+        }
+        for( int t = 0; t < threads; t++ ) {
+                if( workers[t] != NULL ) {
+                        SDL_WaitThread( workers[t], NULL );
+                } else {
+                        view_worker( &work[t] );
+                }
+        }
+
+        /* Close the gaps filtering left between the sorted runs, then merge them. */
+        int kept = 0;
+        for( int t = 0; t < threads; t++ ) {
+                memmove( keys + kept, work[t].keys, work[t].kept * sizeof( VIEW_KEY ));
+                bounds[t] = kept;
+                kept += work[t].kept;
+        }
+        bounds[threads] = kept;
+        if( kept > 0 ) view_merge( keys, bounds, threads );
+
+        if( kept == 0 ) {
+                fprintf( stderr, "WARN: No images in view: %s, %s\n", view_sort_name( new_sort ), view_filter_name( new_filter ));
+        } else {
+                /* Relink the loop in view order. Entries left out keep stale links nobody follows. */
+                for( int i = 0; i < seen_count; i++ ) seen[i]->view_pos = -1;
+                for( int i = 0; i < kept; i++ ) {
+                        order[i] = keys[i].entry;
+                        order[i]->view_pos = i;
+                        order[i]->next = keys[( i + 1 ) % kept].entry;
+                        order[i]->prev = keys[( i + kept - 1 ) % kept].entry;
+                }
+                order_count = kept;
+                head = 0;
+                /* Every header the new filter needs was read above. */
+                waiting_count = 0;
+                sort = new_sort;
+                filter = new_filter;
+                if( file_list == NULL || file_list->view_pos < 0 ) file_list = order[0];
+        }
+
+        if( SGK_DEBUG ) {
+                printf( "DEBUG: View %s, %s -- %d of %d entries, %d threads, %u ms\n", view_sort_name( new_sort ),
+                                view_filter_name( new_filter ), kept, seen_count, threads, SDL_GetTicks() - start_ticks );
+        }
+
+        free( keys );
+        free( work );
+        free( workers );
+        free( bounds );
+
+        return file_list;
+}
+
+FILE_LIST * view_jump( FILE_LIST * file_list, int pos ) {
+        if( order_count == 0 ) return file_list;
+        if( pos < 0 ) pos = 0;
+        if( pos >= order_count ) pos = order_count - 1;
+
+        /* Removed entries leave holes. Take the nearest live one, looking forward first. */
+        for( int i = pos; i < order_count; i++ ) {
+                if( ! order[i]->deleted ) return order[i];
+        }
+        for( int i = pos - 1; i >= 0; i-- ) {
+                if( ! order[i]->deleted ) return order[i];
+        }
+        return file_list;
+}
+
+FILE_LIST * view_jump_text( FILE_LIST * file_list, char * text ) {
+        int len = strlen( text );
+        if( len == 0 || order_count == 0 ) return file_list;
+
+        int digits = strspn( text, "0123456789" );
+        if( digits > 0 && digits == len ) {
+                return view_jump( file_list, atol( text ) - 1 );
+        }
+        if( digits > 0 && digits == len - 1 && text[digits] == '%' ) {
+                long percent = atol( text );
+                if( percent > 100 ) percent = 100;
+                return view_jump( file_list, (Sint64) order_count * percent / 100 );
+        }
+
+        /* A filename prefix. Search forward from the cursor and wrap around, like a text editor. */
+        int start = ( file_list->view_pos >= 0 ) ? file_list->view_pos : 0;
+        for( int i = 1; i <= order_count; i++ ) {
+                FILE_LIST * entry = order[( start + i ) % order_count];
+                if( ! entry->deleted && strncasecmp( entry->file, text, len ) == 0 ) return entry;
+        }
+        return file_list;
+}
+
+FILE_LIST * view_find( char * path ) {
+        if( seen_count == 0 ) return NULL;
+
+        /* Only watched changes look paths up, so the set is built on first use and caught up on each one after. */
+        if( seen_count * 2 > paths_capacity ) {
+                int capacity = ( paths_capacity == 0 ) ? 1024 : paths_capacity;
+                while( capacity < seen_count * 2 ) capacity *= 2;
+                int * table = malloc( capacity * sizeof( int ));
+                if( table == NULL ) {
+                        fprintf( stderr, "ERROR: Unable to malloc for view paths.\n" );
+                        return NULL;
+                }
+                memset( table, -1, capacity * sizeof( int ));
+                free( paths );
+                paths = table;
+                paths_capacity = capacity;
+                paths_count = 0;
+        }
+        Uint32 mask = paths_capacity - 1;
+        for( ; paths_count < seen_count; paths_count++ ) {
+                Uint32 slot = view_hash( seen[paths_count]->path ) & mask;
+                while( paths[slot] >= 0 ) slot = ( slot + 1 ) & mask;
+                paths[slot] = paths_count;
+        }
+
+        /* A path may also be held by tombstones of files since replaced. */
+        for( Uint32 slot = view_hash( path ) & mask; paths[slot] >= 0; slot = ( slot + 1 ) & mask ) {
+                FILE_LIST * entry = seen[paths[slot]];
+                if( ! entry->deleted && strcmp( entry->path, path ) == 0 ) return entry;
+        }
+        return NULL;
+}
+
+FILE_LIST * view_jump_unprocessed( FILE_LIST * file_list ) {
+        int start = ( file_list->view_pos >= 0 ) ? file_list->view_pos : 0;
+        for( int i = 1; i <= order_count; i++ ) {
+                FILE_LIST * entry = order[( start + i ) % order_count];
+                if( ! entry->deleted && ! processed_has( entry->name )) return entry;
+        }
+        return file_list;
+}
+
+int view_count( void ) {
+        return order_count;
+}
+
+VIEW_SORT view_sort( void ) {
+        return sort;
+}
+
+VIEW_FILTER view_filter( void ) {
+        return filter;
+}
+
+const char * view_sort_name( VIEW_SORT with ) {
+        switch( with ) {
+                case sort_scan:
+                        return "scan order";
+                case sort_name:
+                        return "name";
+                case sort_mtime:
+                        return "date";
+                case sort_size:
+                        return "file size";
+                case sort_pixels:
+                        return "pixel count";
+                case sort_count:
+                        break;
+        }
+        return "";
+}
+
+const char * view_filter_name( VIEW_FILTER with ) {
+        switch( with ) {
+                case filter_all:
+                        return "all";
+                case filter_unprocessed:
+                        return "unprocessed";
+                case filter_small:
+                        return "too small";
+                case filter_aspect:
+                        return "wrong aspect";
+                case filter_count:
+                        break;
+        }
+        return "";
+}
+
+FILE_LIST * view_all( void ) {
+        FILE_LIST * first = NULL;
+        FILE_LIST * last = NULL;
+        for( int i = 0; i < seen_count; i++ ) {
+                FILE_LIST * entry = seen[i];
+                if( entry->deleted ) continue;
+                if( first == NULL ) {
+                        first = entry;
+                } else {
+                        last->next = entry;
+                        entry->prev = last;
+                }
+                last = entry;
+        }
+        if( first != NULL ) {
+                first->prev = last;
+                last->next = first;
+        }
+        return first;
+}
+
+void view_terminate( void ) {
+        free( seen );
+        free( order );
+        free( paths );
+        free( waiting );
+        waiting = NULL;
+        waiting_count = 0;
+        waiting_capacity = 0;
+        seen = NULL;
+        order = NULL;
+        paths = NULL;
+        paths_count = 0;
+        paths_capacity = 0;
+        seen_count = 0;
+        seen_capacity = 0;
+        order_count = 0;
+        order_capacity = 0;
+        head = 0;
+}
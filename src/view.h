@@ -0,0 +1,88 @@
+/* See LICENSE file for copyright and license details. */
+
+#ifndef VIEW_H
+#define VIEW_H
+
+/*
+ * Prepares an unsorted, unfiltered view. The "wrong aspect" filter compares against 'aspect', and the
+ * "unprocessed" filter asks processed_has().
+ */
+void view_init( double aspect );
+
+/*
+ * Adds the loop 'batch' from scan_take() to the end of the view around 'file_list', which may be NULL.
+ * Entries the active filter leaves out are kept aside for later views. When the filter needs a header that
+ * isn't known yet, the entry is handed to validate_request() and held back for view_settle(), so this never
+ * reads a file. Returns the cursor: 'file_list', or the first new entry if there was none. Returns NULL if
+ * the view is still empty.
+ */
+FILE_LIST * view_add( FILE_LIST * file_list, FILE_LIST * batch );
+
+/*
+ * Adds the entries view_add() held back whose headers have since been probed, if the active filter keeps
+ * them. Call after validate_collect(). Returns the cursor, as view_add() does.
+ */
+FILE_LIST * view_settle( FILE_LIST * file_list );
+
+/*
+ * Rebuilds the view from every entry seen so far, ordered by 'sort' and limited by 'filter', and relinks
+ * the loop to match. Keeps the cursor on 'file_list' if the new view includes it, otherwise moves it to
+ * the start of the view. If the filter leaves nothing, the view is unchanged.
+ * Returns the cursor.
+ */
+FILE_LIST * view_apply( FILE_LIST * file_list, VIEW_SORT sort, VIEW_FILTER filter );
+
+/*
+ * Returns the entry at position 'pos' of the view, clamped to the view, skipping over removed entries.
+ * Returns 'file_list' if the view is empty.
+ */
+FILE_LIST * view_jump( FILE_LIST * file_list, int pos );
+
+/*
+ * Interprets 'text' typed after KEY_JUMP: a position counting from 1, a percentage ending in '%', or
+ * otherwise the start of a filename, searched for after 'file_list'. Returns the entry to show, or
+ * 'file_list' if nothing matches.
+ */
+FILE_LIST * view_jump_text( FILE_LIST * file_list, char * text );
+
+/*
+ * Returns the first entry after 'file_list' in the view, wrapping around, that has no crop in the
+ * destination yet. Returns 'file_list' if every entry has one.
+ */
+FILE_LIST * view_jump_unprocessed( FILE_LIST * file_list );
+
+/*
+ * Returns the live entry for the file at 'path', whether or not the active filter shows it, or NULL if
+ * the view has never been given one. Call from the UI thread only.
+ */
+FILE_LIST * view_find( char * path );
+
+/*
+ * Returns the number of positions in the active view.
+ */
+int view_count( void );
+
+/*
+ * Returns the active sort order and filter.
+ */
+VIEW_SORT view_sort( void );
+VIEW_FILTER view_filter( void );
+
+/*
+ * Returns a short name for 'sort' or 'filter', for the titlebar.
+ */
+const char * view_sort_name( VIEW_SORT sort );
+const char * view_filter_name( VIEW_FILTER filter );
+
+/*
+ * Relinks every live entry into one loop in scan order, regardless of the view, and returns it.
+ * For saving metadata of every file on exit.
+ */
+FILE_LIST * view_all( void );
+
+/*
+ * Frees the view.
+ */
+void view_terminate( void );
+
+#endif
@@ -0,0 +1,420 @@
+/* See LICENSE file for copyright and license details. */
+
+#define _GNU_SOURCE     /* F_SETLEASE */
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <errno.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#endif
+#include "data_structures.h"
+#include "config.h"
+#include "watch.h"
+
+#ifdef __linux__
+
+/* A file is only reported once it is closed after writing or linked in, so half-copied images never show up. */
+#define WATCH_MASK ( IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE | IN_CREATE | IN_MOVE_SELF | IN_ONLYDIR )
+
+/* A watched directory, found by indexing 'dirs' with its watch number. */
+typedef struct WATCHDIR {
+        char * path;            /* Path of the directory, or NULL if the number is unused */
+        dev_t dev;              /* Device and inode, to tell whether 'path' still leads to it */
+        ino_t ino;
+} WATCH_DIR;
+
+/*
+ * The kernel numbers watches counting up from 1, so the directory behind each one is found by indexing
+ * 'dirs' with it. The thread sleeps in poll() until the kernel has changes or the quit pipe is written.
+ */
+static SDL_Thread * watcher = NULL;
+static SDL_mutex * lock = NULL;
+static int notify_fd = -1;
+static int quit_pipe[2] = { -1, -1 };
+static WATCH_DIR * dirs = NULL;         /* Directory behind each watch. Protected by 'lock' */
+static int dirs_capacity = 0;
+static WATCH_CHANGE * changes_head = NULL;      /* Changes not yet taken, oldest first. Protected by 'lock' */
+static WATCH_CHANGE * changes_tail = NULL;
+static SDL_atomic_t notified;           /* Set while an event is in the SDL queue, so only one ever is */
+static Uint32 event_type = (Uint32) -1;
+static int skipping = 0;                /* Set to 1 when directory 'skip_dev','skip_ino' is never watched */
+static dev_t skip_dev;
+static ino_t skip_ino;
+
+/* Returns 1 if 'path' is the directory passed to watch_init() to be skipped. */
+static int watch_skipped( char * path ) {
+        struct stat st;
+        return skipping && stat( path, &st ) == 0 && st.st_dev == skip_dev && st.st_ino == skip_ino;
+}
+
+/* Joins 'dir' and 'name' into a new path. This function mallocs memory. */
+static char * watch_join( char * dir, char * name ) {
+        int len = strlen( dir ) + 1 + strlen( name ) + 1;
+        char * path = malloc( len );
+        if( path == NULL ) {
+                fprintf( stderr, "ERROR: Unable to malloc for directory path.\n" );
+        } else {
+                snprintf( path, len, "%s/%s", dir, name );
+        }
+        return path;
+}
+
+/* Queues a change of 'kind' to the file or directory 'name' in directory 'dir'. */
+static void watch_queue( WATCH_KIND kind, char * dir, char * name ) {
+        size_t dir_len = strlen( dir );
+        size_t name_len = strlen( name );
+        WATCH_CHANGE * change = malloc( sizeof( WATCH_CHANGE ) + dir_len + 1 + name_len + 1 + dir_len + 1 );
+        if( change == NULL ) {
+                fprintf( stderr, "ERROR: Unable to malloc for directory change.\n" );
+                return;
+        }
+        change->next = NULL;
+        change->kind = kind;
+        change->path = (char *) ( change + 1 );
+        snprintf( change->path, dir_len + 1 + name_len + 1, "%s/%s", dir, name );
+        change->name = change->path + dir_len + 1;
+        change->dir = change->name + name_len + 1;
+        memcpy( change->dir, dir, dir_len + 1 );
+
+        SDL_LockMutex( lock );
+        if( changes_tail == NULL ) {
+                changes_head = change;
+        } else {
+                changes_tail->next = change;
+        }
+        changes_tail = change;
+        SDL_UnlockMutex( lock );
+}
+
+/* Wakes the UI thread to take the queued changes. */
+static void watch_notify( void ) {
+        SDL_LockMutex( lock );
+        int waiting = ( changes_head != NULL );
+        SDL_UnlockMutex( lock );
+        if( waiting && SDL_AtomicCAS( &notified, 0, 1 ) ) {
+                SDL_Event event;
+                memset( &event, 0, sizeof( event ) );
+                event.type = event_type;
+                if( SDL_PushEvent( &event ) <= 0 ) SDL_AtomicSet( &notified, 0 );
+        }
+}
+
+/*
+ * Returns 0 if someone has the file 'name' in directory 'dir_fd' open for writing, otherwise 1. The kernel
+ * refuses a read lease while a writer holds the file. Without leases, the file is taken as finished.
+ */
+static int watch_finished( int dir_fd, char * name ) {
+        int fd = openat( dir_fd, name, O_RDONLY | O_NONBLOCK | O_CLOEXEC );
+        if( fd < 0 ) return 0;
+        int finished = 1;
+        if( fcntl( fd, F_SETLEASE, F_RDLCK ) == 0 ) {
+                fcntl( fd, F_SETLEASE, F_UNLCK );
+        } else if( errno == EAGAIN ) {
+                finished = 0;
+        }
+        close( fd );
+        return finished;
+}
+
+/*
+ * Watches the directory 'path', which just appeared, and everything below it. Files already inside were
+ * written before the watch existed, so no event will report them and they are queued here. A directory
+ * just created may still be filling, as with cp -r; files still open for writing are left to their own
+ * IN_CLOSE_WRITE, so nothing half-copied is queued, or queued twice. A directory moved in with 'moved'
+ * set holds only finished files.
+ */
+static void watch_tree( char * path, int moved ) {
+        if( watch_skipped( path )) return;
+        watch_add( path );
+        DIR * dir = opendir( path );
+        if( dir == NULL ) return;
+
+        struct dirent * ent = NULL;
+        while(( ent = readdir( dir )) != NULL ) {
+                char * name = ent->d_name;
+                if( name[0] == '.' && ( name[1] == '\0' || ( name[1] == '.' && name[2] == '\0' ))) continue;
+                unsigned char type = ent->d_type;
+                if( type == DT_UNKNOWN || ( type == DT_LNK && SCAN_FOLLOW_SYMLINKS )) {
+                        struct stat st;
+                        if( fstatat( dirfd( dir ), name, &st, SCAN_FOLLOW_SYMLINKS ? 0 : AT_SYMLINK_NOFOLLOW ) != 0 ) continue;
+                        if( S_ISDIR( st.st_mode )) type = DT_DIR;
+                        else if( S_ISREG( st.st_mode )) type = DT_REG;
+                        else continue;
+                }
+                if( type == DT_DIR ) {
+                        char * sub = watch_join( path, name );
+                        if( sub != NULL ) watch_tree( sub, moved );
+                        free( sub );
+                } else if( type == DT_REG && ( moved || watch_finished( dirfd( dir ), name ))) {
+                        watch_queue( watch_written, path, name );
+                }
+        }
+        closedir( dir );
+}
+
+/* Stops watching the directory 'path' and every directory below it. */
+static void watch_forget( char * path ) {
+        size_t len = strlen( path );
+        SDL_LockMutex( lock );
+        for( int wd = 0; wd < dirs_capacity; wd++ ) {
+                char * dir = dirs[wd].path;
+                if( dir == NULL || strncmp( dir, path, len ) != 0 || ( dir[len] != '\0' && dir[len] != '/' )) continue;
+                /* The IN_IGNORED that follows finds the watch already cleared. */
+                inotify_rm_watch( notify_fd, wd );
+                free( dir );
+                dirs[wd].path = NULL;
+        }
+        SDL_UnlockMutex( lock );
+        if( SGK_DEBUG ) printf( "DEBUG: Stopped watching %s, which left the source directory.\n", path );
+}
+
+/* Turns one inotify record into queued changes. */
+static void watch_event( struct inotify_event * ev ) {
+        if( ev->mask & IN_Q_OVERFLOW ) {
+                fprintf( stderr, "WARN: Too many changes to the source directory at once. Some were missed.\n" );
+                return;
+        }
+
+        /* Copy the directory out, since the scan may grow 'dirs' meanwhile. */
+        char * dir = NULL;
+        int moved = 0;
+        struct stat st;
+        SDL_LockMutex( lock );
+        if( ev->wd >= 0 && ev->wd < dirs_capacity && dirs[ev->wd].path != NULL ) {
+                if( ev->mask & IN_IGNORED ) {
+                        /* The directory is gone and the kernel dropped its watch. */
+                        free( dirs[ev->wd].path );
+                        dirs[ev->wd].path = NULL;
+                } else if( ev->mask & IN_MOVE_SELF ) {
+                        /*
+                         * A move within the tree was reported to the new parent first, and watch_add() then
+                         * gave the watch its new path. If the path doesn't lead back here, the directory
+                         * left the tree.
+                         */
+                        moved = stat( dirs[ev->wd].path, &st ) != 0 || st.st_dev != dirs[ev->wd].dev
+                                || st.st_ino != dirs[ev->wd].ino;
+                        if( moved ) dir = watch_join( dirs[ev->wd].path, "" );
+                } else if( ev->len > 0 ) {
+                        dir = watch_join( dirs[ev->wd].path, "" );
+                }
+        }
+        SDL_UnlockMutex( lock );
+        if( dir == NULL ) return;
+        dir[strlen( dir ) - 1] = '\0'; /* Drop the separator watch_join() added. */
+
+        if( moved ) {
+                watch_forget( dir );
+        } else if( ev->mask & IN_ISDIR ) {
+                if( ev->mask & ( IN_CREATE | IN_MOVED_TO )) {
+                        if( SCAN_RECURSIVE ) {
+                                char * path = watch_join( dir, ev->name );
+                                if( path != NULL ) watch_tree( path, ( ev->mask & IN_MOVED_TO ) != 0 );
+                                free( path );
+                        }
+                } else if( ev->mask & ( IN_DELETE | IN_MOVED_FROM )) {
+                        watch_queue( watch_removed_dir, dir, ev->name );
+                }
+        } else if( ev->mask & ( IN_CLOSE_WRITE | IN_MOVED_TO )) {
+                watch_queue( watch_written, dir, ev->name );
+        } else if( ev->mask & IN_CREATE ) {
+                /*
+                 * A hard link arrives finished, and nothing but IN_CREATE reports it. A new file still open
+                 * for writing is left to its IN_CLOSE_WRITE. One closed again already is reported twice,
+                 * which only probes it afresh.
+                 */
+                int dir_fd = open( dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC );
+                if( dir_fd >= 0 ) {
+                        if( fstatat( dir_fd, ev->name, &st, SCAN_FOLLOW_SYMLINKS ? 0 : AT_SYMLINK_NOFOLLOW ) == 0
+                                        && S_ISREG( st.st_mode ) && watch_finished( dir_fd, ev->name )) {
+                                watch_queue( watch_written, dir, ev->name );
+                        }
+                        close( dir_fd );
+                }
+        } else if( ev->mask & ( IN_DELETE | IN_MOVED_FROM )) {
+                watch_queue( watch_removed, dir, ev->name );
+        }
+        free( dir );
+}
+
+static int watch_thread( void * data ) {
+        /* Records carry their names inline, so many are read at once into one buffer. */
+        char buffer[64 * 1024] __attribute__(( aligned( __alignof__( struct inotify_event ))));
+        struct pollfd fds[2] = { { notify_fd, POLLIN, 0 }, { quit_pipe[0], POLLIN, 0 } };
+
+        while( 1 ) {
+                if( poll( fds, 2, -1 ) < 0 ) {
+                        if( errno == EINTR ) continue;
+                        fprintf( stderr, "ERROR: Unable to wait for changes to the source directory.\n" );
+                        break;
+                }
+                if( fds[1].revents != 0 ) break;
+
+                ssize_t length = read( notify_fd, buffer, sizeof( buffer ));
+                if( length <= 0 ) continue;
+                for( char * p = buffer; p < buffer + length; ) {
+                        struct inotify_event * ev = (struct inotify_event *) p;
+                        p += sizeof( struct inotify_event ) + ev->len;
+                        watch_event( ev );
+                }
+                watch_notify();
+        }
+
+        return 0;
+}
+
+int watch_init( char * skip ) {
+        if( ! WATCH_SOURCE ) return 0;
+
+        struct stat st;
+        if( skip != NULL && stat( skip, &st ) == 0 ) {
+                skipping = 1;
+                skip_dev = st.st_dev;
+                skip_ino = st.st_ino;
+        }
+
+        lock = SDL_CreateMutex();
+        if( lock == NULL ) {
+                fprintf( stderr, "ERROR: Unable to create watcher lock: %s\n", SDL_GetError() );
+                return 1;
+        }
+        notify_fd = inotify_init1( IN_CLOEXEC );
+        if( notify_fd < 0 || pipe( quit_pipe ) != 0 ) {
+                /* Not fatal. The list just stays as the scan found it. */
+                fprintf( stderr, "WARN: Unable to watch the source directory for changes.\n" );
+                if( notify_fd >= 0 ) close( notify_fd );
+                notify_fd = -1;
+                return 0;
+        }
+        SDL_AtomicSet( &notified, 0 );
+        event_type = SDL_RegisterEvents( 1 );
+
+        watcher = SDL_CreateThread( watch_thread, "watch", NULL );
+        if( watcher == NULL ) {
+                fprintf( stderr, "ERROR: Unable to create watcher thread: %s\n", SDL_GetError() );
+                return 1;
+        }
+
+        return 0;
+}
+
+void watch_add( char * path ) {
+        if( notify_fd < 0 ) return;
+
+        int wd = inotify_add_watch( notify_fd, path, WATCH_MASK );
+        if( wd < 0 ) {
+                /* Usually the fs.inotify.max_user_watches limit. The files were still read once. */
+                fprintf( stderr, "WARN: Unable to watch directory for changes: %s\n", path );
+                return;
+        }
+        struct stat st;
+        if( stat( path, &st ) != 0 ) {
+                /* Gone already. Its IN_IGNORED clears up after it. */
+                return;
+        }
+        int len = strlen( path ) + 1;
+        char * copy = malloc( len );
+        if( copy == NULL ) {
+                fprintf( stderr, "ERROR: Unable to malloc for watched directory.\n" );
+                return;
+        }
+        memcpy( copy, path, len );
+
+        SDL_LockMutex( lock );
+        if( wd >= dirs_capacity ) {
+                int capacity = ( dirs_capacity == 0 ) ? 1024 : dirs_capacity;
+                while( capacity <= wd ) capacity *= 2;
+                WATCH_DIR * temp = realloc( dirs, capacity * sizeof( WATCH_DIR ));
+                if( temp == NULL ) {
+                        SDL_UnlockMutex( lock );
+                        fprintf( stderr, "ERROR: Unable to malloc for watched directory.\n" );
+                        free( copy );
+                        return;
+                }
+                memset( temp + dirs_capacity, 0, ( capacity - dirs_capacity ) * sizeof( WATCH_DIR ));
+                dirs = temp;
+                dirs_capacity = capacity;
+        }
+        /* A directory moved within the tree keeps its watch, under its new path. */
+        free( dirs[wd].path );
+        dirs[wd].path = copy;
+        dirs[wd].dev = st.st_dev;
+        dirs[wd].ino = st.st_ino;
+        SDL_UnlockMutex( lock );
+}
+
+WATCH_CHANGE * watch_take( void ) {
+        if( lock == NULL ) return NULL;
+
+        SDL_LockMutex( lock );
+        SDL_AtomicSet( &notified, 0 );
+        WATCH_CHANGE * head = changes_head;
+        changes_head = NULL;
+        changes_tail = NULL;
+        SDL_UnlockMutex( lock );
+
+        return head;
+}
+
+Uint32 watch_event_type( void ) {
+        return event_type;
+}
+
+void watch_terminate( void ) {
+        if( lock == NULL ) return;
+
+        if( watcher != NULL ) {
+                if( write( quit_pipe[1], "", 1 ) != 1 ) fprintf( stderr, "ERROR: Unable to stop watcher thread.\n" );
+                SDL_WaitThread( watcher, NULL );
+                watcher = NULL;
+        }
+        if( notify_fd >= 0 ) close( notify_fd );
+        if( quit_pipe[0] >= 0 ) close( quit_pipe[0] );
+        if( quit_pipe[1] >= 0 ) close( quit_pipe[1] );
+        notify_fd = -1;
+        quit_pipe[0] = -1;
+        quit_pipe[1] = -1;
+
+        for( int i = 0; i < dirs_capacity; i++ ) free( dirs[i].path );
+        free( dirs );
+        dirs = NULL;
+        dirs_capacity = 0;
+        while( changes_head != NULL ) {
+                WATCH_CHANGE * next = changes_head->next;
+                free( changes_head );
+                changes_head = next;
+        }
+        changes_tail = NULL;
+
+        SDL_DestroyMutex( lock );
+        lock = NULL;
+        event_type = (Uint32) -1;
+        skipping = 0;
+}
+
+#else
+
+/* Without inotify, the list stays as the scan found it. */
+
+int watch_init( char * skip ) {
+        if( WATCH_SOURCE && SGK_DEBUG ) printf( "DEBUG: Directory watching needs inotify. Not watching.\n" );
+        return 0;
+}
+
+void watch_add( char * path ) {
+}
+
+WATCH_CHANGE * watch_take( void ) {
+        return NULL;
+}
+
+Uint32 watch_event_type( void ) {
+        return (Uint32) -1;
+}
+
+void watch_terminate( void ) {
+}
+
+#endif
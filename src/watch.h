@@ -0,0 +1,36 @@
+/* See LICENSE file for copyright and license details. */
+
+#ifndef WATCH_H
+#define WATCH_H
+
+/*
+ * Starts the thread that waits for changes to watched directories, if WATCH_SOURCE is set. Call before
+ * scan_start(), so that the scan can watch each directory as it reads it. The directory 'skip', if not
+ * NULL, is passed over when it appears inside a watched one; scan_start() keeps it out of the first walk.
+ * Returns 1 on program-halting error, otherwise 0.
+ */
+int watch_init( char * skip );
+
+/*
+ * Watches the directory 'path' for files written, linked, moved or deleted. Does nothing unless watch_init()
+ * started the watcher. Safe to call from any thread.
+ */
+void watch_add( char * path );
+
+/*
+ * Returns every change seen since the last call, oldest first, or NULL if there are none.
+ * The caller must free() each change.
+ */
+WATCH_CHANGE * watch_take( void );
+
+/*
+ * Returns the SDL event type pushed when changes are ready for watch_take().
+ */
+Uint32 watch_event_type( void );
+
+/*
+ * Stops the watcher thread and discards changes not yet taken.
+ */
+void watch_terminate( void );
+
+#endif